@@ -0,0 +1,17 @@
+//
+//  affinity.h
+//  CServer
+//
+//  Created by ibrahim alnakeeb on 19/10/2026.
+//
+
+#ifndef affinity_h
+#define affinity_h
+
+int affinityInit(void);
+int affinityEnabled(void);
+int affinityCount(void);
+int affinityCpu(int index);
+int affinityPin(int cpu);
+
+#endif /* affinity_h */
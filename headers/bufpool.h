@@ -0,0 +1,21 @@
+//
+//  bufpool.h
+//  CServer
+//
+//  Created by ibrahim alnakeeb on 19/10/2026.
+//
+
+#ifndef bufpool_h
+#define bufpool_h
+
+#include <stddef.h>
+
+#define BUFPOOL_CLASSES		3			// 4 KiB, 16 KiB and 64 KiB
+#define BUFPOOL_MAX			(64 * 1024)	// size of the largest class
+#define BUFPOOL_KEEP		(1024 * 1024)	// idle bytes a thread keeps per class, the rest is freed
+
+char *bufpoolAcquire(size_t need, size_t *capacity);
+int bufpoolGrow(char **buf, size_t *capacity, size_t used, size_t need);
+void bufpoolRelease(char *buf, size_t capacity);
+
+#endif /* bufpool_h */
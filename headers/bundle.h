@@ -0,0 +1,65 @@
+//
+//  bundle.h
+//  CServer
+//
+//  Created by ibrahim alnakeeb on 19/10/2026.
+//
+
+#ifndef bundle_h
+#define bundle_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BUNDLE_DISK			0		// read public/ from the working directory
+#define BUNDLE_EMBEDDED		1		// serve the copy compiled into the binary
+
+#define BUNDLE_FINGERPRINT_LEN	8		// hex digits of the content hash in fingerprinted paths
+
+// headers[] variants
+#define BUNDLE_REVALIDATE	0		// requested by its plain path: Cache-Control: no-cache
+#define BUNDLE_IMMUTABLE	1		// requested by its fingerprinted path: cached for a year
+
+// their Cache-Control lines, on the 200 and the 304 alike
+#define BUNDLE_REVALIDATE_CACHE	"Cache-Control: no-cache\r\n"
+#define BUNDLE_IMMUTABLE_CACHE	"Cache-Control: public, max-age=31536000, immutable\r\n"
+
+typedef struct {
+	const char			*path;				// e.g. "public/css/style.css"
+	const char			*fingerprintPath;	// e.g. "public/css/style.a458e3d5.css"
+	const char			*mimeType;
+	const unsigned char	*data;				// references to other files point at their fingerprinted paths
+	size_t				length;
+	const char			*etag;				// quoted, e.g. "\"a458e3d571caf8e7\""
+	const char			*headers[2];		// status line to Cache-Control; Connection and the blank line are added when sent
+	size_t				headersLength[2];
+} bundle_file_t;
+
+// Generated from public/ by tools/bundle.c (obj/bundle_data.c).
+extern const bundle_file_t	bundleFiles[];
+extern const int			bundleFileCount;
+extern const short			bundleSlots[];		// hash slot -> file index * 2 + BUNDLE_IMMUTABLE for a fingerprinted path, -1 if empty
+extern const uint32_t		bundleSlotMask;
+extern const uint32_t		bundleSeed;
+
+/*
+ * Seeded FNV-1a with a final mix. The generator searches for a seed under
+ * which every bundled path lands in its own slot, so a lookup is one hash,
+ * one probe and one string compare.
+ */
+static inline uint32_t bundleHash(const char *path, uint32_t seed) {
+	uint32_t hash = 2166136261u ^ seed;
+	for (; *path; path++)
+		hash = (hash ^ (unsigned char)*path) * 16777619u;
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6bu;
+	hash ^= hash >> 13;
+	return hash;
+}
+
+void bundleSetMode(int mode);
+int bundleMode(void);
+const bundle_file_t *bundleFind(const char *path, int *variant);
+const bundle_file_t *bundleFindRenamed(const char *path);
+
+#endif /* bundle_h */
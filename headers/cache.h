@@ -0,0 +1,61 @@
+//
+//  cache.h
+//  CServer
+//
+//  Created by ibrahim alnakeeb on 19/10/2026.
+//
+
+#ifndef cache_h
+#define cache_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CACHE_KEY_MAX		256			// longer keys are not cached
+#define CACHE_ENTRY_MAX		(128 * 1024)	// largest response kept, headers included
+#define CACHE_BUCKETS		4096
+#define CACHE_PASS_TTL		60			// seconds a key stays marked as not cacheable
+
+// cacheLookup() results
+#define CACHE_MISS			0
+#define CACHE_FRESH			1
+#define CACHE_STALE			2			// past its TTL, inside the stale-while-revalidate window
+#define CACHE_PASS			3			// the route does not cache this request; go straight to a handler
+
+/*
+ * A complete response kept by the server process. The Connection header is
+ * left out so one entry serves keep-alive and closing clients alike; it is
+ * inserted between head and body when the entry is sent.
+ */
+typedef struct cache_entry {
+	struct cache_entry	*hashNext;
+	struct cache_entry	*lruPrev, *lruNext;		// most recently used first
+	uint64_t			hash;
+	char				*key;
+	char				*head;					// status line and headers, without the blank line
+	size_t				headLength;
+	char				*body;
+	size_t				bodyLength;
+	int					status;					// from the status line, e.g. 200
+	int					pass;					// marker without a response (CACHE_PASS)
+	uint64_t			freshUntil;				// ms, timerNowMs() clock
+	uint64_t			staleUntil;
+	size_t				size;					// bytes charged to the budget
+	int					refs;					// connections still sending it
+	int					refreshing;				// a handler is producing the next version
+	const uint64_t		*version;				// optional shared counter the response was rendered from
+	uint64_t			versionSeen;			// its value at the time; any other value is a miss
+	int					linked;					// 0 once evicted or replaced
+} cache_entry_t;
+
+int cacheInit(size_t budget);
+uint64_t cacheKeyHash(const char *key);
+cache_entry_t *cacheLookup(const char *key, uint64_t now, int *state);
+cache_entry_t *cacheEntryCreate(const char *key, const char *response, size_t length);
+int cacheInsert(cache_entry_t *entry, int ttl, int stale, const uint64_t *version, uint64_t versionSeen, uint64_t now);
+void cacheInsertPass(const char *key, uint64_t now);
+void cacheRetain(cache_entry_t *entry);
+void cacheRelease(cache_entry_t *entry);
+void cacheClear(void);
+
+#endif /* cache_h */
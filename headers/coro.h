@@ -0,0 +1,29 @@
+//
+//  coro.h
+//  CServer
+//
+//  Created by ibrahim alnakeeb on 19/10/2026.
+//
+
+#ifndef coro_h
+#define coro_h
+
+#include <stddef.h>
+
+#define CORO_STACK_DEFAULT	(64 * 1024)		// bytes, a guard page comes on top
+
+// coroResume() results
+#define CORO_SUSPENDED		0
+#define CORO_FINISHED		1
+
+typedef struct coro coro_t;
+
+int coroInit(size_t stackSize);
+size_t coroStackSize(void);
+coro_t *coroCreate(void (*entry)(void *arg), void (*wake)(void *arg), void *arg);
+int coroResume(coro_t *co);
+void coroYield(void);
+coro_t *coroCurrent(void);
+void coroOffload(void (*work)(void *arg), void *arg);
+
+#endif /* coro_h */
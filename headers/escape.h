@@ -0,0 +1,28 @@
+//
+//  escape.h
+//  CServer
+//
+//  Created by ibrahim alnakeeb on 19/10/2026.
+//
+
+#ifndef escape_h
+#define escape_h
+
+#include <stddef.h>
+
+// how a template slot's value is inserted
+#define ESCAPE_RAW			0		// trusted markup, as is
+#define ESCAPE_HTML			1		// text between tags: & < >
+#define ESCAPE_ATTRIBUTE	2		// quoted attribute value: & < > " '
+
+// escapeKernel() / escapeUseKernel()
+#define ESCAPE_KERNEL_SCALAR	0
+#define ESCAPE_KERNEL_SSE2		1	// 16 bytes per step
+#define ESCAPE_KERNEL_AVX2		2	// 32 bytes per step
+
+size_t escapedLength(const char *src, size_t length, int mode);
+size_t escapeHtml(char *dst, const char *src, size_t length, int mode);
+int escapeKernel(void);
+int escapeUseKernel(int kernel);
+
+#endif /* escape_h */
@@ -0,0 +1,87 @@
+//
+//  form.h
+//  CServer
+//
+//  Created by ibrahim alnakeeb on 19/10/2026.
+//
+
+#ifndef form_h
+#define form_h
+
+#include <stddef.h>
+
+#define FORM_FIELDS_MAX		32
+#define FORM_SLOTS			64			// name index, twice FORM_FIELDS_MAX
+#define FORM_NAMES_SIZE		1024		// multipart names and filenames are copied here
+
+#define FORM_SUCCESS		1
+#define FORM_FAILED			0			// malformed, or more than FORM_FIELDS_MAX fields
+
+#define MULTIPART_BOUNDARY_MAX	70		// RFC 2046
+#define MULTIPART_LINE_MAX		512		// longest part header line
+
+// multipartFeed() results
+#define MULTIPART_MORE		0			// waiting for the rest of the body
+#define MULTIPART_DONE		1			// the closing delimiter was seen
+#define MULTIPART_ERROR		-1
+
+/*
+ * One decoded field. name and value point into the parsed buffer (multipart
+ * names into form_t.names) and are NUL-terminated; valueLength also covers
+ * values holding NUL bytes, such as uploaded files.
+ */
+typedef struct {
+	const char	*name;
+	size_t		nameLength;
+	const char	*value;
+	size_t		valueLength;
+	const char	*filename;					// multipart file parts only, NULL otherwise
+} form_field_t;
+
+typedef struct {
+	form_field_t	fields[FORM_FIELDS_MAX];	// in request order
+	int				count;
+	unsigned char	slots[FORM_SLOTS];			// open addressing: field index + 1, 0 if empty
+	char			names[FORM_NAMES_SIZE];
+	size_t			namesUsed;
+} form_t;
+
+/*
+ * Called by multipartFeed() as parts go by; returning 0 stops the parser.
+ * name, filename and contentType are valid during onPart() only (filename
+ * and contentType are NULL when absent). onData() views point into the fed
+ * buffer, except for up to a delimiter's length of bytes that straddled two
+ * feeds.
+ */
+typedef struct {
+	int	(*onPart)(void *context, const char *name, const char *filename, const char *contentType);
+	int	(*onData)(void *context, const char *data, size_t length);
+	int	(*onPartEnd)(void *context);
+} multipart_callbacks_t;
+
+typedef struct {
+	int								state;
+	char							delimiter[MULTIPART_BOUNDARY_MAX + 4];	// "\r\n--" boundary
+	size_t							delimiterLength;
+	char							held[MULTIPART_BOUNDARY_MAX + 4];		// delimiter prefix at the end of a feed
+	size_t							heldLength;
+	char							line[MULTIPART_LINE_MAX];
+	size_t							lineLength;
+	char							name[128];
+	char							filename[256];
+	char							contentType[128];
+	const multipart_callbacks_t		*callbacks;
+	void							*context;
+} multipart_t;
+
+size_t formDecode(char *data, size_t length);
+int formParse(form_t *form, char *data, size_t length);
+int formParseMultipart(form_t *form, char *body, size_t length, const char *contentType);
+int formParseBody(form_t *form, char *body, size_t length, const char *contentType);
+const form_field_t *formField(const form_t *form, const char *name);
+const char *formGet(const form_t *form, const char *name);
+
+int multipartInit(multipart_t *parser, const char *contentType, const multipart_callbacks_t *callbacks, void *context);
+int multipartFeed(multipart_t *parser, const char *data, size_t length);
+
+#endif /* form_h */
@@ -0,0 +1,40 @@
+//
+//  h2.h
+//  CServer
+//
+//  Created by ibrahim alnakeeb on 19/10/2026.
+//
+
+#ifndef h2_h
+#define h2_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+// what a client sends first on a prior-knowledge (h2c) or ALPN h2 connection
+#define H2_PREFACE			"PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define H2_PREFACE_LENGTH	24
+
+#define H2_STREAMS_MAX		1000	// SETTINGS_MAX_CONCURRENT_STREAMS cap
+
+typedef struct h2_session h2_session_t;
+
+// A stream's request is complete, given as an HTTP/1.1 request with a
+// Content-Length. The server answers it with h2Respond(), or h2Reset().
+// Returns 0 to refuse the stream (REFUSED_STREAM), 1 once it is taken.
+typedef int (*h2_request_fn)(void *owner, uint32_t stream, const char *request, size_t length);
+
+h2_session_t *h2Create(h2_request_fn onRequest, void *owner, int streams, int window, size_t requestMax,
+					   const char *upgradeSettings, size_t upgradeLength);
+void h2Destroy(h2_session_t *h2);
+int h2Receive(h2_session_t *h2, const char *data, size_t length);
+int h2Respond(h2_session_t *h2, uint32_t stream, const struct iovec *parts, int count);
+void h2Reset(h2_session_t *h2, uint32_t stream);
+void h2GoAway(h2_session_t *h2);
+size_t h2Output(h2_session_t *h2, const char **data);
+void h2Sent(h2_session_t *h2);
+int h2Busy(const h2_session_t *h2);
+int h2Finished(const h2_session_t *h2);
+
+#endif /* h2_h */
@@ -17,21 +17,29 @@
 #include <unistd.h>
 #include <ctype.h>
 
+#include "coro.h"
+#include "form.h"
 #include "user.h"
 #include "session.h"
 #include "response.h"
+#include "profiler.h"
+#include "metrics.h"
 
 
 void setUp(void);
 
-void signUp(const char *payload);
-void signIn(const char *payload);
+void signUp(const form_t *form);
+void signIn(const form_t *form);
 
 void send404Page();
 void serveLoginPage();
-void serveHomePage(const char *payload);
-void handleLoginPost(const char *payload);
+void serveHomePage(char *payload, size_t length);
+void serveProfileEvents();
+void handleLoginPost(char *payload, size_t length);
 void sendFileResponse(const char *filePath);
+void serveProfilerReport(char *query);
+void serveMemoryReport();
+void serveMetricsReport();
 
 
 #endif /* handlers_h */
@@ -10,10 +10,113 @@
 
 #include <string.h>
 #include <stdio.h>
+#include <stdint.h>
 
 //Server control functions
 
-void serve_forever(const char *PORT);
+// Connection timeouts in seconds; a request that is still arriving after
+// its first two seconds must average at least minimum_rate bytes per second.
+// An event stream with nothing to send sends a comment line every heartbeat
+// seconds, so clients and proxies do not take it for dead (0: never)
+typedef struct {
+	int header_read;
+	int body_read;
+	int idle;
+	int write_stall;
+	int minimum_rate;
+	int heartbeat;
+} timeouts_t;
+
+extern timeouts_t server_timeouts;
+
+// Admission limits: open connections, concurrent handler processes and
+// coroutine handlers, the queue of complete requests waiting for a handler
+// (depth, and wait in ms), and how long (ms) a request waits for an
+// identical one's cacheable response
+typedef struct {
+	int connections;
+	int workers;
+	int coroutines;
+	int queue_depth;
+	int queue_wait;
+	int coalesce_wait;
+} limits_t;
+
+extern limits_t server_limits;
+
+// Listening socket options, applied at startup: accept backlog, seconds the
+// kernel holds a connection until its first bytes arrive (TCP_DEFER_ACCEPT),
+// TCP Fast Open queue length, busy polling in microseconds (SO_BUSY_POLL),
+// TCP_NODELAY on connections, and one IPv6 socket that also takes IPv4;
+// 0 turns an option off
+typedef struct {
+	int backlog;
+	int defer_accept;
+	int fastopen;
+	int busy_poll;
+	int nodelay;
+	int ipv6;
+} listener_t;
+
+extern listener_t server_listener;
+
+// HTTPS on the tls:PORT listeners (TLS 1.3): PEM certificate chain and key,
+// tickets issued per full handshake (0: no resumption), sessions kept by the
+// server (0: tickets hold the session themselves), and kernel TLS, under
+// which forked handlers write to the socket as they do without TLS
+typedef struct {
+	const char *certificate;
+	const char *key;
+	int tickets;
+	int session_cache;
+	int ktls;
+} tls_options_t;
+
+extern tls_options_t server_tls;
+
+// HTTP/2: h2c (an Upgrade: h2c request, or prior knowledge) and ALPN h2 on
+// the tls: listeners. Streams a client may have open at once, 0 turns HTTP/2
+// off, and KiB of request body a stream, and the whole connection, may send
+// ahead of the server's WINDOW_UPDATE. Each open stream takes an entry of
+// server_limits.connections while the server has its request.
+typedef struct {
+	int streams;
+	int window;
+} http2_options_t;
+
+extern http2_options_t server_http2;
+
+// Scheduling class of a group of routes. While requests wait for a handler,
+// the free handlers go to the classes in proportion to their weights, so a
+// flood on an expensive route cannot delay cheap ones for long; concurrency
+// caps the handlers a class holds at once, 0 for no cap, and queue_depth its
+// waiting requests, 0 for server_limits.queue_depth
+typedef struct {
+	const char	*name;
+	int			weight;
+	int			concurrency;
+	int			queue_depth;
+} route_class_t;
+
+// defined next to route(), ending with { NULL }; the first is the default:
+// the class of the routes ahead of the first ROUTE_CLASS(), and of requests
+// that match no route
+extern route_class_t route_classes[];
+
+extern char	**server_argv;		// re-executed by a binary upgrade (SIGUSR2)
+extern int	drain_timeout;		// seconds SIGTERM/SIGQUIT waits for in-flight requests
+extern int	cache_size;			// KiB of rendered responses the server replays itself, 0 disables
+extern int	pool_threads;		// threads forking the handlers, 0 forks on the event loop, -1 one per CPU
+extern int	handler_coroutines;	// run handlers as coroutines in the server instead of forking them
+extern int	cpu_affinity;		// pin the event loop, pool threads and handlers to cores
+extern int	io_backend;			// how the event loop does socket I/O, one of:
+
+#define IO_BACKEND_EPOLL	0	// readiness with epoll, then recv/sendmsg
+#define IO_BACKEND_URING	1	// accept, recv and send submitted to an io_uring (Linux 6.0)
+
+#define LISTENERS_MAX		16	// ports and Unix sockets served at once
+
+void serve_forever(char *const *addresses, int count);
 
 // Client request
 
@@ -23,20 +126,68 @@ extern char		*method,		// "GET" or "POST"
 				*prot,			// "HTTP/1.1"
 				*payload;		// for POST
 extern int		payload_size;
+extern const char	*route_name;	// label of the matched route, e.g. "GET /home"
+extern const char	*route_class;	// name of its scheduling class, NULL for the default
+extern const char	*route_proxy;	// upstream its requests are proxied to, NULL if the server answers them
+extern int		route_classifying;	// route() is run by the server only to find the class
+extern int		keep_alive;		// the connection stays open after the response
+extern int		cache_ttl,		// set by CACHE_FOR(): seconds the response may be replayed
+				cache_stale,	// and further seconds it may be replayed while being refreshed
+				cache_session;	// set by CACHE_PER_SESSION(): replayed to the same session only
+
+#define CONNECTION_HEADER \
+	(keep_alive ? "Connection: keep-alive\r\n" : "Connection: close\r\n")
 
 char *request_header(const char *name);
+int request_is_admin(void);
+void cache_depends_on(const uint64_t *version);
+int request_wait(int fd, int events, int timeout);
+long request_read(int fd, void *buffer, size_t length, long offset);
+void request_compute(void (*work)(void *arg), void *arg);
+int request_subscribe(const char *topic);
+void event_publish(const char *topic, const char *event, const char *data);
+int proxy_configured(const char *upstream);
 
 void route();
+void reload();		// SIGHUP: re-read configuration and cached content
 
 // some interesting macro for `route()`
-#define ROUTE_START()		if (0) {
-#define ROUTE(METHOD,URI)	} else if (strcmp(URI,uri)==0&&strcmp(METHOD,method)==0) {
+#define ROUTE_START()		route_name = NULL; route_class = NULL; route_proxy = NULL; if (0) {
+#define ROUTE(METHOD,URI)	} else if (strcmp(URI,uri)==0&&strcmp(METHOD,method)==0) { \
+								route_name = METHOD " " URI; if (route_classifying) return;
 #define ROUTE_GET(URI)		ROUTE("GET", URI)
 #define ROUTE_POST(URI)		ROUTE("POST", URI)
 #define ROUTE_GET_STARTS_WITH(PREFIX) \
-							} else if (strncmp(uri, PREFIX, strlen(PREFIX)) == 0 && strcmp(method, "GET") == 0) {
+							} else if (strncmp(uri, PREFIX, strlen(PREFIX)) == 0 && strcmp(method, "GET") == 0) { \
+								route_name = "GET " PREFIX "*"; if (route_classifying) return;
+
+// Proxies requests of any method under PREFIX to the servers of an upstream
+// (-U name=UPSTREAM,...): the server relays them itself and no handler
+// runs. Without that upstream the route does not match, so the routes after
+// it take the requests; the 502 below only answers a request the server
+// could not hand on.
+#define ROUTE_PROXY(PREFIX, UPSTREAM) \
+							} else if (strncmp(uri, PREFIX, strlen(PREFIX)) == 0 && proxy_configured(UPSTREAM)) { \
+								route_name = "PROXY " PREFIX "*"; route_proxy = (UPSTREAM); if (route_classifying) return; \
+								keep_alive = 0; printf("HTTP/1.1 502 Bad Gateway\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+
+// Puts the routes that follow, up to the next ROUTE_CLASS(), in the named
+// entry of route_classes. The server runs route() on each request up to the
+// match, skipping the handlers, to queue it in its class before forking.
+#define ROUTE_CLASS(NAME)	} else if (route_class = (NAME), 0) {
+
+// Lets the server replay this route's response to anonymous GET requests (no
+// session cookie) without forking a handler. Keyed on method, path and query.
+#define CACHE_FOR(TTL, STALE)	cache_ttl = (TTL), cache_stale = (STALE);
+
+// Lets the server replay this route's response to GET requests carrying the
+// same session cookie. The handler must name the version counter the page
+// was rendered from with cache_depends_on(); the copy is dropped once it moves.
+#define CACHE_PER_SESSION(TTL)	cache_ttl = (TTL), cache_stale = 0, cache_session = 1;
 
-#define ROUTE_END()			} else printf(\
+// A request no route matches goes to the default class, whichever
+// ROUTE_CLASS() came last.
+#define ROUTE_END()			} else if (route_class = NULL, !route_classifying) keep_alive = 0, printf(\
 								"HTTP/1.1 500 Not Handled\r\n\r\n" \
 								"The server has no handler to the request.\r\n" \
 							);
@@ -0,0 +1,48 @@
+//
+//  hub.h
+//  CServer
+//
+//  Created by ibrahim alnakeeb on 19/10/2026.
+//
+
+#ifndef hub_h
+#define hub_h
+
+#include <stddef.h>
+
+#define HUB_TOPIC_MAX		128		// topic names are shorter, e.g. a user name
+#define HUB_QUEUE_MAX		8		// events a subscriber holds unsent; another pushes out the oldest
+#define HUB_BUCKETS			4096
+
+// An event as it goes out, formatted once and shared by the subscribers it went to
+typedef struct hub_event {
+	int		refs;
+	size_t	length;
+	char	data[];
+} hub_event_t;
+
+struct hub_subscriber;
+
+// the subscriber has an event waiting, called by hubPublish()
+typedef void (*hub_notify_fn)(struct hub_subscriber *subscriber);
+
+/*
+ * A subscription, embedded in what it belongs to (a connection), so an idle
+ * subscriber costs no allocation: only the topic, shared by its subscribers,
+ * is allocated. Its unsent events are a ring of HUB_QUEUE_MAX.
+ */
+typedef struct hub_subscriber {
+	struct hub_topic		*topic;			// NULL unless subscribed
+	struct hub_subscriber	*prev, *next;	// the topic's subscribers
+	hub_notify_fn			notify;
+	hub_event_t				*queue[HUB_QUEUE_MAX];
+	unsigned				head, count;
+} hub_subscriber_t;
+
+int hubSubscribe(hub_subscriber_t *subscriber, const char *topic, hub_notify_fn notify);
+void hubUnsubscribe(hub_subscriber_t *subscriber);
+int hubPublish(const char *topic, const char *data, size_t length);
+hub_event_t *hubNext(hub_subscriber_t *subscriber);
+void hubRelease(hub_event_t *event);
+
+#endif /* hub_h */
@@ -0,0 +1,59 @@
+//
+//  memstat.h
+//  CServer
+//
+//  Created by ibrahim alnakeeb on 19/10/2026.
+//
+
+#ifndef memstat_h
+#define memstat_h
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MEMSTAT_MAX_ROUTES		32
+#define MEMSTAT_ROUTE_LEN		64
+
+#define MEMSTAT_OK			1
+#define MEMSTAT_DISABLED	0
+
+// the counters of one request, kept by whoever runs it: a forked handler, or a coroutine handler's state
+typedef struct {
+	uint64_t	request;			// tags the blocks counted here, so frees elsewhere are told apart
+	uint64_t	allocations;
+	uint64_t	bytes;
+	int64_t		liveAllocations;
+	int64_t		liveBytes;
+	int64_t		peakLive;
+} memstat_counters_t;
+
+int memstatInit(void);
+void memstatBegin(memstat_counters_t *counters);
+memstat_counters_t *memstatCounters(void);
+void memstatUse(memstat_counters_t *counters);
+void memstatEnd(const char *route);
+int memstatReport(FILE *out);
+
+#ifdef MEMSTAT
+
+void *memstatMalloc(size_t size);
+void *memstatCalloc(size_t count, size_t size);
+void *memstatRealloc(void *ptr, size_t size);
+char *memstatStrdup(const char *str);
+void memstatFree(void *ptr);
+
+// Route every allocation of the including translation unit through the
+// accounting wrappers. memstat.c defines MEMSTAT_IMPLEMENTATION to reach libc.
+#ifndef MEMSTAT_IMPLEMENTATION
+#define malloc(size)		memstatMalloc(size)
+#define calloc(count, size)	memstatCalloc(count, size)
+#define realloc(ptr, size)	memstatRealloc(ptr, size)
+#define strdup(str)			memstatStrdup(str)
+#define free(ptr)			memstatFree(ptr)
+#endif
+
+#endif /* MEMSTAT */
+
+#endif /* memstat_h */
@@ -0,0 +1,92 @@
+//
+//  metrics.h
+//  CServer
+//
+//  Created by ibrahim alnakeeb on 19/10/2026.
+//
+
+#ifndef metrics_h
+#define metrics_h
+
+#include <stdio.h>
+#include <stdint.h>
+#include <assert.h>
+
+// Counters shared by the server and every request handler it forks.
+typedef enum {
+	METRIC_CONNECTIONS_ACCEPTED,
+	METRIC_CONNECTIONS_CLOSED,
+	METRIC_REQUESTS_DISPATCHED,
+	METRIC_TIMEOUT_HEADER,
+	METRIC_TIMEOUT_BODY,
+	METRIC_TIMEOUT_IDLE,
+	METRIC_TIMEOUT_WRITE,
+	METRIC_TIMEOUT_SLOW_RATE,
+	METRIC_REQUESTS_QUEUED,
+	METRIC_QUEUE_WAIT_MS,
+	METRIC_SHED_CONNECTIONS,
+	METRIC_SHED_QUEUE_FULL,
+	METRIC_SHED_QUEUE_WAIT,
+	METRIC_SHED_RATE_LIMIT,
+	METRIC_CACHE_HITS,
+	METRIC_CACHE_STALE_HITS,
+	METRIC_CACHE_MISSES,
+	METRIC_CACHE_FILLS,
+	METRIC_CACHE_EVICTIONS,
+	METRIC_CACHE_SESSION_HITS,
+	METRIC_CACHE_SESSION_MISSES,
+	METRIC_CACHE_COALESCED,
+	METRIC_CACHE_COALESCE_TIMEOUTS,
+	METRIC_POOL_JOBS,
+	METRIC_POOL_STEALS,
+	METRIC_POOL_WAIT_US,
+	METRIC_CORO_HANDLERS,
+	METRIC_CORO_SUSPENDS,
+	METRIC_BUFFER_ALLOCATIONS,
+	METRIC_BUFFER_GROWS,
+	METRIC_TLS_HANDSHAKES,
+	METRIC_TLS_RESUMED,
+	METRIC_TLS_KTLS,
+	METRIC_TLS_FAILURES,
+	METRIC_H2_SESSIONS,
+	METRIC_H2_STREAMS,
+	METRIC_H2_RESETS,
+	METRIC_EVENTS_SUBSCRIBED,
+	METRIC_EVENTS_UNSUBSCRIBED,
+	METRIC_EVENTS_PUBLISHED,
+	METRIC_EVENTS_SENT,
+	METRIC_EVENTS_DROPPED,
+	METRIC_EVENTS_HEARTBEATS,
+	METRIC_PROXY_REQUESTS,
+	METRIC_PROXY_CONNECTS,
+	METRIC_PROXY_REUSED,
+	METRIC_PROXY_RETRIES,
+	METRIC_PROXY_FAILURES,
+	METRIC_PROXY_SERVERS_DOWN,
+	METRIC_PROXY_ERRORS,
+	METRIC_PROXY_TIMEOUTS,
+	METRIC_COUNT
+} metric_t;
+
+#define METRIC_CLASSES_MAX	16
+
+// Counters kept per scheduling class of routes (route_class_t).
+typedef enum {
+	CLASS_METRIC_DISPATCHED,
+	CLASS_METRIC_QUEUED,
+	CLASS_METRIC_QUEUE_WAIT_MS,
+	CLASS_METRIC_SHED,
+	CLASS_METRIC_COUNT
+} class_metric_t;
+
+int metricsInit(void);
+void metricsAdd(metric_t metric, uint64_t value);
+uint64_t metricsGet(metric_t metric);
+void metricsNameClass(int index, const char *name);
+void metricsClassAdd(int index, class_metric_t metric, uint64_t value);
+uint64_t metricsClassGet(int index, class_metric_t metric);
+void metricsReport(FILE *out);
+
+#define METRIC_INC(metric) metricsAdd(metric, 1)
+
+#endif /* metrics_h */
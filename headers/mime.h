@@ -0,0 +1,23 @@
+//
+//  mime.h
+//  CServer
+//
+//  Created by ibrahim alnakeeb on 19/10/2026.
+//
+
+#ifndef mime_h
+#define mime_h
+
+#define MIME_HTML	"text/html"
+#define MIME_CSS	"text/css"
+#define MIME_PLAIN	"text/plain"
+#define MIME_EVENT_STREAM	"text/event-stream"
+#define MIME_JS		"application/javascript"
+#define MIME_ICO	"image/x-icon"
+#define MIME_PNG	"image/png"
+#define MIME_JPEG	"image/jpeg"
+#define MIME_BIN	"application/octet-stream"
+
+const char *get_mime_type(const char *path);
+
+#endif /* mime_h */
@@ -0,0 +1,33 @@
+//
+//  pool.h
+//  CServer
+//
+//  Created by ibrahim alnakeeb on 19/10/2026.
+//
+
+#ifndef pool_h
+#define pool_h
+
+#include <stdint.h>
+
+#define POOL_THREADS_MAX	64
+#define POOL_DEQUE_SIZE		1024		// jobs per deque, a power of two
+
+/*
+ * Work for the pool, embedded in the caller's own structure (see
+ * container_of). run() is called on a pool thread; done() afterwards on the
+ * thread that calls poolComplete().
+ */
+typedef struct pool_job {
+	void				(*run)(struct pool_job *job);
+	void				(*done)(struct pool_job *job);
+	uint64_t			submitted;			// ns, set by poolSubmit()
+	struct pool_job		*completedNext;
+} pool_job_t;
+
+int poolInit(int count);
+int poolThreads(void);
+int poolSubmit(pool_job_t *job);
+void poolComplete(void);
+
+#endif /* pool_h */
@@ -0,0 +1,31 @@
+//
+//  profiler.h
+//  CServer
+//
+//  Created by ibrahim alnakeeb on 19/10/2026.
+//
+
+#ifndef profiler_h
+#define profiler_h
+
+#include <stdio.h>
+#include <assert.h>
+
+#define PROFILER_MAX_STACKS		2048
+#define PROFILER_MAX_DEPTH		48
+
+#define PROFILER_DEFAULT_HZ			99
+#define PROFILER_MAX_HZ				1000
+#define PROFILER_DEFAULT_SECONDS	10
+#define PROFILER_MAX_SECONDS		60
+
+#define PROFILER_OK			1
+#define PROFILER_DISABLED	0
+#define PROFILER_BUSY		-1
+
+int profilerInit(void);
+void profilerAttach(void);
+int profilerRun(int seconds, int hz, FILE *out);
+void profilerStats(unsigned long *samples, unsigned long *dropped);
+
+#endif /* profiler_h */
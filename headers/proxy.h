@@ -0,0 +1,89 @@
+//
+//  proxy.h
+//  CServer
+//
+//  Created by ibrahim alnakeeb on 19/10/2026.
+//
+
+#ifndef proxy_h
+#define proxy_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#define PROXY_UPSTREAMS_MAX		8
+#define PROXY_SERVERS_MAX		16			// per upstream
+#define PROXY_NAME_MAX			32
+#define PROXY_ADDRESS_MAX		108			// "host:port" or "unix:/path" as configured
+#define PROXY_BUFFER			(16 * 1024)	// response bytes read from an upstream before they go to the client
+#define PROXY_HEAD_MAX			(64 * 1024)	// a response head the upstream sends
+#define PROXY_COLLECT_MAX		(8 * 1024 * 1024)	// a response buffered whole, for an HTTP/2 stream
+
+// framing of a message body
+#define PROXY_BODY_NONE			0
+#define PROXY_BODY_LENGTH		1			// Content-Length
+#define PROXY_BODY_CHUNKED		2			// Transfer-Encoding: chunked
+#define PROXY_BODY_CLOSE		3			// until the upstream closes (responses only)
+
+// Where a body being relayed is: the bytes left of it, or how far into the
+// chunked encoding it got, so it is found in pieces as they arrive
+typedef struct {
+	int			mode;
+	int			done;			// the whole body went by
+	int			failed;			// malformed chunked encoding
+	int			state;			// of the chunked encoding
+	int			digits;			// of the chunk size being read
+	uint64_t	remaining;		// bytes left of the body (LENGTH) or of the chunk (CHUNKED)
+} proxy_body_t;
+
+// A response head from an upstream
+typedef struct {
+	int				status;
+	size_t			length;			// its bytes, blank line included
+	int				keep_alive;		// the upstream keeps the connection open afterwards
+	proxy_body_t	body;
+} proxy_response_t;
+
+struct connection;
+
+// A server of an upstream, and what the passive health checks know of it
+typedef struct proxy_server {
+	char					address[PROXY_ADDRESS_MAX];
+	struct sockaddr_storage	addr;
+	socklen_t				addr_length;
+	int						outstanding;	// requests sent whose response has not ended
+	int						fails;			// transport failures in a row
+	uint64_t				down_until;		// ms; not picked before, then one request tries it
+	struct connection		*idle;			// kept-alive connections, held by the event loop
+	int						idle_count;
+} proxy_server_t;
+
+// Servers a proxy route balances over, and how their connections are kept
+typedef struct proxy_upstream {
+	char			name[PROXY_NAME_MAX];
+	proxy_server_t	servers[PROXY_SERVERS_MAX];
+	int				count;
+	int				keepalive;		// idle connections kept per server
+	int				idle;			// seconds one is kept
+	int				max_fails;		// failures in a row that take a server out
+	int				down;			// seconds it stays out
+	int				timeout;		// seconds to connect, and between the response's bytes
+	unsigned		next;			// where picking starts among equally busy servers
+} proxy_upstream_t;
+
+int proxyValidUpstream(const char *name, int count, int keepalive, int idle, int maxFails, int down, int timeout);
+int proxyAddUpstream(const char *name, char *const *servers, int count,
+					 int keepalive, int idle, int maxFails, int down, int timeout);
+proxy_upstream_t *proxyFind(const char *name);
+int proxyUpstreamCount(void);
+proxy_server_t *proxyPick(proxy_upstream_t *upstream, uint64_t now);
+void proxyDone(proxy_upstream_t *upstream, proxy_server_t *server, int failed, uint64_t now);
+
+int proxyRequestBody(const char *head, size_t length, proxy_body_t *body);
+char *proxyRequestHead(const char *head, size_t length, const char *client, int https, size_t *outLength);
+int proxyParseResponse(const char *data, size_t length, int headRequest, proxy_response_t *response);
+char *proxyResponseHead(const char *head, size_t length, int keepAlive, int dechunk, size_t *outLength);
+size_t proxyBodyScan(proxy_body_t *body, char *data, size_t length, int decode, size_t *payload);
+
+#endif /* proxy_h */
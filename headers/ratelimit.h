@@ -0,0 +1,28 @@
+//
+//  ratelimit.h
+//  CServer
+//
+//  Created by ibrahim alnakeeb on 19/10/2026.
+//
+
+#ifndef ratelimit_h
+#define ratelimit_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define RATELIMIT_RULES_MAX		32
+#define RATELIMIT_PATH_MAX		256
+#define RATELIMIT_BURST_MAX		4000		// requests a bucket holds at most
+#define RATELIMIT_SLOTS			65536		// buckets in the shared table, a power of two
+#define RATELIMIT_PROBES		8			// slots past its hash a client's bucket may sit in
+
+int ratelimitInit(void);
+int ratelimitValidRule(const char *method, const char *path, int requests, int seconds, int burst);
+int ratelimitAddRule(const char *method, const char *path, int requests, int seconds, int burst);
+void ratelimitClearRules(void);
+int ratelimitRuleCount(void);
+const char *ratelimitCheck(const void *client, size_t clientLength, const char *method, size_t methodLength,
+						   const char *path, size_t pathLength, uint64_t now);
+
+#endif /* ratelimit_h */
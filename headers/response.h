@@ -13,18 +13,16 @@
 #include <stdlib.h>
 #include <assert.h>
 
+#include "httpd.h"
 #include "pages.h"
+#include "mime.h"
+#include "bundle.h"
+#include "escape.h"
+#include "memstat.h"
 
 #define BUFFER_SIZE 256
-
-#define MIME_HTML	"text/html"
-#define MIME_CSS	"text/css"
-#define MIME_PLAIN	"text/plain"
-#define MIME_JS		"application/javascript"
-#define MIME_ICO	"image/x-icon"
-#define MIME_PNG	"image/png"
-#define MIME_JPEG	"image/jpeg"
-#define MIME_BIN	"application/octet-stream"
+#define TEMPLATE_SLOTS_MAX 8	// placeholders per renderTemplate() call
+#define TEMPLATE_COMPUTE_MIN (16 * 1024)	// pages filled by request_compute(): smaller ones cost less than its round trip
 
 #define STATUS_200_OK				"HTTP/1.1 200 OK"
 #define STATUS_302_FOUND			"HTTP/1.1 302 Found"
@@ -32,6 +30,7 @@
 #define STATUS_401_UNAUTHORIZED		"HTTP/1.1 401 Unauthorized"
 #define STATUS_403_FORBIDDEN		"HTTP/1.1 403 Forbidden"
 #define STATUS_404_NOT_FOUND		"HTTP/1.1 404 Not Found"
+#define STATUS_409_CONFLICT			"HTTP/1.1 409 Conflict"
 #define STATUS_500_INTERNAL_ERROR	"HTTP/1.1 500 Internal Server Error"
 
 #define GET_FILE(path) \
@@ -59,7 +58,8 @@ void sendFallback500Response();
 void renderErrorPage(const char *message);
 char *renderHtmlResponse(const char *html, const char *status);
 char *renderFileResponse(const char *filepath, int *out_size);
+void sendBundledFile(const bundle_file_t *file, int variant);
 void redirect(const char *location, const char *status, int clearCookie, const char *sessionToken);
-char *renderTemplate(const char *filepath, const char **placeholders, const char **values, int count);
+char *renderTemplate(const char *filepath, const char **placeholders, const char **values, const int *modes, int count);
 
 #endif /* response_h */
\ No newline at end of file
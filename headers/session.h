@@ -14,10 +14,11 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <fcntl.h>
-#include <openssl/rand.h>
+#include <sys/random.h>
 #include <sys/stat.h>
 
 #include "httpd.h"
+#include "memstat.h"
 
 #define TOKEN_SIZE 32
 #define NAME_SIZE 128
@@ -0,0 +1,15 @@
+//
+//  shm.h
+//  CServer
+//
+//  Created by ibrahim alnakeeb on 19/10/2026.
+//
+
+#ifndef shm_h
+#define shm_h
+
+#include <stddef.h>
+
+void *shmAlloc(size_t size);
+
+#endif /* shm_h */
@@ -0,0 +1,40 @@
+//
+//  timer.h
+//  CServer
+//
+//  Created by ibrahim alnakeeb on 19/10/2026.
+//
+
+#ifndef timer_h
+#define timer_h
+
+#include <stdint.h>
+
+#define TIMER_TICK_MS		10		// resolution of the wheel
+#define TIMER_LEVELS		4
+#define TIMER_LEVEL_BITS	6
+#define TIMER_SLOTS			(1 << TIMER_LEVEL_BITS)
+
+#define TIMER_NONE			-1		// timerNextTimeout(): nothing scheduled
+
+typedef struct timer_entry {
+	struct timer_entry	*next, *prev;
+	uint64_t			expires;	// in ticks
+	void				(*callback)(struct timer_entry *timer);
+} timer_entry_t;
+
+typedef struct {
+	uint64_t		now;			// current tick
+	int				pending;
+	timer_entry_t	slots[TIMER_LEVELS][TIMER_SLOTS];	// list heads
+} timer_wheel_t;
+
+uint64_t timerNowMs(void);
+void timerWheelInit(timer_wheel_t *wheel, uint64_t nowMs);
+void timerAdd(timer_wheel_t *wheel, timer_entry_t *timer, uint64_t expiresMs);
+void timerCancel(timer_wheel_t *wheel, timer_entry_t *timer);
+int timerIsPending(const timer_entry_t *timer);
+void timerAdvance(timer_wheel_t *wheel, uint64_t nowMs);
+int timerNextTimeout(const timer_wheel_t *wheel);
+
+#endif /* timer_h */
@@ -0,0 +1,34 @@
+//
+//  tls.h
+//  CServer
+//
+//  Created by ibrahim alnakeeb on 19/10/2026.
+//
+
+#ifndef tls_h
+#define tls_h
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define TLS_HANDSHAKE_DONE		0
+#define TLS_HANDSHAKE_READ		1		// waiting for the client's next flight
+#define TLS_HANDSHAKE_WRITE		2		// the socket buffer is full
+#define TLS_HANDSHAKE_FAILED	3
+
+#define TLS_RECORD_MAX			16384	// plaintext bytes in one record
+
+typedef struct ssl_st tls_t;			// OpenSSL's SSL, one per connection
+
+int tlsInit(const char *certificate, const char *key, int tickets, int sessionCache, int ktls, int http2);
+tls_t *tlsAccept(int fd);
+int tlsHandshake(tls_t *tls);
+int tlsResumed(tls_t *tls);
+int tlsKernelSend(tls_t *tls);
+int tlsHttp2(tls_t *tls);
+ssize_t tlsRead(tls_t *tls, void *buffer, size_t length);
+int tlsPending(tls_t *tls);
+ssize_t tlsWrite(tls_t *tls, const void *buffer, size_t length);
+void tlsClose(tls_t *tls);
+
+#endif /* tls_h */
@@ -0,0 +1,45 @@
+//
+//  uring.h
+//  CServer
+//
+//  Created by ibrahim alnakeeb on 19/10/2026.
+//
+
+#ifndef uring_h
+#define uring_h
+
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+#define URING_BUFFER_GROUP	0		// buffer group of uringProvideBuffers()
+
+/*
+ * An io_uring instance used from one thread, set up with raw system calls.
+ * The submission and completion rings are shared with the kernel.
+ */
+typedef struct {
+	int					fd;
+	unsigned			*sqHead, *sqTail, sqMask, sqEntries;
+	unsigned			sqLocalTail;		// SQEs handed out so far
+	unsigned			sqSubmitted;		// of which the kernel has seen this many
+	struct io_uring_sqe	*sqes;
+	unsigned			*cqHead, *cqTail, cqMask;
+	struct io_uring_cqe	*cqes;
+	struct io_uring_buf_ring	*buffers;	// provided buffer ring, NULL until set up
+	char				*bufferData;
+	unsigned			bufferCount, bufferSize;
+	unsigned short		bufferTail;
+} uring_t;
+
+int uringInit(uring_t *ring, unsigned entries);
+int uringSupports(uring_t *ring, int op);
+struct io_uring_sqe *uringSqe(uring_t *ring);
+int uringSubmit(uring_t *ring, int timeoutMs);
+struct io_uring_cqe *uringCqe(uring_t *ring);
+void uringCqeSeen(uring_t *ring);
+int uringProvideBuffers(uring_t *ring, unsigned count, unsigned size);
+char *uringBuffer(uring_t *ring, unsigned id);
+void uringRecycleBuffer(uring_t *ring, unsigned id);
+int uringRegisterFiles(uring_t *ring, unsigned count);
+
+#endif /* uring_h */
@@ -11,6 +11,8 @@
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <stdint.h>
+#include "memstat.h"
 
 #define UPDATE_SUCCESS 1
 #define UPDATE_FAILED 0
@@ -30,6 +32,10 @@
 #define MAX_LINE_LEN 512
 #define USER_FILE_ERROR -1
 
+#define PROFILE_VERSION_SLOTS 4096	// users whose profile changes are tracked
+#define PROFILE_NAME_LEN 128
+#define PROFILE_DESCRIPTION_MAX 250	// keeps a user's line within MAX_LINE_LEN
+
 
 int addUser(const char *username, const char *password);
 
@@ -39,5 +45,8 @@ int checkPassword(const char *username, const char *password);
 char *getProfileDescription(const char *username);
 int setProfileDescription(const char *username, const char *new_desc);
 
+int profileVersionsInit(void);
+const uint64_t *profileVersion(const char *username);
+
 
 #endif /* user_h */
\ No newline at end of file
@@ -7,28 +7,561 @@
 
 #include "httpd.h"
 #include "handlers.h"
+#include "profiler.h"
+#include "bundle.h"
+#include "cache.h"
+#include "coro.h"
+#include "h2.h"
+#include "pool.h"
+#include "proxy.h"
+#include "ratelimit.h"
 
+#include <unistd.h>
+#include <string.h>
+
+static const char *configPath;		// -f, re-read on SIGHUP
+static char *rateLimitOptions[RATELIMIT_RULES_MAX];	// -R, applied again on SIGHUP
+static int rateLimitOptionCount;
+static int rateLimitsOff;			// -R off: not even the default rule
+
+#define CONFIG_LINE_MAX		512
+
+// A configuration file, parsed whole before any of it is applied
+typedef struct {
+	timeouts_t		timeouts;
+	limits_t		limits;
+	listener_t		listener;
+	tls_options_t	tls;
+	http2_options_t	http2;
+	char			rateLimits[RATELIMIT_RULES_MAX][CONFIG_LINE_MAX];	// "ratelimit" options, checked
+	int				rateLimitCount;
+	int				rateLimitsOff;
+	char			upstreams[PROXY_UPSTREAMS_MAX][CONFIG_LINE_MAX];	// "upstream" options, checked
+	int				upstreamCount;
+} config_t;
+
+static config_t fileConfig;			// -f, parsed at startup and on each SIGHUP
+
+static void usage(const char *prog) {
+	fprintf(stderr,
+		"Usage: %s [options] <port | tls:PORT | unix:PATH | admin:PORT | admin:unix:PATH>...\n"
+		"  Listens on each TCP port, HTTPS port and Unix socket given, and on the sockets\n"
+		"  systemd passes with LISTEN_FDS (socket activation; FileDescriptorName=tls for HTTPS).\n"
+		"  An admin: address (127.0.0.1 only for a port; FileDescriptorName=admin) serves /admin,\n"
+		"  which answers nowhere else\n"
+		"  -P    enable the sampling profiler (GET /admin/profile on an admin: listener)\n"
+		"  -T header=S,body=S,idle=S,write=S,rate=B,heartbeat=S\n"
+		"        connection timeouts in seconds and minimum request rate in bytes/s;\n"
+		"        heartbeat: comment sent on a quiet event stream (default 15, 0 never)\n"
+		"  -L connections=N,workers=N,coroutines=N,queue=N,wait=MS,coalesce=MS\n"
+		"        admission limits; requests over them get 503 Service Unavailable\n"
+		"        coroutines: coroutine handlers (-c, HTTP/2 streams, TLS without kTLS)\n"
+		"        coalesce: wait for an identical request's cacheable response\n"
+		"  -R [method=M,]path=P,requests=N[,seconds=S,burst=B] | off\n"
+		"        limit each client to N requests per S seconds (default 1) on a path, with\n"
+		"        bursts of B (default N); P may end in '*'; repeat for more rules. Over the\n"
+		"        limit is a 429. Default: method=POST,path=/login,requests=30,seconds=60,burst=10\n"
+		"  -N backlog=N,defer=S,fastopen=N,busypoll=US,nodelay=0|1,ipv6=0|1\n"
+		"        listening socket options, 0 turns one off (default backlog=65535,defer=10,\n"
+		"        fastopen=256,busypoll=0,nodelay=1,ipv6=1); ipv6 also takes IPv4 clients\n"
+		"  -t cert=FILE,key=FILE,tickets=N,cache=N,ktls=0|1\n"
+		"        TLS 1.3 for the tls: ports: PEM certificate chain and key, session tickets\n"
+		"        per handshake (default 2, 0 turns resumption off), sessions kept in the\n"
+		"        server (default 0: tickets carry them), kernel TLS (default 1)\n"
+		"  -H streams=N,window=KB\n"
+		"        HTTP/2 (h2 over TLS, h2c): concurrent streams per connection (default 100,\n"
+		"        0 turns HTTP/2 off) and the request bytes a client may send ahead (default 1024)\n"
+		"  -U name=N,server=HOST:PORT|unix:PATH[,...],keepalive=N,idle=S,fails=N,down=S,timeout=S\n"
+		"        upstream N for ROUTE_PROXY routes; repeat server= for each of its servers.\n"
+		"        Idle connections kept per server (default 16, 0 none) and for how long\n"
+		"        (default 4); failures in a row that take a server out (default 3) and for\n"
+		"        how long (default 10); seconds to connect and between response bytes (default 30)\n"
+		"  -D S  seconds SIGTERM/SIGQUIT waits for in-flight requests (default 30)\n"
+		"  -C KB response cache size (default 8192, 0 disables)\n"
+		"  -W N  threads forking request handlers off the event loop\n"
+		"        (default one per CPU, 0 forks on the event loop)\n"
+		"  -c    run request handlers as coroutines in the server instead of forking them;\n"
+		"        storage calls go to the -W threads\n"
+		"  -S KB coroutine stack size (default 64)\n"
+		"  -A    pin the event loop and -W threads to one CPU each, and each handler to the\n"
+		"        CPU that receives its connection's packets\n"
+		"  -I epoll|uring\n"
+		"        socket I/O backend (default epoll); uring falls back to epoll without Linux 6.0\n"
+		"  -d    serve public/ from disk instead of the copy built into the binary\n"
+		"  -f FILE\n"
+		"        configuration file of \"timeouts ...\", \"limits ...\", \"listen ...\",\n"
+		"        \"tls ...\", \"http2 ...\", \"ratelimit ...\" and \"upstream ...\" lines,\n"
+		"        re-read on SIGHUP (listen, tls and upstream apply at startup only)\n",
+		prog);
+}
+
+/*
+ * Parses the -T option into timeouts (server_timeouts, or a configuration's).
+ *
+ * Returns:
+ *   1 on success, 0 on an unknown key or a negative value.
+ */
+static int parseTimeouts(char *options, timeouts_t *timeouts) {
+	char *const keys[] = { "header", "body", "idle", "write", "rate", "heartbeat", NULL };
+	int *targets[] = {
+		&timeouts->header_read,
+		&timeouts->body_read,
+		&timeouts->idle,
+		&timeouts->write_stall,
+		&timeouts->minimum_rate,
+		&timeouts->heartbeat,
+	};
+
+	char *value;
+	while (*options) {
+		int key = getsubopt(&options, keys, &value);
+		if (key < 0 || !value || atoi(value) < 0) return 0;
+		*targets[key] = atoi(value);
+	}
+	return 1;
+}
+
+/*
+ * Parses the -L option into limits.
+ *
+ * Returns:
+ *   1 on success, 0 on an unknown key or a value below 1.
+ */
+static int parseLimits(char *options, limits_t *limits) {
+	char *const keys[] = { "connections", "workers", "coroutines", "queue", "wait", "coalesce", NULL };
+	int *targets[] = {
+		&limits->connections,
+		&limits->workers,
+		&limits->coroutines,
+		&limits->queue_depth,
+		&limits->queue_wait,
+		&limits->coalesce_wait,
+	};
+
+	char *value;
+	while (*options) {
+		int key = getsubopt(&options, keys, &value);
+		if (key < 0 || !value || atoi(value) < 1) return 0;
+		*targets[key] = atoi(value);
+	}
+	return 1;
+}
+
+/*
+ * Parses the -N option into listener.
+ *
+ * Returns:
+ *   1 on success, 0 on an unknown key, a negative value or a zero backlog.
+ */
+static int parseListener(char *options, listener_t *listener) {
+	char *const keys[] = { "backlog", "defer", "fastopen", "busypoll", "nodelay", "ipv6", NULL };
+	int *targets[] = {
+		&listener->backlog,
+		&listener->defer_accept,
+		&listener->fastopen,
+		&listener->busy_poll,
+		&listener->nodelay,
+		&listener->ipv6,
+	};
+
+	char *value;
+	while (*options) {
+		int key = getsubopt(&options, keys, &value);
+		if (key < 0 || !value || atoi(value) < 0) return 0;
+		*targets[key] = atoi(value);
+	}
+	return listener->backlog > 0;
+}
+
+/*
+ * Parses the -t option into tls. The file names are copied, since a
+ * configuration line's buffer is reused.
+ *
+ * Returns:
+ *   1 on success, 0 on an unknown key, a missing value or a negative number.
+ */
+static int parseTls(char *options, tls_options_t *tls) {
+	char *const keys[] = { "cert", "key", "tickets", "cache", "ktls", NULL };
+	int *targets[] = {
+		NULL,
+		NULL,
+		&tls->tickets,
+		&tls->session_cache,
+		&tls->ktls,
+	};
+
+	char *value;
+	while (*options) {
+		int key = getsubopt(&options, keys, &value);
+		if (key < 0 || !value) return 0;
+		if (key == 0)
+			tls->certificate = strdup(value);
+		else if (key == 1)
+			tls->key = strdup(value);
+		else if (atoi(value) < 0)
+			return 0;
+		else
+			*targets[key] = atoi(value);
+	}
+	return 1;
+}
+
+/*
+ * Parses the -H option into http2.
+ *
+ * Returns:
+ *   1 on success, 0 on an unknown key or a value out of range.
+ */
+static int parseHttp2(char *options, http2_options_t *http2) {
+	char *const keys[] = { "streams", "window", NULL };
+	int *targets[] = {
+		&http2->streams,
+		&http2->window,
+	};
+
+	char *value;
+	while (*options) {
+		int key = getsubopt(&options, keys, &value);
+		if (key < 0 || !value || atoi(value) < 0) return 0;
+		*targets[key] = atoi(value);
+	}
+	// the window is a 31-bit byte count, no smaller than HTTP/2's default
+	return http2->streams <= H2_STREAMS_MAX && http2->window >= 64 && http2->window <= 2097151;
+}
+
+/*
+ * Parses a -R option or "ratelimit" line into a rate limit rule; "off"
+ * turns off the default rule.
+ *
+ * Parameters:
+ *   off - Set if the rule is "off".
+ *   add - Add the rule; otherwise it is only checked.
+ *
+ * Returns:
+ *   1 on success, 0 on an unknown key, a missing path or requests, or a bad value.
+ */
+static int parseRateLimit(char *options, int *off, int add) {
+	if (strcmp(options, "off") == 0) {
+		*off = 1;
+		return 1;
+	}
+
+	char *const keys[] = { "method", "path", "requests", "seconds", "burst", NULL };
+	char *method = NULL, *path = NULL;
+	int requests = 0, seconds = 1, burst = 0;
+
+	char *value;
+	while (*options) {
+		int key = getsubopt(&options, keys, &value);
+		if (key < 0 || !value) return 0;
+		switch (key) {
+		case 0: method = value; break;
+		case 1: path = value; break;
+		case 2: requests = atoi(value); break;
+		case 3: seconds = atoi(value); break;
+		case 4: burst = atoi(value); break;
+		}
+	}
+	if (!add)
+		return ratelimitValidRule(method, path, requests, seconds, burst ? burst : requests);
+	return ratelimitAddRule(method, path, requests, seconds, burst ? burst : requests);
+}
+
+/*
+ * Parses a -U option or "upstream" line into an upstream for proxy routes.
+ *
+ * Parameters:
+ *   add - Add the upstream; otherwise its values are only checked.
+ *
+ * Returns:
+ *   1 on success, 0 on an unknown key, a missing name or server, or a bad value.
+ */
+static int parseUpstream(char *options, int add) {
+	char *const keys[] = { "name", "server", "keepalive", "idle", "fails", "down", "timeout", NULL };
+	char *name = NULL, *servers[PROXY_SERVERS_MAX];
+	int count = 0, keepalive = 16, idle = 4, fails = 3, down = 10, timeout = 30;
+
+	char *value;
+	while (*options) {
+		int key = getsubopt(&options, keys, &value);
+		if (key < 0 || !value) return 0;
+		switch (key) {
+		case 0: name = value; break;
+		case 1:
+			if (count == PROXY_SERVERS_MAX) return 0;
+			servers[count++] = value;
+			break;
+		case 2: keepalive = atoi(value); break;
+		case 3: idle = atoi(value); break;
+		case 4: fails = atoi(value); break;
+		case 5: down = atoi(value); break;
+		case 6: timeout = atoi(value); break;
+		}
+	}
+	if (!add)
+		return proxyValidUpstream(name, count, keepalive, idle, fails, down, timeout);
+	return proxyAddUpstream(name, servers, count, keepalive, idle, fails, down, timeout);
+}
+
+// brute-forcing passwords costs a scan of the user file per attempt; limit it unless told otherwise
+static void defaultRateLimit(void) {
+	if (!ratelimitRuleCount() && !rateLimitsOff)
+		ratelimitAddRule("POST", "/login", 30, 60, 10);
+}
+
+/*
+ * Parses the configuration file given with -f into config, on top of the
+ * settings in effect. Each line holds a section and its options in the
+ * -T/-L/-N/-t/-H/-R/-U syntax, e.g. "timeouts idle=5,header=10"; blank
+ * lines and lines starting with '#' are ignored. Nothing is applied, so a
+ * file with a bad line leaves the server as it was.
+ *
+ * Returns:
+ *   1 on success, 0 if the file cannot be read or has an invalid line.
+ */
+static int readConfig(const char *path, config_t *config) {
+	FILE *file = fopen(path, "r");
+	if (!file) {
+		perror(path);
+		return 0;
+	}
+
+	memset(config, 0, sizeof(*config));
+	config->timeouts = server_timeouts;
+	config->limits = server_limits;
+	config->listener = server_listener;
+	config->tls = server_tls;
+	config->http2 = server_http2;
+
+	char line[CONFIG_LINE_MAX];
+	int lineNumber = 0, ok = 1;
+	while (ok && fgets(line, sizeof(line), file)) {
+		lineNumber++;
+		char *section = strtok(line, " \t\r\n");
+		char *options = strtok(NULL, " \t\r\n");
+		if (!section || *section == '#') continue;
+
+		// getsubopt() cuts the options up: rules and upstreams keep a copy to apply
+		char copy[CONFIG_LINE_MAX];
+		if (options)
+			snprintf(copy, sizeof(copy), "%s", options);
+
+		if (options && strcmp(section, "timeouts") == 0)
+			ok = parseTimeouts(options, &config->timeouts);
+		else if (options && strcmp(section, "limits") == 0)
+			ok = parseLimits(options, &config->limits);
+		else if (options && strcmp(section, "listen") == 0)
+			ok = parseListener(options, &config->listener);
+		else if (options && strcmp(section, "tls") == 0)
+			ok = parseTls(options, &config->tls);
+		else if (options && strcmp(section, "http2") == 0)
+			ok = parseHttp2(options, &config->http2);
+		else if (options && strcmp(section, "ratelimit") == 0) {
+			ok = config->rateLimitCount + rateLimitOptionCount < RATELIMIT_RULES_MAX
+				 && parseRateLimit(options, &config->rateLimitsOff, 0);
+			if (ok && strcmp(copy, "off") != 0)
+				memcpy(config->rateLimits[config->rateLimitCount++], copy, sizeof(copy));
+		} else if (options && strcmp(section, "upstream") == 0) {
+			ok = config->upstreamCount < PROXY_UPSTREAMS_MAX && parseUpstream(options, 0);
+			if (ok)
+				memcpy(config->upstreams[config->upstreamCount++], copy, sizeof(copy));
+		} else
+			ok = 0;
+
+		if (!ok)
+			fprintf(stderr, "%s:%d: invalid configuration line\n", path, lineNumber);
+	}
+	fclose(file);
+	return ok;
+}
+
+/*
+ * Applies a configuration readConfig() parsed. At startup every section
+ * applies; a reload leaves the listeners, TLS and upstreams as they are.
+ *
+ * Returns:
+ *   1 on success, 0 if an upstream's server does not resolve.
+ */
+static int applyConfig(config_t *config, int startup) {
+	server_timeouts = config->timeouts;
+	server_limits = config->limits;
+	server_http2 = config->http2;
+	if (startup) {
+		server_listener = config->listener;
+		server_tls = config->tls;
+	} else {
+		if (config->tls.certificate != server_tls.certificate) free((char *)config->tls.certificate);
+		if (config->tls.key != server_tls.key) free((char *)config->tls.key);
+	}
+
+	if (config->rateLimitsOff)
+		rateLimitsOff = 1;
+	for (int i = 0; i < config->rateLimitCount; i++)
+		parseRateLimit(config->rateLimits[i], &rateLimitsOff, 1);
+
+	for (int i = 0; startup && i < config->upstreamCount; i++)
+		if (!parseUpstream(config->upstreams[i], 1)) return 0;
+	return 1;
+}
 
 int main(int argc, char *argv[]) {
-	if (argc < 2) {
-		fprintf(stderr, "Usage: %s <port>\n", argv[0]);
+	server_argv = argv;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "PT:L:N:t:H:R:U:D:C:W:cS:AI:df:")) != -1) {
+		switch (opt) {
+		case 'P':
+			if (profilerInit() != PROFILER_OK) {
+				fprintf(stderr, "Unable to enable the profiler\n");
+				return 1;
+			}
+			break;
+		case 'T':
+			if (!parseTimeouts(optarg, &server_timeouts)) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'L':
+			if (!parseLimits(optarg, &server_limits)) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'N':
+			if (!parseListener(optarg, &server_listener)) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 't':
+			if (!parseTls(optarg, &server_tls)) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'H':
+			if (!parseHttp2(optarg, &server_http2)) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'D':
+			drain_timeout = atoi(optarg);
+			if (drain_timeout < 1) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'C':
+			cache_size = atoi(optarg);
+			if (cache_size < 0) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'W':
+			pool_threads = atoi(optarg);
+			if (pool_threads < 0 || pool_threads > POOL_THREADS_MAX) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'c':
+			handler_coroutines = 1;
+			break;
+		case 'S':
+			if (atoi(optarg) < 1 || !coroInit((size_t)atoi(optarg) * 1024)) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'A':
+			cpu_affinity = 1;
+			break;
+		case 'I':
+			if (strcmp(optarg, "epoll") == 0)
+				io_backend = IO_BACKEND_EPOLL;
+			else if (strcmp(optarg, "uring") == 0)
+				io_backend = IO_BACKEND_URING;
+			else {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'd':
+			bundleSetMode(BUNDLE_DISK);
+			break;
+		case 'R':
+			if (rateLimitOptionCount == RATELIMIT_RULES_MAX
+				|| !(rateLimitOptions[rateLimitOptionCount++] = strdup(optarg))
+				|| !parseRateLimit(optarg, &rateLimitsOff, 1)) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'U':
+			if (!parseUpstream(optarg, 1)) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'f':
+			configPath = optarg;
+			if (!readConfig(configPath, &fileConfig) || !applyConfig(&fileConfig, 1)) return 1;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	// with socket activation systemd has opened the listeners already
+	if (optind >= argc && !getenv("LISTEN_FDS")) {
+		usage(argv[0]);
 		return 1;
 	}
 
+	defaultRateLimit();
+	memstatInit();
+	metricsInit();
+	ratelimitInit();
+	profileVersionsInit();
 	setUp();
-	const char *port = argv[1];
-	serve_forever(port);
+	serve_forever(argv + optind, argc - optind);
 	return 0;
 }
 
+/*
+ * Scheduling classes of the routes below. Under load the handlers are shared
+ * out by weight, and the capped classes can never take them all, so a burst
+ * of logins or profiler sessions leaves handlers for pages and files.
+ */
+route_class_t route_classes[] = {
+	// name			weight	concurrency	queue_depth
+	{ "pages",		4,		0,			0 },		// the default
+	{ "static",		8,		0,			0 },		// files, 404s and health checks: cheap, keep them quick
+	{ "auth",		1,		16,			64 },		// password hashing, user file scans
+	{ "admin",		1,		2,			8 },		// profiler sessions last seconds
+	{ NULL }
+};
+
 void route() {
 	ROUTE_START()
 
+	ROUTE_CLASS("pages")
+
 	ROUTE_GET("/home") {
-		serveHomePage(NULL);
+		CACHE_PER_SESSION(300)
+		serveHomePage(NULL, 0);
+	}
+
+	ROUTE_GET("/home/events") {
+		serveProfileEvents();
 	}
 
 	ROUTE_GET("/login") {
+		CACHE_FOR(10, 60)
 		serveLoginPage();
 	}
 
@@ -36,22 +569,80 @@ void route() {
 		REDIRECT_AND_CLEAR_SESSION("login");
 	}
 
+	ROUTE_CLASS("admin")
+
+	ROUTE_GET("/admin/profile") {
+		serveProfilerReport(qs);
+	}
+
+	ROUTE_GET("/admin/memory") {
+		serveMemoryReport();
+	}
+
+	// metrics stay out of "admin": a scrape is a cheap read, and must not
+	// queue behind the profiler sessions holding that class's two handlers
+	ROUTE_CLASS("static")
+
+	ROUTE_GET("/admin/metrics") {
+		serveMetricsReport();
+	}
+
 	ROUTE_GET_STARTS_WITH("/public/") {
+		if (bundleMode() == BUNDLE_EMBEDDED) {
+			CACHE_FOR(3600, 0)		// fixed at build time; a crowd on a new asset costs one handler
+		}
 		sendFileResponse(uri + 1);
 	}
 
+	ROUTE_PROXY("/api/", "api") {
+		// relayed by the server to the servers of -U name=api, when it is set
+	}
+
 	ROUTE_GET_STARTS_WITH("/") {
+		CACHE_FOR(10, 60)
 		send404Page();
 	}
 
+	ROUTE_CLASS("pages")
+
 	ROUTE_POST("/home") {
-		serveHomePage(payload);
+		serveHomePage(payload, payload_size);
 	}
 
+	ROUTE_CLASS("auth")
+
 	ROUTE_POST("/login") {
-		handleLoginPost(payload);
+		handleLoginPost(payload, payload_size);
 	}
 
   
 	ROUTE_END()
 }
+
+/*
+ * Called by the server on SIGHUP. The connection table is sized at startup,
+ * so a reload keeps the current connection limit. Cached pages are dropped
+ * so edited templates (-d) show up right away.
+ */
+void reload() {
+	cacheClear();
+	if (!configPath) return;
+
+	if (!readConfig(configPath, &fileConfig)) {
+		fprintf(stderr, "%s: not reloaded, the configuration stays as it was\n", configPath);
+		return;
+	}
+
+	// rate limit rules are replaced: the -R ones, then the file's
+	ratelimitClearRules();
+	rateLimitsOff = 0;
+	for (int i = 0; i < rateLimitOptionCount; i++) {
+		char options[CONFIG_LINE_MAX];		// getsubopt() cuts the string up
+		snprintf(options, sizeof(options), "%s", rateLimitOptions[i]);
+		parseRateLimit(options, &rateLimitsOff, 1);
+	}
+
+	fileConfig.limits.connections = server_limits.connections;
+	applyConfig(&fileConfig, 0);
+	defaultRateLimit();
+}
@@ -0,0 +1,78 @@
+//
+//  affinity.c
+//  CServer
+//
+//  Created by ibrahim alnakeeb on 19/10/2026.
+//
+
+#define _GNU_SOURCE
+
+#include "affinity.h"
+
+#include <sched.h>
+#include <stdio.h>
+
+static int cpus[CPU_SETSIZE];		// the CPUs the process may run on, in order
+static int count;
+
+/*
+ * Turns CPU pinning on (-A) for the CPUs the server was started on, as
+ * taskset or a cgroup left them. Memory a pinned thread touches first comes
+ * from its own NUMA node, so each thread's state ends up local to it.
+ *
+ * Returns:
+ *   The number of CPUs, 0 if they could not be read (pinning stays off).
+ */
+int affinityInit(void) {
+	cpu_set_t set;
+	if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+		perror("sched_getaffinity() error");
+		return 0;
+	}
+
+	count = 0;
+	for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+		if (CPU_ISSET(cpu, &set))
+			cpus[count++] = cpu;
+	return count;
+}
+
+/*
+ * Returns 1 once affinityInit() succeeded.
+ */
+int affinityEnabled(void) {
+	return count > 0;
+}
+
+/*
+ * Returns the number of CPUs pinning spreads over.
+ */
+int affinityCount(void) {
+	return count;
+}
+
+/*
+ * Returns the CPU for a thread by its index (event loop 0, pool threads
+ * from 1), wrapping around when there are more threads than CPUs.
+ */
+int affinityCpu(int index) {
+	return count ? cpus[index % count] : -1;
+}
+
+/*
+ * Pins the calling thread to one CPU.
+ *
+ * Returns:
+ *   1 on success, 0 if pinning is off or the CPU is not one of the server's.
+ */
+int affinityPin(int cpu) {
+	int allowed = 0;
+	for (int i = 0; i < count && !allowed; i++)
+		allowed = cpus[i] == cpu;
+	if (!allowed) return 0;
+
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
@@ -0,0 +1,108 @@
+//
+//  bufpool.c
+//  CServer
+//
+//  Created by ibrahim alnakeeb on 19/10/2026.
+//
+
+#include "bufpool.h"
+#include "metrics.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// a free buffer; the link lives in its first bytes
+typedef struct free_buffer {
+	struct free_buffer	*next;
+} free_buffer_t;
+
+static const size_t classSizes[BUFPOOL_CLASSES] = { 4 * 1024, 16 * 1024, BUFPOOL_MAX };
+
+// each thread keeps its own free lists, so taking and returning a buffer needs no lock
+static __thread free_buffer_t *freeBuffers[BUFPOOL_CLASSES];
+static __thread size_t freeBytes[BUFPOOL_CLASSES];
+
+// smallest class holding need bytes, -1 if none does
+static int classFor(size_t need) {
+	for (int i = 0; i < BUFPOOL_CLASSES; i++)
+		if (need <= classSizes[i]) return i;
+	return -1;
+}
+
+/*
+ * Takes a buffer of the smallest size class that holds need bytes, from the
+ * calling thread's free list when it has one.
+ *
+ * Parameters:
+ *   need     - Bytes the buffer must hold, at most BUFPOOL_MAX.
+ *   capacity - Set to the size of the buffer; pass it to bufpoolRelease().
+ *
+ * Returns:
+ *   The buffer, or NULL if need is too big or out of memory.
+ */
+char *bufpoolAcquire(size_t need, size_t *capacity) {
+	int class = classFor(need);
+	if (class < 0) return NULL;
+
+	free_buffer_t *buffer = freeBuffers[class];
+	if (buffer) {
+		freeBuffers[class] = buffer->next;
+		freeBytes[class] -= classSizes[class];
+	} else {
+		buffer = malloc(classSizes[class]);
+		if (!buffer) return NULL;
+		METRIC_INC(METRIC_BUFFER_ALLOCATIONS);
+	}
+	*capacity = classSizes[class];
+	return (char *)buffer;
+}
+
+/*
+ * Moves the contents of a buffer to one of a larger class once it has to
+ * hold need bytes. Nothing changes when it already does.
+ *
+ * Parameters:
+ *   buf      - The buffer, replaced on success.
+ *   capacity - Its size, updated on success.
+ *   used     - Bytes of it to keep.
+ *
+ * Returns:
+ *   1 on success, 0 if need is too big or out of memory; the buffer is
+ *   left as it was.
+ */
+int bufpoolGrow(char **buf, size_t *capacity, size_t used, size_t need) {
+	assert(used <= *capacity);
+	if (need <= *capacity) return 1;
+
+	size_t grown;
+	char *buffer = bufpoolAcquire(need, &grown);
+	if (!buffer) return 0;
+
+	memcpy(buffer, *buf, used);
+	bufpoolRelease(*buf, *capacity);
+	*buf = buffer;
+	*capacity = grown;
+	METRIC_INC(METRIC_BUFFER_GROWS);
+	return 1;
+}
+
+/*
+ * Returns a buffer to the calling thread's free list, or to malloc once the
+ * list holds BUFPOOL_KEEP bytes, so a burst does not stay resident.
+ */
+void bufpoolRelease(char *buf, size_t capacity) {
+	if (!buf) return;
+
+	int class = classFor(capacity);
+	assert(class >= 0 && classSizes[class] == capacity);
+
+	if (freeBytes[class] + capacity > BUFPOOL_KEEP) {
+		free(buf);
+		return;
+	}
+	free_buffer_t *buffer = (free_buffer_t *)buf;
+	buffer->next = freeBuffers[class];
+	freeBuffers[class] = buffer;
+	freeBytes[class] += capacity;
+}
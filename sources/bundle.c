@@ -0,0 +1,94 @@
+//
+//  bundle.c
+//  CServer
+//
+//  Created by ibrahim alnakeeb on 19/10/2026.
+//
+
+#include "bundle.h"
+
+#include <assert.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+static int mode = BUNDLE_EMBEDDED;
+
+/*
+ * Chooses where public/ is served from. BUNDLE_DISK is meant for development,
+ * where edits to templates and styles should show up without a rebuild.
+ */
+void bundleSetMode(int newMode) {
+	mode = newMode;
+}
+
+int bundleMode(void) {
+	return mode;
+}
+
+/*
+ * Looks up a file of the embedded public/ tree.
+ *
+ * Parameters:
+ *   path    - Path relative to the working directory, either plain ("public/css/style.css")
+ *             or fingerprinted ("public/css/style.a458e3d5.css") (must not be NULL).
+ *   variant - Optional; receives BUNDLE_IMMUTABLE for a fingerprinted path and
+ *             BUNDLE_REVALIDATE otherwise.
+ *
+ * Returns:
+ *   The embedded file, or NULL if it is not bundled or the server runs in BUNDLE_DISK mode.
+ */
+const bundle_file_t *bundleFind(const char *path, int *variant) {
+	assert(path != NULL);
+
+	if (mode != BUNDLE_EMBEDDED || bundleFileCount == 0) return NULL;
+
+	int key = bundleSlots[bundleHash(path, bundleSeed) & bundleSlotMask];
+	if (key < 0) return NULL;
+
+	const bundle_file_t *file = &bundleFiles[key >> 1];
+	int fingerprinted = key & 1;
+	if (strcmp(fingerprinted ? file->fingerprintPath : file->path, path) != 0) return NULL;
+
+	if (variant)
+		*variant = fingerprinted ? BUNDLE_IMMUTABLE : BUNDLE_REVALIDATE;
+	return file;
+}
+
+/*
+ * Resolves a fingerprint from an earlier build, so pages cached before a
+ * deploy can be sent on to the current version of the file.
+ *
+ * Parameters:
+ *   path - A fingerprinted path that bundleFind() did not know (must not be NULL).
+ *
+ * Returns:
+ *   The file the path named before its contents changed, or NULL if the path
+ *   carries no fingerprint or names no bundled file.
+ */
+const bundle_file_t *bundleFindRenamed(const char *path) {
+	assert(path != NULL);
+
+	// "<name>.<fingerprint><ext>", where ext may be empty
+	const char *slash = strrchr(path, '/');
+	const char *ext = strrchr(path, '.');
+	if (!ext || (slash && ext < slash)) return NULL;
+
+	const char *fingerprint = ext - BUNDLE_FINGERPRINT_LEN;
+	if (fingerprint - 1 <= (slash ? slash : path) || fingerprint[-1] != '.') {
+		// no extension: the fingerprint is the last dot-separated part
+		fingerprint = ext + 1;
+		if (strlen(fingerprint) != BUNDLE_FINGERPRINT_LEN) return NULL;
+		ext = fingerprint + BUNDLE_FINGERPRINT_LEN;
+	}
+	for (int i = 0; i < BUNDLE_FINGERPRINT_LEN; i++)
+		if (!isxdigit((unsigned char)fingerprint[i])) return NULL;
+
+	char plain[512];
+	int written = snprintf(plain, sizeof(plain), "%.*s%s", (int)(fingerprint - 1 - path), path, ext);
+	if (written < 0 || (size_t)written >= sizeof(plain)) return NULL;
+
+	int variant;
+	const bundle_file_t *file = bundleFind(plain, &variant);
+	return file && variant == BUNDLE_REVALIDATE ? file : NULL;
+}
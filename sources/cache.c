@@ -0,0 +1,282 @@
+//
+//  cache.c
+//  CServer
+//
+//  Created by ibrahim alnakeeb on 19/10/2026.
+//
+
+#define _GNU_SOURCE
+
+#include "cache.h"
+#include "metrics.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define CACHE_MASK (CACHE_BUCKETS - 1)
+
+static cache_entry_t **buckets;
+static cache_entry_t *lruHead, *lruTail;
+static size_t budget, used;
+
+/*
+ * Returns the 64-bit FNV-1a hash of a key, as used by the cache table.
+ */
+uint64_t cacheKeyHash(const char *key) {
+	uint64_t hash = 14695981039346656037ULL;
+	for (; *key; key++)
+		hash = (hash ^ (unsigned char)*key) * 1099511628211ULL;
+	return hash;
+}
+
+static void lruUnlink(cache_entry_t *entry) {
+	if (entry->lruPrev) entry->lruPrev->lruNext = entry->lruNext;
+	else lruHead = entry->lruNext;
+	if (entry->lruNext) entry->lruNext->lruPrev = entry->lruPrev;
+	else lruTail = entry->lruPrev;
+	entry->lruPrev = entry->lruNext = NULL;
+}
+
+static void lruPush(cache_entry_t *entry) {
+	entry->lruNext = lruHead;
+	if (lruHead) lruHead->lruPrev = entry;
+	else lruTail = entry;
+	lruHead = entry;
+}
+
+// take an entry out of the table; it is freed once no connection sends it
+static void unlinkEntry(cache_entry_t *entry) {
+	cache_entry_t **link = &buckets[entry->hash & CACHE_MASK];
+	while (*link != entry)
+		link = &(*link)->hashNext;
+	*link = entry->hashNext;
+
+	lruUnlink(entry);
+	used -= entry->size;
+	entry->linked = 0;
+	cacheRelease(entry);
+}
+
+static cache_entry_t *findEntry(const char *key, uint64_t hash) {
+	for (cache_entry_t *entry = buckets[hash & CACHE_MASK]; entry; entry = entry->hashNext)
+		if (entry->hash == hash && strcmp(entry->key, key) == 0)
+			return entry;
+	return NULL;
+}
+
+/*
+ * Sets up an empty cache in the server process.
+ *
+ * Parameters:
+ *   size - Byte budget for keys, headers and bodies; 0 disables the cache.
+ *
+ * Returns:
+ *   1 if the cache is enabled, 0 otherwise.
+ */
+int cacheInit(size_t size) {
+	budget = size;
+	if (budget == 0) return 0;
+
+	buckets = calloc(CACHE_BUCKETS, sizeof(cache_entry_t *));
+	if (!buckets) budget = 0;
+	return buckets != NULL;
+}
+
+/*
+ * Finds the response stored under key and marks it most recently used.
+ *
+ * Parameters:
+ *   key   - Cache key, e.g. "GET /login" (must not be NULL).
+ *   now   - Current timerNowMs() time.
+ *   state - Receives CACHE_FRESH, CACHE_STALE, CACHE_PASS or CACHE_MISS (must not be NULL).
+ *
+ * Returns:
+ *   The entry, or NULL on a miss. Expired entries are dropped on the way.
+ */
+cache_entry_t *cacheLookup(const char *key, uint64_t now, int *state) {
+	assert(key != NULL && state != NULL);
+
+	*state = CACHE_MISS;
+	if (!buckets) return NULL;
+
+	cache_entry_t *entry = findEntry(key, cacheKeyHash(key));
+	if (!entry) return NULL;
+
+	if (now >= entry->staleUntil
+		|| (entry->version && __atomic_load_n(entry->version, __ATOMIC_ACQUIRE) != entry->versionSeen)) {
+		unlinkEntry(entry);
+		return NULL;
+	}
+
+	lruUnlink(entry);
+	lruPush(entry);
+	*state = entry->pass ? CACHE_PASS : now < entry->freshUntil ? CACHE_FRESH : CACHE_STALE;
+	return entry;
+}
+
+/*
+ * Builds an entry from a complete response produced by a handler, without
+ * adding it to the table; coalesced requests can be answered from it either way.
+ *
+ * Parameters:
+ *   key      - Cache key (must not be NULL).
+ *   response - The serialized response, headers and body (must not be NULL).
+ *   length   - Size of the response in bytes.
+ *
+ * Returns:
+ *   The entry holding one reference, or NULL if the response is too large,
+ *   malformed, sets a cookie, or memory runs out.
+ */
+cache_entry_t *cacheEntryCreate(const char *key, const char *response, size_t length) {
+	assert(key != NULL && response != NULL);
+
+	if (length > CACHE_ENTRY_MAX || length < 12 || memcmp(response, "HTTP/", 5) != 0) return NULL;
+
+	const char *end = memmem(response, length, "\r\n\r\n", 4);
+	if (!end) return NULL;
+
+	// copy the header lines except Connection; a response that sets a cookie is never shared
+	size_t keyLength = strlen(key) + 1;
+	char *block = malloc(keyLength + length);
+	if (!block) return NULL;
+
+	char *head = block + keyLength;
+	size_t headLength = 0;
+	for (const char *line = response; line < end + 2; ) {
+		const char *eol = memmem(line, end + 2 - line, "\r\n", 2);
+		size_t lineLength = eol + 2 - line;
+		if (strncasecmp(line, "Set-Cookie:", 11) == 0) {
+			free(block);
+			return NULL;
+		}
+		if (strncasecmp(line, "Connection:", 11) != 0) {
+			memcpy(head + headLength, line, lineLength);
+			headLength += lineLength;
+		}
+		line = eol + 2;
+	}
+
+	cache_entry_t *entry = calloc(1, sizeof(cache_entry_t));
+	if (!entry) {
+		free(block);
+		return NULL;
+	}
+
+	memcpy(block, key, keyLength);
+	entry->key = block;
+	entry->head = head;
+	entry->headLength = headLength;
+	entry->body = head + headLength;
+	entry->bodyLength = response + length - (end + 4);
+	memcpy(entry->body, end + 4, entry->bodyLength);
+	entry->status = atoi(response + 9);
+	entry->hash = cacheKeyHash(key);
+	entry->size = sizeof(cache_entry_t) + keyLength + headLength + entry->bodyLength;
+	entry->refs = 1;
+	return entry;
+}
+
+// add an entry built by cacheEntryCreate(), replacing the previous version and
+// evicting least recently used entries to stay within the budget
+static int insertEntry(cache_entry_t *entry) {
+	cache_entry_t *previous = findEntry(entry->key, entry->hash);
+	if (previous)
+		unlinkEntry(previous);
+
+	while (lruTail && used + entry->size > budget) {
+		unlinkEntry(lruTail);
+		METRIC_INC(METRIC_CACHE_EVICTIONS);
+	}
+	if (used + entry->size > budget) return 0;
+
+	cacheRetain(entry);		// the table's reference
+	entry->linked = 1;
+	entry->hashNext = buckets[entry->hash & CACHE_MASK];
+	buckets[entry->hash & CACHE_MASK] = entry;
+	lruPush(entry);
+	used += entry->size;
+	return 1;
+}
+
+/*
+ * Adds an entry to the table. Server errors are never stored.
+ *
+ * Parameters:
+ *   entry    - Entry from cacheEntryCreate(); the caller keeps its own reference.
+ *   ttl      - Seconds the response is served as fresh.
+ *   stale    - Further seconds it may be served while a handler refreshes it.
+ *   version  - Optional counter in shared memory; the entry is dropped as soon as
+ *              it no longer holds versionSeen.
+ *   versionSeen - Value of *version when the response was rendered.
+ *   now      - Current timerNowMs() time.
+ *
+ * Returns:
+ *   1 if the entry was stored, 0 if it is an error, does not fit the budget,
+ *   or was rendered from a version that already moved on.
+ */
+int cacheInsert(cache_entry_t *entry, int ttl, int stale, const uint64_t *version, uint64_t versionSeen, uint64_t now) {
+	assert(entry != NULL && !entry->linked);
+
+	if (!buckets || ttl <= 0 || entry->status >= 500) return 0;
+	if (version && __atomic_load_n(version, __ATOMIC_ACQUIRE) != versionSeen) return 0;
+
+	entry->version = version;
+	entry->versionSeen = versionSeen;
+	entry->freshUntil = now + (uint64_t)ttl * 1000;
+	entry->staleUntil = entry->freshUntil + (uint64_t)(stale > 0 ? stale : 0) * 1000;
+	return insertEntry(entry);
+}
+
+/*
+ * Remembers for CACHE_PASS_TTL seconds that requests with this key are not
+ * cacheable, so they go straight to a handler instead of waiting on each other.
+ */
+void cacheInsertPass(const char *key, uint64_t now) {
+	assert(key != NULL);
+
+	if (!buckets) return;
+
+	size_t keyLength = strlen(key) + 1;
+	cache_entry_t *entry = calloc(1, sizeof(cache_entry_t));
+	char *block = malloc(keyLength);
+	if (!entry || !block) {
+		free(entry);
+		free(block);
+		return;
+	}
+
+	memcpy(block, key, keyLength);
+	entry->key = block;
+	entry->pass = 1;
+	entry->hash = cacheKeyHash(key);
+	entry->freshUntil = entry->staleUntil = now + CACHE_PASS_TTL * 1000;
+	entry->size = sizeof(cache_entry_t) + keyLength;
+	entry->refs = 1;
+	insertEntry(entry);
+	cacheRelease(entry);
+}
+
+/*
+ * Keeps an entry alive while a connection sends it, even if it is evicted meanwhile.
+ */
+void cacheRetain(cache_entry_t *entry) {
+	entry->refs++;
+}
+
+void cacheRelease(cache_entry_t *entry) {
+	if (--entry->refs > 0) return;
+
+	assert(!entry->linked);
+	free(entry->key);		// key, head and body share one block
+	free(entry);
+}
+
+/*
+ * Drops every entry, e.g. after a reload changed what the handlers render.
+ */
+void cacheClear(void) {
+	while (lruTail)
+		unlinkEntry(lruTail);
+}
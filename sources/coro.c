@@ -0,0 +1,212 @@
+//
+//  coro.c
+//  CServer
+//
+//  Created by ibrahim alnakeeb on 19/10/2026.
+//
+
+#define _GNU_SOURCE
+
+#include "coro.h"
+#include "memstat.h"
+#include "metrics.h"
+#include "pool.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+struct coro {
+	ucontext_t		context;
+	ucontext_t		caller;			// where coroYield() and the end of entry() return to
+	void			(*entry)(void *arg);
+	void			(*wake)(void *arg);
+	void			*arg;
+	int				finished;
+	char			*stack;			// guard page, then stackSize usable bytes
+	struct coro		*nextFree;
+};
+
+// a call running on a pool thread while its coroutine waits
+typedef struct {
+	pool_job_t	job;
+	void		(*work)(void *arg);
+	void		*arg;
+	coro_t		*co;
+	memstat_counters_t	*counters;	// the request's, for what work() allocates and frees
+} offload_t;
+
+static size_t stackSize = CORO_STACK_DEFAULT;
+static size_t pageSize;
+static coro_t *freeCoroutines;		// finished ones, stacks kept mapped for reuse
+static __thread coro_t *current;
+
+/*
+ * Sets the stack size of the coroutines created from now on. Each stack is
+ * mapped with an inaccessible guard page below it, so an overflow faults
+ * instead of running into other memory.
+ *
+ * Parameters:
+ *   size - Usable bytes per stack, rounded up to whole pages.
+ *
+ * Returns:
+ *   1 on success, 0 if size is below one page.
+ */
+int coroInit(size_t size) {
+	pageSize = sysconf(_SC_PAGESIZE);
+	if (size < pageSize) return 0;
+
+	stackSize = (size + pageSize - 1) & ~(pageSize - 1);
+
+	// stacks of the old size are not reused
+	while (freeCoroutines) {
+		coro_t *co = freeCoroutines;
+		freeCoroutines = co->nextFree;
+		munmap(co->stack, pageSize + stackSize);
+		free(co);
+	}
+	return 1;
+}
+
+/*
+ * Returns the usable stack size of new coroutines, in bytes.
+ */
+size_t coroStackSize(void) {
+	return stackSize;
+}
+
+static void coroMain(void) {
+	coro_t *co = current;
+	co->entry(co->arg);
+	co->finished = 1;		// returning switches to co->caller through uc_link
+}
+
+/*
+ * Creates a coroutine that runs entry(arg) on its own stack once resumed,
+ * reusing the stack of a finished one when there is one.
+ *
+ * Parameters:
+ *   entry - Body of the coroutine.
+ *   wake  - Called on the event loop when a call the coroutine waits for in
+ *           coroOffload() is done; it must call coroResume().
+ *   arg   - Passed to both.
+ *
+ * Returns:
+ *   The coroutine, or NULL if no stack could be mapped.
+ */
+coro_t *coroCreate(void (*entry)(void *arg), void (*wake)(void *arg), void *arg) {
+	assert(entry != NULL && wake != NULL);
+
+	if (!pageSize) pageSize = sysconf(_SC_PAGESIZE);
+
+	coro_t *co = freeCoroutines;
+	if (co) {
+		freeCoroutines = co->nextFree;
+	} else {
+		co = calloc(1, sizeof(coro_t));
+		if (!co) return NULL;
+
+		co->stack = mmap(NULL, pageSize + stackSize, PROT_READ | PROT_WRITE,
+						 MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+		if (co->stack == MAP_FAILED || mprotect(co->stack, pageSize, PROT_NONE) != 0) {
+			perror("coroCreate() error");
+			if (co->stack != MAP_FAILED) munmap(co->stack, pageSize + stackSize);
+			free(co);
+			return NULL;
+		}
+	}
+
+	getcontext(&co->context);
+	co->context.uc_stack.ss_sp = co->stack + pageSize;
+	co->context.uc_stack.ss_size = stackSize;
+	co->context.uc_link = &co->caller;
+	makecontext(&co->context, coroMain, 0);
+
+	co->entry = entry;
+	co->wake = wake;
+	co->arg = arg;
+	co->finished = 0;
+	return co;
+}
+
+/*
+ * Runs a coroutine until it yields or returns. A finished coroutine is gone
+ * afterwards: its stack goes back to the pool.
+ *
+ * Returns:
+ *   CORO_SUSPENDED or CORO_FINISHED.
+ */
+int coroResume(coro_t *co) {
+	assert(co != NULL && !co->finished && current == NULL);
+
+	current = co;
+	swapcontext(&co->caller, &co->context);
+	current = NULL;
+
+	if (!co->finished) return CORO_SUSPENDED;
+
+	co->nextFree = freeCoroutines;
+	freeCoroutines = co;
+	return CORO_FINISHED;
+}
+
+/*
+ * Suspends the running coroutine; coroResume() continues it from here.
+ */
+void coroYield(void) {
+	coro_t *co = current;
+	assert(co != NULL);
+
+	METRIC_INC(METRIC_CORO_SUSPENDS);
+	swapcontext(&co->context, &co->caller);
+}
+
+/*
+ * Returns the running coroutine, NULL outside of one.
+ */
+coro_t *coroCurrent(void) {
+	return current;
+}
+
+static void runOffload(pool_job_t *job) {
+	offload_t *offload = container_of(job, offload_t, job);
+	memstatUse(offload->counters);
+	offload->work(offload->arg);
+	memstatUse(NULL);
+}
+
+static void offloadDone(pool_job_t *job) {
+	coro_t *co = container_of(job, offload_t, job)->co;
+	co->wake(co->arg);
+}
+
+/*
+ * Calls work(arg) on a pool thread and suspends the running coroutine until
+ * it returns, so a blocking call (file I/O) does not hold up the event loop.
+ * Outside a coroutine, or when the pool takes no job, work() runs right here.
+ *
+ * work() must not touch the request globals of httpd.h: while it runs, the
+ * event loop moves on to other requests.
+ */
+void coroOffload(void (*work)(void *arg), void *arg) {
+	assert(work != NULL);
+
+	offload_t offload = {
+		.job = { .run = runOffload, .done = offloadDone },
+		.work = work,
+		.arg = arg,
+		.co = current,
+		.counters = memstatCounters(),
+	};
+	if (!current || !poolSubmit(&offload.job)) {
+		work(arg);
+		return;
+	}
+	coroYield();
+}
@@ -0,0 +1,316 @@
+//
+//  escape.c
+//  CServer
+//
+//  Created by ibrahim alnakeeb on 19/10/2026.
+//
+
+#include "escape.h"
+
+#include <assert.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ESCAPE_X86 1
+#endif
+
+static int kernel = -1;		// chosen on first use
+
+static size_t entityLength(unsigned char c, int attribute) {
+	switch (c) {
+	case '&':	return 5;					// &amp;
+	case '<':
+	case '>':	return 4;					// &lt; &gt;
+	case '"':	return attribute ? 6 : 1;	// &quot;
+	case '\'':	return attribute ? 5 : 1;	// &#39;
+	default:	return 1;
+	}
+}
+
+static char *appendEntity(char *out, char c) {
+	const char *entity;
+	switch (c) {
+	case '&':	entity = "&amp;"; break;
+	case '<':	entity = "&lt;"; break;
+	case '>':	entity = "&gt;"; break;
+	case '"':	entity = "&quot;"; break;
+	default:	entity = "&#39;"; break;
+	}
+	size_t length = strlen(entity);
+	memcpy(out, entity, length);
+	return out + length;
+}
+
+static int isSpecial(unsigned char c, int attribute) {
+	return c == '&' || c == '<' || c == '>' || (attribute && (c == '"' || c == '\''));
+}
+
+static size_t lengthScalar(const char *src, size_t length, int attribute) {
+	size_t total = 0;
+	for (size_t i = 0; i < length; i++)
+		total += entityLength((unsigned char)src[i], attribute);
+	return total;
+}
+
+// copy each clean run in one memcpy, then the entity that ended it
+static size_t escapeScalar(char *dst, const char *src, size_t length, int attribute) {
+	char *out = dst;
+	size_t i = 0;
+	while (i < length) {
+		size_t run = i;
+		while (run < length && !isSpecial((unsigned char)src[run], attribute))
+			run++;
+		memcpy(out, src + i, run - i);
+		out += run - i;
+		if (run == length) break;
+		out = appendEntity(out, src[run]);
+		i = run + 1;
+	}
+	return out - dst;
+}
+
+#ifdef __SSE2__
+static inline __m128i specialsSse2(__m128i chunk, const __m128i *targets) {
+	return _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, targets[0]), _mm_cmpeq_epi8(chunk, targets[1])),
+						_mm_or_si128(_mm_cmpeq_epi8(chunk, targets[2]),
+									 _mm_or_si128(_mm_cmpeq_epi8(chunk, targets[3]), _mm_cmpeq_epi8(chunk, targets[4]))));
+}
+
+/*
+ * Body mode compares against '&' in place of the quotes, so both modes run
+ * the same five compares without a branch.
+ */
+static size_t lengthSse2(const char *src, size_t length, int attribute) {
+	const __m128i amp = _mm_set1_epi8('&'), lt = _mm_set1_epi8('<'), gt = _mm_set1_epi8('>');
+	const __m128i quot = _mm_set1_epi8(attribute ? '"' : '&'), apos = _mm_set1_epi8(attribute ? '\'' : '&');
+	size_t total = 0, i = 0;
+
+	for (; i + 16 <= length; i += 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i *)(src + i));
+		unsigned ampMask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, amp));
+		unsigned tagMask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, lt), _mm_cmpeq_epi8(chunk, gt)));
+		total += 16 + 4 * __builtin_popcount(ampMask) + 3 * __builtin_popcount(tagMask);
+		if (attribute)
+			total += 5 * __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, quot)))
+				   + 4 * __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, apos)));
+	}
+	return total + lengthScalar(src + i, length - i, attribute);
+}
+
+/*
+ * Stores every chunk as loaded and only backs up when it holds a special
+ * byte. The store may run past the clean part, but never past the end of
+ * the output: each byte still to come writes at least one byte. Clean text
+ * goes 64 bytes per step.
+ */
+static size_t escapeSse2(char *dst, const char *src, size_t length, int attribute) {
+	const __m128i targets[5] = {
+		_mm_set1_epi8('&'), _mm_set1_epi8('<'), _mm_set1_epi8('>'),
+		_mm_set1_epi8(attribute ? '"' : '&'), _mm_set1_epi8(attribute ? '\'' : '&'),
+	};
+	char *out = dst;
+	size_t i = 0;
+
+	while (i + 16 <= length) {
+		if (i + 64 <= length) {
+			__m128i a = _mm_loadu_si128((const __m128i *)(src + i));
+			__m128i b = _mm_loadu_si128((const __m128i *)(src + i + 16));
+			__m128i c = _mm_loadu_si128((const __m128i *)(src + i + 32));
+			__m128i d = _mm_loadu_si128((const __m128i *)(src + i + 48));
+			__m128i hit = _mm_or_si128(_mm_or_si128(specialsSse2(a, targets), specialsSse2(b, targets)),
+									   _mm_or_si128(specialsSse2(c, targets), specialsSse2(d, targets)));
+			if (!_mm_movemask_epi8(hit)) {
+				_mm_storeu_si128((__m128i *)out, a);
+				_mm_storeu_si128((__m128i *)(out + 16), b);
+				_mm_storeu_si128((__m128i *)(out + 32), c);
+				_mm_storeu_si128((__m128i *)(out + 48), d);
+				out += 64;
+				i += 64;
+				continue;
+			}
+		}
+
+		__m128i chunk = _mm_loadu_si128((const __m128i *)(src + i));
+		unsigned mask = _mm_movemask_epi8(specialsSse2(chunk, targets));
+		_mm_storeu_si128((__m128i *)out, chunk);
+		if (!mask) {
+			out += 16;
+			i += 16;
+			continue;
+		}
+		unsigned clean = __builtin_ctz(mask);
+		out = appendEntity(out + clean, src[i + clean]);
+		i += clean + 1;
+	}
+	return (out - dst) + escapeScalar(out, src + i, length - i, attribute);
+}
+#endif
+
+#ifdef ESCAPE_X86
+__attribute__((target("avx2")))
+static inline __m256i specialsAvx2(__m256i chunk, const __m256i *targets) {
+	return _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, targets[0]), _mm256_cmpeq_epi8(chunk, targets[1])),
+						   _mm256_or_si256(_mm256_cmpeq_epi8(chunk, targets[2]),
+										   _mm256_or_si256(_mm256_cmpeq_epi8(chunk, targets[3]), _mm256_cmpeq_epi8(chunk, targets[4]))));
+}
+
+__attribute__((target("avx2")))
+static size_t lengthAvx2(const char *src, size_t length, int attribute) {
+	const __m256i amp = _mm256_set1_epi8('&'), lt = _mm256_set1_epi8('<'), gt = _mm256_set1_epi8('>');
+	const __m256i quot = _mm256_set1_epi8(attribute ? '"' : '&'), apos = _mm256_set1_epi8(attribute ? '\'' : '&');
+	size_t total = 0, i = 0;
+
+	for (; i + 32 <= length; i += 32) {
+		__m256i chunk = _mm256_loadu_si256((const __m256i *)(src + i));
+		unsigned ampMask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, amp));
+		unsigned tagMask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, lt), _mm256_cmpeq_epi8(chunk, gt)));
+		total += 32 + 4 * __builtin_popcount(ampMask) + 3 * __builtin_popcount(tagMask);
+		if (attribute)
+			total += 5 * __builtin_popcount(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, quot)))
+				   + 4 * __builtin_popcount(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, apos)));
+	}
+	return total + lengthScalar(src + i, length - i, attribute);
+}
+
+// the SSE2 loop with 32-byte chunks
+__attribute__((target("avx2")))
+static size_t escapeAvx2(char *dst, const char *src, size_t length, int attribute) {
+	const __m256i targets[5] = {
+		_mm256_set1_epi8('&'), _mm256_set1_epi8('<'), _mm256_set1_epi8('>'),
+		_mm256_set1_epi8(attribute ? '"' : '&'), _mm256_set1_epi8(attribute ? '\'' : '&'),
+	};
+	char *out = dst;
+	size_t i = 0;
+
+	while (i + 32 <= length) {
+		if (i + 64 <= length) {
+			__m256i a = _mm256_loadu_si256((const __m256i *)(src + i));
+			__m256i b = _mm256_loadu_si256((const __m256i *)(src + i + 32));
+			if (_mm256_testz_si256(_mm256_or_si256(specialsAvx2(a, targets), specialsAvx2(b, targets)), _mm256_set1_epi8(-1))) {
+				_mm256_storeu_si256((__m256i *)out, a);
+				_mm256_storeu_si256((__m256i *)(out + 32), b);
+				out += 64;
+				i += 64;
+				continue;
+			}
+		}
+
+		__m256i chunk = _mm256_loadu_si256((const __m256i *)(src + i));
+		unsigned mask = _mm256_movemask_epi8(specialsAvx2(chunk, targets));
+		_mm256_storeu_si256((__m256i *)out, chunk);
+		if (!mask) {
+			out += 32;
+			i += 32;
+			continue;
+		}
+		unsigned clean = __builtin_ctz(mask);
+		out = appendEntity(out + clean, src[i + clean]);
+		i += clean + 1;
+	}
+	return (out - dst) + escapeScalar(out, src + i, length - i, attribute);
+}
+#endif
+
+/*
+ * Returns the kernel escapeHtml() uses: the widest one the CPU runs,
+ * unless escapeUseKernel() picked another.
+ */
+int escapeKernel(void) {
+	if (kernel >= 0) return kernel;
+
+	kernel = ESCAPE_KERNEL_SCALAR;
+#ifdef __SSE2__
+	kernel = ESCAPE_KERNEL_SSE2;
+#endif
+#ifdef ESCAPE_X86
+	if (__builtin_cpu_supports("avx2"))
+		kernel = ESCAPE_KERNEL_AVX2;
+#endif
+	return kernel;
+}
+
+/*
+ * Forces a kernel, e.g. ESCAPE_KERNEL_SCALAR to compare against.
+ *
+ * Returns:
+ *   1 on success, 0 if this build or CPU cannot run it.
+ */
+int escapeUseKernel(int requested) {
+	int available = 1;
+	switch (requested) {
+	case ESCAPE_KERNEL_SCALAR:
+		break;
+	case ESCAPE_KERNEL_SSE2:
+#ifndef __SSE2__
+		available = 0;
+#endif
+		break;
+	case ESCAPE_KERNEL_AVX2:
+#ifdef ESCAPE_X86
+		available = __builtin_cpu_supports("avx2");
+#else
+		available = 0;
+#endif
+		break;
+	default:
+		available = 0;
+	}
+
+	if (available) kernel = requested;
+	return available;
+}
+
+/*
+ * Returns the number of bytes escapeHtml() writes for src.
+ */
+size_t escapedLength(const char *src, size_t length, int mode) {
+	assert(src != NULL || length == 0);
+
+	if (mode == ESCAPE_RAW) return length;
+
+	int attribute = mode == ESCAPE_ATTRIBUTE;
+	switch (escapeKernel()) {
+#ifdef ESCAPE_X86
+	case ESCAPE_KERNEL_AVX2:	return lengthAvx2(src, length, attribute);
+#endif
+#ifdef __SSE2__
+	case ESCAPE_KERNEL_SSE2:	return lengthSse2(src, length, attribute);
+#endif
+	default:					return lengthScalar(src, length, attribute);
+	}
+}
+
+/*
+ * Escapes text for insertion into an HTML page. Clean runs are copied in
+ * bulk, 16 or 32 bytes per step with SSE2 or AVX2.
+ *
+ * Parameters:
+ *   dst    - Output, escapedLength(src, length, mode) bytes (must not be NULL).
+ *            It is not NUL-terminated.
+ *   src    - The text (must not be NULL).
+ *   length - Number of bytes.
+ *   mode   - ESCAPE_RAW, ESCAPE_HTML or ESCAPE_ATTRIBUTE.
+ *
+ * Returns:
+ *   The number of bytes written.
+ */
+size_t escapeHtml(char *dst, const char *src, size_t length, int mode) {
+	assert((dst != NULL && src != NULL) || length == 0);
+
+	if (mode == ESCAPE_RAW) {
+		memcpy(dst, src, length);
+		return length;
+	}
+
+	int attribute = mode == ESCAPE_ATTRIBUTE;
+	switch (escapeKernel()) {
+#ifdef ESCAPE_X86
+	case ESCAPE_KERNEL_AVX2:	return escapeAvx2(dst, src, length, attribute);
+#endif
+#ifdef __SSE2__
+	case ESCAPE_KERNEL_SSE2:	return escapeSse2(dst, src, length, attribute);
+#endif
+	default:					return escapeScalar(dst, src, length, attribute);
+	}
+}
@@ -0,0 +1,481 @@
+//
+//  form.c
+//  CServer
+//
+//  Created by ibrahim alnakeeb on 19/10/2026.
+//
+
+#define _GNU_SOURCE
+
+#include "form.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// multipart_t.state
+#define PART_PREAMBLE		0
+#define PART_DELIMITER		1			// after a delimiter: "\r\n" starts a part, "--" ends the body
+#define PART_HEADERS		2
+#define PART_BODY			3
+#define PART_DONE			4
+#define PART_ERROR			5
+
+static int hexValue(char c) {
+	if (c >= '0' && c <= '9') return c - '0';
+	c |= 0x20;
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	return -1;
+}
+
+/*
+ * Decodes "%XX" sequences and '+' in place. Runs without either are skipped
+ * (or moved down, once the output trails the input) 16 bytes at a time with
+ * SSE2 where available. Malformed escapes are kept as they are.
+ *
+ * Parameters:
+ *   data   - The encoded bytes (must not be NULL).
+ *   length - Number of bytes.
+ *
+ * Returns:
+ *   The decoded length; data is not NUL-terminated.
+ */
+size_t formDecode(char *data, size_t length) {
+	assert(data != NULL);
+
+	const char *in = data, *end = data + length;
+	char *out = data;
+
+	while (in < end) {
+#ifdef __SSE2__
+		const __m128i percent = _mm_set1_epi8('%'), plus = _mm_set1_epi8('+');
+		while (end - in >= 16) {
+			__m128i chunk = _mm_loadu_si128((const __m128i *)in);
+			int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, percent), _mm_cmpeq_epi8(chunk, plus)));
+			if (mask) {
+				int plain = __builtin_ctz(mask);
+				memmove(out, in, plain);
+				in += plain;
+				out += plain;
+				break;
+			}
+			_mm_storeu_si128((__m128i *)out, chunk);
+			in += 16;
+			out += 16;
+		}
+		if (in == end) break;
+#endif
+		int high, low;
+		if (*in == '+') {
+			*out++ = ' ';
+			in++;
+		} else if (*in == '%' && end - in >= 3 && (high = hexValue(in[1])) >= 0 && (low = hexValue(in[2])) >= 0) {
+			*out++ = (char)(high << 4 | low);
+			in += 3;
+		} else {
+			*out++ = *in++;
+		}
+	}
+	return out - data;
+}
+
+static uint32_t nameHash(const char *name, size_t length) {
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < length; i++)
+		hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+	return hash;
+}
+
+static void formReset(form_t *form) {
+	form->count = 0;
+	form->namesUsed = 0;
+	memset(form->slots, 0, sizeof(form->slots));
+}
+
+// index a field by name; a repeated name keeps pointing at its first field
+static void indexField(form_t *form, int index) {
+	const form_field_t *field = &form->fields[index];
+	uint32_t slot = nameHash(field->name, field->nameLength) & (FORM_SLOTS - 1);
+
+	while (form->slots[slot]) {
+		const form_field_t *other = &form->fields[form->slots[slot] - 1];
+		if (other->nameLength == field->nameLength && memcmp(other->name, field->name, field->nameLength) == 0)
+			return;
+		slot = (slot + 1) & (FORM_SLOTS - 1);
+	}
+	form->slots[slot] = (unsigned char)(index + 1);
+}
+
+/*
+ * Splits an application/x-www-form-urlencoded body or a query string into
+ * fields, decoding names and values in place.
+ *
+ * Parameters:
+ *   form   - Receives the fields (must not be NULL).
+ *   data   - "a=1&b=x%20y" (must not be NULL). data[length] must be writable,
+ *            e.g. the terminator of a string; '=', '&' and it are overwritten
+ *            with the fields' terminators.
+ *   length - Number of bytes, terminator excluded.
+ *
+ * Returns:
+ *   FORM_SUCCESS, or FORM_FAILED if there are more than FORM_FIELDS_MAX fields.
+ */
+int formParse(form_t *form, char *data, size_t length) {
+	assert(form != NULL && data != NULL);
+
+	formReset(form);
+	char *end = data + length;
+
+	while (data < end) {
+		char *separator = memchr(data, '&', end - data);
+		if (!separator) separator = end;
+		char *equals = memchr(data, '=', separator - data);
+		char *nameEnd = equals ? equals : separator;
+
+		// "&&" and "=x" carry no field
+		if (nameEnd > data) {
+			if (form->count == FORM_FIELDS_MAX) return FORM_FAILED;
+
+			char *value = equals ? equals + 1 : separator;
+			size_t nameLength = formDecode(data, nameEnd - data);
+			size_t valueLength = equals ? formDecode(value, separator - value) : 0;
+			data[nameLength] = '\0';
+			value[valueLength] = '\0';
+
+			form->fields[form->count] = (form_field_t){ data, nameLength, value, valueLength, NULL };
+			indexField(form, form->count++);
+		}
+		data = separator + 1;
+	}
+	return FORM_SUCCESS;
+}
+
+/*
+ * Finds a field by name in O(1).
+ *
+ * Returns:
+ *   The first field with that name, or NULL.
+ */
+const form_field_t *formField(const form_t *form, const char *name) {
+	assert(form != NULL && name != NULL);
+
+	size_t length = strlen(name);
+	uint32_t slot = nameHash(name, length) & (FORM_SLOTS - 1);
+
+	while (form->slots[slot]) {
+		const form_field_t *field = &form->fields[form->slots[slot] - 1];
+		if (field->nameLength == length && memcmp(field->name, name, length) == 0)
+			return field;
+		slot = (slot + 1) & (FORM_SLOTS - 1);
+	}
+	return NULL;
+}
+
+/*
+ * Returns the decoded value of a field, or NULL if the form does not have it.
+ */
+const char *formGet(const form_t *form, const char *name) {
+	const form_field_t *field = formField(form, name);
+	return field ? field->value : NULL;
+}
+
+// copy a multipart name into the form's own storage
+static const char *keepName(form_t *form, const char *name) {
+	size_t length = strlen(name) + 1;
+	if (form->namesUsed + length > FORM_NAMES_SIZE) return NULL;
+
+	char *copy = form->names + form->namesUsed;
+	memcpy(copy, name, length);
+	form->namesUsed += length;
+	return copy;
+}
+
+static int onFormPart(void *context, const char *name, const char *filename, const char *contentType) {
+	(void)contentType;
+	form_t *form = context;
+	if (form->count == FORM_FIELDS_MAX || !name[0]) return 0;
+
+	form_field_t *field = &form->fields[form->count];
+	*field = (form_field_t){ keepName(form, name), strlen(name), NULL, 0, NULL };
+	if (filename)
+		field->filename = keepName(form, filename);
+	return field->name && (!filename || field->filename);
+}
+
+// a single feed hands each part's data over in one piece
+static int onFormData(void *context, const char *data, size_t length) {
+	form_t *form = context;
+	form_field_t *field = &form->fields[form->count];
+	if (field->value && field->value + field->valueLength != data) return 0;
+
+	if (!field->value) field->value = data;
+	field->valueLength += length;
+	return 1;
+}
+
+static int onFormPartEnd(void *context) {
+	form_t *form = context;
+	form_field_t *field = &form->fields[form->count];
+
+	// the delimiter's CR follows the value in the caller's writable body
+	if (field->value) ((char *)field->value)[field->valueLength] = '\0';
+	else field->value = "";
+
+	indexField(form, form->count++);
+	return 1;
+}
+
+/*
+ * Splits a complete multipart/form-data body into fields without copying
+ * the values: each points into body and is NUL-terminated over the CR of
+ * the delimiter after it.
+ *
+ * Parameters:
+ *   form        - Receives the fields (must not be NULL).
+ *   body        - The request body (must not be NULL).
+ *   length      - Number of bytes.
+ *   contentType - The Content-Type header carrying the boundary (must not be NULL).
+ *
+ * Returns:
+ *   FORM_SUCCESS, or FORM_FAILED on a malformed or truncated body, or one
+ *   with too many fields.
+ */
+int formParseMultipart(form_t *form, char *body, size_t length, const char *contentType) {
+	assert(form != NULL && body != NULL && contentType != NULL);
+
+	static const multipart_callbacks_t callbacks = { onFormPart, onFormData, onFormPartEnd };
+	multipart_t parser;
+
+	formReset(form);
+	if (!multipartInit(&parser, contentType, &callbacks, form)) return FORM_FAILED;
+	return multipartFeed(&parser, body, length) == MULTIPART_DONE ? FORM_SUCCESS : FORM_FAILED;
+}
+
+/*
+ * Parses a request body according to its Content-Type: multipart/form-data,
+ * or application/x-www-form-urlencoded otherwise (contentType may be NULL).
+ */
+int formParseBody(form_t *form, char *body, size_t length, const char *contentType) {
+	if (contentType && strncasecmp(contentType, "multipart/form-data", 19) == 0)
+		return formParseMultipart(form, body, length, contentType);
+	return formParse(form, body, length);
+}
+
+// value of a "key=value" or key="value" parameter in a header, copied into out
+static int headerParameter(const char *header, const char *key, char *out, size_t size) {
+	size_t keyLength = strlen(key);
+
+	for (const char *p = strchr(header, ';'); p; p = strchr(p, ';')) {
+		p++;
+		while (*p == ' ' || *p == '\t') p++;
+		if (strncasecmp(p, key, keyLength) != 0 || p[keyLength] != '=') continue;
+
+		const char *value = p + keyLength + 1;
+		const char *end;
+		if (*value == '"') {
+			end = strchr(++value, '"');
+			if (!end) return 0;
+		} else {
+			end = value + strcspn(value, "; \t");
+		}
+		if ((size_t)(end - value) >= size) return 0;
+		memcpy(out, value, end - value);
+		out[end - value] = '\0';
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * Prepares a streaming multipart/form-data parser.
+ *
+ * Parameters:
+ *   parser      - The parser state (must not be NULL).
+ *   contentType - The Content-Type header, e.g. "multipart/form-data; boundary=x" (must not be NULL).
+ *   callbacks   - Receives the parts (must not be NULL).
+ *   context     - Passed to the callbacks.
+ *
+ * Returns:
+ *   1 on success, 0 if the header has no valid boundary.
+ */
+int multipartInit(multipart_t *parser, const char *contentType, const multipart_callbacks_t *callbacks, void *context) {
+	assert(parser != NULL && contentType != NULL && callbacks != NULL);
+
+	char boundary[MULTIPART_BOUNDARY_MAX + 1];
+	if (!headerParameter(contentType, "boundary", boundary, sizeof(boundary)) || !boundary[0])
+		return 0;
+
+	parser->delimiterLength = snprintf(parser->delimiter, sizeof(parser->delimiter), "\r\n--%s", boundary);
+	parser->callbacks = callbacks;
+	parser->context = context;
+	parser->lineLength = 0;
+
+	// the first delimiter may open the body without a CRLF before it
+	parser->state = PART_PREAMBLE;
+	memcpy(parser->held, "\r\n", 2);
+	parser->heldLength = 2;
+	return 1;
+}
+
+static int fail(multipart_t *parser) {
+	parser->state = PART_ERROR;
+	return MULTIPART_ERROR;
+}
+
+// pick the name, filename and type out of one part header line
+static int partHeader(multipart_t *parser, const char *line) {
+	if (strncasecmp(line, "Content-Disposition:", 20) == 0) {
+		if (!headerParameter(line, "name", parser->name, sizeof(parser->name)))
+			return 0;
+		if (!headerParameter(line, "filename", parser->filename, sizeof(parser->filename)))
+			parser->filename[0] = '\0';
+	} else if (strncasecmp(line, "Content-Type:", 13) == 0) {
+		line += 13 + strspn(line + 13, " \t");
+		if (strlen(line) >= sizeof(parser->contentType)) return 0;
+		strcpy(parser->contentType, line);
+	}
+	return 1;
+}
+
+/*
+ * Consumes preamble or part data up to the next delimiter, passing part data
+ * on as views into the buffer. A possible delimiter prefix at the end of the
+ * buffer is held back until the next feed tells.
+ *
+ * Returns:
+ *   1 if a delimiter was consumed, 0 if the buffer ran out, -1 on a callback abort.
+ */
+static int scanBody(multipart_t *parser, const char **data, size_t *length) {
+	int emit = parser->state == PART_BODY;
+	const multipart_callbacks_t *callbacks = parser->callbacks;
+
+	if (parser->heldLength) {
+		size_t missing = parser->delimiterLength - parser->heldLength;
+		size_t n = missing < *length ? missing : *length;
+		if (memcmp(*data, parser->delimiter + parser->heldLength, n) == 0) {
+			*data += n;
+			*length -= n;
+			if (n < missing) {
+				memcpy(parser->held + parser->heldLength, *data - n, n);
+				parser->heldLength += n;
+				return 0;
+			}
+			parser->heldLength = 0;
+			return 1;
+		}
+
+		// the boundary has no CR, so no delimiter starts inside the held bytes
+		if (emit && !callbacks->onData(parser->context, parser->held, parser->heldLength)) return -1;
+		parser->heldLength = 0;
+	}
+
+	const char *found = memmem(*data, *length, parser->delimiter, parser->delimiterLength);
+	if (found) {
+		if (emit && found > *data && !callbacks->onData(parser->context, *data, found - *data)) return -1;
+		*length -= found + parser->delimiterLength - *data;
+		*data = found + parser->delimiterLength;
+		return 1;
+	}
+
+	size_t keep = parser->delimiterLength - 1 < *length ? parser->delimiterLength - 1 : *length;
+	for (; keep > 0; keep--)
+		if (memcmp(*data + *length - keep, parser->delimiter, keep) == 0)
+			break;
+
+	if (emit && *length > keep && !callbacks->onData(parser->context, *data, *length - keep)) return -1;
+	memcpy(parser->held, *data + *length - keep, keep);
+	parser->heldLength = keep;
+	*data += *length;
+	*length = 0;
+	return 0;
+}
+
+/*
+ * Feeds the next piece of a multipart/form-data body to the parser.
+ *
+ * Parameters:
+ *   parser - A parser set up by multipartInit() (must not be NULL).
+ *   data   - The bytes; views passed to onData() point into them.
+ *   length - Number of bytes.
+ *
+ * Returns:
+ *   MULTIPART_MORE if the body continues, MULTIPART_DONE once the closing
+ *   delimiter was seen (the epilogue is ignored), or MULTIPART_ERROR on a
+ *   malformed body or when a callback returned 0.
+ */
+int multipartFeed(multipart_t *parser, const char *data, size_t length) {
+	assert(parser != NULL && (data != NULL || length == 0));
+
+	const multipart_callbacks_t *callbacks = parser->callbacks;
+
+	while (length > 0 && parser->state != PART_DONE) {
+		switch (parser->state) {
+		case PART_PREAMBLE:
+		case PART_BODY: {
+			int found = scanBody(parser, &data, &length);
+			if (found < 0) return fail(parser);
+			if (!found) break;
+			if (parser->state == PART_BODY && !callbacks->onPartEnd(parser->context)) return fail(parser);
+			parser->state = PART_DELIMITER;
+			parser->lineLength = 0;
+			break;
+		}
+
+		case PART_DELIMITER:
+			parser->line[parser->lineLength++] = *data++;
+			length--;
+			if (parser->lineLength < 2) break;
+
+			if (memcmp(parser->line, "--", 2) == 0) {
+				parser->state = PART_DONE;
+			} else if (memcmp(parser->line, "\r\n", 2) == 0) {
+				parser->state = PART_HEADERS;
+				parser->name[0] = parser->filename[0] = parser->contentType[0] = '\0';
+			} else {
+				return fail(parser);
+			}
+			parser->lineLength = 0;
+			break;
+
+		case PART_HEADERS: {
+			const char *newline = memchr(data, '\n', length);
+			size_t take = newline ? (size_t)(newline - data) + 1 : length;
+			if (parser->lineLength + take > MULTIPART_LINE_MAX) return fail(parser);
+
+			memcpy(parser->line + parser->lineLength, data, take);
+			parser->lineLength += take;
+			data += take;
+			length -= take;
+			if (!newline) break;
+
+			if (parser->lineLength < 2 || parser->line[parser->lineLength - 2] != '\r') return fail(parser);
+			parser->line[parser->lineLength - 2] = '\0';
+
+			// a blank line ends the headers
+			if (parser->lineLength == 2) {
+				if (!callbacks->onPart(parser->context, parser->name,
+						parser->filename[0] ? parser->filename : NULL,
+						parser->contentType[0] ? parser->contentType : NULL))
+					return fail(parser);
+				parser->state = PART_BODY;
+			} else if (!partHeader(parser, parser->line)) {
+				return fail(parser);
+			}
+			parser->lineLength = 0;
+			break;
+		}
+
+		default:
+			return MULTIPART_ERROR;
+		}
+	}
+
+	if (parser->state == PART_ERROR) return MULTIPART_ERROR;
+	return parser->state == PART_DONE ? MULTIPART_DONE : MULTIPART_MORE;
+}
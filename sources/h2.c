@@ -0,0 +1,1405 @@
+//
+//  h2.c
+//  CServer
+//
+//  Created by ibrahim alnakeeb on 19/10/2026.
+//
+
+#define _GNU_SOURCE
+
+#include "h2.h"
+#include "metrics.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+// frame types (RFC 9113 section 6, PRIORITY_UPDATE from RFC 9218)
+#define FRAME_DATA				0x0
+#define FRAME_HEADERS			0x1
+#define FRAME_PRIORITY			0x2
+#define FRAME_RST_STREAM		0x3
+#define FRAME_SETTINGS			0x4
+#define FRAME_PUSH_PROMISE		0x5
+#define FRAME_PING				0x6
+#define FRAME_GOAWAY			0x7
+#define FRAME_WINDOW_UPDATE		0x8
+#define FRAME_CONTINUATION		0x9
+#define FRAME_PRIORITY_UPDATE	0x10
+
+#define FLAG_END_STREAM			0x1
+#define FLAG_ACK				0x1
+#define FLAG_END_HEADERS		0x4
+#define FLAG_PADDED				0x8
+#define FLAG_PRIORITY			0x20
+
+#define SETTINGS_HEADER_TABLE_SIZE		0x1
+#define SETTINGS_ENABLE_PUSH			0x2
+#define SETTINGS_MAX_CONCURRENT_STREAMS	0x3
+#define SETTINGS_INITIAL_WINDOW_SIZE	0x4
+#define SETTINGS_MAX_FRAME_SIZE			0x5
+
+#define ERROR_NO_ERROR			0x0
+#define ERROR_PROTOCOL			0x1
+#define ERROR_INTERNAL			0x2
+#define ERROR_FLOW_CONTROL		0x3
+#define ERROR_STREAM_CLOSED		0x5
+#define ERROR_FRAME_SIZE		0x6
+#define ERROR_REFUSED_STREAM	0x7
+#define ERROR_COMPRESSION		0x9
+
+#define FRAME_HEADER		9
+#define FRAME_SIZE_DEFAULT	16384			// until the client allows more; the most we take, too
+#define FRAME_SIZE_LIMIT	16777215
+#define WINDOW_DEFAULT		65535
+#define WINDOW_LIMIT		0x7fffffff
+#define TABLE_SIZE			4096			// HPACK dynamic table, each direction
+#define ENTRY_OVERHEAD		32
+#define TABLE_ENTRIES		(TABLE_SIZE / ENTRY_OVERHEAD)
+#define BLOCK_MAX			(64 * 1024)		// a header block with its CONTINUATION frames
+#define OUTPUT_AHEAD		(64 * 1024)		// DATA scheduled at once, so priorities still apply to the rest
+#define URGENCY_DEFAULT		3
+
+// stream states
+#define STREAM_RECEIVING	0	// the request is arriving
+#define STREAM_WAITING		1	// the server has the request (half-closed remote)
+#define STREAM_SENDING		2	// the response's DATA goes out as the windows allow
+
+static const char upgradeResponse[] =
+	"HTTP/1.1 101 Switching Protocols\r\n"
+	"Connection: Upgrade\r\n"
+	"Upgrade: h2c\r\n"
+	"\r\n";
+
+typedef struct {
+	char	*data;
+	size_t	length, capacity;
+} buffer_t;
+
+// HPACK dynamic table, newest entry first; name and value share one allocation
+typedef struct {
+	char	*name, *value;
+	size_t	nameLength, valueLength;
+} field_t;
+
+typedef struct {
+	field_t	entries[TABLE_ENTRIES];
+	int		count;
+	size_t	size, max;
+} table_t;
+
+typedef struct h2_stream {
+	struct h2_stream	*next;
+	uint32_t			id;
+	int					state;
+	int					urgency;		// RFC 9218: 0 goes first, 7 last
+	int					incremental;	// shares the bandwidth with its urgency's other responses
+	int					prioritized;	// by the priority field, which a PRIORITY weight does not override
+	int64_t				window;			// response bytes the client takes now; negative after it shrank
+	size_t				received;		// request DATA since the stream's last WINDOW_UPDATE
+	char				method[16];
+	buffer_t			path, authority, cookie;
+	buffer_t			head;			// the request's HTTP/1.1 head
+	buffer_t			body;			// its body
+	int					fields;			// a regular field came, so no more pseudo-fields
+	int					host;			// a host field came
+	int					malformed;
+	int					oversized;
+	char				*response;		// STREAM_SENDING: the server's response
+	const char			*data;			// its body
+	size_t				dataLength, sent;
+	uint64_t			served;			// when an incremental response last got a frame
+} h2_stream_t;
+
+struct h2_session {
+	h2_request_fn	onRequest;
+	void			*owner;
+	int				streamsMax;			// SETTINGS_MAX_CONCURRENT_STREAMS
+	int				window;				// SETTINGS_INITIAL_WINDOW_SIZE, also the connection's
+	size_t			requestMax;
+	int				preface;			// bytes of the client preface seen
+	int				settings;			// the client's first frame, SETTINGS, arrived
+	buffer_t		input;				// a partial frame
+	buffer_t		block;				// header block, until END_HEADERS
+	uint32_t		blockStream;		// its stream, 0 when none is arriving
+	int				blockFlags;
+	int				blockWeight;		// of the HEADERS frame's priority, 0 without
+	table_t			decoder, encoder;
+	int				resized;			// the encoder's table shrank: the next block says so
+	h2_stream_t		*streams;
+	int				streamCount;
+	int				busy;				// streams waiting for the server's response
+	uint32_t		lastStream;			// highest stream the client opened
+	int64_t			sendWindow;			// connection window of the responses
+	int64_t			initialWindow;		// the client's SETTINGS_INITIAL_WINDOW_SIZE
+	size_t			frameSize;			// the client's SETTINGS_MAX_FRAME_SIZE
+	size_t			received;			// DATA since the connection's last WINDOW_UPDATE
+	buffer_t		output[2];			// the one given to h2Output(), and the one filling
+	int				sending;			// index of the first
+	uint64_t		clock;				// DATA frames scheduled
+	int				goaway;				// sent
+	int				peerGoaway;
+	int				failed;				// connection error: GOAWAY is out, input is ignored
+};
+
+static const struct { const char *name, *value; } staticTable[] = {
+	{ NULL, NULL },
+	{ ":authority", "" }, { ":method", "GET" }, { ":method", "POST" }, { ":path", "/" },
+	{ ":path", "/index.html" }, { ":scheme", "http" }, { ":scheme", "https" }, { ":status", "200" },
+	{ ":status", "204" }, { ":status", "206" }, { ":status", "304" }, { ":status", "400" },
+	{ ":status", "404" }, { ":status", "500" }, { "accept-charset", "" }, { "accept-encoding", "gzip, deflate" },
+	{ "accept-language", "" }, { "accept-ranges", "" }, { "accept", "" }, { "access-control-allow-origin", "" },
+	{ "age", "" }, { "allow", "" }, { "authorization", "" }, { "cache-control", "" },
+	{ "content-disposition", "" }, { "content-encoding", "" }, { "content-language", "" }, { "content-length", "" },
+	{ "content-location", "" }, { "content-range", "" }, { "content-type", "" }, { "cookie", "" },
+	{ "date", "" }, { "etag", "" }, { "expect", "" }, { "expires", "" },
+	{ "from", "" }, { "host", "" }, { "if-match", "" }, { "if-modified-since", "" },
+	{ "if-none-match", "" }, { "if-range", "" }, { "if-unmodified-since", "" }, { "last-modified", "" },
+	{ "link", "" }, { "location", "" }, { "max-forwards", "" }, { "proxy-authenticate", "" },
+	{ "proxy-authorization", "" }, { "range", "" }, { "referer", "" }, { "refresh", "" },
+	{ "retry-after", "" }, { "server", "" }, { "set-cookie", "" }, { "strict-transport-security", "" },
+	{ "transfer-encoding", "" }, { "user-agent", "" }, { "vary", "" }, { "via", "" },
+	{ "www-authenticate", "" },
+};
+
+#define STATIC_ENTRIES	((int)(sizeof(staticTable) / sizeof(staticTable[0])) - 1)
+
+// bits of each symbol's code (RFC 7541 appendix B); the code is canonical,
+// so the codes themselves follow from the lengths
+static const unsigned char huffmanLengths[257] = {
+	13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+	28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+	6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+	5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+	13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+	7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+	15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+	6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+	20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+	24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+	22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+	21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+	26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+	19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+	20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+	26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+	30,
+};
+
+#define HUFFMAN_EOS		256
+#define HUFFMAN_BITS	30
+
+static uint16_t huffmanSymbols[257];				// by code length, then by symbol
+static uint32_t huffmanFirst[HUFFMAN_BITS + 1];		// code of the first symbol of each length
+static uint16_t huffmanCount[HUFFMAN_BITS + 1], huffmanOffset[HUFFMAN_BITS + 1];
+
+// the canonical decoding tables, once
+static void huffmanInit(void) {
+	if (huffmanCount[huffmanLengths[0]]) return;
+
+	for (int symbol = 0; symbol <= HUFFMAN_EOS; symbol++)
+		huffmanCount[huffmanLengths[symbol]]++;
+	uint32_t code = 0;
+	for (int bits = 1, offset = 0; bits <= HUFFMAN_BITS; bits++) {
+		huffmanFirst[bits] = code;
+		huffmanOffset[bits] = offset;
+		code = (code + huffmanCount[bits]) << 1;
+		offset += huffmanCount[bits];
+	}
+	uint16_t next[HUFFMAN_BITS + 1];
+	memcpy(next, huffmanOffset, sizeof(next));
+	for (int symbol = 0; symbol <= HUFFMAN_EOS; symbol++)
+		huffmanSymbols[next[huffmanLengths[symbol]]++] = symbol;
+}
+
+static int reserve(buffer_t *b, size_t more) {
+	if (b->length + more <= b->capacity) return 1;
+	size_t capacity = b->capacity ? b->capacity : 256;
+	while (capacity < b->length + more)
+		capacity *= 2;
+	char *data = realloc(b->data, capacity);
+	if (!data) return 0;
+	b->data = data;
+	b->capacity = capacity;
+	return 1;
+}
+
+static int append(buffer_t *b, const void *data, size_t length) {
+	if (!reserve(b, length)) return 0;
+	if (length) memcpy(b->data + b->length, data, length);
+	b->length += length;
+	return 1;
+}
+
+static void release(buffer_t *b) {
+	free(b->data);
+	*b = (buffer_t){ 0 };
+}
+
+/*
+ * Decodes Huffman-coded string bytes onto out: the code is read a bit at a
+ * time, and a code of n bits is a symbol once it falls in the range of the
+ * n-bit codes.
+ *
+ * Returns:
+ *   1 on success, 0 on EOS in the string or padding other than up to 7 one bits.
+ */
+static int huffmanDecode(const unsigned char *data, size_t length, buffer_t *out) {
+	uint32_t code = 0;
+	int bits = 0;
+	for (size_t i = 0; i < length; i++) {
+		for (int bit = 7; bit >= 0; bit--) {
+			code = code << 1 | (data[i] >> bit & 1);
+			bits++;
+			if (code - huffmanFirst[bits] < huffmanCount[bits]) {
+				uint16_t symbol = huffmanSymbols[huffmanOffset[bits] + code - huffmanFirst[bits]];
+				char c = (char)symbol;
+				if (symbol == HUFFMAN_EOS || !append(out, &c, 1)) return 0;
+				code = 0;
+				bits = 0;
+			} else if (bits == HUFFMAN_BITS) {
+				return 0;
+			}
+		}
+	}
+	return bits <= 7 && code == (1u << bits) - 1;
+}
+
+// an HPACK integer with a prefix of bits; 0 if it runs past end or grows past 2^28
+static int decodeInteger(const unsigned char **p, const unsigned char *end, int bits, uint32_t *value) {
+	uint32_t max = (1u << bits) - 1;
+	uint32_t v = *(*p)++ & max;
+	if (v == max) {
+		unsigned char byte;
+		int shift = 0;
+		do {
+			if (*p == end || shift > 21) return 0;
+			byte = *(*p)++;
+			v += (uint32_t)(byte & 0x7f) << shift;
+			shift += 7;
+		} while (byte & 0x80);
+	}
+	*value = v;
+	return 1;
+}
+
+// a string literal onto out, decoded
+static int decodeString(const unsigned char **p, const unsigned char *end, buffer_t *out) {
+	if (*p == end) return 0;
+	int huffman = **p & 0x80;
+	uint32_t length;
+	if (!decodeInteger(p, end, 7, &length) || length > (size_t)(end - *p)) return 0;
+	const unsigned char *data = *p;
+	*p += length;
+	return huffman ? huffmanDecode(data, length, out) : append(out, data, length);
+}
+
+static int encodeInteger(buffer_t *b, unsigned char first, int bits, size_t value) {
+	unsigned char bytes[12];
+	int n = 0;
+	size_t max = (1u << bits) - 1;
+	if (value < max) {
+		bytes[n++] = first | value;
+	} else {
+		bytes[n++] = first | max;
+		for (value -= max; value >= 128; value >>= 7)
+			bytes[n++] = (value & 0x7f) | 0x80;
+		bytes[n++] = value;
+	}
+	return append(b, bytes, n);
+}
+
+// as it is: responses are short-lived, Huffman coding them is not worth the time
+static int encodeString(buffer_t *b, const char *data, size_t length) {
+	return encodeInteger(b, 0x00, 7, length) && append(b, data, length);
+}
+
+static void tableEvict(table_t *t, size_t max) {
+	while (t->size > max) {
+		field_t *oldest = &t->entries[--t->count];
+		t->size -= oldest->nameLength + oldest->valueLength + ENTRY_OVERHEAD;
+		free(oldest->name);
+	}
+}
+
+// an entry larger than the whole table empties it, which is not an error
+static int tableAdd(table_t *t, const char *name, size_t nameLength, const char *value, size_t valueLength) {
+	size_t size = nameLength + valueLength + ENTRY_OVERHEAD;
+	if (size > t->max) {
+		tableEvict(t, 0);
+		return 1;
+	}
+	tableEvict(t, t->max - size);
+
+	char *copy = malloc(nameLength + valueLength + 1);
+	if (!copy) return 0;
+	memcpy(copy, name, nameLength);
+	memcpy(copy + nameLength, value, valueLength);
+	memmove(t->entries + 1, t->entries, t->count * sizeof(field_t));
+	t->entries[0] = (field_t){ copy, copy + nameLength, nameLength, valueLength };
+	t->count++;
+	t->size += size;
+	return 1;
+}
+
+// field of an HPACK index, static entries first; 0 if there is none
+static int tableGet(const table_t *t, uint32_t index, const char **name, size_t *nameLength,
+					const char **value, size_t *valueLength) {
+	if (index >= 1 && index <= (uint32_t)STATIC_ENTRIES) {
+		*name = staticTable[index].name;
+		*nameLength = strlen(*name);
+		*value = staticTable[index].value;
+		*valueLength = strlen(*value);
+		return 1;
+	}
+	if (index <= (uint32_t)STATIC_ENTRIES || index - STATIC_ENTRIES > (uint32_t)t->count)
+		return 0;
+	const field_t *entry = &t->entries[index - STATIC_ENTRIES - 1];
+	*name = entry->name;
+	*nameLength = entry->nameLength;
+	*value = entry->value;
+	*valueLength = entry->valueLength;
+	return 1;
+}
+
+static h2_stream_t *findStream(h2_session_t *h2, uint32_t id) {
+	for (h2_stream_t *s = h2->streams; s; s = s->next)
+		if (s->id == id)
+			return s;
+	return NULL;
+}
+
+static void removeStream(h2_session_t *h2, h2_stream_t *stream) {
+	h2_stream_t **link = &h2->streams;
+	while (*link != stream)
+		link = &(*link)->next;
+	*link = stream->next;
+
+	if (stream->state == STREAM_WAITING)
+		h2->busy--;
+	h2->streamCount--;
+	release(&stream->path);
+	release(&stream->authority);
+	release(&stream->cookie);
+	release(&stream->head);
+	release(&stream->body);
+	free(stream->response);
+	free(stream);
+}
+
+static h2_stream_t *openStream(h2_session_t *h2, uint32_t id) {
+	h2_stream_t *stream = calloc(1, sizeof(h2_stream_t));
+	if (!stream) return NULL;
+	stream->id = id;
+	stream->urgency = URGENCY_DEFAULT;
+	stream->window = h2->initialWindow;
+	stream->next = h2->streams;
+	h2->streams = stream;
+	h2->streamCount++;
+	return stream;
+}
+
+// frames go to the output being filled; out of memory, the session fails for good
+static void writeFrame(h2_session_t *h2, int type, int flags, uint32_t stream, const void *payload, size_t length) {
+	unsigned char header[FRAME_HEADER] = {
+		length >> 16, length >> 8, length, type, flags,
+		(stream >> 24) & 0x7f, stream >> 16, stream >> 8, stream,
+	};
+	buffer_t *out = &h2->output[!h2->sending];
+	if (!reserve(out, FRAME_HEADER + length)) {
+		h2->failed = 1;
+		return;
+	}
+	append(out, header, FRAME_HEADER);
+	append(out, payload, length);
+}
+
+static void writeUint32(unsigned char *p, uint32_t value) {
+	p[0] = value >> 24;
+	p[1] = value >> 16;
+	p[2] = value >> 8;
+	p[3] = value;
+}
+
+static uint32_t readUint32(const unsigned char *p) {
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static void writeWindowUpdate(h2_session_t *h2, uint32_t stream, uint32_t increment) {
+	unsigned char payload[4];
+	writeUint32(payload, increment);
+	writeFrame(h2, FRAME_WINDOW_UPDATE, 0, stream, payload, sizeof(payload));
+}
+
+// a header block in HEADERS and as many CONTINUATION frames as the client's frame size needs
+static void writeHeaders(h2_session_t *h2, uint32_t stream, const buffer_t *block, int endStream) {
+	size_t offset = 0;
+	do {
+		size_t length = block->length - offset < h2->frameSize ? block->length - offset : h2->frameSize;
+		int last = offset + length == block->length;
+		writeFrame(h2, offset ? FRAME_CONTINUATION : FRAME_HEADERS,
+				   (last ? FLAG_END_HEADERS : 0) | (!offset && endStream ? FLAG_END_STREAM : 0),
+				   stream, block->data + offset, length);
+		offset += length;
+	} while (offset < block->length);
+}
+
+// the stream ends here, whatever state it was in
+static void resetStream(h2_session_t *h2, uint32_t id, uint32_t code) {
+	unsigned char payload[4];
+	writeUint32(payload, code);
+	writeFrame(h2, FRAME_RST_STREAM, 0, id, payload, sizeof(payload));
+
+	h2_stream_t *stream = findStream(h2, id);
+	if (stream)
+		removeStream(h2, stream);
+}
+
+// connection error: GOAWAY with the code, then the server closes once it is out
+static void fail(h2_session_t *h2, uint32_t code) {
+	if (h2->failed) return;
+	unsigned char payload[8];
+	writeUint32(payload, h2->lastStream);
+	writeUint32(payload + 4, code);
+	writeFrame(h2, FRAME_GOAWAY, 0, 0, payload, sizeof(payload));
+	h2->failed = 1;
+	h2->goaway = 1;
+}
+
+// connection-specific fields, which HTTP/2 does without (and a response leaves out)
+static int hopByHop(const char *name, size_t length) {
+	static const char *const names[] = { "connection", "keep-alive", "proxy-connection", "transfer-encoding", "upgrade" };
+	for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+		if (length == strlen(names[i]) && strncasecmp(name, names[i], length) == 0)
+			return 1;
+	return 0;
+}
+
+/*
+ * Applies the priority field (RFC 9218): "u=N" for the urgency, 0 to 7, and
+ * "i" for an incremental response. Parameters of the members are ignored.
+ */
+static void parsePriority(h2_stream_t *stream, const char *value, size_t length) {
+	const char *p = value, *end = value + length;
+	stream->urgency = URGENCY_DEFAULT;
+	stream->incremental = 0;
+	stream->prioritized = 1;
+
+	while (p < end) {
+		while (p < end && (*p == ' ' || *p == '\t' || *p == ','))
+			p++;
+		const char *member = p;
+		while (p < end && *p != ',' && *p != ';' && *p != ' ')
+			p++;
+		size_t n = p - member;
+		if (n == 3 && member[0] == 'u' && member[1] == '=' && member[2] >= '0' && member[2] <= '7')
+			stream->urgency = member[2] - '0';
+		else if ((n == 1 && member[0] == 'i') || (n == 4 && memcmp(member, "i=?1", 4) == 0))
+			stream->incremental = 1;
+		while (p < end && *p != ',')
+			p++;
+	}
+}
+
+// an RFC 7540 weight (1 to 256) as an urgency: 16, the default, is 3; each doubling one more urgent
+static void applyWeight(h2_stream_t *stream, int weight) {
+	if (stream->prioritized) return;
+	int urgency = 7;
+	for (int w = weight; w > 1 && urgency > 0; w >>= 1)
+		urgency--;
+	stream->urgency = urgency;
+}
+
+// append "Content-Type: " for "content-type", the way handlers look fields up
+static int appendFieldName(buffer_t *b, const char *name, size_t length) {
+	if (!reserve(b, length)) return 0;
+	for (size_t i = 0; i < length; i++)
+		b->data[b->length + i] = i == 0 || name[i - 1] == '-' ? (char)(name[i] & ~0x20) : name[i];
+	b->length += length;
+	return 1;
+}
+
+/*
+ * Takes a decoded field of a request's header block. Pseudo-fields make the
+ * request line; the others become HTTP/1.1 header lines, cookie crumbs one
+ * Cookie line. A malformed request (RFC 9113 section 8.2) is noted, to reset
+ * its stream once the block is decoded.
+ */
+static void addField(h2_session_t *h2, h2_stream_t *stream, const char *name, size_t nameLength,
+					 const char *value, size_t valueLength) {
+	if (nameLength == 0)
+		stream->malformed = 1;
+	for (size_t i = 0; i < valueLength; i++)
+		if (value[i] == '\r' || value[i] == '\n' || value[i] == '\0')
+			stream->malformed = 1;
+	for (size_t i = 1; i < nameLength; i++)
+		if ((name[i] >= 'A' && name[i] <= 'Z') || name[i] <= ' ' || name[i] == ':' || name[i] == 0x7f)
+			stream->malformed = 1;
+	if (stream->malformed || (name[0] >= 'A' && name[0] <= 'Z') || name[0] <= ' ') {
+		stream->malformed = 1;
+		return;
+	}
+
+	if (name[0] == ':') {
+		buffer_t *target = NULL;
+		if (stream->fields)
+			stream->malformed = 1;
+		else if (nameLength == 7 && memcmp(name, ":method", 7) == 0) {
+			if (valueLength == 0 || valueLength >= sizeof(stream->method)) stream->malformed = 1;
+			else memcpy(stream->method, value, valueLength);
+		} else if (nameLength == 5 && memcmp(name, ":path", 5) == 0)
+			target = &stream->path;
+		else if (nameLength == 10 && memcmp(name, ":authority", 10) == 0)
+			target = &stream->authority;
+		else if (!(nameLength == 7 && memcmp(name, ":scheme", 7) == 0))
+			stream->malformed = 1;
+		if (target && (target->length || !append(target, value, valueLength)))
+			stream->malformed = 1;
+		return;
+	}
+
+	stream->fields = 1;
+	if (hopByHop(name, nameLength)
+		|| (nameLength == 2 && memcmp(name, "te", 2) == 0 && !(valueLength == 8 && memcmp(value, "trailers", 8) == 0))) {
+		stream->malformed = 1;
+		return;
+	}
+	if (nameLength == 2 && memcmp(name, "te", 2) == 0)
+		return;
+	if (nameLength == 14 && memcmp(name, "content-length", 14) == 0)
+		return;			// the request gets its own, once the body is in
+	if (nameLength == 8 && memcmp(name, "priority", 8) == 0)
+		parsePriority(stream, value, valueLength);
+	if (nameLength == 4 && memcmp(name, "host", 4) == 0)
+		stream->host = 1;
+
+	if (stream->head.length + stream->cookie.length + nameLength + valueLength + 4 > h2->requestMax) {
+		stream->oversized = 1;
+		return;
+	}
+	if (nameLength == 6 && memcmp(name, "cookie", 6) == 0) {
+		if ((stream->cookie.length && !append(&stream->cookie, "; ", 2)) || !append(&stream->cookie, value, valueLength))
+			stream->oversized = 1;
+		return;
+	}
+	if (!appendFieldName(&stream->head, name, nameLength) || !append(&stream->head, ": ", 2)
+		|| !append(&stream->head, value, valueLength) || !append(&stream->head, "\r\n", 2))
+		stream->oversized = 1;
+}
+
+/*
+ * Decodes a complete header block, updating the dynamic table whether or not
+ * the fields are wanted: stream is NULL for a refused or closed stream, and
+ * for trailers.
+ *
+ * Returns:
+ *   1 on success, 0 on a compression error.
+ */
+static int decodeBlock(h2_session_t *h2, h2_stream_t *stream, const unsigned char *p, const unsigned char *end) {
+	buffer_t field = { 0 };
+	int fields = 0, ok = 1;
+
+	while (ok && p < end) {
+		uint32_t index;
+		unsigned char first = *p;
+
+		// dynamic table size update, only ahead of the fields
+		if ((first & 0xe0) == 0x20) {
+			ok = !fields && decodeInteger(&p, end, 5, &index) && index <= TABLE_SIZE;
+			if (ok) {
+				h2->decoder.max = index;
+				tableEvict(&h2->decoder, index);
+			}
+			continue;
+		}
+
+		const char *name, *value;
+		size_t nameLength, valueLength;
+		fields++;
+		field.length = 0;
+		if (first & 0x80) {
+			ok = decodeInteger(&p, end, 7, &index) && tableGet(&h2->decoder, index, &name, &nameLength, &value, &valueLength);
+		} else {
+			// literal: incremental indexing (01), without indexing (0000) or never indexed (0001)
+			int indexing = (first & 0xc0) == 0x40;
+			ok = decodeInteger(&p, end, indexing ? 6 : 4, &index);
+			if (ok && index)
+				ok = tableGet(&h2->decoder, index, &name, &nameLength, &value, &valueLength)
+					 && append(&field, name, nameLength);
+			else if (ok)
+				ok = decodeString(&p, end, &field);
+			nameLength = field.length;
+			ok = ok && decodeString(&p, end, &field) && reserve(&field, 1);
+			if (!ok) break;
+			name = field.data;
+			value = field.data + nameLength;
+			valueLength = field.length - nameLength;
+			if (indexing && !tableAdd(&h2->decoder, name, nameLength, value, valueLength))
+				ok = 0;
+		}
+		if (ok && stream)
+			addField(h2, stream, name, nameLength, value, valueLength);
+	}
+
+	release(&field);
+	return ok;
+}
+
+/*
+ * Writes the request line ahead of the stream's header lines, once its
+ * first header block is decoded: "GET /path HTTP/2", then Host from the
+ * :authority when the client sent no host field.
+ *
+ * Returns:
+ *   1 on success, 0 if the request is malformed or too large.
+ */
+static int finishHead(h2_session_t *h2, h2_stream_t *stream) {
+	if (!stream->method[0] || !stream->path.length || strcmp(stream->method, "CONNECT") == 0) {
+		stream->malformed = 1;
+		return 0;
+	}
+
+	buffer_t head = { 0 };
+	int ok = append(&head, stream->method, strlen(stream->method)) && append(&head, " ", 1)
+			 && append(&head, stream->path.data, stream->path.length) && append(&head, " HTTP/2\r\n", 9);
+	if (ok && stream->authority.length && !stream->host)
+		ok = append(&head, "Host: ", 6) && append(&head, stream->authority.data, stream->authority.length)
+			 && append(&head, "\r\n", 2);
+	ok = ok && append(&head, stream->head.data, stream->head.length);
+	if (ok && stream->cookie.length)
+		ok = append(&head, "Cookie: ", 8) && append(&head, stream->cookie.data, stream->cookie.length)
+			 && append(&head, "\r\n", 2);
+
+	release(&stream->head);
+	release(&stream->path);
+	release(&stream->authority);
+	release(&stream->cookie);
+	stream->head = head;
+	if (!ok || head.length > h2->requestMax)
+		stream->oversized = 1;
+	return ok && !stream->oversized;
+}
+
+static int encodeField(h2_session_t *h2, buffer_t *block, const char *name, size_t nameLength,
+					   const char *value, size_t valueLength);
+
+// answer with a bare status before the request is all in: 431, 413; the rest of it is not wanted
+static void refuseRequest(h2_session_t *h2, h2_stream_t *stream, const char *status) {
+	buffer_t block = { 0 };
+	if ((h2->resized && !encodeInteger(&block, 0x20, 5, h2->encoder.max))
+		|| !encodeField(h2, &block, ":status", 7, status, 3)
+		|| !encodeField(h2, &block, "content-length", 14, "0", 1)) {
+		release(&block);
+		resetStream(h2, stream->id, ERROR_INTERNAL);
+		return;
+	}
+	h2->resized = 0;
+	writeHeaders(h2, stream->id, &block, 1);
+	release(&block);
+	resetStream(h2, stream->id, ERROR_NO_ERROR);
+}
+
+// the request is complete: hand it to the server as HTTP/1.1, with the body's Content-Length
+static void completeRequest(h2_session_t *h2, h2_stream_t *stream) {
+	char length[48];
+	int n = stream->body.length ? snprintf(length, sizeof(length), "Content-Length: %zu\r\n", stream->body.length) : 0;
+
+	buffer_t request = stream->head;
+	stream->head = (buffer_t){ 0 };
+	if (!append(&request, length, n) || !append(&request, "\r\n", 2)
+		|| !append(&request, stream->body.data, stream->body.length)) {
+		release(&request);
+		resetStream(h2, stream->id, ERROR_INTERNAL);
+		return;
+	}
+	release(&stream->body);
+	stream->state = STREAM_WAITING;
+	h2->busy++;
+
+	// the server may answer right away, and the stream be gone when it returns
+	uint32_t id = stream->id;
+	int taken = h2->onRequest(h2->owner, id, request.data, request.length);
+	release(&request);
+	if (!taken)
+		resetStream(h2, id, ERROR_REFUSED_STREAM);
+}
+
+// the header block is complete: a new request, trailers, or fields to decode and drop
+static void endBlock(h2_session_t *h2) {
+	uint32_t id = h2->blockStream;
+	int endStream = h2->blockFlags & FLAG_END_STREAM;
+	h2->blockStream = 0;
+
+	h2_stream_t *stream = findStream(h2, id), *target = NULL;
+	int refused = 0, trailers = 0;
+	if (stream) {
+		trailers = 1;
+	} else if (id > h2->lastStream) {
+		h2->lastStream = id;
+		refused = h2->goaway ? -1 : h2->streamCount >= h2->streamsMax;
+		if (!refused && !(target = stream = openStream(h2, id)))
+			refused = 1;
+		if (target && h2->blockWeight)
+			applyWeight(target, h2->blockWeight);
+	}
+
+	const unsigned char *block = (const unsigned char *)h2->block.data;
+	int ok = decodeBlock(h2, target, block, block + h2->block.length);
+	h2->block.length = 0;
+	if (!ok) {
+		fail(h2, ERROR_COMPRESSION);
+		return;
+	}
+
+	if (refused > 0)
+		resetStream(h2, id, ERROR_REFUSED_STREAM);
+	if (!stream)
+		return;			// on a closed stream, or after GOAWAY
+
+	if (trailers) {
+		if (stream->state != STREAM_RECEIVING)
+			resetStream(h2, id, ERROR_STREAM_CLOSED);
+		else if (!endStream)
+			resetStream(h2, id, ERROR_PROTOCOL);
+		else
+			completeRequest(h2, stream);
+		return;
+	}
+
+	if (!stream->malformed)
+		finishHead(h2, stream);
+	if (stream->malformed)
+		resetStream(h2, id, ERROR_PROTOCOL);
+	else if (stream->oversized)
+		refuseRequest(h2, stream, "431");
+	else if (endStream)
+		completeRequest(h2, stream);
+}
+
+static void receiveData(h2_session_t *h2, int flags, uint32_t id, const unsigned char *payload, size_t length) {
+	// the whole frame counts against the windows, padding included
+	h2->received += length;
+	if (h2->received >= (size_t)h2->window / 2) {
+		writeWindowUpdate(h2, 0, h2->received);
+		h2->received = 0;
+	}
+
+	if (flags & FLAG_PADDED) {
+		if (length < 1 || payload[0] >= length) {
+			fail(h2, ERROR_PROTOCOL);
+			return;
+		}
+		length -= 1 + payload[0];
+		payload++;
+	}
+
+	h2_stream_t *stream = findStream(h2, id);
+	if (!stream) {
+		if (id > h2->lastStream)
+			fail(h2, ERROR_PROTOCOL);	// idle: never opened
+		return;							// reset or answered: what was in flight is dropped
+	}
+	if (stream->state != STREAM_RECEIVING) {
+		resetStream(h2, id, ERROR_STREAM_CLOSED);
+		return;
+	}
+
+	stream->received += length;
+	if (stream->head.length + stream->body.length + length > h2->requestMax || !append(&stream->body, payload, length)) {
+		refuseRequest(h2, stream, "413");
+		return;
+	}
+	if (flags & FLAG_END_STREAM) {
+		completeRequest(h2, stream);
+		return;
+	}
+	if (stream->received >= (size_t)h2->window / 2) {
+		writeWindowUpdate(h2, id, stream->received);
+		stream->received = 0;
+	}
+}
+
+/*
+ * Applies the client's settings, from a SETTINGS frame or the HTTP2-Settings
+ * field of an h2c upgrade.
+ *
+ * Returns:
+ *   0 on success, or the error code of the connection error.
+ */
+static uint32_t applySettings(h2_session_t *h2, const unsigned char *payload, size_t length) {
+	if (length % 6) return ERROR_FRAME_SIZE;
+
+	for (size_t i = 0; i < length; i += 6) {
+		int id = payload[i] << 8 | payload[i + 1];
+		uint32_t value = readUint32(payload + i + 2);
+		switch (id) {
+		case SETTINGS_HEADER_TABLE_SIZE:
+			value = value < TABLE_SIZE ? value : TABLE_SIZE;
+			if (value != h2->encoder.max) {
+				h2->encoder.max = value;
+				tableEvict(&h2->encoder, value);
+				h2->resized = 1;
+			}
+			break;
+		case SETTINGS_ENABLE_PUSH:
+			if (value > 1) return ERROR_PROTOCOL;
+			break;
+		case SETTINGS_INITIAL_WINDOW_SIZE:
+			if (value > WINDOW_LIMIT) return ERROR_FLOW_CONTROL;
+			// the change applies to every open stream's window
+			for (h2_stream_t *s = h2->streams; s; s = s->next) {
+				s->window += (int64_t)value - h2->initialWindow;
+				if (s->window > WINDOW_LIMIT) return ERROR_FLOW_CONTROL;
+			}
+			h2->initialWindow = value;
+			break;
+		case SETTINGS_MAX_FRAME_SIZE:
+			if (value < FRAME_SIZE_DEFAULT || value > FRAME_SIZE_LIMIT) return ERROR_PROTOCOL;
+			h2->frameSize = value;
+			break;
+		}
+	}
+	return 0;
+}
+
+static void handleFrame(h2_session_t *h2, int type, int flags, uint32_t id, const unsigned char *payload, size_t length) {
+	// nothing may come between a header block's frames
+	if (h2->blockStream && (type != FRAME_CONTINUATION || id != h2->blockStream)) {
+		fail(h2, ERROR_PROTOCOL);
+		return;
+	}
+	if (!h2->settings && type != FRAME_SETTINGS) {
+		fail(h2, ERROR_PROTOCOL);
+		return;
+	}
+
+	switch (type) {
+	case FRAME_DATA:
+		if (id == 0) fail(h2, ERROR_PROTOCOL);
+		else receiveData(h2, flags, id, payload, length);
+		break;
+
+	case FRAME_HEADERS: {
+		size_t padding = 0;
+		if (id == 0 || !(id & 1)) {
+			fail(h2, ERROR_PROTOCOL);
+			break;
+		}
+		if (flags & FLAG_PADDED) {
+			if (length < 1) {
+				fail(h2, ERROR_FRAME_SIZE);
+				break;
+			}
+			padding = *payload++;
+			length--;
+		}
+		h2->blockWeight = 0;
+		if (flags & FLAG_PRIORITY) {
+			if (length < 5) {
+				fail(h2, ERROR_FRAME_SIZE);
+				break;
+			}
+			h2->blockWeight = payload[4] + 1;
+			payload += 5;
+			length -= 5;
+		}
+		if (padding > length) {
+			fail(h2, ERROR_PROTOCOL);
+			break;
+		}
+		h2->blockStream = id;
+		h2->blockFlags = flags;
+		if (!append(&h2->block, payload, length - padding)) {
+			fail(h2, ERROR_INTERNAL);
+			break;
+		}
+		if (flags & FLAG_END_HEADERS)
+			endBlock(h2);
+		break;
+	}
+
+	case FRAME_CONTINUATION:
+		if (!h2->blockStream) {
+			fail(h2, ERROR_PROTOCOL);
+			break;
+		}
+		if (h2->block.length + length > BLOCK_MAX || !append(&h2->block, payload, length)) {
+			fail(h2, ERROR_COMPRESSION);
+			break;
+		}
+		if (flags & FLAG_END_HEADERS)
+			endBlock(h2);
+		break;
+
+	case FRAME_PRIORITY: {
+		if (id == 0) {
+			fail(h2, ERROR_PROTOCOL);
+			break;
+		}
+		if (length != 5) {
+			resetStream(h2, id, ERROR_FRAME_SIZE);
+			break;
+		}
+		h2_stream_t *stream = findStream(h2, id);
+		if (stream)
+			applyWeight(stream, payload[4] + 1);
+		break;
+	}
+
+	case FRAME_PRIORITY_UPDATE: {
+		if (id != 0) {
+			fail(h2, ERROR_PROTOCOL);
+			break;
+		}
+		if (length < 4) {
+			fail(h2, ERROR_FRAME_SIZE);
+			break;
+		}
+		h2_stream_t *stream = findStream(h2, readUint32(payload) & 0x7fffffff);
+		if (stream)
+			parsePriority(stream, (const char *)payload + 4, length - 4);
+		break;
+	}
+
+	case FRAME_RST_STREAM: {
+		if (id == 0 || id > h2->lastStream) {
+			fail(h2, ERROR_PROTOCOL);
+			break;
+		}
+		if (length != 4) {
+			fail(h2, ERROR_FRAME_SIZE);
+			break;
+		}
+		h2_stream_t *stream = findStream(h2, id);
+		if (stream) {
+			METRIC_INC(METRIC_H2_RESETS);
+			removeStream(h2, stream);
+		}
+		break;
+	}
+
+	case FRAME_SETTINGS: {
+		if (id != 0) {
+			fail(h2, ERROR_PROTOCOL);
+			break;
+		}
+		if (flags & FLAG_ACK) {
+			if (length != 0) fail(h2, ERROR_FRAME_SIZE);
+			break;
+		}
+		uint32_t error = applySettings(h2, payload, length);
+		if (error) {
+			fail(h2, error);
+			break;
+		}
+		h2->settings = 1;
+		writeFrame(h2, FRAME_SETTINGS, FLAG_ACK, 0, NULL, 0);
+		break;
+	}
+
+	case FRAME_PUSH_PROMISE:
+		fail(h2, ERROR_PROTOCOL);		// clients do not push
+		break;
+
+	case FRAME_PING:
+		if (id != 0) fail(h2, ERROR_PROTOCOL);
+		else if (length != 8) fail(h2, ERROR_FRAME_SIZE);
+		else if (!(flags & FLAG_ACK)) writeFrame(h2, FRAME_PING, FLAG_ACK, 0, payload, length);
+		break;
+
+	case FRAME_GOAWAY:
+		if (id != 0) fail(h2, ERROR_PROTOCOL);
+		else h2->peerGoaway = 1;
+		break;
+
+	case FRAME_WINDOW_UPDATE: {
+		if (length != 4) {
+			fail(h2, ERROR_FRAME_SIZE);
+			break;
+		}
+		uint32_t increment = readUint32(payload) & 0x7fffffff;
+		if (id == 0) {
+			h2->sendWindow += increment;
+			if (increment == 0) fail(h2, ERROR_PROTOCOL);
+			else if (h2->sendWindow > WINDOW_LIMIT) fail(h2, ERROR_FLOW_CONTROL);
+			break;
+		}
+		if (id > h2->lastStream) {
+			fail(h2, ERROR_PROTOCOL);
+			break;
+		}
+		h2_stream_t *stream = findStream(h2, id);
+		if (!stream)
+			break;
+		stream->window += increment;
+		if (increment == 0)
+			resetStream(h2, id, ERROR_PROTOCOL);
+		else if (stream->window > WINDOW_LIMIT)
+			resetStream(h2, id, ERROR_FLOW_CONTROL);
+		break;
+	}
+	}
+	// frames of unknown types are ignored
+}
+
+/*
+ * Starts an HTTP/2 session on a connection and queues the server's SETTINGS.
+ * The client's preface is expected first, as it comes over prior knowledge,
+ * ALPN h2 and, after the 101 response, an h2c upgrade.
+ *
+ * Parameters:
+ *   onRequest       - Called for each complete request.
+ *   owner           - Passed back to onRequest.
+ *   streams         - Concurrent streams a client may open.
+ *   window          - Request bytes a stream, and the connection, take before
+ *                     the client waits for a WINDOW_UPDATE.
+ *   requestMax      - Largest request, head and body; larger ones get 431 or 413.
+ *   upgradeSettings - The HTTP2-Settings field of an h2c upgrade, NULL
+ *                     otherwise. The 101 response is queued first, and the
+ *                     upgrade request is stream 1, waiting for h2Respond().
+ *
+ * Returns:
+ *   The session, NULL if out of memory or the settings are invalid.
+ */
+h2_session_t *h2Create(h2_request_fn onRequest, void *owner, int streams, int window, size_t requestMax,
+					   const char *upgradeSettings, size_t upgradeLength) {
+	huffmanInit();
+	h2_session_t *h2 = calloc(1, sizeof(h2_session_t));
+	if (!h2) return NULL;
+
+	h2->onRequest = onRequest;
+	h2->owner = owner;
+	h2->streamsMax = streams;
+	h2->window = window;
+	h2->requestMax = requestMax;
+	h2->decoder.max = h2->encoder.max = TABLE_SIZE;
+	h2->sendWindow = h2->initialWindow = WINDOW_DEFAULT;
+	h2->frameSize = FRAME_SIZE_DEFAULT;
+
+	if (upgradeSettings) {
+		// base64url, without padding
+		unsigned char settings[256];
+		size_t length = 0;
+		uint32_t bits = 0;
+		int count = 0, ok = upgradeLength <= sizeof(settings) * 4 / 3;
+		for (size_t i = 0; ok && i < upgradeLength && upgradeSettings[i] != '='; i++) {
+			char c = upgradeSettings[i];
+			int value = c >= 'A' && c <= 'Z' ? c - 'A' : c >= 'a' && c <= 'z' ? c - 'a' + 26
+					  : c >= '0' && c <= '9' ? c - '0' + 52 : c == '-' ? 62 : c == '_' ? 63 : -1;
+			ok = value >= 0;
+			bits = bits << 6 | value;
+			if (ok && (count += 6) >= 8) {
+				count -= 8;
+				settings[length++] = bits >> count;
+			}
+		}
+		if (!ok || applySettings(h2, settings, length) || !append(&h2->output[1], upgradeResponse, sizeof(upgradeResponse) - 1)
+			|| !openStream(h2, 1)) {
+			h2Destroy(h2);
+			return NULL;
+		}
+		h2->streams->state = STREAM_WAITING;
+		h2->busy = 1;
+		h2->lastStream = 1;
+	}
+
+	unsigned char settings[12];
+	settings[0] = 0;
+	settings[1] = SETTINGS_MAX_CONCURRENT_STREAMS;
+	writeUint32(settings + 2, streams);
+	settings[6] = 0;
+	settings[7] = SETTINGS_INITIAL_WINDOW_SIZE;
+	writeUint32(settings + 8, window);
+	writeFrame(h2, FRAME_SETTINGS, 0, 0, settings, sizeof(settings));
+	if (window > WINDOW_DEFAULT)
+		writeWindowUpdate(h2, 0, window - WINDOW_DEFAULT);
+
+	if (h2->failed) {
+		h2Destroy(h2);
+		return NULL;
+	}
+	return h2;
+}
+
+void h2Destroy(h2_session_t *h2) {
+	while (h2->streams)
+		removeStream(h2, h2->streams);
+	tableEvict(&h2->decoder, 0);
+	tableEvict(&h2->encoder, 0);
+	release(&h2->input);
+	release(&h2->block);
+	release(&h2->output[0]);
+	release(&h2->output[1]);
+	free(h2);
+}
+
+/*
+ * Takes bytes the client sent. Complete requests go to onRequest() on the
+ * way; what the session answers by itself (SETTINGS and PING
+ * acknowledgements, WINDOW_UPDATE, resets) is queued for h2Output().
+ *
+ * Returns:
+ *   1 on success, 0 after a connection error: the session only sends its
+ *   GOAWAY from then on.
+ */
+int h2Receive(h2_session_t *h2, const char *data, size_t length) {
+	if (h2->failed) return 0;
+
+	while (h2->preface < H2_PREFACE_LENGTH && length > 0) {
+		if (*data != H2_PREFACE[h2->preface]) {
+			fail(h2, ERROR_PROTOCOL);
+			return 0;
+		}
+		h2->preface++;
+		data++;
+		length--;
+	}
+	if (!append(&h2->input, data, length)) {
+		fail(h2, ERROR_INTERNAL);
+		return 0;
+	}
+
+	size_t offset = 0;
+	while (!h2->failed && h2->input.length - offset >= FRAME_HEADER) {
+		const unsigned char *frame = (const unsigned char *)h2->input.data + offset;
+		size_t frameLength = (size_t)frame[0] << 16 | frame[1] << 8 | frame[2];
+		if (frameLength > FRAME_SIZE_DEFAULT) {
+			fail(h2, ERROR_FRAME_SIZE);
+			break;
+		}
+		if (h2->input.length - offset < FRAME_HEADER + frameLength)
+			break;
+		offset += FRAME_HEADER + frameLength;
+		handleFrame(h2, frame[3], frame[4], readUint32(frame + 5) & 0x7fffffff, frame + FRAME_HEADER, frameLength);
+	}
+
+	if (offset) {
+		h2->input.length -= offset;
+		memmove(h2->input.data, h2->input.data + offset, h2->input.length);
+	}
+	return !h2->failed;
+}
+
+// responses change more than requests: fields that differ each time stay out of the table
+static int indexable(const char *name, size_t length) {
+	static const char *const names[] = { "content-length", "date", "etag", "last-modified", "location" };
+	for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+		if (length == strlen(names[i]) && memcmp(name, names[i], length) == 0)
+			return 0;
+	return 1;
+}
+
+// a response field: indexed if a table has it, else a literal, added to the table if it may repeat
+static int encodeField(h2_session_t *h2, buffer_t *block, const char *name, size_t nameLength,
+					   const char *value, size_t valueLength) {
+	int index = 0, nameIndex = 0;
+	for (int i = 1; i <= STATIC_ENTRIES && !index; i++) {
+		if (strlen(staticTable[i].name) != nameLength || memcmp(staticTable[i].name, name, nameLength) != 0)
+			continue;
+		if (!nameIndex) nameIndex = i;
+		if (strlen(staticTable[i].value) == valueLength && memcmp(staticTable[i].value, value, valueLength) == 0)
+			index = i;
+	}
+	for (int i = 0; i < h2->encoder.count && !index; i++) {
+		const field_t *entry = &h2->encoder.entries[i];
+		if (entry->nameLength != nameLength || memcmp(entry->name, name, nameLength) != 0)
+			continue;
+		if (!nameIndex) nameIndex = STATIC_ENTRIES + 1 + i;
+		if (entry->valueLength == valueLength && memcmp(entry->value, value, valueLength) == 0)
+			index = STATIC_ENTRIES + 1 + i;
+	}
+	if (index)
+		return encodeInteger(block, 0x80, 7, index);
+
+	// set-cookie is never indexed (0001), not even by an intermediary
+	int sensitive = nameLength == 10 && memcmp(name, "set-cookie", 10) == 0;
+	int indexing = !sensitive && indexable(name, nameLength);
+	if (!(indexing ? encodeInteger(block, 0x40, 6, nameIndex) : encodeInteger(block, sensitive ? 0x10 : 0x00, 4, nameIndex))
+		|| (!nameIndex && !encodeString(block, name, nameLength)) || !encodeString(block, value, valueLength))
+		return 0;
+	return !indexing || tableAdd(&h2->encoder, name, nameLength, value, valueLength);
+}
+
+/*
+ * Answers a stream with an HTTP/1.1 response, as the handlers and the cache
+ * produce it: the status line becomes :status, the header lines fields
+ * (connection-specific ones dropped) and the body DATA frames, sent by
+ * h2Output() as the flow control windows and the streams' priorities allow.
+ * The response is copied.
+ *
+ * Returns:
+ *   1 on success; 0 if the stream is gone (the client reset it) or the
+ *   response cannot be parsed, when the stream is reset.
+ */
+int h2Respond(h2_session_t *h2, uint32_t id, const struct iovec *parts, int count) {
+	h2_stream_t *stream = findStream(h2, id);
+	if (!stream || stream->state != STREAM_WAITING) return 0;
+
+	size_t total = 0;
+	for (int i = 0; i < count; i++)
+		total += parts[i].iov_len;
+	char *response = malloc(total + 1);
+	if (!response) {
+		resetStream(h2, id, ERROR_INTERNAL);
+		return 0;
+	}
+	for (size_t i = 0, offset = 0; i < (size_t)count; offset += parts[i++].iov_len)
+		memcpy(response + offset, parts[i].iov_base, parts[i].iov_len);
+	response[total] = '\0';
+
+	char *end = memmem(response, total, "\r\n\r\n", 4);
+	char *line = memchr(response, '\n', total);
+	if (!end || total < 12 || memcmp(response, "HTTP/1.", 7) != 0 || response[8] != ' '
+		|| response[9] < '1' || response[9] > '5' || response[10] < '0' || response[10] > '9'
+		|| response[11] < '0' || response[11] > '9') {
+		free(response);
+		resetStream(h2, id, ERROR_INTERNAL);
+		return 0;
+	}
+
+	buffer_t block = { 0 };
+	int ok = (!h2->resized || encodeInteger(&block, 0x20, 5, h2->encoder.max))
+			 && encodeField(h2, &block, ":status", 7, response + 9, 3);
+	size_t bodyLength = total - (end + 4 - response);
+	char name[64];
+	for (line++; ok && line < end + 2; ) {
+		char *eol = memmem(line, end + 2 - line, "\r\n", 2);
+		char *colon = memchr(line, ':', eol - line);
+		size_t nameLength = colon ? (size_t)(colon - line) : 0;
+		if (nameLength && nameLength < sizeof(name) && !hopByHop(line, nameLength)) {
+			for (size_t i = 0; i < nameLength; i++)
+				name[i] = line[i] >= 'A' && line[i] <= 'Z' ? line[i] | 0x20 : line[i];
+			char *value = colon + 1;
+			while (value < eol && (*value == ' ' || *value == '\t'))
+				value++;
+			ok = encodeField(h2, &block, name, nameLength, value, eol - value);
+			if (nameLength == 14 && memcmp(name, "content-length", 14) == 0 && strtoul(value, NULL, 10) < bodyLength)
+				bodyLength = strtoul(value, NULL, 10);
+		}
+		line = eol + 2;
+	}
+	if (!ok) {
+		release(&block);
+		free(response);
+		resetStream(h2, id, ERROR_INTERNAL);
+		return 0;
+	}
+	h2->resized = 0;
+	writeHeaders(h2, id, &block, bodyLength == 0);
+	release(&block);
+
+	if (bodyLength == 0) {
+		free(response);
+		removeStream(h2, stream);
+		return 1;
+	}
+	h2->busy--;
+	stream->state = STREAM_SENDING;
+	stream->response = response;
+	stream->data = end + 4;
+	stream->dataLength = bodyLength;
+	return 1;
+}
+
+/*
+ * Resets a stream the server cannot answer (the handler failed) with
+ * INTERNAL_ERROR.
+ */
+void h2Reset(h2_session_t *h2, uint32_t id) {
+	if (findStream(h2, id))
+		resetStream(h2, id, ERROR_INTERNAL);
+}
+
+/*
+ * Tells the client no new streams are taken (draining, idle). The streams it
+ * opened so far are still answered; h2Finished() is true after the last.
+ */
+void h2GoAway(h2_session_t *h2) {
+	if (h2->goaway) return;
+	unsigned char payload[8];
+	writeUint32(payload, h2->lastStream);
+	writeUint32(payload + 4, ERROR_NO_ERROR);
+	writeFrame(h2, FRAME_GOAWAY, 0, 0, payload, sizeof(payload));
+	h2->goaway = 1;
+}
+
+// of two streams with DATA to send, whether a goes first: the lower urgency, then
+// sequential responses in stream order ahead of incremental ones taking turns
+static int before(const h2_stream_t *a, const h2_stream_t *b) {
+	if (!b) return 1;
+	if (a->urgency != b->urgency) return a->urgency < b->urgency;
+	if (a->incremental != b->incremental) return !a->incremental;
+	return a->incremental ? a->served < b->served : a->id < b->id;
+}
+
+// DATA frames, a frame at a time to the most urgent stream the windows allow, up to OUTPUT_AHEAD;
+// after an h2c upgrade none until the client's preface, as clients keep little of what comes before
+static void scheduleData(h2_session_t *h2) {
+	buffer_t *out = &h2->output[!h2->sending];
+	if (h2->preface < H2_PREFACE_LENGTH) return;
+	while (!h2->failed && out->length < OUTPUT_AHEAD && h2->sendWindow > 0) {
+		h2_stream_t *next = NULL;
+		for (h2_stream_t *s = h2->streams; s; s = s->next)
+			if (s->state == STREAM_SENDING && s->window > 0 && before(s, next))
+				next = s;
+		if (!next) return;
+
+		size_t length = next->dataLength - next->sent;
+		if (length > h2->frameSize) length = h2->frameSize;
+		if ((int64_t)length > next->window) length = next->window;
+		if ((int64_t)length > h2->sendWindow) length = h2->sendWindow;
+		int last = next->sent + length == next->dataLength;
+
+		writeFrame(h2, FRAME_DATA, last ? FLAG_END_STREAM : 0, next->id, next->data + next->sent, length);
+		next->sent += length;
+		next->window -= length;
+		h2->sendWindow -= length;
+		next->served = ++h2->clock;
+		if (last)
+			removeStream(h2, next);
+	}
+}
+
+/*
+ * Gives the bytes to send next. They stay in place until h2Sent(), however
+ * the session changes meanwhile, so a send can be retried or left to the
+ * kernel; what is queued meanwhile comes with the next call.
+ *
+ * Returns:
+ *   The number of bytes at *data, 0 if there is nothing to send.
+ */
+size_t h2Output(h2_session_t *h2, const char **data) {
+	buffer_t *sending = &h2->output[h2->sending];
+	if (sending->length == 0) {
+		scheduleData(h2);
+		h2->sending = !h2->sending;
+		sending = &h2->output[h2->sending];
+	}
+	*data = sending->data;
+	return sending->length;
+}
+
+/*
+ * The bytes h2Output() gave are all sent.
+ */
+void h2Sent(h2_session_t *h2) {
+	h2->output[h2->sending].length = 0;
+}
+
+/*
+ * Returns the number of streams whose request the server has and has not
+ * answered yet.
+ */
+int h2Busy(const h2_session_t *h2) {
+	return h2->busy;
+}
+
+/*
+ * Returns 1 once the server should close the connection, when what
+ * h2Output() gives is sent: after a connection error, or after a GOAWAY
+ * either way once no stream is left.
+ */
+int h2Finished(const h2_session_t *h2) {
+	return h2->failed || ((h2->goaway || h2->peerGoaway) && h2->streamCount == 0);
+}
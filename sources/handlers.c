@@ -24,49 +24,75 @@
         "<button type=\"button\" class=\"btn-close\" data-bs-dismiss=\"alert\" aria-label=\"Close\"></button>" \
     "</div>"
 
+// milliseconds a client that got the profile without a stream waits before asking again
+#define PROFILE_EVENTS_RETRY_MS 10000
+
+// the login page's {{alert}} slot holds markup built from ALERT()
+static const int rawAlert[] = { ESCAPE_RAW };
+
+// a profiling session, which sleeps for its length on a pool thread
+typedef struct {
+	int		seconds;
+	int		hz;
+	FILE	*out;
+	int		status;
+} profile_call_t;
+
+static void runProfiler(void *arg) {
+	profile_call_t *call = arg;
+	call->status = profilerRun(call->seconds, call->hz, call->out);
+}
+
 /*
- * Decodes a URL-encoded string, converting percent-encoded characters and plus signs.
+ * Sends a plain text HTTP response.
  *
  * Parameters:
- *   dst - Destination buffer to store the decoded result (must not be NULL).
- *         Must be large enough to hold the decoded string.
- *   src - Source URL-encoded string (must not be NULL).
+ *   status  - The HTTP status line (must not be NULL).
+ *   headers - Extra header lines, each terminated by "\r\n" (must not be NULL; may be empty).
+ *   body    - The response body (must not be NULL).
+ *   length  - Number of body bytes to send.
  *
- * Behavior:
- *   - Replaces "%XX" sequences with their corresponding character (hexadecimal decoding).
- *   - Replaces '+' characters with spaces.
- *   - Copies all other characters as-is.
+ * Side Effects:
+ *   Sends the HTTP response to stdout.
  */
-void urlDecode(char *dst, const char *src) {
-	assert(dst != NULL && src != NULL);
-
-	while (*src) {
-		if (*src == '%') {
-			if (isxdigit(*(src + 1)) && isxdigit(*(src + 2))) {
-				char hex[3] = { *(src + 1), *(src + 2), '\0' };
-				*dst++ = (char)strtol(hex, NULL, 16);
-				src += 3;
-			} else {
-				*dst++ = *src++;
-			}
-		} else if (*src == '+') {
-			*dst++ = ' ';
-			src++;
-		} else {
-			*dst++ = *src++;
-		}
-	}
-	*dst = '\0';
+static void sendTextResponse(const char *status, const char *headers, const char *body, size_t length) {
+	assert(status != NULL && headers != NULL && body != NULL);
+
+	printf(
+		"%s\r\n"
+		"Content-Type: %s\r\n"
+		"Content-Length: %zu\r\n"
+		"%s"
+		"%s"
+		"\r\n",
+		status, MIME_PLAIN, length, headers, CONNECTION_HEADER
+	);
+	fwrite(body, 1, length, stdout);
+}
+
+/*
+ * Reads an integer field from a parsed form or query string.
+ *
+ * Parameters:
+ *   form         - The parsed fields (must not be NULL).
+ *   name         - The field name to look up (must not be NULL).
+ *   defaultValue - Value returned when the field is missing or empty.
+ *
+ * Returns:
+ *   The parsed value of the first field with that name, or defaultValue.
+ */
+static int formInt(const form_t *form, const char *name, int defaultValue) {
+	const char *value = formGet(form, name);
+	return value && *value ? atoi(value) : defaultValue;
 }
 
 /*
- * Handles user sign-up by parsing the request payload, creating a new user, and responding with feedback.
+ * Handles user sign-up by reading the credentials from the form, creating a new user, and responding with feedback.
  *
  * Parameters:
- *   payload - A URL-encoded string containing "username" and "password" parameters (must not be NULL).
+ *   form - The parsed request body with "username" and "password" fields (must not be NULL).
  *
  * Behavior:
- *   - Parses the payload to extract credentials.
  *   - Attempts to register the user using addUser().
  *   - On success, returns a login page with a success alert.
  *   - On failure due to duplicate username, returns the login page with an error alert.
@@ -75,31 +101,30 @@ void urlDecode(char *dst, const char *src) {
  * Side Effects:
  *   Prints the HTTP response to stdout.
  */
-void signUp(const char *payload) {
-	if (!payload) {
-		renderErrorPage("Invalid request payload.");
-		return;
-	}
+void signUp(const form_t *form) {
+	assert(form != NULL);
 
-	char username[NAME_SIZE], password[NAME_SIZE];
+	const char *username = formGet(form, "username");
+	const char *password = formGet(form, "password");
 	const char *placeholders[] = { "{{alert}}" };
 	const char *values[1];
 	const char *status = STATUS_200_OK;
 
-	// Parse payload (format assumed: "username=...&password=...&profile=...")
-	sscanf(payload, "username=%127[^&]&password=%127[^&]", username, password);
-	int addStatus = addUser(username, password);
+	int addStatus = addUser(username ? username : "", password ? password : "");
 	if (addStatus == ADD_USER_SUCCESS) {
 		values[0] = ALERT("success", "Sign-up successful!", "You're all set! Go ahead and sign in.");
 	} else if (addStatus == ADD_USER_FAILED) {
 		values[0] = ALERT("danger", "Oops!", "That name has already been registered. Select a different one.");
 		status = STATUS_400_BAD_REQUEST;
+	} else if (addStatus == ADD_USER_INVALID_INPUT) {
+		values[0] = ALERT("danger", "Oops!", "Names and passwords need 1 to 127 characters, without ':'.");
+		status = STATUS_400_BAD_REQUEST;
 	} else {
 		renderErrorPage("Something went wrong on our end. Please try again later.");
 		return;
 	}
 
-	char *html = renderTemplate(LOGIN_PAGE, placeholders, values, 1);
+	char *html = renderTemplate(LOGIN_PAGE, placeholders, values, rawAlert, 1);
 	if(!html) {
 		renderErrorPage("Unable to display login page.");
 		return;
@@ -120,10 +145,9 @@ void signUp(const char *payload) {
  * Handles user sign-in by validating credentials and initiating a session on success.
  *
  * Parameters:
- *   payload - A URL-encoded string containing "username" and "password" parameters (must not be NULL).
+ *   form - The parsed request body with "username" and "password" fields (must not be NULL).
  *
  * Behavior:
- *   - Parses the payload to extract login credentials.
  *   - Validates credentials using checkPassword().
  *   - On success, generates a session token, stores it, and redirects to /home with a session cookie.
  *   - On invalid credentials, renders the login page with an error alert.
@@ -133,21 +157,24 @@ void signUp(const char *payload) {
  *   Generates and store a session token.
  *   Prints the HTTP response to stdout.
  */
-void signIn(const char *payload) {
-	if (!payload) {
-		renderErrorPage("Invalid request payload.");
-		return;
-	}
+void signIn(const form_t *form) {
+	assert(form != NULL);
 
-	char username[NAME_SIZE], password[NAME_SIZE];
-	sscanf(payload, "username=%127[^&]&password=%127[^\n]", username, password);
+	const char *username = formGet(form, "username");
+	const char *password = formGet(form, "password");
+	if (!username) username = "";
+	if (!password) password = "";
 
 	int passwordStatus = checkPassword(username, password);
 	if (passwordStatus == PASSWORD_MATCH) {
 		char token[TOKEN_BYTE_LENGTH];
-		generateToken(token);
-		storeSession(token, username);
+		if (generateToken(token) != TOKEN_GENERATION_SUCCESS
+			|| storeSession(token, username) != SESSION_WRITE_SUCCESS) {
+			renderErrorPage("Something went wrong on our end. Please try again later.");
+			return;
+		}
 		REDIRECT_WITH_SESSION("/home", token);
+		return;
 	} else if (passwordStatus == USER_FILE_ERROR) {
 		renderErrorPage("Something went wrong on our end. Please try again later.");
 		return;
@@ -155,7 +182,7 @@ void signIn(const char *payload) {
 
 	const char *placeholders[] = { "{{alert}}" };
 	const char *values[] = { ALERT("danger", "Unauthorized!", "Invalid credentials.") };
-	char *html = renderTemplate(LOGIN_PAGE, placeholders, values, 1);
+	char *html = renderTemplate(LOGIN_PAGE, placeholders, values, rawAlert, 1);
 
 	if(!html) {
 		renderErrorPage("Unable to display login page.");
@@ -196,13 +223,14 @@ void setUp(void) {
  * Serves the home page for a signed-in user, optionally updating the user's profile description.
  *
  * Parameters:
- *   payload - Optional URL-encoded form data. If present and begins with "profile-description=",
- *             the user's profile description will be updated accordingly.
+ *   payload - Optional form data (NULL for GET), decoded in place. A "profile-description"
+ *             field updates the user's profile description; line breaks become spaces.
+ *   length  - Number of payload bytes.
  *
  * Behavior:
  *   - Extracts and validates the session token from the Cookie header.
  *   - Retrieves the associated username from the session token.
- *   - If a valid profile update payload is provided, decodes and saves the new description.
+ *   - If a valid profile update is provided, saves the new description.
  *   - Loads and renders the home page template with the user's username and description.
  *   - Responds with a full HTML response or an error page if any step fails.
  *
@@ -210,7 +238,7 @@ void setUp(void) {
  *   Sends the HTTP response to stdout.
  *   Redirects to the login page and clears the session on invalid token.
  */
-void serveHomePage(const char *payload) {
+void serveHomePage(char *payload, size_t length) {
 	char *token = extractSessionToken();
 	if (!token) {
 		REDIRECT_AND_CLEAR_SESSION("/login");
@@ -226,17 +254,34 @@ void serveHomePage(const char *payload) {
 
 	free(token);
 
-	if (payload) {
-		const char *prefix = "profile-description=";
-		if (strncmp(payload, prefix, strlen(prefix)) == 0) {
-			const char *desc = payload + strlen(prefix);
-			char decodedDesc[MAX_LINE_LEN];
-			urlDecode(decodedDesc, desc);
-			int result = setProfileDescription(username, decodedDesc);
-			if (result != UPDATE_SUCCESS) {
-				renderErrorPage("Unable to update profile description.");
-				return;
-			}
+	// a cached copy of this page lasts until the profile changes
+	cache_depends_on(profileVersion(username));
+
+	form_t form;
+	const form_field_t *field = NULL;
+	if (payload && formParseBody(&form, payload, length, request_header("Content-Type")) == FORM_SUCCESS)
+		field = formField(&form, "profile-description");
+
+	if (field) {
+		if (field->valueLength > PROFILE_DESCRIPTION_MAX) {
+			renderErrorPage("Profile descriptions are limited to 250 characters.");
+			return;
+		}
+
+		// the description is stored on one line
+		char description[PROFILE_DESCRIPTION_MAX + 1];
+		size_t used = 0;
+		for (size_t i = 0; i < field->valueLength; i++) {
+			char c = field->value[i];
+			if (c == '\n' && used > 0 && field->value[i - 1] == '\r') continue;
+			description[used++] = (c == '\r' || c == '\n') ? ' ' : c;
+		}
+		description[used] = '\0';
+
+		int result = setProfileDescription(username, description);
+		if (result != UPDATE_SUCCESS) {
+			renderErrorPage("Unable to update profile description.");
+			return;
 		}
 	}
 
@@ -248,7 +293,7 @@ void serveHomePage(const char *payload) {
 
 	const char *placeholders[] = { "{{username}}", "{{profile}}" };
 	const char *values[] = { username, desc };
-	char *html = renderTemplate(HOME_PAGE, placeholders, values, 2);
+	char *html = renderTemplate(HOME_PAGE, placeholders, values, NULL, 2);
 	free(desc);
 
 	if (!html) {
@@ -267,6 +312,69 @@ void serveHomePage(const char *payload) {
 	}
 }
 
+/*
+ * Streams the signed-in user's profile description as Server-Sent Events ("profile"
+ * events): the current one, then each one saved from then on, by any session.
+ *
+ * Behavior:
+ *   - Answers 401 Unauthorized without a valid session, which EventSource does not retry.
+ *   - Subscribes the connection to the user's events before reading the description,
+ *     so a change saved meanwhile still arrives.
+ *   - Where the connection cannot carry a stream (an HTTP/2 stream), sends the current
+ *     description as a complete response that asks the client to reconnect after
+ *     PROFILE_EVENTS_RETRY_MS, so the page polls instead.
+ *
+ * Side Effects:
+ *   Sends the HTTP response head and the first event to stdout; the server sends the rest.
+ */
+void serveProfileEvents() {
+	char *token = extractSessionToken();
+	char username[NAME_SIZE];
+	int signedIn = token && getUsernameFromToken(token, username) == TOKEN_FOUND;
+	free(token);
+	if (!signedIn) {
+		const char *message = "Sign in to follow the profile.\r\n";
+		sendTextResponse(STATUS_401_UNAUTHORIZED, "", message, strlen(message));
+		return;
+	}
+
+	int streaming = request_subscribe(username);
+	char *desc = getProfileDescription(username);
+	if (!streaming && !desc) {
+		renderErrorPage("Unable to retrieve profile description.");
+		return;
+	}
+
+	if (streaming) {
+		printf(
+			"%s\r\n"
+			"Content-Type: %s\r\n"
+			"Cache-Control: no-store\r\n"
+			"Connection: close\r\n"
+			"\r\n",
+			STATUS_200_OK, MIME_EVENT_STREAM
+		);
+		if (desc)
+			printf("event: profile\ndata: %s\n\n", desc);
+		free(desc);
+		return;
+	}
+
+	char body[PROFILE_DESCRIPTION_MAX + BUFFER_SIZE];
+	int length = snprintf(body, sizeof(body), "retry: %d\nevent: profile\ndata: %s\n\n", PROFILE_EVENTS_RETRY_MS, desc);
+	free(desc);
+	printf(
+		"%s\r\n"
+		"Content-Type: %s\r\n"
+		"Content-Length: %d\r\n"
+		"Cache-Control: no-store\r\n"
+		"%s"
+		"\r\n"
+		"%s",
+		STATUS_200_OK, MIME_EVENT_STREAM, length, CONNECTION_HEADER, body
+	);
+}
+
 /*
  * Serves the login page, redirecting authenticated users to the home page.
  *
@@ -294,7 +402,7 @@ void serveLoginPage() {
 	const char *placeholders[] = { "{{alert}}" };
 	const char *values[] = { "" };
 
-	char *html = renderTemplate(LOGIN_PAGE, placeholders, values, 1);
+	char *html = renderTemplate(LOGIN_PAGE, placeholders, values, rawAlert, 1);
 	if(!html) {
 		renderErrorPage("Unable to display login page.");
 		return;
@@ -336,7 +444,9 @@ void send404Page() {
  *   filePath - Path to the file to be served (must not be NULL).
  *
  * Behavior:
- *   - Loads the file using RENDER_FILE_WITH_SIZE, which includes HTTP headers.
+ *   - Sends embedded files straight from the bundle with their prebuilt headers.
+ *   - Redirects a fingerprint from an earlier build to the current one.
+ *   - Otherwise loads the file using RENDER_FILE_WITH_SIZE, which includes HTTP headers.
  *   - Writes the complete response to stdout using fwrite.
  *   - Frees the allocated memory after sending.
  *
@@ -344,6 +454,21 @@ void send404Page() {
  *   Sends the HTTP response to stdout.
  */
 void sendFileResponse(const char *filePath) {
+	int variant;
+	const bundle_file_t *bundled = bundleFind(filePath, &variant);
+	if (bundled) {
+		sendBundledFile(bundled, variant);
+		return;
+	}
+
+	bundled = bundleFindRenamed(filePath);
+	if (bundled) {
+		char location[BUFFER_SIZE * 2];
+		snprintf(location, sizeof(location), "/%s", bundled->fingerprintPath);
+		REDIRECT(location);
+		return;
+	}
+
 	int response_size = 0;
 	char *response = RENDER_FILE_WITH_SIZE(filePath, &response_size);
 	if (response) {
@@ -356,33 +481,174 @@ void sendFileResponse(const char *filePath) {
  * Handles POST requests to the login endpoint by dispatching to sign-in or sign-up logic.
  *
  * Parameters:
- *   payload - A URL-encoded request body containing an "action" key and additional parameters (must not be NULL).
+ *   payload - The request body, URL-encoded or multipart, with an "action" field and the
+ *             credentials in any order (must not be NULL). It is decoded in place.
+ *   length  - Number of payload bytes.
  *
  * Behavior:
- *   - Parses the "action" field from the payload.
- *   - If action is "signin", delegates to signIn() with the remaining payload.
- *   - If action is "signup", delegates to signUp() with the remaining payload.
+ *   - Parses the form and reads its "action" field.
+ *   - If action is "signin", delegates to signIn() with the form.
+ *   - If action is "signup", delegates to signUp() with the form.
  *   - Otherwise, renders an error page indicating an invalid request.
  *
  * Side Effects:
  *   Generates and send HTML responses to stdout.
  */
-void handleLoginPost(const char *payload) {
-	if (!payload) {
+void handleLoginPost(char *payload, size_t length) {
+	form_t form;
+	if (!payload || formParseBody(&form, payload, length, request_header("Content-Type")) != FORM_SUCCESS) {
 		renderErrorPage("Invalid request payload.");
 		return;
 	}
 
-	char action[16] = {0};
-	sscanf(payload, "action=%15[^&]", action);
-
-	size_t prefixLen = strlen("action=") + strlen(action) + 1; // +1 for '&'
+	const char *action = formGet(&form, "action");
+	if (!action) action = "";
 
 	if (strcmp(action, "signin") == 0) {
-		signIn(payload + prefixLen);
+		signIn(&form);
 	} else if (strcmp(action, "signup") == 0) {
-		signUp(payload + prefixLen);
+		signUp(&form);
 	} else {
 		renderErrorPage("Invalid request action.");
 	}
 }
+
+/*
+ * Runs a sampling profiler session and serves the result as folded stacks.
+ *
+ * Parameters:
+ *   query - The request query string; "seconds" and "hz" select the session
+ *           length and sample rate (defaults: PROFILER_DEFAULT_SECONDS, PROFILER_DEFAULT_HZ).
+ *
+ * Behavior:
+ *   - Only answers requests that came on an admin: listener when the profiler was enabled at
+ *     startup; everything else gets the 404 page.
+ *   - Responds with 409 Conflict if another session is already running.
+ *   - Otherwise blocks for the session and returns text/plain output for flamegraph.pl,
+ *     with the sample counters in X-Profile-Samples and X-Profile-Dropped.
+ *
+ * Side Effects:
+ *   Sends the HTTP response to stdout.
+ */
+void serveProfilerReport(char *query) {
+	if (!request_is_admin()) {
+		send404Page();
+		return;
+	}
+
+	form_t form;
+	if (formParse(&form, query, strlen(query)) != FORM_SUCCESS) {
+		const char *message = "Too many parameters.\r\n";
+		sendTextResponse(STATUS_400_BAD_REQUEST, "", message, strlen(message));
+		return;
+	}
+	int seconds = formInt(&form, "seconds", PROFILER_DEFAULT_SECONDS);
+	int hz = formInt(&form, "hz", PROFILER_DEFAULT_HZ);
+
+	char *report = NULL;
+	size_t reportSize = 0;
+	FILE *out = open_memstream(&report, &reportSize);
+	if (!out) {
+		renderErrorPage("Unable to start the profiler.");
+		return;
+	}
+
+	profile_call_t call = { .seconds = seconds, .hz = hz, .out = out };
+	coroOffload(runProfiler, &call);
+	int status = call.status;
+	fclose(out);
+
+	if (status == PROFILER_DISABLED) {
+		free(report);
+		send404Page();
+		return;
+	}
+
+	if (status == PROFILER_BUSY) {
+		free(report);
+		const char *message = "A profiling session is already running.\r\n";
+		sendTextResponse(STATUS_409_CONFLICT, "", message, strlen(message));
+		return;
+	}
+
+	unsigned long samples, dropped;
+	profilerStats(&samples, &dropped);
+
+	char headers[BUFFER_SIZE];
+	snprintf(headers, sizeof(headers),
+		"X-Profile-Samples: %lu\r\n"
+		"X-Profile-Dropped: %lu\r\n",
+		samples, dropped
+	);
+	sendTextResponse(STATUS_200_OK, headers, report, reportSize);
+	free(report);
+}
+
+/*
+ * Serves the per-route allocation table collected by a MEMSTAT build.
+ *
+ * Behavior:
+ *   - Only answers requests that came on an admin: listener of an instrumented build;
+ *     everything else gets the 404 page.
+ *   - Each row reports requests, allocations, bytes, peak live bytes and the
+ *     allocations still live when the request finished.
+ *
+ * Side Effects:
+ *   Sends the HTTP response to stdout.
+ */
+void serveMemoryReport() {
+	if (!request_is_admin()) {
+		send404Page();
+		return;
+	}
+
+	char *report = NULL;
+	size_t reportSize = 0;
+	FILE *out = open_memstream(&report, &reportSize);
+	if (!out) {
+		renderErrorPage("Unable to collect allocation statistics.");
+		return;
+	}
+
+	int status = memstatReport(out);
+	fclose(out);
+
+	if (status != MEMSTAT_OK) {
+		free(report);
+		send404Page();
+		return;
+	}
+
+	sendTextResponse(STATUS_200_OK, "", report, reportSize);
+	free(report);
+}
+
+/*
+ * Serves the server counters (connections, requests, timeouts) as "name value" lines.
+ *
+ * Behavior:
+ *   - Only answers requests that came on an admin: listener; everything else gets the 404 page.
+ *
+ * Side Effects:
+ *   Sends the HTTP response to stdout.
+ */
+void serveMetricsReport() {
+	if (!request_is_admin()) {
+		send404Page();
+		return;
+	}
+
+	char *report = NULL;
+	size_t reportSize = 0;
+	FILE *out = open_memstream(&report, &reportSize);
+	if (!out) {
+		renderErrorPage("Unable to collect server metrics.");
+		return;
+	}
+
+	metricsReport(out);
+	fclose(out);
+
+	sendTextResponse(STATUS_200_OK, "", report, reportSize);
+	free(report);
+}
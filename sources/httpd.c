@@ -5,103 +5,3749 @@
 //  Created by ibrahim alankeeb on 21/01/2023.
 //
 
+#define _GNU_SOURCE
+
 #include "httpd.h"
+#include "affinity.h"
+#include "bufpool.h"
+#include "cache.h"
+#include "coro.h"
+#include "h2.h"
+#include "hub.h"
+#include "metrics.h"
+#include "pool.h"
+#include "profiler.h"
+#include "proxy.h"
+#include "ratelimit.h"
+#include "timer.h"
+#include "tls.h"
+#include "uring.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <strings.h>
+#include <limits.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+
+#include "memstat.h"
+
+#define REQUEST_MAX		65535
+#define MAX_EVENTS		64
+
+#define RATE_GRACE_MS	2000	// minimum_rate is enforced after this much time in a read state
+#define RATE_CHECK_MS	1000
+
+#define BIND_ATTEMPTS		20		// openTcp() retries a busy port this often
+#define BIND_RETRY_US		250000
+
+// environment of a server started by a binary upgrade (SIGUSR2)
+#define ENV_LISTEN_FD		"CSERVER_LISTEN_FD"		// the listeners, "3,tls:4,admin:5,..."
+#define ENV_UPGRADE_FROM	"CSERVER_UPGRADE_FROM"
+
+#define LISTEN_FDS_START	3		// first descriptor systemd passes (socket activation)
+
+// handlers send cacheable responses and events back to the server through this descriptor
+#define FILL_FD				(STDERR_FILENO + 1)
+#define FILL_SNDBUF			(4 * 1024 * 1024)
+
+#define FLIGHT_BUCKETS		256		// cache keys being rendered by a handler right now
+
+#define WFQ_UNIT			(1 << 20)	// virtual time a request of weight 1 takes
+
+// io_uring backend (-I uring)
+#define URING_ENTRIES		4096
+#define URING_BUFFERS		1024	// provided receive buffers, a power of two
+#define URING_BUFFER_SIZE	4096
+
+// io_uring user_data: operation in the low byte, connection slot and generation above
+#define OP_ACCEPT			1
+#define OP_RECV				2
+#define OP_SEND				3
+#define OP_EPOLL			4		// the epoll set of the remaining descriptors is readable
+#define OP_READ				5		// request_read() of a coroutine handler
+#define OP_IGNORE			6		// cancellations and file table updates
+
+// connection states
+#define CONN_READ_HEADER	0
+#define CONN_READ_BODY		1
+#define CONN_DISPATCHED		2	// a forked handler owns the socket
+#define CONN_IDLE			3	// keep-alive, waiting for the next request
+#define CONN_QUEUED			4	// complete request waiting for a free handler slot
+#define CONN_FREE			5	// table entry on the free list
+#define CONN_WRITE			6	// the server sends a cached response itself
+#define CONN_COALESCED		7	// waiting for the handler rendering the same cache key
+#define CONN_RUNNING		8	// a coroutine handler runs the request in the server (-c)
+#define CONN_CLOSING		9	// closed, the ring may still read its response (-I uring)
+#define CONN_HANDSHAKE		10	// TLS handshake of a tls: listener's connection
+#define CONN_H2				11	// carries an HTTP/2 session, whose streams have entries of their own
+#define CONN_EVENTS			12	// streams the events of the topic it subscribed to (Server-Sent Events)
+#define CONN_PROXY			13	// its request is relayed to an upstream server, and the response back
+#define CONN_UPSTREAM		14	// the server's own connection to an upstream, carrying a client's request
+#define CONN_POOLED			15	// an idle upstream connection, kept for the next request to its server
+
+// exit status of a request handler, read back by the server
+#define WORKER_KEEP_ALIVE	0
+#define WORKER_CLOSE		1
+#define WORKER_WRITE_STALL	2
+#define WORKER_SUBSCRIBE	3		// the response opened an event stream, which the server carries on
+
+// what a message on the fill channel is
+#define FILL_RESPONSE		0		// a response for the cache
+#define FILL_PUBLISH		1		// an event for the topic named by key
+#define FILL_SUBSCRIBE		2		// the handler's connection subscribes to the topic named by key
+
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+// message on the fill channel, followed by the serialized response or event
+typedef struct {
+	int				kind;
+	int				connection;		// FILL_SUBSCRIBE: index and generation of the handler's connection
+	uint32_t		generation;
+	int				ttl;
+	int				stale;
+	const uint64_t	*version;		// shared memory, mapped at the same address in every process
+	uint64_t		version_seen;
+	char			key[CACHE_KEY_MAX];
+} fill_header_t;
+
+/*
+ * State a connection only has in some of its roles, each allocated when it
+ * takes that role and freed once it leaves it or closes, so that an idle
+ * keep-alive connection is only its table entry.
+ */
+
+// a request run by a coroutine handler in the server (-c), until it returns
+typedef struct {
+	coro_t					*coro;
+	struct request_state	*request;			// globals swapped in and out around its resumes
+	fill_header_t			*fill;				// its cache fill, stored once it returned; ttl 0 if none
+	int						wait_expired;		// request_wait() timed out
+	int						io_result;			// of its request_read()
+} handler_state_t;
+
+// a stream of an HTTP/2 session: an entry of its own, without a socket
+typedef struct {
+	struct connection		*session;			// the connection carrying it
+	uint32_t				generation;			// the session's when the stream opened
+	uint32_t				id;
+} stream_state_t;
+
+// an event stream's subscription (CONN_EVENTS)
+typedef struct {
+	hub_subscriber_t		subscriber;
+	hub_event_t				*event;				// the event being sent, NULL for a heartbeat
+	struct connection		*connection;
+} events_state_t;
+
+// a proxied request's side of the relay (CONN_PROXY), or an upstream connection's
+typedef struct {
+	proxy_upstream_t		*proxy;				// the upstream of the request, or of the connection to it
+	proxy_server_t			*server;			// of an upstream connection: the server it goes to
+	struct connection		*peer;				// the upstream connection of a proxied request, and the other way round
+	proxy_body_t			body;				// the body being relayed: the request's, or the response's
+	size_t					relaying;			// bytes at the start of buf the peer is sending
+	int						head_request;		// the proxied request is a HEAD
+	int						http10;				// and came as HTTP/1.0
+	int						dechunk;			// the response's chunked encoding is removed on the way
+	int						reusable;			// the upstream keeps the connection after the response
+	int						reused;				// the upstream connection was taken from the idle ones
+	int						response_started;	// the upstream's response head is in
+	int						request_sent;		// the upstream took bytes of the request
+	int						refusals;			// connections refused to a proxied request so far
+} relay_t;
+
+typedef struct connection {
+	int					fd;
+	int					state;
+	pid_t				worker;
+	int					class_index;		// its scheduling class
+	char				*buf;				// from the buffer pool, NULL while idle
+	size_t				capacity;			// its size class
+	size_t				length;				// bytes buffered
+	size_t				header_length;		// 0 until the blank line arrived
+	size_t				request_length;		// headers + body
+	uint64_t			state_start;		// ms, when the current state began
+	size_t				state_bytes;		// bytes received in the current state
+	uint64_t			queued_at;			// ms, when the request entered the queue
+	uint64_t			finish_tag;			// virtual time its class is done with it
+	timer_entry_t		timer;
+	struct sockaddr_storage	addr;
+	int					admin;				// came on an admin: listener
+	int					cache_session;		// the cache key includes the session cookie
+	struct connection	*next;				// free list or dispatched list
+	struct connection	*queue_prev, *queue_next;
+	char				*cache_key;			// NULL unless the request may be cached and missed it
+	cache_entry_t		*entry;				// cached response being sent (CONN_WRITE)
+	cache_entry_t		*refreshing;		// stale entry the dispatched handler replaces
+	struct iovec		out[4];				// head, Connection, blank line, body
+	int					out_count;
+	int					reuse;				// keep the connection after the cached response
+	int					write_waiting;		// registered for EPOLLOUT
+	pid_t				spawned;			// fork() result, read once the job is done
+	pool_job_t			spawn;				// forks the handler on a pool thread
+	struct flight		*flight;			// flight it leads, or waits on (CONN_COALESCED)
+	struct connection	*waiter_next;
+	char				*response;			// what the coroutine handler wrote, or the head for an upstream
+	size_t				response_length;
+	uint32_t			generation;			// tells completions for an earlier connection in the slot apart
+	int					receiving;			// multishot recv armed (-I uring)
+	int					sending;			// sendmsg in flight
+	int					peer_closed;		// no more input will come: end of stream, or more than the buffer holds
+	struct msghdr		message;
+	tls_t				*tls;				// TLS session, NULL on a plaintext listener
+	h2_session_t		*h2;				// HTTP/2 session of the connection (CONN_H2)
+	handler_state_t		*handler;			// while a coroutine handler runs the request (CONN_RUNNING)
+	stream_state_t		*stream;			// of an HTTP/2 stream, NULL otherwise
+	events_state_t		*events;			// once the response subscribed it to a topic
+	relay_t				*relay;				// of a proxied request and of an upstream connection
+	int					ktls;				// the kernel encrypts what is written to the socket
+	int					off_ring;			// moved to epoll to relay a request (-I uring)
+	int					paused;				// out of the epoll set until its peer catches up
+} connection_t;
+
+// a cache miss being rendered, and the identical requests waiting for its response
+typedef struct flight {
+	struct flight	*next;				// hash chain
+	connection_t	*leader;			// its request is with a handler or queued
+	connection_t	*waiters, *waiters_tail;
+	uint64_t		hash;
+	char			key[CACHE_KEY_MAX];
+} flight_t;
+
+// Sent without touching a handler when the server is over its limits
+static const char overloadedResponse[] =
+	"HTTP/1.1 503 Service Unavailable\r\n"
+	"Retry-After: 1\r\n"
+	"Content-Type: text/plain\r\n"
+	"Content-Length: 21\r\n"
+	"Connection: close\r\n"
+	"\r\n"
+	"Server is overloaded\n";
+
+// Sent for a proxied request the upstream did not answer
+static const char badGatewayResponse[] =
+	"HTTP/1.1 502 Bad Gateway\r\n"
+	"Content-Type: text/plain\r\n"
+	"Content-Length: 12\r\n"
+	"Connection: close\r\n"
+	"\r\n"
+	"Bad gateway\n";
+
+static const char gatewayTimeoutResponse[] =
+	"HTTP/1.1 504 Gateway Timeout\r\n"
+	"Content-Type: text/plain\r\n"
+	"Content-Length: 16\r\n"
+	"Connection: close\r\n"
+	"\r\n"
+	"Gateway timeout\n";
+
+// every server of the upstream is out after its failures
+static const char noUpstreamResponse[] =
+	"HTTP/1.1 503 Service Unavailable\r\n"
+	"Retry-After: 1\r\n"
+	"Content-Type: text/plain\r\n"
+	"Content-Length: 22\r\n"
+	"Connection: close\r\n"
+	"\r\n"
+	"No upstream available\n";
+
+static int listeners[LISTENERS_MAX];		// epoll tags are the entries' addresses
+static int listenerTls[LISTENERS_MAX];		// the listener's connections speak TLS
+static int listenerAdmin[LISTENERS_MAX];	// its connections may use the /admin routes
+static int listenerCount;
+static int epollfd, signalfd_;
+static int fillChannel[2] = { -1, -1 };	// SOCK_SEQPACKET pair: server end, handler end
+static char *fillBuffer;
+static int caching;						// the response cache is on
+static int signalTag, fillTag, poolTag;	// epoll markers for the non-connection fds
+static timer_wheel_t wheel;
+static uring_t ring;
+static int uring;						// the ring carries accept, recv and send (-I uring)
+static const int noFile = -1;			// clears a slot of the ring's file table
+
+static connection_t *connections;		// the connection table, server_limits.connections entries
+static connection_t *freeConnections;
+static int connectionsUsed;				// entries handed out so far; the pages of the rest are untouched
+static connection_t *dispatched;		// connections waiting on a handler process
+static int activeWorkers;
+static int activeCoroutines;			// coroutine handlers running
+static int spawning;					// handlers being forked by a pool thread
+
+// handlers that exited before the pool thread forking them reported the pid
+typedef struct { pid_t pid; int status; } early_exit_t;
+static early_exit_t *earlyExits;		// pid 0 if free
+static int earlyExitsSize;
+
+static flight_t *flights[FLIGHT_BUCKETS];
+
+// a scheduling class: its complete requests waiting for a handler slot, in order
+typedef struct {
+	const route_class_t	*config;
+	connection_t		*head, *tail;
+	int					waiting;
+	int					running;		// handlers it holds
+	uint64_t			cost;			// virtual time a request of it takes: WFQ_UNIT / weight
+	uint64_t			finish;			// finish tag of its last queued request
+} sched_class_t;
+
+static sched_class_t classes[METRIC_CLASSES_MAX];
+static int classCount;
+static uint64_t virtualTime;			// start tag of the request dispatched last
+static int drainingQueue;				// drainQueue() is running: it sees slots freed meanwhile
+static int openConnections;
+
+static int draining;					// stopped accepting, finishing in-flight requests
+static timer_entry_t drainTimer;
+
+static void openListeners(char *const *addresses, int count);
+static int respond(connection_t *);
+static void startHandler(connection_t *);
+
+typedef struct { char *name, *value; } header_t;
+static header_t reqhdr[17] = { {"\0", "\0"} };
+static int clientadmin;					// the request came on an admin: listener
+
+static char *buf;
+
+char	*method,
+		*uri,
+		*qs,
+		*prot,
+		*payload;
+int	  payload_size;
+const char *route_name;
+const char *route_class;
+const char *route_proxy;
+int	  route_classifying;
+int	  keep_alive;
+int	  cache_ttl, cache_stale, cache_session;
+static const uint64_t *cacheVersion;
+static uint64_t cacheVersionSeen;
+char	**server_argv;
+static char serverPath[PATH_MAX];		// the binary server_argv[0] named, found at startup
+int	  drain_timeout = 30;
+int	  cache_size = 8192;
+int	  pool_threads = -1;
+int	  handler_coroutines;
+int	  cpu_affinity;
+int	  io_backend = IO_BACKEND_EPOLL;
+
+tls_options_t server_tls = {
+	.tickets		= 2,
+	.session_cache	= 0,
+	.ktls			= 1,
+};
+
+http2_options_t server_http2 = {
+	.streams		= 100,
+	.window			= 1024,
+};
+
+limits_t server_limits = {
+	.connections	= 1024,
+	.workers		= 64,
+	.coroutines		= 256,
+	.queue_depth	= 256,
+	.queue_wait		= 2000,
+	.coalesce_wait	= 1000,
+};
+
+listener_t server_listener = {
+	.backlog		= 65535,		// the kernel caps it at net.core.somaxconn
+	.defer_accept	= 10,
+	.fastopen		= 256,
+	.busy_poll		= 0,
+	.nodelay		= 1,
+	.ipv6			= 1,
+};
+
+timeouts_t server_timeouts = {
+	.header_read	= 10,
+	.body_read		= 30,
+	.idle			= 5,
+	.write_stall	= 10,
+	.minimum_rate	= 128,
+	.heartbeat		= 15,
+};
+
+// the request globals above, one copy per coroutine handler
+typedef struct request_state {
+	char				*method, *uri, *qs, *prot, *payload, *buf;
+	int					payload_size;
+	const char			*route_name;
+	int					keep_alive;
+	int					cache_ttl, cache_stale, cache_session;
+	const uint64_t		*cacheVersion;
+	uint64_t			cacheVersionSeen;
+	header_t			reqhdr[17];
+	int					clientadmin;
+	FILE				*output;			// stdout
+	memstat_counters_t	*memstat;			// what allocations are counted for
+} request_state_t;
+
+static connection_t *running;			// whose coroutine handler runs right now
+static connection_t *responding;		// the forked handler's connection, in the handler
+static int subscribing;					// its response opens an event stream (request_subscribe())
+
+static void saveRequest(request_state_t *s)
+{
+	s->method = method;
+	s->uri = uri;
+	s->qs = qs;
+	s->prot = prot;
+	s->payload = payload;
+	s->buf = buf;
+	s->payload_size = payload_size;
+	s->route_name = route_name;
+	s->keep_alive = keep_alive;
+	s->cache_ttl = cache_ttl;
+	s->cache_stale = cache_stale;
+	s->cache_session = cache_session;
+	s->cacheVersion = cacheVersion;
+	s->cacheVersionSeen = cacheVersionSeen;
+	memcpy(s->reqhdr, reqhdr, sizeof(reqhdr));
+	s->clientadmin = clientadmin;
+	s->output = stdout;
+	s->memstat = memstatCounters();
+}
+
+static void loadRequest(const request_state_t *s)
+{
+	method = s->method;
+	uri = s->uri;
+	qs = s->qs;
+	prot = s->prot;
+	payload = s->payload;
+	buf = s->buf;
+	payload_size = s->payload_size;
+	route_name = s->route_name;
+	keep_alive = s->keep_alive;
+	cache_ttl = s->cache_ttl;
+	cache_stale = s->cache_stale;
+	cache_session = s->cache_session;
+	cacheVersion = s->cacheVersion;
+	cacheVersionSeen = s->cacheVersionSeen;
+	memcpy(reqhdr, s->reqhdr, sizeof(reqhdr));
+	clientadmin = s->clientadmin;
+	stdout = s->output;
+	memstatUse(s->memstat);
+}
+
+// install the globals kept in s and keep the current ones there instead
+static void swapRequest(request_state_t *s)
+{
+	request_state_t current;
+	saveRequest(&current);
+	loadRequest(s);
+	*s = current;
+}
+
+static void unqueue(connection_t *c)
+{
+	sched_class_t *class = &classes[c->class_index];
+	if (c->queue_prev) c->queue_prev->queue_next = c->queue_next;
+	else class->head = c->queue_next;
+	if (c->queue_next) c->queue_next->queue_prev = c->queue_prev;
+	else class->tail = c->queue_prev;
+	c->queue_prev = c->queue_next = NULL;
+	class->waiting--;
+}
+
+static void releaseCacheEntries(connection_t *c)
+{
+	if (c->entry) {
+		cacheRelease(c->entry);
+		c->entry = NULL;
+	}
+	if (c->refreshing) {
+		c->refreshing->refreshing = 0;
+		cacheRelease(c->refreshing);
+		c->refreshing = NULL;
+	}
+}
+
+// make the buffer hold need bytes, the request's terminating NUL included
+static int reserveInput(connection_t *c, size_t need)
+{
+	if (!c->buf) {
+		c->buf = bufpoolAcquire(need, &c->capacity);
+		return c->buf != NULL;
+	}
+	return bufpoolGrow(&c->buf, &c->capacity, c->length, need);
+}
+
+static void releaseInput(connection_t *c)
+{
+	bufpoolRelease(c->buf, c->capacity);
+	c->buf = NULL;
+	c->capacity = 0;
+}
+
+static uint64_t opData(connection_t *c, int op)
+{
+	return (uint64_t)c->generation << 32 | (uint64_t)(c - connections) << 8 | op;
+}
+
+// the connection a completion belongs to, NULL if it was closed since
+static connection_t *opConnection(uint64_t data)
+{
+	int index = (data >> 8) & 0xffffff;
+	if (index >= connectionsUsed) return NULL;
+	connection_t *c = &connections[index];
+	return c->generation == data >> 32 && c->state != CONN_FREE ? c : NULL;
+}
+
+// receive into provided buffers until the connection closes; the socket is slot c of the file table
+static void armRecv(connection_t *c)
+{
+	struct io_uring_sqe *sqe = uringSqe(&ring);
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = c - connections;
+	sqe->flags = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->buf_group = URING_BUFFER_GROUP;
+	sqe->user_data = opData(c, OP_RECV);
+	c->receiving = 1;
+}
+
+static void submitSend(connection_t *c)
+{
+	c->message = (struct msghdr){ .msg_iov = c->out, .msg_iovlen = c->out_count };
+
+	struct io_uring_sqe *sqe = uringSqe(&ring);
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->fd = c - connections;
+	sqe->flags = IOSQE_FIXED_FILE;
+	sqe->addr = (uint64_t)(uintptr_t)&c->message;
+	sqe->msg_flags = MSG_NOSIGNAL;
+	sqe->user_data = opData(c, OP_SEND);
+	c->sending = 1;
+}
+
+// put the socket in the ring's file table, then start receiving
+static void startReceiving(connection_t *c)
+{
+	struct io_uring_sqe *sqe = uringSqe(&ring);
+	sqe->opcode = IORING_OP_FILES_UPDATE;
+	sqe->fd = -1;
+	sqe->addr = (uint64_t)(uintptr_t)&c->fd;
+	sqe->len = 1;
+	sqe->off = c - connections;
+	sqe->flags = IOSQE_IO_LINK;
+	sqe->user_data = OP_IGNORE;
+	armRecv(c);
+}
+
+// cancel what the ring still does with the socket and drop the table's reference to it
+static void stopReceiving(connection_t *c)
+{
+	struct io_uring_sqe *sqe = uringSqe(&ring);
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = c - connections;
+	sqe->cancel_flags = IORING_ASYNC_CANCEL_ALL | IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_FD_FIXED;
+	sqe->user_data = OP_IGNORE;
+
+	sqe = uringSqe(&ring);
+	sqe->opcode = IORING_OP_FILES_UPDATE;
+	sqe->fd = -1;
+	sqe->addr = (uint64_t)(uintptr_t)&noFile;
+	sqe->len = 1;
+	sqe->off = c - connections;
+	sqe->user_data = OP_IGNORE;
+}
+
+// the server's own connection to an upstream server, not a client's
+static int isUpstream(const connection_t *c)
+{
+	return c->relay && c->relay->server;
+}
+
+// TLS connections are read through their session, so they stay on epoll under -I uring;
+// HTTP/2 streams have no socket, and the proxy's connections are read a buffer at a time
+static int onRing(const connection_t *c)
+{
+	return uring && !c->tls && !c->stream && !c->off_ring && !isUpstream(c);
+}
+
+// read the next request: with io_uring the recv stays armed and only what arrived meanwhile is handled
+static int watchConnection(connection_t *c)
+{
+	if (onRing(c) || c->stream) return 1;
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+	return epoll_ctl(epollfd, EPOLL_CTL_ADD, c->fd, &ev) == 0;
+}
+
+// leave the socket alone while a handler has the request; io_uring buffers what arrives meanwhile
+static void unwatchConnection(connection_t *c)
+{
+	if (!onRing(c) && !c->stream)
+		epoll_ctl(epollfd, EPOLL_CTL_DEL, c->fd, NULL);
+}
+
+static void leaveFlight(connection_t *c);
+static void landFlight(flight_t *f, cache_entry_t *entry, int pass);
+
+static void releaseConnection(connection_t *c)
+{
+	releaseCacheEntries(c);
+	releaseInput(c);
+	free(c->response);
+	c->response = NULL;
+	free(c->cache_key);
+	c->cache_key = NULL;
+	if (c->h2) {
+		h2Destroy(c->h2);
+		c->h2 = NULL;
+	}
+	if (c->handler) {
+		free(c->handler->fill);
+		free(c->handler);
+		c->handler = NULL;
+	}
+	if (c->events) {
+		hubUnsubscribe(&c->events->subscriber);
+		hubRelease(c->events->event);
+		free(c->events);
+		c->events = NULL;
+	}
+	free(c->stream);
+	c->stream = NULL;
+	free(c->relay);
+	c->relay = NULL;
+	c->state = CONN_FREE;
+	c->next = freeConnections;
+	freeConnections = c;
+	openConnections--;
+}
+
+static connection_t *liveSession(const connection_t *c);
+static void flushSession(connection_t *c);
+static void upstreamLost(connection_t *u, const char *response, int failed, int retry);
+static void unpoolUpstream(connection_t *u);
+
+static void closeConnection(connection_t *c)
+{
+	// a proxied request's upstream connection goes with it; an upstream
+	// connection that breaks answers its client, or gives it another
+	if (c->state == CONN_PROXY && c->relay->peer) {
+		connection_t *u = c->relay->peer;
+		proxyDone(u->relay->proxy, u->relay->server, -1, timerNowMs());
+		u->relay->peer = c->relay->peer = NULL;
+		closeConnection(u);
+	} else if (c->state == CONN_UPSTREAM && c->relay->peer) {
+		upstreamLost(c, badGatewayResponse, 1, 1);
+		return;
+	} else if (c->state == CONN_POOLED)
+		unpoolUpstream(c);
+
+	if (c->state == CONN_COALESCED)
+		leaveFlight(c);
+	else if (c->flight)
+		landFlight(c->flight, NULL, 0);
+
+	timerCancel(&wheel, &c->timer);
+	if (c->state == CONN_QUEUED)
+		unqueue(c);
+
+	// a stream the server did not answer is reset, its session goes on
+	if (c->stream) {
+		connection_t *session = liveSession(c);
+		if (session && c->stream->id)
+			h2Reset(session->h2, c->stream->id);
+		releaseConnection(c);
+		if (session)
+			flushSession(session);
+		return;
+	}
+
+	if (onRing(c))
+		stopReceiving(c);
+	else if (c->state == CONN_READ_HEADER || c->state == CONN_READ_BODY || c->state == CONN_IDLE || c->state == CONN_WRITE
+			 || c->state == CONN_HANDSHAKE || c->state == CONN_H2 || c->state == CONN_EVENTS
+			 || c->state == CONN_PROXY || c->state == CONN_UPSTREAM || c->state == CONN_POOLED)
+		unwatchConnection(c);
+	if (c->tls) {
+		tlsClose(c->tls);
+		c->tls = NULL;
+	}
+	close(c->fd);
+	if (!isUpstream(c))
+		METRIC_INC(METRIC_CONNECTIONS_CLOSED);
+
+	// the kernel may still be reading the response out of c->out
+	if (c->sending) {
+		c->state = CONN_CLOSING;
+		return;
+	}
+	releaseConnection(c);
+}
+
+static void respondStream(connection_t *c, const struct iovec *parts, int count);
+
+// answer a request the server refuses to hand to a handler, then close
+static void rejectConnection(connection_t *c, const char *response)
+{
+	if (c->stream) {
+		respondStream(c, &(struct iovec){ (char *)response, strlen(response) }, 1);
+		return;
+	}
+	if (c->tls && !c->ktls)
+		tlsWrite(c->tls, response, strlen(response));
+	else
+		send(c->fd, response, strlen(response), MSG_DONTWAIT | MSG_NOSIGNAL);
+	closeConnection(c);
+}
+
+static void enterState(connection_t *c, int state, uint64_t now)
+{
+	c->state = state;
+	c->state_start = now;
+	c->state_bytes = 0;
+}
+
+// schedule the next deadline or minimum-rate check of the current state
+static void armTimer(connection_t *c, uint64_t now)
+{
+	// a proxied request waits on its client while that sends the body or takes
+	// the response, on the upstream otherwise; a kept connection for its idle time
+	if (c->state == CONN_PROXY || c->state == CONN_UPSTREAM || c->state == CONN_POOLED) {
+		int seconds = c->state == CONN_POOLED ? c->relay->proxy->idle
+					: c->state == CONN_UPSTREAM ? (c->relay->peer && c->relay->peer->out_count ? 0 : c->relay->proxy->timeout)
+					: c->out_count ? server_timeouts.write_stall
+					: !c->relay->body.done && !c->relay->relaying ? server_timeouts.body_read
+					: 0;
+		if (seconds)
+			timerAdd(&wheel, &c->timer, c->state_start + (uint64_t)seconds * 1000);
+		else
+			timerCancel(&wheel, &c->timer);
+		return;
+	}
+
+	int writing = (c->state == CONN_H2 || c->state == CONN_EVENTS) && c->out_count;
+	int seconds = c->state == CONN_READ_HEADER || c->state == CONN_HANDSHAKE ? server_timeouts.header_read
+				: c->state == CONN_READ_BODY   ? server_timeouts.body_read
+				: c->state == CONN_WRITE || writing ? server_timeouts.write_stall
+				: c->state == CONN_EVENTS ? server_timeouts.heartbeat
+				: server_timeouts.idle;
+
+	// an event stream without heartbeats waits for its events as long as it takes
+	if (seconds == 0 && c->state == CONN_EVENTS) {
+		timerCancel(&wheel, &c->timer);
+		return;
+	}
+
+	uint64_t expires = c->state_start + (uint64_t)seconds * 1000;
+	if ((c->state == CONN_READ_HEADER || c->state == CONN_READ_BODY)
+		&& server_timeouts.minimum_rate > 0 && now + RATE_CHECK_MS < expires)
+		expires = now + RATE_CHECK_MS;
+
+	timerAdd(&wheel, &c->timer, expires);
+}
+
+static void admitRequest(connection_t *c, uint64_t now);
+static void resumeHandler(void *arg);
+static void sendHeartbeat(connection_t *c);
+static void readProxy(connection_t *c);
+
+static void onConnectionTimer(timer_entry_t *timer)
+{
+	connection_t *c = container_of(timer, connection_t, timer);
+	uint64_t now = timerNowMs();
+	uint64_t elapsed = now - c->state_start;
+
+	// the handler gave up waiting in request_wait()
+	if (c->state == CONN_RUNNING) {
+		c->handler->wait_expired = 1;
+		resumeHandler(c);
+		return;
+	}
+
+	if (c->state == CONN_IDLE) {
+		METRIC_INC(METRIC_TIMEOUT_IDLE);
+		closeConnection(c);
+		return;
+	}
+
+	// a session is idle while no handler has one of its requests, even with
+	// streams waiting on the client's window; it says GOAWAY before closing
+	if (c->state == CONN_H2) {
+		if (c->out_count) {
+			METRIC_INC(METRIC_TIMEOUT_WRITE);
+			closeConnection(c);
+		} else if (h2Busy(c->h2)) {
+			c->state_start = now;
+			armTimer(c, now);
+		} else {
+			METRIC_INC(METRIC_TIMEOUT_IDLE);
+			c->reuse = 0;
+			h2GoAway(c->h2);
+			flushSession(c);
+		}
+		return;
+	}
+
+	// an event stream sends a comment line after a quiet heartbeat
+	if (c->state == CONN_EVENTS) {
+		if (c->out_count) {
+			METRIC_INC(METRIC_TIMEOUT_WRITE);
+			closeConnection(c);
+		} else {
+			METRIC_INC(METRIC_EVENTS_HEARTBEATS);
+			sendHeartbeat(c);
+		}
+		return;
+	}
+
+	if (c->state == CONN_UPSTREAM) {
+		METRIC_INC(METRIC_PROXY_TIMEOUTS);
+		upstreamLost(c, gatewayTimeoutResponse, 1, 0);
+		return;
+	}
+	if (c->state == CONN_POOLED) {
+		closeConnection(c);
+		return;
+	}
+
+	// records TLS decrypted before the buffer filled are taken once it has room
+	if (c->state == CONN_PROXY) {
+		if (c->tls && !c->paused && !c->write_waiting && tlsPending(c->tls)) {
+			readProxy(c);
+			return;
+		}
+		METRIC_INC(c->out_count ? METRIC_TIMEOUT_WRITE : METRIC_TIMEOUT_BODY);
+		closeConnection(c);
+		return;
+	}
+
+	// no rate checks during a handshake: the deadline is the header read's
+	if (c->state == CONN_HANDSHAKE) {
+		METRIC_INC(METRIC_TIMEOUT_HEADER);
+		closeConnection(c);
+		return;
+	}
+
+	if (c->state == CONN_QUEUED) {
+		METRIC_INC(METRIC_SHED_QUEUE_WAIT);
+		metricsClassAdd(c->class_index, CLASS_METRIC_SHED, 1);
+		rejectConnection(c, overloadedResponse);
+		return;
+	}
+
+	if (c->state == CONN_WRITE) {
+		METRIC_INC(METRIC_TIMEOUT_WRITE);
+		closeConnection(c);
+		return;
+	}
+
+	// the response it waits for is taking too long: render it separately
+	if (c->state == CONN_COALESCED) {
+		METRIC_INC(METRIC_CACHE_COALESCE_TIMEOUTS);
+		leaveFlight(c);
+		admitRequest(c, now);
+		return;
+	}
+
+	int seconds = c->state == CONN_READ_HEADER ? server_timeouts.header_read : server_timeouts.body_read;
+	if (elapsed >= (uint64_t)seconds * 1000) {
+		METRIC_INC(c->state == CONN_READ_HEADER ? METRIC_TIMEOUT_HEADER : METRIC_TIMEOUT_BODY);
+		closeConnection(c);
+		return;
+	}
+
+	if (elapsed >= RATE_GRACE_MS && c->state_bytes * 1000 < (uint64_t)server_timeouts.minimum_rate * elapsed) {
+		METRIC_INC(METRIC_TIMEOUT_SLOW_RATE);
+		closeConnection(c);
+		return;
+	}
+
+	armTimer(c, now);
+}
+
+// value of a header in a raw header block, NULL if absent; *length excludes the CRLF
+static const char *findHeader(const char *headers, size_t length, const char *name, size_t *valueLength)
+{
+	const char *line = headers;
+	const char *end = headers + length;
+	size_t nameLength = strlen(name);
+
+	while (line < end) {
+		const char *eol = memmem(line, end - line, "\r\n", 2);
+		if (!eol) break;
+		if ((size_t)(eol - line) > nameLength && line[nameLength] == ':'
+			&& strncasecmp(line, name, nameLength) == 0) {
+			const char *value = line + nameLength + 1;
+			while (value < eol && (*value == ' ' || *value == '\t'))
+				value++;
+			*valueLength = eol - value;
+			return value;
+		}
+		line = eol + 2;
+	}
+	return NULL;
+}
+
+/*
+ * Content-Length of a complete header block, 0 if absent. The block is
+ * invalid (-1) when a Content-Length is not plain digits, when two of them
+ * disagree, or when a field name has whitespace before its colon or a line
+ * is folded (RFC 9112 section 5.1): the request could be framed one way
+ * here and another way by whoever sent it.
+ */
+static long contentLength(const char *headers, size_t length)
+{
+	const char *line = memmem(headers, length, "\r\n", 2);
+	const char *end = headers + length - 2;		// the blank line's CRLF
+	long result = -1;
+
+	while (line && (line += 2) < end) {
+		const char *eol = memmem(line, end + 2 - line, "\r\n", 2);
+		const char *colon = memchr(line, ':', eol - line);
+		if (!colon || colon == line) return -1;
+		for (const char *c = line; c < colon; c++)
+			if (*c <= ' ' || *c == 0x7f) return -1;
+
+		if (colon - line == 14 && strncasecmp(line, "Content-Length", 14) == 0) {
+			const char *value = colon + 1;
+			while (value < eol && (*value == ' ' || *value == '\t'))
+				value++;
+			if (value == eol || *value < '0' || *value > '9') return -1;
+			long parsed = 0;
+			for (; value < eol && *value >= '0' && *value <= '9'; value++) {
+				if (parsed > (LONG_MAX - 9) / 10) return -1;
+				parsed = parsed * 10 + (*value - '0');
+			}
+			for (; value < eol; value++)
+				if (*value != ' ' && *value != '\t') return -1;
+			if (result >= 0 && parsed != result) return -1;
+			result = parsed;
+		}
+		line = eol;
+	}
+	return result < 0 ? 0 : result;
+}
+
+// the same decision as wantsKeepAlive(), made on the raw request by the server
+static int rawKeepAlive(connection_t *c)
+{
+	const char *eol = memmem(c->buf, c->header_length, "\r\n", 2);
+	int http11 = eol && eol - c->buf >= 8 && memcmp(eol - 8, "HTTP/1.1", 8) == 0;
+
+	size_t length;
+	const char *connection = findHeader(c->buf, c->header_length, "Connection", &length);
+	if (http11)
+		return !connection || !(length == 5 && strncasecmp(connection, "close", 5) == 0);
+	return connection && length == 10 && strncasecmp(connection, "keep-alive", 10) == 0;
+}
+
+// method and path (without the query) of the request line in the raw head; 0 if malformed
+static int requestTarget(connection_t *c, char **method, size_t *methodLength, char **path, size_t *pathLength)
+{
+	char *end = c->buf + c->header_length;
+	char *space = memchr(c->buf, ' ', end - c->buf);
+	if (!space) return 0;
+	char *pathEnd = memchr(space + 1, ' ', end - space - 1);
+	if (!pathEnd) return 0;
+	char *query = memchr(space + 1, '?', pathEnd - space - 1);
+	if (query) pathEnd = query;
+
+	*method = c->buf;
+	*methodLength = space - c->buf;
+	*path = space + 1;
+	*pathLength = pathEnd - *path;
+	return 1;
+}
+
+/*
+ * Finds the route of a request whose head is in: route() runs on its method
+ * and path with route_classifying set, so the ROUTE macros return on the
+ * match before any handler code, leaving route_class and route_proxy set.
+ *
+ * Returns:
+ *   1 once route() ran, 0 if the request line is malformed.
+ */
+static int matchRoute(connection_t *c)
+{
+	char *requestMethod, *path;
+	size_t methodLength, pathLength;
+	if (!requestTarget(c, &requestMethod, &methodLength, &path, &pathLength))
+		return 0;
+
+	// terminate both in place for route()'s strcmp(), then put the bytes back
+	char methodEnd = requestMethod[methodLength], pathEnd = path[pathLength];
+	requestMethod[methodLength] = '\0';
+	path[pathLength] = '\0';
+	char *savedMethod = method, *savedUri = uri;
+	const char *savedName = route_name;
+	method = requestMethod;
+	uri = path;
+
+	route_classifying = 1;
+	route();
+	route_classifying = 0;
+
+	method = savedMethod;
+	uri = savedUri;
+	route_name = savedName;
+	requestMethod[methodLength] = methodEnd;
+	path[pathLength] = pathEnd;
+	return 1;
+}
+
+/*
+ * Finds the scheduling class of a complete request, which ROUTE_CLASS()
+ * names ahead of its route.
+ *
+ * Returns:
+ *   Index in classes, 0 (the default class) if the name is unknown.
+ */
+static int classifyRequest(connection_t *c)
+{
+	if (classCount == 1 || !matchRoute(c))
+		return 0;
+
+	for (int i = 0; route_class && i < classCount; i++)
+		if (strcmp(classes[i].config->name, route_class) == 0)
+			return i;
+	return 0;
+}
+
+/*
+ * Builds the cache key of a GET into key, CACHE_KEY_MAX bytes: "GET /login?x=1"
+ * for an anonymous request, "GET /home session=<token>" for a signed-in one.
+ * Requests that are never cached have none, including conditional ones, which
+ * the handler answers with 304 Not Modified.
+ *
+ * Returns:
+ *   1 if the request has a key, 0 otherwise.
+ */
+static int buildCacheKey(connection_t *c, char *key)
+{
+	c->cache_session = 0;
+	if (!caching || c->request_length != c->header_length) return 0;
+	if (c->header_length < 4 || memcmp(c->buf, "GET ", 4) != 0) return 0;
+
+	size_t length;
+	if (findHeader(c->buf, c->header_length, "If-None-Match", &length)
+		|| findHeader(c->buf, c->header_length, "If-Modified-Since", &length))
+		return 0;
+
+	const char *target = c->buf + 4;
+	const char *end = memchr(target, ' ', c->header_length - 4);
+	if (!end || end == target) return 0;
+
+	const char *token = NULL;
+	size_t tokenLength = 0;
+	const char *cookie = findHeader(c->buf, c->header_length, "Cookie", &length);
+	if (cookie && (token = memmem(cookie, length, "session=", 8))) {
+		token += 8;
+		const char *tokenEnd = memchr(token, ';', cookie + length - token);
+		tokenLength = (tokenEnd ? tokenEnd : cookie + length) - token;
+		if (tokenLength == 0) return 0;
+	}
+
+	int written = snprintf(key, CACHE_KEY_MAX, "%.*s%s%.*s",
+		(int)(end - c->buf), c->buf, token ? " session=" : "", (int)tokenLength, token ? token : "");
+	if (written < 0 || written >= CACHE_KEY_MAX)
+		return 0;
+	c->cache_session = token != NULL;
+	return 1;
+}
+
+static void runWorker(connection_t *c)
+{
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigprocmask(SIG_SETMASK, &mask, NULL);
+	signal(SIGCHLD, SIG_DFL);
+	signal(SIGPIPE, SIG_DFL);
+
+	// keep only the client socket and the fill channel: listener, epoll and every other connection go
+	dup2(c->fd, STDOUT_FILENO);
+	if (fillChannel[1] >= 0) {
+		if (fillChannel[1] != FILL_FD)
+			dup2(fillChannel[1], FILL_FD);
+		fillChannel[1] = FILL_FD;
+	}
+	close_range(FILL_FD + (fillChannel[1] >= 0), ~0U, 0);
+
+	struct timeval stall = { .tv_sec = server_timeouts.write_stall, .tv_usec = 0 };
+	setsockopt(STDOUT_FILENO, SOL_SOCKET, SO_SNDTIMEO, &stall, sizeof(stall));
+
+	// hold partial segments until respond() has written the whole response, so
+	// the head and the body's first bytes share packets instead of separate writes
+	int on = 1;
+	setsockopt(STDOUT_FILENO, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+
+	// run on the core that receives the client's packets, where its socket is hot (-A)
+	int cpu;
+	socklen_t cpuSize = sizeof(cpu);
+	if (affinityEnabled() && getsockopt(STDOUT_FILENO, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &cpuSize) == 0)
+		affinityPin(cpu);
+
+	profilerAttach();
+	exit(respond(c));
+}
+
+/*
+ * Forks a handler for the request, on a pool thread or on the event loop
+ * without one. The child has only the forking thread, and every lock another
+ * thread held at that moment stays held in it. glibc resets malloc's and
+ * stdio's in the child, and the pool turns itself off there; handler code
+ * must take no other lock. OpenSSL's are the ones to mind: the event loop
+ * holds them during TLS handshakes, so handlers do not call into OpenSSL
+ * (session tokens come from getrandom()), and a kTLS socket needs none.
+ */
+static void spawnWorker(pool_job_t *job)
+{
+	connection_t *c = container_of(job, connection_t, spawn);
+	c->spawned = fork();
+	if (c->spawned == 0)
+		runWorker(c);
+	if (c->spawned < 0)
+		c->spawned = -errno;		// errno is the pool thread's own
+}
+
+static void finishRequest(connection_t *c, int status);
+
+static void unlinkDispatched(connection_t *c)
+{
+	connection_t **link = &dispatched;
+	while (*link != c)
+		link = &(*link)->next;
+	*link = c->next;
+	activeWorkers--;
+	classes[c->class_index].running--;
+}
+
+// the handler's fork() returned: 1 if it runs, 0 if the request was refused
+static int workerStarted(connection_t *c)
+{
+	if (c->spawned < 0) {
+		errno = -c->spawned;
+		perror("fork() error");
+		unlinkDispatched(c);
+		rejectConnection(c, overloadedResponse);
+		return 0;
+	}
+
+	c->worker = c->spawned;
+	METRIC_INC(METRIC_REQUESTS_DISPATCHED);
+	return 1;
+}
+
+static void drainQueue(void);
+
+// a pool thread forked the handler, which may even have exited already
+static void spawnDone(pool_job_t *job)
+{
+	connection_t *c = container_of(job, connection_t, spawn);
+	spawning--;
+
+	if (workerStarted(c)) {
+		for (int i = 0; i < earlyExitsSize; i++) {
+			if (earlyExits[i].pid != c->worker) continue;
+
+			earlyExits[i].pid = 0;
+			unlinkDispatched(c);
+			finishRequest(c, earlyExits[i].status);
+			break;
+		}
+	}
+	drainQueue();
+}
+
+/*
+ * Hands a complete request to a forked handler. fork() copies the server's
+ * page tables, which grow with the cache, so it runs on a pool thread and the
+ * event loop keeps answering cached requests meanwhile.
+ */
+static void dispatch(connection_t *c)
+{
+	// the handler writes to a kTLS socket with blocking writes; the server left it non-blocking for its session
+	if (c->tls)
+		fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL) & ~O_NONBLOCK);
+
+	fflush(stdout);
+	c->state = CONN_DISPATCHED;
+	c->worker = 0;				// until fork() returns
+	c->next = dispatched;
+	dispatched = c;
+	activeWorkers++;
+	classes[c->class_index].running++;
+
+	c->spawn.run = spawnWorker;
+	c->spawn.done = spawnDone;
+	if (poolSubmit(&c->spawn)) {
+		spawning++;
+		return;
+	}
+
+	spawnWorker(&c->spawn);
+	workerStarted(c);
+}
+
+static int classifyRequest(connection_t *c);
+
+// the request's handler runs as a coroutine in the server: with -c, and where only the server can
+// write the response, to a TLS session the kernel does not encrypt for or to an HTTP/2 stream
+static int runsInServer(const connection_t *c)
+{
+	return handler_coroutines || (c->tls && !c->ktls) || c->stream;
+}
+
+/*
+ * Queues a complete request in its class, then starts it if a handler slot
+ * is free; sheds it when the class's queue is full. Coroutine handlers go the
+ * same way as forked ones, with slots of their own (-L coroutines=).
+ */
+static void admitRequest(connection_t *c, uint64_t now)
+{
+	timerCancel(&wheel, &c->timer);
+	unwatchConnection(c);
+
+	c->class_index = classifyRequest(c);
+	sched_class_t *class = &classes[c->class_index];
+	if (class->waiting >= (class->config->queue_depth ? class->config->queue_depth : server_limits.queue_depth)) {
+		METRIC_INC(METRIC_SHED_QUEUE_FULL);
+		metricsClassAdd(c->class_index, CLASS_METRIC_SHED, 1);
+		rejectConnection(c, overloadedResponse);
+		return;
+	}
+
+	// an idle class starts at the current virtual time: it cannot save up a share it did not use
+	c->finish_tag = (class->finish > virtualTime ? class->finish : virtualTime) + class->cost;
+	class->finish = c->finish_tag;
+
+	c->state = CONN_QUEUED;
+	c->queued_at = now;
+	c->queue_prev = class->tail;
+	c->queue_next = NULL;
+	if (class->tail) class->tail->queue_next = c;
+	else class->head = c;
+	class->tail = c;
+	class->waiting++;
+
+	drainQueue();
+	if (c->state != CONN_QUEUED)
+		return;
+
+	METRIC_INC(METRIC_REQUESTS_QUEUED);
+	metricsClassAdd(c->class_index, CLASS_METRIC_QUEUED, 1);
+	timerAdd(&wheel, &c->timer, now + server_limits.queue_wait);
+}
+
+/*
+ * Starts queued requests while handler slots are free, by weighted fair
+ * queuing: of the classes under their concurrency cap whose first request
+ * has a slot of its kind (a process, or a coroutine), the one whose first
+ * request has the earliest finish tag goes next. A request's tag is its
+ * class's previous tag plus WFQ_UNIT / weight, so under load each class is
+ * served in proportion to its weight.
+ */
+static void drainQueue(void)
+{
+	// a coroutine handler can finish before startHandler() returns; the loop below takes its slot
+	if (drainingQueue) return;
+	drainingQueue = 1;
+
+	uint64_t now = timerNowMs();
+	for (;;) {
+		int workerFree = activeWorkers < server_limits.workers;
+		int coroutineFree = activeCoroutines < server_limits.coroutines;
+		sched_class_t *next = NULL;
+		for (int i = 0; i < classCount; i++) {
+			sched_class_t *class = &classes[i];
+			if (class->head && (!class->config->concurrency || class->running < class->config->concurrency)
+				&& (runsInServer(class->head) ? coroutineFree : workerFree)
+				&& (!next || class->head->finish_tag < next->head->finish_tag))
+				next = class;
+		}
+		if (!next) break;
+
+		connection_t *c = next->head;
+		unqueue(c);
+		timerCancel(&wheel, &c->timer);
+		virtualTime = c->finish_tag - next->cost;
+		metricsAdd(METRIC_QUEUE_WAIT_MS, now - c->queued_at);
+		metricsClassAdd(c->class_index, CLASS_METRIC_QUEUE_WAIT_MS, now - c->queued_at);
+		metricsClassAdd(c->class_index, CLASS_METRIC_DISPATCHED, 1);
+		if (runsInServer(c))
+			startHandler(c);
+		else
+			dispatch(c);
+	}
+	drainingQueue = 0;
+}
+
+static void nextRequest(connection_t *c);
+
+// drop the fully sent parts of the response and advance into the first partial one
+static void advanceOutput(connection_t *c, size_t sent)
+{
+	int skip = 0;
+	while (skip < c->out_count && sent >= c->out[skip].iov_len)
+		sent -= c->out[skip++].iov_len;
+	c->out_count -= skip;
+	memmove(c->out, c->out + skip, c->out_count * sizeof(struct iovec));
+	if (c->out_count > 0) {
+		c->out[0].iov_base = (char *)c->out[0].iov_base + sent;
+		c->out[0].iov_len -= sent;
+	}
+}
+
+static void readSession(connection_t *c);
+static void enterEvents(connection_t *c);
+static void sendEvents(hub_subscriber_t *subscriber);
+static void proxyRequestSent(connection_t *u);
+static void proxyResponseSent(connection_t *c);
+
+// the response is out: wait for the next request or close
+static void writeFinished(connection_t *c)
+{
+	// a proxied exchange goes on with its other side
+	if (c->state == CONN_UPSTREAM || c->state == CONN_PROXY) {
+		if (c->write_waiting) {
+			struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+			epoll_ctl(epollfd, EPOLL_CTL_MOD, c->fd, &ev);
+			c->write_waiting = 0;
+		}
+		if (c->state == CONN_UPSTREAM)
+			proxyRequestSent(c);
+		else
+			proxyResponseSent(c);
+		return;
+	}
+
+	// an HTTP/2 session sends its next buffer; TLS may hold input that arrived meanwhile
+	if (c->h2) {
+		if (c->write_waiting) {
+			struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+			epoll_ctl(epollfd, EPOLL_CTL_MOD, c->fd, &ev);
+			c->write_waiting = 0;
+		}
+		h2Sent(c->h2);
+		if (c->tls)
+			readSession(c);
+		else
+			flushSession(c);
+		return;
+	}
+
+	// an event stream sends its next event, or waits for one
+	if (c->state == CONN_EVENTS) {
+		if (c->write_waiting) {
+			struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+			epoll_ctl(epollfd, EPOLL_CTL_MOD, c->fd, &ev);
+			c->write_waiting = 0;
+		}
+		hubRelease(c->events->event);
+		c->events->event = NULL;
+		sendEvents(&c->events->subscriber);
+		return;
+	}
+
+	if (c->entry) {
+		cacheRelease(c->entry);
+		c->entry = NULL;
+	}
+	free(c->response);
+	c->response = NULL;
+	timerCancel(&wheel, &c->timer);
+
+	// a coroutine handler's response that opened an event stream is not followed by requests
+	if (!c->reuse && !c->events) {
+		closeConnection(c);
+		return;
+	}
+	if (c->write_waiting) {
+		struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+		epoll_ctl(epollfd, EPOLL_CTL_MOD, c->fd, &ev);
+		c->write_waiting = 0;
+	}
+	if (c->events)
+		enterEvents(c);
+	else
+		nextRequest(c);
+}
+
+/*
+ * Encrypts the start of c->out in the server (no kTLS). Small parts, such as
+ * a cached response's head lines, are gathered into one record instead of
+ * a record each; a large one is passed as it is.
+ *
+ * Returns:
+ *   The bytes sent, -1 with errno as for send().
+ */
+static ssize_t sendTls(connection_t *c)
+{
+	static char record[TLS_RECORD_MAX];
+
+	if (c->out_count == 1 || c->out[0].iov_len >= TLS_RECORD_MAX)
+		return tlsWrite(c->tls, c->out[0].iov_base, c->out[0].iov_len);
+
+	// after EAGAIN the same bytes are gathered again, as tlsWrite() needs
+	size_t length = 0;
+	for (int i = 0; i < c->out_count && length < TLS_RECORD_MAX; i++) {
+		size_t part = c->out[i].iov_len < TLS_RECORD_MAX - length ? c->out[i].iov_len : TLS_RECORD_MAX - length;
+		memcpy(record + length, c->out[i].iov_base, part);
+		length += part;
+	}
+	return tlsWrite(c->tls, record, length);
+}
+
+// send the rest of a cached or coroutine handler's response; resumes on EPOLLOUT,
+// or on the completion of the ring's sendmsg
+static void writeConnection(connection_t *c)
+{
+	if (c->stream) {
+		respondStream(c, c->out, c->out_count);
+		return;
+	}
+	if (onRing(c)) {
+		if (c->out_count > 0)
+			submitSend(c);
+		else
+			writeFinished(c);
+		return;
+	}
+
+	while (c->out_count > 0) {
+		struct msghdr msg = { .msg_iov = c->out, .msg_iovlen = c->out_count };
+		ssize_t sent = c->tls && !c->ktls ? sendTls(c) : sendmsg(c->fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (sent < 0 && errno == EINTR)
+			continue;
+		if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			// a proxy's connection paused for reading is out of the epoll set
+			if (!c->write_waiting) {
+				struct epoll_event ev = { .events = EPOLLOUT, .data.ptr = c };
+				epoll_ctl(epollfd, c->paused ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, c->fd, &ev);
+				c->write_waiting = 1;
+				c->paused = 0;
+			}
+			return;
+		}
+		if (sent < 0) {
+			closeConnection(c);
+			return;
+		}
+		advanceOutput(c, sent);
+	}
+	writeFinished(c);
+}
+
+// answer from the cache without a handler: one sendmsg of head, Connection line and body
+static void sendCached(connection_t *c, cache_entry_t *entry, uint64_t now)
+{
+	static const char keepAliveLine[] = "Connection: keep-alive\r\n";
+	static const char closeLine[] = "Connection: close\r\n";
+
+	c->reuse = !draining && rawKeepAlive(c);
+	cacheRetain(entry);
+	c->entry = entry;
+
+	c->out[0] = (struct iovec){ entry->head, entry->headLength };
+	c->out[1] = c->reuse ? (struct iovec){ (char *)keepAliveLine, sizeof(keepAliveLine) - 1 }
+						 : (struct iovec){ (char *)closeLine, sizeof(closeLine) - 1 };
+	c->out[2] = (struct iovec){ "\r\n", 2 };
+	c->out[3] = (struct iovec){ entry->body, entry->bodyLength };
+	c->out_count = 4;
+
+	enterState(c, CONN_WRITE, now);
+	armTimer(c, now);
+	writeConnection(c);
+}
+
+/*
+ * Turns a connection whose response head went out into an event stream:
+ * from now on it only carries the events published to the topic it
+ * subscribed to, and a heartbeat comment while there are none. It holds
+ * no buffer; what the client sends is dropped, and its end closes the
+ * stream.
+ */
+static void enterEvents(connection_t *c)
+{
+	if (draining || c->peer_closed) {
+		closeConnection(c);
+		return;
+	}
+
+	releaseInput(c);
+	c->length = c->header_length = c->request_length = 0;
+	c->out_count = 0;
+	enterState(c, CONN_EVENTS, timerNowMs());
+	sendEvents(&c->events->subscriber);
+}
+
+// send the stream's oldest queued event unless it is still sending one (hub_notify_fn)
+static void sendEvents(hub_subscriber_t *subscriber)
+{
+	connection_t *c = container_of(subscriber, events_state_t, subscriber)->connection;
+	if (c->state != CONN_EVENTS || c->out_count > 0 || c->sending)
+		return;
+
+	uint64_t now = timerNowMs();
+	c->state_start = now;
+	c->events->event = hubNext(subscriber);
+	if (c->events->event) {
+		c->out[0] = (struct iovec){ c->events->event->data, c->events->event->length };
+		c->out_count = 1;
+		METRIC_INC(METRIC_EVENTS_SENT);
+	}
+	armTimer(c, now);
+	if (c->events->event)
+		writeConnection(c);
+}
+
+// a comment line, which EventSource ignores, keeps a quiet stream's connection in use
+static void sendHeartbeat(connection_t *c)
+{
+	static const char heartbeat[] = ":\n\n";
+
+	uint64_t now = timerNowMs();
+	c->state_start = now;
+	c->out[0] = (struct iovec){ (char *)heartbeat, sizeof(heartbeat) - 1 };
+	c->out_count = 1;
+	armTimer(c, now);
+	writeConnection(c);
+}
+
+// input on an event stream: only its end matters
+static void readEvents(connection_t *c)
+{
+	static char discard[TLS_RECORD_MAX];
+
+	for (;;) {
+		ssize_t rcvd = c->tls ? tlsRead(c->tls, discard, sizeof(discard)) : recv(c->fd, discard, sizeof(discard), MSG_DONTWAIT);
+		if (rcvd < 0 && errno == EINTR)
+			continue;
+		if (rcvd < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return;
+		if (rcvd <= 0) {
+			closeConnection(c);
+			return;
+		}
+	}
+}
+
+static flight_t *findFlight(const char *key)
+{
+	uint64_t hash = cacheKeyHash(key);
+	for (flight_t *f = flights[hash % FLIGHT_BUCKETS]; f; f = f->next)
+		if (f->hash == hash && strcmp(f->key, key) == 0)
+			return f;
+	return NULL;
+}
+
+// make c the leader of a new flight for its key; without memory it simply runs alone
+static flight_t *startFlight(connection_t *c)
+{
+	flight_t *f = calloc(1, sizeof(flight_t));
+	if (!f) return NULL;
+
+	snprintf(f->key, sizeof(f->key), "%s", c->cache_key);
+	f->hash = cacheKeyHash(f->key);
+	f->leader = c;
+	f->next = flights[f->hash % FLIGHT_BUCKETS];
+	flights[f->hash % FLIGHT_BUCKETS] = f;
+	c->flight = f;
+	return f;
+}
+
+static void joinFlight(connection_t *c, flight_t *f, uint64_t now)
+{
+	timerCancel(&wheel, &c->timer);
+	unwatchConnection(c);
+	enterState(c, CONN_COALESCED, now);
+
+	c->flight = f;
+	c->waiter_next = NULL;
+	if (f->waiters_tail) f->waiters_tail->waiter_next = c;
+	else f->waiters = c;
+	f->waiters_tail = c;
+
+	timerAdd(&wheel, &c->timer, now + server_limits.coalesce_wait);
+}
+
+// stop waiting (timeout or close); the connection leaves the flight untouched otherwise
+static void leaveFlight(connection_t *c)
+{
+	flight_t *f = c->flight;
+	connection_t **link = &f->waiters, *previous = NULL;
+	while (*link != c) {
+		previous = *link;
+		link = &(*link)->waiter_next;
+	}
+	*link = c->waiter_next;
+	if (f->waiters_tail == c)
+		f->waiters_tail = previous;
+	c->waiter_next = NULL;
+	c->flight = NULL;
+}
+
+/*
+ * Ends a flight once its leader's handler answered or went away.
+ *
+ * Parameters:
+ *   f     - The flight; it is freed.
+ *   entry - The leader's response, sent to every waiter, errors included.
+ *           NULL if there is none to share.
+ *   pass  - With no entry: 1 if the route does not cache this request, so each
+ *           waiter goes to its own handler; 0 if the leader failed (crashed,
+ *           disconnected), so the oldest waiter leads a new flight for the rest.
+ */
+static void landFlight(flight_t *f, cache_entry_t *entry, int pass)
+{
+	flight_t **link = &flights[f->hash % FLIGHT_BUCKETS];
+	while (*link != f)
+		link = &(*link)->next;
+	*link = f->next;
+	f->leader->flight = NULL;
+
+	connection_t *waiters = f->waiters;
+	uint64_t now = timerNowMs();
+
+	if (!entry && !pass && waiters) {
+		connection_t *leader = waiters;
+		waiters = leader->waiter_next;
+		leader->waiter_next = NULL;
+		leader->flight = NULL;
+
+		f->leader = leader;
+		f->waiters = waiters;
+		if (!waiters) f->waiters_tail = NULL;
+		f->next = flights[f->hash % FLIGHT_BUCKETS];
+		flights[f->hash % FLIGHT_BUCKETS] = f;
+		for (connection_t *w = waiters; w; w = w->waiter_next)
+			w->flight = f;
+		leader->flight = f;
+
+		admitRequest(leader, now);
+		return;
+	}
+	free(f);
+
+	while (waiters) {
+		connection_t *c = waiters;
+		waiters = c->waiter_next;
+		c->waiter_next = NULL;
+		c->flight = NULL;
+
+		if (!entry) {
+			admitRequest(c, now);
+			continue;
+		}
+
+		if (!watchConnection(c)) {
+			closeConnection(c);
+			continue;
+		}
+		METRIC_INC(METRIC_CACHE_COALESCED);
+		sendCached(c, entry, now);
+	}
+}
+
+/*
+ * Serves a complete request from the cache when possible. A stale entry is
+ * still served, except to the first request after it expired: that one goes
+ * to a handler whose response replaces the entry. On a miss, the first request
+ * goes to a handler and identical ones arriving meanwhile wait for its response
+ * (single flight) instead of each rendering the page again.
+ *
+ * Returns:
+ *   1 if the response is being sent from the cache, 0 if a handler is needed.
+ */
+static int serveFromCache(connection_t *c, uint64_t now)
+{
+	static char key[CACHE_KEY_MAX];
+	if (!buildCacheKey(c, key)) return 0;
+
+	int state;
+	cache_entry_t *entry = cacheLookup(key, now, &state);
+	int hit = state == CACHE_FRESH || (state == CACHE_STALE && entry->refreshing);
+
+	// the request goes on with its key: to the handler that fills the cache, or to wait for it
+	if (!hit && !(c->cache_key = strdup(key)))
+		return 0;
+	if (state == CACHE_PASS)
+		return 0;
+
+	// someone else's request for the same key is being rendered: wait for it
+	if (state == CACHE_MISS) {
+		flight_t *f = findFlight(c->cache_key);
+		if (!f) {
+			startFlight(c);
+			return 0;
+		}
+		joinFlight(c, f, now);
+		return 1;
+	}
+
+	if (state == CACHE_STALE && !entry->refreshing) {
+		entry->refreshing = 1;
+		cacheRetain(entry);
+		c->refreshing = entry;
+		return 0;
+	}
+
+	METRIC_INC(c->cache_session ? METRIC_CACHE_SESSION_HITS
+			 : state == CACHE_FRESH ? METRIC_CACHE_HITS : METRIC_CACHE_STALE_HITS);
+	sendCached(c, entry, now);
+	return 1;
+}
+
+/*
+ * Stores a handler's response in the cache and answers the requests waiting
+ * on it. An empty fill means the route does not cache the request; the key
+ * is marked so later requests skip the wait.
+ */
+static void storeFill(const fill_header_t *header, const char *response, size_t length)
+{
+	uint64_t now = timerNowMs();
+
+	cache_entry_t *entry = NULL;
+	if (length > 0)
+		entry = cacheEntryCreate(header->key, response, length);
+	if (!entry)
+		cacheInsertPass(header->key, now);
+	else if (cacheInsert(entry, header->ttl, header->stale, header->version, header->version_seen, now))
+		METRIC_INC(METRIC_CACHE_FILLS);
+
+	// a page rendered before its data changed is not shared with requests that came after
+	int outdated = entry && header->version
+				&& __atomic_load_n(header->version, __ATOMIC_ACQUIRE) != header->version_seen;
+
+	flight_t *f = findFlight(header->key);
+	if (f)
+		landFlight(f, outdated ? NULL : entry, !entry);
+	if (entry)
+		cacheRelease(entry);
+}
+
+/*
+ * Subscribes the connection to topic; it becomes an event stream once its
+ * response is out. A later subscription of the same response replaces it.
+ *
+ * Returns:
+ *   1 on success, 0 if the topic name is too long or memory ran out.
+ */
+static int subscribeConnection(connection_t *c, const char *topic)
+{
+	if (!c->events) {
+		c->events = calloc(1, sizeof(events_state_t));
+		if (!c->events)
+			return 0;
+		c->events->connection = c;
+	}
+	if (hubSubscribe(&c->events->subscriber, topic, sendEvents))
+		return 1;
+	free(c->events);
+	c->events = NULL;
+	return 0;
+}
+
+// a forked handler's connection subscribes; it becomes an event stream once the handler exits
+static void subscribeDispatched(const fill_header_t *header)
+{
+	if (header->connection < 0 || header->connection >= connectionsUsed)
+		return;
+	connection_t *c = &connections[header->connection];
+	if (c->generation == header->generation && c->state == CONN_DISPATCHED)
+		subscribeConnection(c, header->key);
+}
+
+// store the responses forked handlers sent back on the fill channel, and take their events and subscriptions
+static void receiveFills(void)
+{
+	ssize_t length;
+	while ((length = recv(fillChannel[0], fillBuffer, sizeof(fill_header_t) + CACHE_ENTRY_MAX, MSG_DONTWAIT | MSG_TRUNC)) > 0) {
+		if ((size_t)length < sizeof(fill_header_t) || (size_t)length > sizeof(fill_header_t) + CACHE_ENTRY_MAX)
+			continue;
+
+		fill_header_t *header = (fill_header_t *)fillBuffer;
+		header->key[CACHE_KEY_MAX - 1] = '\0';
+		const char *body = fillBuffer + sizeof(fill_header_t);
+		size_t bodyLength = length - sizeof(fill_header_t);
+		if (header->kind == FILL_PUBLISH)
+			hubPublish(header->key, body, bodyLength);
+		else if (header->kind == FILL_SUBSCRIBE)
+			subscribeDispatched(header);
+		else
+			storeFill(header, body, bodyLength);
+	}
+}
+
+static void handlerMain(void *arg);
+
+/*
+ * Runs the request on a coroutine in the server process (-c) instead of a
+ * forked handler. The handler writes its response to memory and suspends on
+ * storage calls and request_wait(); the server sends the response once the
+ * coroutine returns.
+ */
+static void startHandler(connection_t *c)
+{
+	c->handler = calloc(1, sizeof(handler_state_t));
+	if (c->handler)
+		c->handler->coro = coroCreate(handlerMain, resumeHandler, c);
+	if (!c->handler || !c->handler->coro) {
+		rejectConnection(c, overloadedResponse);
+		return;
+	}
+
+	c->state = CONN_RUNNING;				// handlerMain() sets up c->handler->request on its own stack
+	activeCoroutines++;
+	classes[c->class_index].running++;
+	METRIC_INC(METRIC_REQUESTS_DISPATCHED);
+	METRIC_INC(METRIC_CORO_HANDLERS);
+	resumeHandler(c);
+}
+
+static void handlerFinished(connection_t *c);
+
+// continue a coroutine handler; also its wake-up once an offloaded call is done
+static void resumeHandler(void *arg)
+{
+	connection_t *c = arg;
+
+	if (c->handler->request)
+		swapRequest(c->handler->request);
+	running = c;
+	int result = coroResume(c->handler->coro);
+	running = NULL;
+	if (c->handler->request)
+		swapRequest(c->handler->request);
+
+	if (result == CORO_FINISHED) {
+		activeCoroutines--;
+		classes[c->class_index].running--;
+		handlerFinished(c);
+		drainQueue();
+	}
+}
+
+// store the coroutine handler's fill, then send its response like a cached one
+static void handlerFinished(connection_t *c)
+{
+	handler_state_t *handler = c->handler;
+	c->handler = NULL;
+	releaseCacheEntries(c);
+
+	if (handler->fill) {
+		size_t length = handler->fill->ttl > 0 && c->response_length <= CACHE_ENTRY_MAX ? c->response_length : 0;
+		storeFill(handler->fill, c->response, length);
+		free(handler->fill);
+	}
+	free(handler);
+	if (c->flight)
+		landFlight(c->flight, NULL, 0);
+
+	if (!c->response || !watchConnection(c)) {
+		closeConnection(c);
+		return;
+	}
+
+	uint64_t now = timerNowMs();
+	c->reuse = c->reuse && !draining;
+	c->out[0] = (struct iovec){ c->response, c->response_length };
+	c->out_count = 1;
+	enterState(c, CONN_WRITE, now);
+	armTimer(c, now);
+	writeConnection(c);
+}
+
+// a peer on this host: loopback or a Unix socket
+static int addressIsLocal(const struct sockaddr_storage *addr)
+{
+	if (addr->ss_family == AF_INET) {
+		const struct sockaddr_in *in = (const struct sockaddr_in *)addr;
+		return (ntohl(in->sin_addr.s_addr) >> 24) == 127;
+	}
+	if (addr->ss_family == AF_INET6) {
+		const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *)addr;
+		return IN6_IS_ADDR_LOOPBACK(&in6->sin6_addr);
+	}
+	return addr->ss_family == AF_UNIX;
+}
+
+/*
+ * Charges a request whose head has arrived to its client's rate limits,
+ * before the body is read. The client is the peer's IP address, or for a
+ * Unix socket the peer's user; behind a reverse proxy on
+ * this host it is the last address the proxy appended to X-Forwarded-For.
+ *
+ * Returns:
+ *   NULL if the request may go on, or the 429 response to send.
+ */
+static const char *rateLimited(connection_t *c, uint64_t now)
+{
+	if (!ratelimitRuleCount()) return NULL;
+
+	char *requestMethod, *path;
+	size_t methodLength, pathLength;
+	if (!requestTarget(c, &requestMethod, &methodLength, &path, &pathLength))
+		return NULL;
+
+	const void *client = NULL;
+	size_t clientLength = 0;
+	struct ucred peer;
+	if (c->addr.ss_family == AF_INET) {
+		client = &((const struct sockaddr_in *)&c->addr)->sin_addr;
+		clientLength = sizeof(struct in_addr);
+	} else if (c->addr.ss_family == AF_INET6) {
+		client = &((const struct sockaddr_in6 *)&c->addr)->sin6_addr;
+		clientLength = sizeof(struct in6_addr);
+	} else {
+		// Unix sockets have no peer address: the user at the other end is the client, or
+		// failing that the connection (an HTTP/2 stream's is the one carrying it)
+		socklen_t peerLength = sizeof(peer);
+		const connection_t *carrier = c->stream ? c->stream->session : c;
+		memset(&peer, 0, sizeof(peer));
+		if (getsockopt(carrier->fd, SOL_SOCKET, SO_PEERCRED, &peer, &peerLength) == 0)
+			peer.pid = 0;
+		else
+			peer.pid = -(int)(carrier - connections) - 1;
+		client = &peer;
+		clientLength = sizeof(peer);
+	}
+
+	size_t length;
+	const char *forwarded = findHeader(c->buf, c->header_length, "X-Forwarded-For", &length);
+	if (forwarded && addressIsLocal(&c->addr)) {
+		const char *last = forwarded + length;
+		while (last > forwarded && last[-1] != ',')
+			last--;
+		while (last < forwarded + length && (*last == ' ' || *last == '\t'))
+			last++;
+		// an empty last entry would put every such request in one bucket
+		if (last < forwarded + length) {
+			client = last;
+			clientLength = forwarded + length - last;
+		}
+	}
+
+	return ratelimitCheck(client, clientLength, requestMethod, methodLength, path, pathLength, now);
+}
+
+static void startSession(connection_t *c, int upgrade);
+static void proxyRequest(connection_t *c, proxy_upstream_t *proxy, uint64_t now);
+
+// the upstream a ROUTE_PROXY() route relays the request to, NULL if the server answers it
+static proxy_upstream_t *proxyRoute(connection_t *c)
+{
+	if (!proxyUpstreamCount() || !matchRoute(c) || !route_proxy)
+		return NULL;
+	return proxyFind(route_proxy);
+}
+
+// an h2c upgrade the server takes: Upgrade names h2c, and HTTP2-Settings is there
+static int wantsHttp2(connection_t *c)
+{
+	size_t length;
+	const char *upgrade = findHeader(c->buf, c->header_length, "Upgrade", &length);
+	return upgrade && memmem(upgrade, length, "h2c", 3) && findHeader(c->buf, c->header_length, "HTTP2-Settings", &length);
+}
+
+// look for a complete request in the buffer and dispatch it
+static void processInput(connection_t *c, uint64_t now)
+{
+	// HTTP/2 with prior knowledge: the client's preface instead of a request
+	if (c->header_length == 0 && server_http2.streams > 0 && !c->stream && c->length > 0
+		&& memcmp(c->buf, H2_PREFACE, c->length < H2_PREFACE_LENGTH ? c->length : H2_PREFACE_LENGTH) == 0) {
+		if (c->length >= H2_PREFACE_LENGTH)
+			startSession(c, 0);
+		else if (c->peer_closed)
+			closeConnection(c);
+		else
+			armTimer(c, now);
+		return;
+	}
+
+	if (c->header_length == 0) {
+		char *end = memmem(c->buf, c->length, "\r\n\r\n", 4);
+		if (!end) {
+			if (c->length >= REQUEST_MAX - 1)
+				rejectConnection(c, "HTTP/1.1 431 Request Header Fields Too Large\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+			else if (c->peer_closed)
+				closeConnection(c);
+			else
+				armTimer(c, now);
+			return;
+		}
+
+		c->header_length = end + 4 - c->buf;
+		long body = contentLength(c->buf, c->header_length);
+		if (body < 0) {
+			rejectConnection(c, "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+			return;
+		}
+		// a proxied body is relayed as it arrives, of any size
+		proxy_upstream_t *proxy = proxyRoute(c);
+		if (!proxy && c->header_length + body > REQUEST_MAX - 1) {
+			rejectConnection(c, "HTTP/1.1 413 Content Too Large\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+			return;
+		}
+		// requests are framed by Content-Length alone; a chunked body would be read as the next request
+		size_t encodingLength;
+		if (findHeader(c->buf, c->header_length, "Transfer-Encoding", &encodingLength)) {
+			rejectConnection(c, "HTTP/1.1 501 Not Implemented\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+			return;
+		}
+		const char *limited = rateLimited(c, now);
+		if (limited) {
+			METRIC_INC(METRIC_SHED_RATE_LIMIT);
+			rejectConnection(c, limited);
+			return;
+		}
+		if (proxy) {
+			proxyRequest(c, proxy, now);
+			return;
+		}
+		c->request_length = c->header_length + body;
+		if (!reserveInput(c, c->request_length + 1)) {
+			closeConnection(c);
+			return;
+		}
+
+		if (c->length < c->request_length) {
+			enterState(c, CONN_READ_BODY, now);
+			c->state_bytes = c->length - c->header_length;
+		}
+	}
+
+	if (c->length < c->request_length) {
+		if (c->peer_closed)
+			closeConnection(c);
+		else
+			armTimer(c, now);
+		return;
+	}
+
+	if (server_http2.streams > 0 && !c->tls && !c->stream && wantsHttp2(c)) {
+		startSession(c, 1);
+		return;
+	}
+	if (serveFromCache(c, now))
+		return;
+	admitRequest(c, now);
+}
+
+// new bytes are at the end of the buffer
+static void inputReceived(connection_t *c, size_t length)
+{
+	uint64_t now = timerNowMs();
+	if (c->state == CONN_IDLE)
+		enterState(c, CONN_READ_HEADER, now);
+
+	c->length += length;
+	c->state_bytes += length;
+	processInput(c, now);
+}
+
+// the connection waits for request bytes
+static int readingInput(const connection_t *c)
+{
+	return c->state == CONN_READ_HEADER || c->state == CONN_READ_BODY || c->state == CONN_IDLE;
+}
+
+static void readConnection(connection_t *c)
+{
+	do {
+		// start with the smallest buffer, the next size once it is full
+		if (!reserveInput(c, c->length + 2)) {
+			closeConnection(c);
+			return;
+		}
+
+		size_t room = (c->capacity < REQUEST_MAX ? c->capacity : REQUEST_MAX) - 1 - c->length;
+		ssize_t rcvd = c->tls ? tlsRead(c->tls, c->buf + c->length, room)
+							  : recv(c->fd, c->buf + c->length, room, MSG_DONTWAIT);
+		if (rcvd < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+			return;
+		if (rcvd <= 0) {
+			closeConnection(c);
+			return;
+		}
+
+		inputReceived(c, rcvd);
+
+	// TLS is read until the socket is drained: the rest of a record the buffer did not
+	// take is not signalled by the socket, and under -I uring the epoll set is only
+	// looked at when something new arrives
+	} while (c->tls && readingInput(c));
+}
+
+/*
+ * Advances the TLS handshake of a tls: listener's connection. Once it is
+ * done, requests are read through the session. If the kernel took over the
+ * encryption (kTLS), responses are written to the socket as they are
+ * without TLS, by forked handlers too; otherwise the server encrypts them
+ * and the requests run on coroutines.
+ */
+static void handshakeConnection(connection_t *c)
+{
+	int result = tlsHandshake(c->tls);
+	if (result == TLS_HANDSHAKE_FAILED) {
+		METRIC_INC(METRIC_TLS_FAILURES);
+		closeConnection(c);
+		return;
+	}
+
+	// wait for room in the socket buffer, or for the client
+	int writing = result == TLS_HANDSHAKE_WRITE;
+	if (writing != c->write_waiting) {
+		struct epoll_event ev = { .events = writing ? EPOLLOUT : EPOLLIN, .data.ptr = c };
+		epoll_ctl(epollfd, EPOLL_CTL_MOD, c->fd, &ev);
+		c->write_waiting = writing;
+	}
+	if (result != TLS_HANDSHAKE_DONE)
+		return;
+
+	METRIC_INC(METRIC_TLS_HANDSHAKES);
+	if (tlsResumed(c->tls))
+		METRIC_INC(METRIC_TLS_RESUMED);
+	c->ktls = tlsKernelSend(c->tls);
+	if (c->ktls)
+		METRIC_INC(METRIC_TLS_KTLS);
+	if (tlsHttp2(c->tls)) {
+		startSession(c, 0);
+		return;
+	}
+
+	uint64_t now = timerNowMs();
+	enterState(c, CONN_READ_HEADER, now);
+	armTimer(c, now);
+	readConnection(c);
+}
+
+static int receiveSession(connection_t *c, const char *data, size_t length);
+static void receiveOffRing(connection_t *c, const char *data, size_t length);
+
+/*
+ * A completion of the multishot recv (-I uring). It stays armed while a
+ * handler has the request, so bytes can arrive in any state: they are only
+ * looked at in the read states, and the end of the input is noted for
+ * nextRequest() instead of closing under the handler.
+ */
+static void receiveCompleted(connection_t *c, int result, unsigned flags)
+{
+	if (!(flags & IORING_CQE_F_MORE))
+		c->receiving = 0;
+
+	// a proxied request's client went to epoll: what the recv took before it was cancelled comes first
+	if (c->off_ring) {
+		if (result > 0)
+			receiveOffRing(c, uringBuffer(&ring, flags >> IORING_CQE_BUFFER_SHIFT), result);
+		return;
+	}
+
+	int reading = c->state == CONN_READ_HEADER || c->state == CONN_READ_BODY || c->state == CONN_IDLE;
+	if (result == -ENOBUFS) {
+		armRecv(c);			// every buffer is taken until the loop catches up
+		return;
+	}
+
+	// an HTTP/2 session takes everything as it comes
+	if (c->state == CONN_H2) {
+		if (result <= 0) {
+			closeConnection(c);
+			return;
+		}
+		if (!c->receiving)
+			armRecv(c);
+		receiveSession(c, uringBuffer(&ring, flags >> IORING_CQE_BUFFER_SHIFT), result);
+		flushSession(c);
+		return;
+	}
+
+	// an event stream drops what the client sends, and closes with it
+	if (c->state == CONN_EVENTS) {
+		if (result <= 0)
+			closeConnection(c);
+		else if (!c->receiving)
+			armRecv(c);
+		return;
+	}
+	if (result <= 0) {
+		if (reading)
+			closeConnection(c);
+		else
+			c->peer_closed = 1;
+		return;
+	}
+
+	// a handler being forked copies the buffer right now, so it cannot move
+	size_t length = (size_t)result;
+	size_t need = c->length + length < REQUEST_MAX - 1 ? c->length + length + 1 : REQUEST_MAX;
+	int movable = reading || c->state != CONN_DISPATCHED || c->worker > 0;
+	if (movable && !reserveInput(c, need) && reading) {
+		closeConnection(c);
+		return;
+	}
+
+	// what does not fit is lost, so no request can follow it
+	size_t room = c->buf ? (c->capacity < REQUEST_MAX ? c->capacity : REQUEST_MAX) - 1 - c->length : 0;
+	if (length > room) {
+		length = room;
+		c->peer_closed = 1;
+	}
+	if (length)
+		memcpy(c->buf + c->length, uringBuffer(&ring, flags >> IORING_CQE_BUFFER_SHIFT), length);
+
+	if (!c->receiving && !c->peer_closed)
+		armRecv(c);
+
+	if (reading)
+		inputReceived(c, length);
+	else
+		c->length += length;
+}
+
+// an IPv4 client of the dual-stack listener arrives as ::ffff:a.b.c.d; keep it as IPv4
+static void unmapAddress(struct sockaddr_storage *addr)
+{
+	const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *)addr;
+	if (addr->ss_family != AF_INET6 || !IN6_IS_ADDR_V4MAPPED(&in6->sin6_addr))
+		return;
+
+	struct sockaddr_in in = { .sin_family = AF_INET, .sin_port = in6->sin6_port };
+	memcpy(&in.sin_addr, &in6->sin6_addr.s6_addr[12], sizeof(in.sin_addr));
+	memset(addr, 0, sizeof(*addr));
+	memcpy(addr, &in, sizeof(in));
+}
+
+// a cleared entry of the connection table, NULL if it is full
+static connection_t *takeConnection(void)
+{
+	if (!freeConnections && connectionsUsed == server_limits.connections)
+		return NULL;
+
+	// reuse a closed entry before touching a new one, so the table's memory follows the peak
+	connection_t *c = freeConnections;
+	if (c)
+		freeConnections = c->next;
+	else
+		c = &connections[connectionsUsed++];
+	uint32_t generation = c->generation;
+	memset(c, 0, sizeof(connection_t));
+	c->generation = generation + 1;		// completions for the entry's last connection are stale now
+	c->timer.callback = onConnectionTimer;
+	openConnections++;
+	return c;
+}
+
+// the session a stream came on, NULL once that connection is closed
+static connection_t *liveSession(const connection_t *c)
+{
+	connection_t *session = c->stream->session;
+	return session->generation == c->stream->generation && session->state == CONN_H2 ? session : NULL;
+}
+
+static connection_t *receivingSession;		// whose input is being taken: it sends once that is done
+
+/*
+ * Sends what the HTTP/2 session has queued, unless a send is under way. With
+ * nothing left to send it closes the connection once the session is over,
+ * and otherwise waits for the client.
+ */
+static void flushSession(connection_t *c)
+{
+	if (c == receivingSession || c->out_count > 0 || c->sending)
+		return;
+
+	uint64_t now = timerNowMs();
+	const char *data;
+	size_t length = h2Output(c->h2, &data);
+	if (length == 0 && (!c->reuse || h2Finished(c->h2))) {
+		closeConnection(c);
+		return;
+	}
+
+	c->state_start = now;
+	c->out[0] = (struct iovec){ (char *)data, length };
+	c->out_count = length > 0;
+	armTimer(c, now);
+	if (length > 0)
+		writeConnection(c);
+}
+
+// bytes from the client; responses they bring about go out together afterwards
+static int receiveSession(connection_t *c, const char *data, size_t length)
+{
+	receivingSession = c;
+	int ok = h2Receive(c->h2, data, length);
+	receivingSession = NULL;
+	return ok;
+}
+
+// what the session's socket holds, read until it would block
+static void readSession(connection_t *c)
+{
+	static char data[TLS_RECORD_MAX];
+
+	for (;;) {
+		ssize_t rcvd = c->tls ? tlsRead(c->tls, data, sizeof(data)) : recv(c->fd, data, sizeof(data), MSG_DONTWAIT);
+		if (rcvd < 0 && errno == EINTR)
+			continue;
+		if (rcvd < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+		if (rcvd <= 0) {
+			closeConnection(c);
+			return;
+		}
+		if (!receiveSession(c, data, rcvd))
+			break;			// only the GOAWAY is left to send
+	}
+	flushSession(c);
+}
+
+/*
+ * A request of an HTTP/2 session (h2_request_fn). The stream gets an entry
+ * of its own, without a socket, and its request goes the way of an HTTP/1.1
+ * one: rate limits, the cache, its scheduling class's queue, then a
+ * coroutine handler once the class and -L coroutines= have room. The
+ * response comes back through respondStream().
+ */
+static int openStream(void *owner, uint32_t stream, const char *request, size_t length)
+{
+	connection_t *session = owner;
+	connection_t *c = takeConnection();
+	if (!c) {
+		METRIC_INC(METRIC_SHED_CONNECTIONS);
+		return 0;
+	}
+	c->stream = malloc(sizeof(stream_state_t));
+	if (!c->stream) {
+		releaseConnection(c);
+		return 0;
+	}
+	c->fd = -1;
+	c->addr = session->addr;
+	c->admin = session->admin;
+	c->stream->session = session;
+	c->stream->generation = session->generation;
+	c->stream->id = stream;
+
+	uint64_t now = timerNowMs();
+	enterState(c, CONN_READ_HEADER, now);
+	if (!reserveInput(c, length + 1)) {
+		releaseConnection(c);
+		return 0;
+	}
+	memcpy(c->buf, request, length);
+	c->length = c->state_bytes = length;
+	METRIC_INC(METRIC_H2_STREAMS);
+	processInput(c, now);
+	return 1;
+}
+
+// a stream's response, handed to its session to send as the client's window allows
+static void respondStream(connection_t *c, const struct iovec *parts, int count)
+{
+	connection_t *session = liveSession(c);
+	if (session)
+		h2Respond(session->h2, c->stream->id, parts, count);
+	c->stream->id = 0;		// answered: there is nothing to reset
+	closeConnection(c);
+}
+
+/*
+ * Turns the connection into an HTTP/2 session: after ALPN h2, on the
+ * client's preface (prior knowledge), or to answer an h2c upgrade, whose
+ * request is the session's stream 1. What the buffer holds past that goes
+ * to the session, which reads the socket by itself from then on.
+ */
+static void startSession(connection_t *c, int upgrade)
+{
+	size_t settingsLength = 0;
+	const char *settings = upgrade ? findHeader(c->buf, c->header_length, "HTTP2-Settings", &settingsLength) : NULL;
+	c->h2 = h2Create(openStream, c, server_http2.streams, server_http2.window * 1024, REQUEST_MAX - 1,
+					 settings, settingsLength);
+	if (!c->h2) {
+		closeConnection(c);
+		return;
+	}
+
+	METRIC_INC(METRIC_H2_SESSIONS);
+	timerCancel(&wheel, &c->timer);
+	enterState(c, CONN_H2, timerNowMs());
+	c->reuse = 1;
+	if (draining)
+		h2GoAway(c->h2);
+
+	receivingSession = c;
+	size_t taken = 0;
+	if (upgrade) {
+		taken = c->request_length;
+		if (!openStream(c, 1, c->buf, c->request_length))
+			h2Reset(c->h2, 1);
+	}
+	if (c->length > taken)
+		h2Receive(c->h2, c->buf + taken, c->length - taken);
+	receivingSession = NULL;
+
+	c->length = c->header_length = c->request_length = 0;
+	releaseInput(c);
+	if (onRing(c))
+		flushSession(c);
+	else
+		readSession(c);
+}
+
+// open a connection for an accepted socket; a tls: listener's starts with the handshake
+static void openConnection(int fd, const struct sockaddr_storage *addr, int tls, int admin)
+{
+	METRIC_INC(METRIC_CONNECTIONS_ACCEPTED);
+
+	// connection table full: answer right away instead of holding the socket; TLS clients could not read it
+	connection_t *c = takeConnection();
+	if (!c) {
+		METRIC_INC(METRIC_SHED_CONNECTIONS);
+		if (!tls)
+			send(fd, overloadedResponse, sizeof(overloadedResponse) - 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+		close(fd);
+		return;
+	}
+	c->fd = fd;
+	c->addr = *addr;
+	unmapAddress(&c->addr);
+	c->admin = admin;
+
+	uint64_t now = timerNowMs();
+	enterState(c, CONN_READ_HEADER, now);
+	armTimer(c, now);
+
+	if (tls) {
+		// OpenSSL reads and writes the socket itself, so it must not block
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		c->tls = tlsAccept(fd);
+		c->state = CONN_HANDSHAKE;
+		if (!c->tls || !watchConnection(c)) {
+			closeConnection(c);
+			return;
+		}
+		handshakeConnection(c);		// with TCP_DEFER_ACCEPT the ClientHello is usually in
+		return;
+	}
+
+	if (onRing(c))
+		startReceiving(c);
+	else if (!watchConnection(c))
+		closeConnection(c);
+}
+
+// take every connection the listener has ready, not one per wakeup; the sockets
+// stay blocking for the handlers, the event loop passes MSG_DONTWAIT instead
+static void acceptConnection(int index)
+{
+	int listenfd = listeners[index];
+	for (;;) {
+		struct sockaddr_storage addr;
+		socklen_t addrlen = sizeof(addr);
+		int fd = accept4(listenfd, (struct sockaddr *) &addr, &addrlen, SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				perror("accept() error");
+			return;
+		}
+		openConnection(fd, &addr, listenerTls[index], listenerAdmin[index]);
+	}
+}
+
+// wait for the next request on a connection registered for EPOLLIN
+static void nextRequest(connection_t *c)
+{
+	// keep any pipelined bytes that followed the request; an idle connection holds no buffer
+	c->length -= c->request_length;
+	memmove(c->buf, c->buf + c->request_length, c->length);
+	if (!c->length)
+		releaseInput(c);
+	c->header_length = 0;
+	c->request_length = 0;
+	free(c->cache_key);
+	c->cache_key = NULL;
+
+	uint64_t now = timerNowMs();
+	enterState(c, c->length ? CONN_READ_HEADER : CONN_IDLE, now);
+	c->state_bytes = c->length;
+
+	// the client is done (-I uring), only what it sent before counts
+	if (c->peer_closed && !c->length) {
+		closeConnection(c);
+		return;
+	}
+
+	if (c->length)
+		processInput(c, now);
+	else
+		armTimer(c, now);
+
+	// records that arrived while the handler ran, or were left in the session
+	if (c->tls && readingInput(c))
+		readConnection(c);
+}
+
+// the client's address for X-Forwarded-For; a Unix socket's has none
+static const char *clientAddress(const connection_t *c, char *text, size_t size)
+{
+	const char *address = NULL;
+	if (c->addr.ss_family == AF_INET)
+		address = inet_ntop(AF_INET, &((const struct sockaddr_in *)&c->addr)->sin_addr, text, size);
+	else if (c->addr.ss_family == AF_INET6)
+		address = inet_ntop(AF_INET6, &((const struct sockaddr_in6 *)&c->addr)->sin6_addr, text, size);
+	return address ? address : "unknown";
+}
+
+/*
+ * Puts a connection of the proxy in the epoll set or takes it out: a side
+ * is not read while the other has not taken what it sent, which is the
+ * relay's flow control. One waiting to write is left as it is;
+ * writeFinished() puts it back on EPOLLIN.
+ */
+static void proxyWatch(connection_t *c, int reading)
+{
+	if (c->stream || c->write_waiting || reading == !c->paused)
+		return;
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+	epoll_ctl(epollfd, reading ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, c->fd, reading ? &ev : NULL);
+	c->paused = !reading;
+}
+
+// keep an upstream connection for its server's next request; it holds no buffer meanwhile
+static void poolUpstream(connection_t *u, uint64_t now)
+{
+	free(u->response);
+	u->response = NULL;
+	releaseInput(u);
+	u->length = 0;
+	u->relay->relaying = 0;
+	u->relay->response_started = u->relay->reusable = u->relay->dechunk = u->relay->reused = u->relay->request_sent = 0;
+	memset(&u->relay->body, 0, sizeof(u->relay->body));
+
+	proxyWatch(u, 1);			// to see the server close it
+	enterState(u, CONN_POOLED, now);
+	armTimer(u, now);
+	u->next = u->relay->server->idle;
+	u->relay->server->idle = u;
+	u->relay->server->idle_count++;
+}
+
+static void unpoolUpstream(connection_t *u)
+{
+	connection_t **link = &u->relay->server->idle;
+	while (*link != u)
+		link = &(*link)->next;
+	*link = u->next;
+	u->next = NULL;
+	u->relay->server->idle_count--;
+}
+
+// a kept connection became readable: the server closed it, or sent what no request asked for
+static void checkPooled(connection_t *u)
+{
+	char byte;
+	ssize_t rcvd = recv(u->fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+	if (rcvd < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+		return;
+	closeConnection(u);
+}
+
+/*
+ * Opens a connection to an upstream server; it is written to once EPOLLOUT
+ * tells the connect is done.
+ *
+ * Returns:
+ *   The connection; NULL with *failed set if the server refused it at once,
+ *   without if the server is out of descriptors or connection entries.
+ */
+static connection_t *openUpstream(proxy_server_t *server, int *failed)
+{
+	*failed = 0;
+	int fd = socket(server->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return NULL;
+	int on = 1;
+	if (server->addr.ss_family != AF_UNIX)
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+	if (connect(fd, (struct sockaddr *)&server->addr, server->addr_length) != 0 && errno != EINPROGRESS) {
+		*failed = 1;
+		close(fd);
+		return NULL;
+	}
+
+	connection_t *u = takeConnection();
+	struct epoll_event ev = { .events = EPOLLOUT, .data.ptr = u };
+	if (!u || !(u->relay = calloc(1, sizeof(relay_t))) || epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+		if (u)
+			releaseConnection(u);
+		close(fd);
+		return NULL;
+	}
+	u->fd = fd;
+	u->write_waiting = 1;
+	METRIC_INC(METRIC_PROXY_CONNECTS);
+	return u;
+}
+
+/*
+ * Sends a proxied request's head to the server proxyPick() chose, on a
+ * connection kept from an earlier request if the server has one; a new
+ * one sends it once connected.
+ */
+static void connectUpstream(connection_t *c, uint64_t now)
+{
+	proxy_server_t *server = proxyPick(c->relay->proxy, now);
+	if (!server) {
+		METRIC_INC(METRIC_PROXY_ERRORS);
+		rejectConnection(c, noUpstreamResponse);
+		return;
+	}
+
+	connection_t *u = server->idle;
+	int failed = 0;
+	if (u) {
+		unpoolUpstream(u);
+		u->relay->reused = 1;
+		METRIC_INC(METRIC_PROXY_REUSED);
+	} else if (!(u = openUpstream(server, &failed))) {
+		proxyDone(c->relay->proxy, server, failed ? 1 : -1, now);
+		if (failed && c->relay->body.mode == PROXY_BODY_NONE && ++c->relay->refusals < c->relay->proxy->count) {
+			METRIC_INC(METRIC_PROXY_RETRIES);
+			connectUpstream(c, now);
+			return;
+		}
+		METRIC_INC(METRIC_PROXY_ERRORS);
+		rejectConnection(c, failed ? badGatewayResponse : overloadedResponse);
+		return;
+	}
+
+	u->relay->proxy = c->relay->proxy;
+	u->relay->server = server;
+	u->relay->peer = c;
+	c->relay->peer = u;
+	c->relay->relaying = 0;
+	u->out[0] = (struct iovec){ c->response, c->response_length };
+	u->out_count = 1;
+	enterState(u, CONN_UPSTREAM, now);
+	armTimer(u, now);
+	if (u->relay->reused)
+		writeConnection(u);
+}
+
+/*
+ * Relays a request of a ROUTE_PROXY() route once its head is in: the head
+ * is rewritten for the upstream (proxyRequestHead()), and the body follows
+ * as it arrives, however large. Under -I uring the client moves to epoll,
+ * whose readiness lets the relay stop reading a side the other does not
+ * keep up with.
+ */
+static void proxyRequest(connection_t *c, proxy_upstream_t *proxy, uint64_t now)
+{
+	METRIC_INC(METRIC_PROXY_REQUESTS);
+	timerCancel(&wheel, &c->timer);
+	if (!c->relay && !(c->relay = calloc(1, sizeof(relay_t)))) {
+		rejectConnection(c, overloadedResponse);
+		return;
+	}
+	c->relay->proxy = proxy;
+
+	char address[INET6_ADDRSTRLEN];
+	int https = c->stream ? c->stream->session->tls != NULL : c->tls != NULL;
+	size_t length;
+	if (!proxyRequestBody(c->buf, c->header_length, &c->relay->body)
+		|| !(c->response = proxyRequestHead(c->buf, c->header_length, clientAddress(c, address, sizeof(address)),
+											https, &length))) {
+		rejectConnection(c, "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+		return;
+	}
+	const char *eol = memmem(c->buf, c->header_length, "\r\n", 2);
+	c->response_length = length;
+	c->reuse = !draining && rawKeepAlive(c);
+	c->relay->head_request = memcmp(c->buf, "HEAD ", 5) == 0;
+	c->relay->http10 = eol && eol - c->buf >= 8 && memcmp(eol - 8, "HTTP/1.0", 8) == 0;
+	c->relay->refusals = 0;
+
+	// the buffer holds the body from now on, and what follows it
+	c->length -= c->header_length;
+	memmove(c->buf, c->buf + c->header_length, c->length);
+	c->header_length = c->request_length = 0;
+	if (!reserveInput(c, PROXY_BUFFER)) {
+		closeConnection(c);
+		return;
+	}
+
+	if (onRing(c)) {
+		stopReceiving(c);
+		c->off_ring = 1;
+		if (!watchConnection(c)) {
+			closeConnection(c);
+			return;
+		}
+	}
+	enterState(c, CONN_PROXY, now);
+	connectUpstream(c, now);
+}
+
+/*
+ * Sends the body bytes the client's buffer holds on to the upstream. One
+ * piece is under way at a time and the client is not read while its
+ * buffer is full, so an upload takes PROXY_BUFFER bytes of the server
+ * however fast it comes.
+ */
+static void relayRequest(connection_t *c)
+{
+	connection_t *u = c->relay->peer;
+	uint64_t now = timerNowMs();
+
+	if (u && !u->out_count && !c->relay->body.done && c->length > 0) {
+		size_t payload;
+		size_t taken = proxyBodyScan(&c->relay->body, c->buf, c->length, 0, &payload);
+		if (c->relay->body.failed) {
+			if (u->relay->response_started || c->out_count)
+				closeConnection(c);
+			else
+				rejectConnection(c, "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+			return;
+		}
+		if (taken) {
+			c->relay->relaying = taken;
+			u->out[0] = (struct iovec){ c->buf, taken };
+			u->out_count = 1;
+			u->state_start = now;
+			armTimer(u, now);
+			writeConnection(u);
+			return;
+		}
+	}
+
+	c->state_start = now;
+	proxyWatch(c, !c->peer_closed && c->length < c->capacity);
+	armTimer(c, now);
+	if (c->tls && !c->paused && !c->write_waiting && tlsPending(c->tls))
+		timerAdd(&wheel, &c->timer, now);		// onConnectionTimer() reads it, off this call chain
+}
+
+// the upstream took what was sent: the head, or a piece of the body
+static void proxyRequestSent(connection_t *u)
+{
+	connection_t *c = u->relay->peer;
+	uint64_t now = timerNowMs();
+	u->relay->request_sent = 1;
+	u->state_start = now;
+	armTimer(u, now);
+	if (!c)
+		return;
+
+	c->length -= c->relay->relaying;
+	memmove(c->buf, c->buf + c->relay->relaying, c->length);
+	c->relay->relaying = 0;
+	relayRequest(c);
+}
+
+// request body from a proxied request's client, read while its buffer has room
+static void readProxy(connection_t *c)
+{
+	while (c->length < c->capacity) {
+		size_t room = c->capacity - c->length;
+		ssize_t rcvd = c->tls ? tlsRead(c->tls, c->buf + c->length, room) : recv(c->fd, c->buf + c->length, room, MSG_DONTWAIT);
+		if (rcvd < 0 && errno == EINTR)
+			continue;
+		if (rcvd < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+		if (rcvd <= 0) {
+			// done sending once its request is in: the response still goes out
+			if (rcvd == 0 && c->relay->body.done) {
+				c->peer_closed = 1;
+				break;
+			}
+			closeConnection(c);
+			return;
+		}
+		c->length += rcvd;
+		c->state_bytes += rcvd;
+	}
+	// a full buffer stops the reads until relayRequest() wants more, whose
+	// watch reports what is left: under -I uring nothing else would
+	if (c->length == c->capacity)
+		proxyWatch(c, 0);
+	relayRequest(c);
+}
+
+// bytes the ring's recv took from a client before it went to epoll (-I uring)
+static void receiveOffRing(connection_t *c, const char *data, size_t length)
+{
+	int movable = readingInput(c) || (c->state == CONN_PROXY && !c->relay->relaying);
+	if ((movable && !reserveInput(c, c->length + length + 1)) || !c->buf || c->capacity - c->length <= length) {
+		closeConnection(c);
+		return;
+	}
+	memcpy(c->buf + c->length, data, length);
+	if (readingInput(c)) {
+		inputReceived(c, length);
+		return;
+	}
+	c->length += length;
+	if (c->state == CONN_PROXY)
+		relayRequest(c);
+}
+
+static void finishProxy(connection_t *u);
+
+/*
+ * Ends an exchange whose upstream connection failed. A kept connection the
+ * server closed before answering is no failure of the server: a request
+ * without a body goes again on another connection, as it does to another
+ * server when the connection was refused, until each server had one
+ * refusal. Otherwise the client
+ * gets the response, or loses its connection if part of the upstream's
+ * already went out.
+ *
+ * Parameters:
+ *   response - 502 or 504.
+ *   failed   - The server is at fault: refused, reset, closed early, timed
+ *              out or malformed (counted by proxyDone()).
+ *   retry    - Nothing says the server saw the request.
+ */
+static void upstreamLost(connection_t *u, const char *response, int failed, int retry)
+{
+	connection_t *c = u->relay->peer;
+	uint64_t now = timerNowMs();
+	int stale = retry && u->relay->reused && !u->relay->response_started && u->length == 0;
+	int refused = retry && !u->relay->reused && !u->relay->request_sent;
+	int started = u->relay->response_started;
+	proxyDone(u->relay->proxy, u->relay->server, stale ? -1 : failed, now);
+	u->relay->peer = NULL;
+	closeConnection(u);
+	if (!c)
+		return;
+	c->relay->peer = NULL;
+	c->relay->relaying = 0;
+
+	if (c->relay->body.mode == PROXY_BODY_NONE && (stale || (refused && ++c->relay->refusals < c->relay->proxy->count))) {
+		METRIC_INC(METRIC_PROXY_RETRIES);
+		connectUpstream(c, now);
+		return;
+	}
+	if ((started && !c->stream) || c->out_count) {
+		closeConnection(c);
+		return;
+	}
+	METRIC_INC(METRIC_PROXY_ERRORS);
+	rejectConnection(c, response);
+}
+
+/*
+ * Takes the head of the upstream's final response: how its body comes, and
+ * the head the client gets instead (proxyResponseHead()).
+ *
+ * Returns:
+ *   1 on success, 0 if the exchange was given up.
+ */
+static int startResponse(connection_t *u, const proxy_response_t *response)
+{
+	connection_t *c = u->relay->peer;
+	u->relay->response_started = 1;
+	u->relay->body = response->body;
+	u->relay->reusable = response->keep_alive;
+
+	// an HTTP/1.0 client and an HTTP/2 stream take the body without the chunked
+	// encoding; a body only the end of the connection ends ends the client's too
+	u->relay->dechunk = u->relay->body.mode == PROXY_BODY_CHUNKED && (c->stream || c->relay->http10);
+	if (u->relay->dechunk || u->relay->body.mode == PROXY_BODY_CLOSE)
+		c->reuse = 0;
+
+	u->response = proxyResponseHead(u->buf, response->length, c->reuse, u->relay->dechunk, &u->response_length);
+	if (!u->response) {
+		upstreamLost(u, badGatewayResponse, 0, 0);
+		return 0;
+	}
+	u->length -= response->length;
+	memmove(u->buf, u->buf + response->length, u->length);
+	return 1;
+}
+
+/*
+ * Passes what the upstream sent on to the client: interim responses as
+ * they are to HTTP/1.1 clients, the final head, then the body a buffer at
+ * a time, the upstream not being read while the client is behind. An
+ * HTTP/2 stream takes its response whole, so it is collected first, up to
+ * PROXY_COLLECT_MAX.
+ */
+static void relayResponse(connection_t *u)
+{
+	connection_t *c = u->relay->peer;
+	uint64_t now = timerNowMs();
+	if (c->out_count)
+		return;
+
+	while (!u->relay->response_started) {
+		proxy_response_t response;
+		int parsed = proxyParseResponse(u->buf, u->length, c->relay->head_request, &response);
+		// a server that closed before its head was whole failed; nothing at all from a kept one may be retried
+		if (parsed == 0 && u->peer_closed) {
+			upstreamLost(u, badGatewayResponse, 1, 1);
+			return;
+		}
+		if (parsed == 0) {
+			proxyWatch(u, 1);
+			armTimer(u, now);
+			return;
+		}
+		// no protocol switch is relayed: the upstream answered an Upgrade the proxy dropped
+		if (parsed < 0 || response.status == 101) {
+			upstreamLost(u, badGatewayResponse, parsed < 0, 0);
+			return;
+		}
+		if (response.status >= 200) {
+			if (!startResponse(u, &response))
+				return;
+			break;
+		}
+
+		// 100 Continue, 103 Early Hints
+		if (!c->stream && !c->relay->http10) {
+			u->relay->relaying = response.length;
+			c->out[0] = (struct iovec){ u->buf, response.length };
+			c->out_count = 1;
+			c->state_start = now;
+			armTimer(c, now);
+			armTimer(u, now);
+			writeConnection(c);
+			return;
+		}
+		u->length -= response.length;
+		memmove(u->buf, u->buf + response.length, u->length);
+	}
+
+	size_t payload = 0, taken = u->length ? proxyBodyScan(&u->relay->body, u->buf, u->length, u->relay->dechunk, &payload) : 0;
+	if (u->relay->body.failed) {
+		upstreamLost(u, badGatewayResponse, 1, 0);
+		return;
+	}
+	if (u->relay->body.mode == PROXY_BODY_CLOSE && u->peer_closed && taken == u->length)
+		u->relay->body.done = 1;
+	// the rest of a Content-Length or chunked body will not come
+	if (u->peer_closed && !u->relay->body.done) {
+		upstreamLost(u, badGatewayResponse, 1, 0);
+		return;
+	}
+
+	if (c->stream) {
+		char *grown = u->response_length + payload <= PROXY_COLLECT_MAX ? realloc(u->response, u->response_length + payload) : NULL;
+		if (!grown) {
+			upstreamLost(u, badGatewayResponse, 0, 0);
+			return;
+		}
+		memcpy(grown + u->response_length, u->buf, payload);
+		u->response = grown;
+		u->response_length += payload;
+		u->length -= taken;
+		memmove(u->buf, u->buf + taken, u->length);
+		if (u->relay->body.done) {
+			finishProxy(u);
+			return;
+		}
+		proxyWatch(u, !u->peer_closed);
+		armTimer(u, now);
+		return;
+	}
+
+	int count = 0;
+	if (u->response)
+		c->out[count++] = (struct iovec){ u->response, u->response_length };
+	if (payload)
+		c->out[count++] = (struct iovec){ u->buf, payload };
+	u->relay->relaying = taken;
+	if (count) {
+		c->out_count = count;
+		c->state_start = now;
+		armTimer(c, now);
+		armTimer(u, now);
+		proxyWatch(u, !u->relay->body.done && !u->peer_closed && u->length < u->capacity);
+		writeConnection(c);
+		return;
+	}
+
+	// only chunk framing came
+	u->length -= taken;
+	memmove(u->buf, u->buf + taken, u->length);
+	u->relay->relaying = 0;
+	if (u->relay->body.done) {
+		finishProxy(u);
+		return;
+	}
+	proxyWatch(u, !u->peer_closed);
+	armTimer(u, now);
+}
+
+// the client took a piece of the response: send the next, or end the exchange
+static void proxyResponseSent(connection_t *c)
+{
+	connection_t *u = c->relay->peer;
+	if (!u)
+		return;
+
+	free(u->response);
+	u->response = NULL;
+	u->length -= u->relay->relaying;
+	memmove(u->buf, u->buf + u->relay->relaying, u->length);
+	u->relay->relaying = 0;
+	if (u->relay->body.done)
+		finishProxy(u);
+	else
+		relayResponse(u);
+}
+
+// response bytes from an upstream, read while its buffer has room
+static void readUpstream(connection_t *u)
+{
+	// a complete response's connection is looked at again once it is kept
+	if (!u->relay->peer || u->relay->body.done) {
+		proxyWatch(u, 0);
+		return;
+	}
+
+	// the head may take up to PROXY_HEAD_MAX; the body goes through
+	// PROXY_BUFFER, which does not move while the client is sent a piece of it
+	if (!u->relay->relaying) {
+		size_t need = u->relay->response_started || u->length + PROXY_BUFFER > PROXY_HEAD_MAX ? PROXY_BUFFER : u->length + PROXY_BUFFER;
+		if (!reserveInput(u, need < u->length ? u->length : need)) {
+			upstreamLost(u, badGatewayResponse, 0, 0);
+			return;
+		}
+	}
+
+	// until the socket is drained or the buffer full: under -I uring the epoll
+	// set is only looked at again when something new arrives
+	size_t before = u->length;
+	while (u->length < u->capacity) {
+		ssize_t rcvd = recv(u->fd, u->buf + u->length, u->capacity - u->length, MSG_DONTWAIT);
+		if (rcvd < 0 && errno == EINTR)
+			continue;
+		if (rcvd < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+
+		// the server is done: relayResponse() finishes a response that came
+		// whole, or ends the body that has no length, and fails a short one
+		if (rcvd == 0) {
+			u->peer_closed = 1;
+			break;
+		}
+		if (rcvd < 0) {
+			closeConnection(u);
+			return;
+		}
+		u->length += rcvd;
+	}
+	if (u->length == u->capacity || u->peer_closed)
+		proxyWatch(u, 0);
+	if (u->length == before && !u->peer_closed)
+		return;
+	u->state_start = timerNowMs();
+	relayResponse(u);
+}
+
+/*
+ * Ends a proxied exchange once the response is out. The upstream
+ * connection is kept for its server's next request if neither side is
+ * done with it: the request went out whole, nothing came after the
+ * response, and the server did not say close.
+ */
+static void finishProxy(connection_t *u)
+{
+	connection_t *c = u->relay->peer;
+	uint64_t now = timerNowMs();
+	int sent = c->relay->body.done && !u->out_count;
+	int stream = c->stream != NULL;
+
+	proxyDone(u->relay->proxy, u->relay->server, 0, now);
+	u->relay->peer = c->relay->peer = NULL;
+	free(c->response);
+	c->response = NULL;
+	if (stream)
+		respondStream(c, &(struct iovec){ u->response, u->response_length }, 1);
+
+	if (sent && u->relay->reusable && u->length == 0 && !u->peer_closed && !draining
+		&& u->relay->server->idle_count < u->relay->proxy->keepalive)
+		poolUpstream(u, now);
+	else
+		closeConnection(u);
+
+	if (stream)
+		return;
+	if (!c->reuse || !sent) {
+		closeConnection(c);
+		return;
+	}
+	free(c->relay);				// the next request may not be proxied
+	c->relay = NULL;
+	proxyWatch(c, 1);
+	nextRequest(c);
+}
+
+// a handler finished: keep the connection for the next request or close it
+static void finishRequest(connection_t *c, int status)
+{
+	releaseCacheEntries(c);
+
+	// the handler's fill may still be unread; without one the waiters need a new leader
+	if (c->flight)
+		receiveFills();
+	if (c->flight)
+		landFlight(c->flight, NULL, 0);
+
+	// the handler sent its subscription before it exited
+	if (status == WORKER_SUBSCRIBE && !c->events)
+		receiveFills();
+
+	if (status == WORKER_WRITE_STALL)
+		METRIC_INC(METRIC_TIMEOUT_WRITE);
+	int subscribed = status == WORKER_SUBSCRIBE && c->events;
+	if ((status != WORKER_KEEP_ALIVE && !subscribed) || draining) {
+		closeConnection(c);
+		return;
+	}
+
+	if (c->tls)
+		fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL) | O_NONBLOCK);
+	if (!watchConnection(c)) {
+		closeConnection(c);
+		return;
+	}
+
+	if (subscribed)
+		enterEvents(c);
+	else
+		nextRequest(c);
+}
+
+// keep the exit of a handler whose pid is not back from its pool thread yet
+static void keepEarlyExit(pid_t pid, int status)
+{
+	int i = 0;
+	while (i < earlyExitsSize && earlyExits[i].pid)
+		i++;
+
+	if (i == earlyExitsSize) {
+		early_exit_t *grown = realloc(earlyExits, 2 * earlyExitsSize * sizeof(early_exit_t));
+		if (!grown) {
+			perror("realloc() error");
+			return;
+		}
+		memset(grown + earlyExitsSize, 0, earlyExitsSize * sizeof(early_exit_t));
+		earlyExits = grown;
+		earlyExitsSize *= 2;
+	}
+	earlyExits[i] = (early_exit_t){ pid, status };
+}
+
+static void reapWorkers(void)
+{
+	pid_t pid;
+	int status;
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+		status = WIFEXITED(status) ? WEXITSTATUS(status) : WORKER_CLOSE;
+
+		connection_t **link = &dispatched;
+		while (*link && (*link)->worker != pid)
+			link = &(*link)->next;
+		if (!*link) {
+			if (spawning)
+				keepEarlyExit(pid, status);
+			continue;
+		}
+
+		connection_t *c = *link;
+		*link = c->next;
+		activeWorkers--;
+		classes[c->class_index].running--;
+		finishRequest(c, status);
+	}
+
+	drainQueue();
+}
+
+static void onDrainDeadline(timer_entry_t *timer)
+{
+	(void)timer;
+	fprintf(stderr, "Drain deadline reached, stopping %d handlers.\n", activeWorkers);
+	for (connection_t *c = dispatched; c; c = c->next)
+		if (c->worker > 0)
+			kill(c->worker, SIGTERM);
+	exit(0);
+}
+
+// stop accepting and let the in-flight requests finish (SIGTERM, SIGQUIT)
+static void startDrain(void)
+{
+	if (draining) return;
+	draining = 1;
+	fprintf(stderr, "Draining %d connections.\n", openConnections);
+
+	for (int i = 0; i < listenerCount; i++) {
+		if (uring) {
+			struct io_uring_sqe *sqe = uringSqe(&ring);
+			sqe->opcode = IORING_OP_ASYNC_CANCEL;
+			sqe->fd = listeners[i];
+			sqe->cancel_flags = IORING_ASYNC_CANCEL_ALL | IORING_ASYNC_CANCEL_FD;
+			sqe->user_data = OP_IGNORE;
+		}
+		epoll_ctl(epollfd, EPOLL_CTL_DEL, listeners[i], NULL);
+		close(listeners[i]);
+	}
+
+	// sessions take no new streams and close after their last; event streams
+	// never end by themselves, their clients reconnect to the next server;
+	// kept upstream connections are not needed any more
+	for (int i = 0; i < connectionsUsed; i++) {
+		if (connections[i].state == CONN_IDLE || connections[i].state == CONN_EVENTS || connections[i].state == CONN_POOLED)
+			closeConnection(&connections[i]);
+		else if (connections[i].state == CONN_H2) {
+			h2GoAway(connections[i].h2);
+			flushSession(&connections[i]);
+		}
+	}
+
+	drainTimer.callback = onDrainDeadline;
+	timerAdd(&wheel, &drainTimer, timerNowMs() + (uint64_t)drain_timeout * 1000);
+}
+
+// start the binary at the path this one was started from on the same listening
+// sockets (SIGUSR2); once it runs it asks this server to drain, so no
+// connection is ever refused
+static void upgradeBinary(void)
+{
+	if (draining) return;
+
+	pid_t parent = getpid();
+	fflush(stdout);
+	pid_t pid = fork();
+	if (pid < 0) {
+		perror("fork() error");
+		return;
+	}
+	if (pid > 0) {
+		fprintf(stderr, "Upgrading: started %s as %d.\n", serverPath, pid);
+		return;
+	}
+
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigprocmask(SIG_SETMASK, &mask, NULL);
+
+	// the listeners go to 3, 4, ... in order: first out of each other's way,
+	// then into place, where dup2() leaves them open across exec
+	int first = STDERR_FILENO + 1;
+	for (int i = 0; i < listenerCount; i++)
+		listeners[i] = fcntl(listeners[i], F_DUPFD_CLOEXEC, first + listenerCount);
+	char value[LISTENERS_MAX * 16];
+	value[0] = '\0';
+	for (int i = 0; i < listenerCount; i++) {
+		dup2(listeners[i], first + i);
+		snprintf(value + strlen(value), sizeof(value) - strlen(value), "%s%s%s%d", i ? "," : "",
+				 listenerTls[i] ? "tls:" : "", listenerAdmin[i] ? "admin:" : "", first + i);
+	}
+	close_range(first + listenerCount, ~0U, 0);
+	setenv(ENV_LISTEN_FD, value, 1);
+
+	snprintf(value, sizeof(value), "%d", (int)parent);
+	setenv(ENV_UPGRADE_FROM, value, 1);
+
+	execv(serverPath, server_argv);
+	perror("execv() error");
+	_exit(1);
+}
 
-#include <stdio.h>
-#include <string.h>
-#include <stdlib.h>
-#include <unistd.h>
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <sys/socket.h>
-#include <arpa/inet.h>
-#include <netdb.h>
-#include <fcntl.h>
-#include <signal.h>
+static void handleSignals(void)
+{
+	struct signalfd_siginfo info;
+	int workersExited = 0;
 
-#define CONNMAX 1000
+	while (read(signalfd_, &info, sizeof(info)) == sizeof(info)) {
+		switch (info.ssi_signo) {
+		case SIGCHLD:
+			workersExited = 1;
+			break;
+		case SIGTERM:
+		case SIGQUIT:
+			startDrain();
+			break;
+		case SIGHUP:
+			fprintf(stderr, "Reloading.\n");
+			reload();
+			break;
+		case SIGUSR2:
+			upgradeBinary();
+			break;
+		}
+	}
 
-static int listenfd, clients[CONNMAX];
-static void startServer(const char *);
-static void respond(int);
+	if (workersExited)
+		reapWorkers();
+}
 
-typedef struct { char *name, *value; } header_t;
-static header_t reqhdr[17] = { {"\0", "\0"} };
-static int clientfd;
+static void handleEvents(const struct epoll_event *events, int n)
+{
+	for (int i = 0; i < n; i++)
+	{
+		void *tag = events[i].data.ptr;
+		if (tag >= (void *)listeners && tag < (void *)(listeners + listenerCount))
+			acceptConnection((int *)tag - listeners);
+		else if (tag == &signalTag)
+			handleSignals();
+		else if (tag == &fillTag)
+			receiveFills();
+		else if (tag == &poolTag)
+			poolComplete();
+		else if (((connection_t *)tag)->state == CONN_FREE)
+			continue;		// closed with its peer by an earlier event of the batch
+		else if (((connection_t *)tag)->state == CONN_WRITE)
+			writeConnection(tag);
+		else if (((connection_t *)tag)->state == CONN_RUNNING)
+			resumeHandler(tag);		// what its request_wait() waits for
+		else if (((connection_t *)tag)->state == CONN_HANDSHAKE)
+			handshakeConnection(tag);
+		else if (((connection_t *)tag)->state == CONN_H2 && ((connection_t *)tag)->write_waiting)
+			writeConnection(tag);
+		else if (((connection_t *)tag)->state == CONN_H2)
+			readSession(tag);
+		else if (((connection_t *)tag)->state == CONN_EVENTS && ((connection_t *)tag)->write_waiting)
+			writeConnection(tag);
+		else if (((connection_t *)tag)->state == CONN_EVENTS)
+			readEvents(tag);
+		else if ((((connection_t *)tag)->state == CONN_PROXY || ((connection_t *)tag)->state == CONN_UPSTREAM)
+				 && ((connection_t *)tag)->write_waiting)
+			writeConnection(tag);
+		else if (((connection_t *)tag)->state == CONN_PROXY)
+			readProxy(tag);
+		else if (((connection_t *)tag)->state == CONN_UPSTREAM)
+			readUpstream(tag);
+		else if (((connection_t *)tag)->state == CONN_POOLED)
+			checkPooled(tag);
+		else
+			readConnection(tag);
+	}
+}
 
-static char *buf;
+// the listener's index goes where a connection's would
+static void armAccept(int index)
+{
+	struct io_uring_sqe *sqe = uringSqe(&ring);
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = listeners[index];
+	sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+	sqe->accept_flags = SOCK_CLOEXEC;
+	sqe->user_data = (uint64_t)index << 8 | OP_ACCEPT;
+}
 
-char	*method,
-		*uri,
-		*qs,
-		*prot,
-		*payload;
-int	  payload_size;
+// the epoll set still holds the signalfd, the fill channel, the pool and request_wait() descriptors
+static void armEpoll(void)
+{
+	struct io_uring_sqe *sqe = uringSqe(&ring);
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = epollfd;
+	sqe->poll32_events = EPOLLIN;
+	sqe->len = IORING_POLL_ADD_MULTI;
+	sqe->user_data = OP_EPOLL;
+}
+
+/*
+ * Moves the listener and the connections onto an io_uring (-I uring):
+ * multishot accept, multishot recv into provided buffers and sendmsg, with
+ * the sockets in a fixed file table at their connection's index. Needs
+ * Linux 6.0 for multishot recv; the kernel cannot be asked for that
+ * directly, so SEND_ZC, new in the same release, stands in for it.
+ *
+ * Returns:
+ *   1 if the ring runs, 0 to stay on epoll.
+ */
+static int startRing(void)
+{
+	if (!uringInit(&ring, URING_ENTRIES))
+		return 0;
+	if (!uringSupports(&ring, IORING_OP_SEND_ZC)
+		|| !uringProvideBuffers(&ring, URING_BUFFERS, URING_BUFFER_SIZE)
+		|| !uringRegisterFiles(&ring, server_limits.connections))
+	{
+		close(ring.fd);
+		errno = ENOSYS;
+		return 0;
+	}
+
+	for (int i = 0; i < listenerCount; i++) {
+		epoll_ctl(epollfd, EPOLL_CTL_DEL, listeners[i], NULL);
+		armAccept(i);
+	}
+	armEpoll();
+	uring = 1;
+	return 1;
+}
+
+static void acceptCompleted(int index, int fd, unsigned flags)
+{
+	if (!(flags & IORING_CQE_F_MORE) && !draining)
+		armAccept(index);
+	if (fd < 0) {
+		if (fd != -ECANCELED)
+			fprintf(stderr, "accept() error: %s\n", strerror(-fd));
+		return;
+	}
+	if (draining) {
+		close(fd);
+		return;
+	}
+
+	struct sockaddr_storage addr;
+	socklen_t addrlen = sizeof(addr);
+	if (getpeername(fd, (struct sockaddr *) &addr, &addrlen) != 0)
+		memset(&addr, 0, sizeof(addr));
+	openConnection(fd, &addr, listenerTls[index], listenerAdmin[index]);
+}
+
+static void handleCompletions(void)
+{
+	struct io_uring_cqe *cqe;
+	while ((cqe = uringCqe(&ring)))
+	{
+		uint64_t data = cqe->user_data;
+		int result = cqe->res;
+		unsigned flags = cqe->flags;
+		uringCqeSeen(&ring);
+
+		connection_t *c = opConnection(data);
+		switch (data & 0xff)
+		{
+		case OP_ACCEPT:
+			acceptCompleted((data >> 8) & 0xffffff, result, flags);
+			break;
+		case OP_RECV:
+			// the buffer is copied out before anything else can take it
+			if (c && c->state != CONN_CLOSING)
+				receiveCompleted(c, result, flags);
+			if (flags & IORING_CQE_F_BUFFER)
+				uringRecycleBuffer(&ring, flags >> IORING_CQE_BUFFER_SHIFT);
+			break;
+		case OP_SEND:
+			if (!c)
+				break;
+			c->sending = 0;
+			if (c->state == CONN_CLOSING)
+				releaseConnection(c);
+			else if (result < 0)
+				closeConnection(c);
+			else
+			{
+				advanceOutput(c, result);
+				writeConnection(c);
+			}
+			break;
+		case OP_EPOLL:
+		{
+			if (!(flags & IORING_CQE_F_MORE))
+				armEpoll();
+			// the poll fires once per wakeup, so take everything that is ready
+			struct epoll_event events[MAX_EVENTS];
+			int n;
+			do {
+				n = epoll_wait(epollfd, events, MAX_EVENTS, 0);
+				handleEvents(events, n);
+			} while (n == MAX_EVENTS);
+			break;
+		}
+		case OP_READ:
+			if (c && c->state == CONN_RUNNING)
+			{
+				c->handler->io_result = result;
+				resumeHandler(c);
+			}
+			break;
+		}
+	}
+}
+
+// the scheduling classes of route_classes, whose counters go under their names
+static void initClasses(void)
+{
+	for (classCount = 0; route_classes[classCount].name; classCount++) {
+		const route_class_t *config = &route_classes[classCount];
+		if (classCount == METRIC_CLASSES_MAX || config->weight < 1) {
+			fprintf(stderr, "Route class %s: at most %d classes, each of weight 1 or more.\n",
+					config->name, METRIC_CLASSES_MAX);
+			exit(1);
+		}
+		classes[classCount].config = config;
+		classes[classCount].cost = config->weight < WFQ_UNIT ? WFQ_UNIT / config->weight : 1;
+		metricsNameClass(classCount, config->name);
+	}
+
+	if (classCount == 0) {
+		fprintf(stderr, "route_classes needs at least the default class.\n");
+		exit(1);
+	}
+}
 
-void serve_forever(const char *PORT)
+void serve_forever(char *const *addresses, int count)
 {
-	struct sockaddr_in clientaddr;
-	socklen_t addrlen;
-	
-	int slot = 0;
-	
-	printf("Server started %shttp://127.0.0.1:%s%s\n","\033[92m",PORT,"\033[0m");
+	// execv() does not search PATH, and argv[0] may be relative to a directory left since:
+	// the upgrade runs whatever binary is at this path by then
+	ssize_t pathLength = readlink("/proc/self/exe", serverPath, sizeof(serverPath) - 1);
+	if (pathLength > 0)
+		serverPath[pathLength] = '\0';
+	else if (server_argv)
+		snprintf(serverPath, sizeof(serverPath), "%s", server_argv[0]);
+
+	initClasses();
+	openListeners(addresses, count);
+	fflush(stdout);
+
+	// tls: listeners: one context for all of them, sessions resumed across them
+	for (int i = 0; i < listenerCount; i++) {
+		if (!listenerTls[i]) continue;
+		if (!server_tls.certificate || !server_tls.key)
+		{
+			fprintf(stderr, "A tls: address needs a certificate and a key (-t cert=FILE,key=FILE).\n");
+			exit(1);
+		}
+		if (!tlsInit(server_tls.certificate, server_tls.key, server_tls.tickets,
+					 server_tls.session_cache, server_tls.ktls, server_http2.streams > 0))
+			exit(1);
+		// a client that closes mid-record must not kill the server through OpenSSL's writes
+		signal(SIGPIPE, SIG_IGN);
+		// without kTLS only this process can write to a session: say where those handlers run
+		if (!server_tls.ktls || access("/sys/module/tls", F_OK) != 0)
+			fprintf(stderr, "Kernel TLS is %s: tls: requests run as coroutine handlers in the server, %d at once (-L coroutines=).\n",
+					server_tls.ktls ? "not available (no tls module)" : "off", server_limits.coroutines);
+		break;
+	}
+
+	// every connection holds a descriptor, an idle event stream too: allow as many as the hard limit does
+	struct rlimit files;
+	if (getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur < files.rlim_max) {
+		files.rlim_cur = files.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &files);
+	}
+
+	// entries are taken in order as connections arrive: calloc() maps the table without touching it
+	connections = calloc(server_limits.connections, sizeof(connection_t));
+	if (!connections)
+	{
+		perror("calloc() error");
+		exit(1);
+	}
+
+	// handler exits and control signals are read from a signalfd in the loop
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGQUIT);
+	sigaddset(&mask, SIGHUP);
+	sigaddset(&mask, SIGUSR2);
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+	signalfd_ = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+
+	epollfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epollfd < 0 || signalfd_ < 0)
+	{
+		perror("epoll_create1() or signalfd() error");
+		exit(1);
+	}
+
+	struct epoll_event ev = { .events = EPOLLIN };
+	for (int i = 0; i < listenerCount; i++) {
+		ev.data.ptr = &listeners[i];
+		epoll_ctl(epollfd, EPOLL_CTL_ADD, listeners[i], &ev);
+	}
+	ev.data.ptr = &signalTag;
+	epoll_ctl(epollfd, EPOLL_CTL_ADD, signalfd_, &ev);
 
-	// Setting all elements to -1: signifies there is no client connected
-	int i;
-	for (i=0; i < CONNMAX; i++)
-		clients[i] = -1;
-	startServer(PORT);
-	
-	// Ignore SIGCHLD to avoid zombie threads
-	signal(SIGCHLD,SIG_IGN);
+	// response cache, filled by handlers over a datagram-per-response channel,
+	// which also carries their events and event stream subscriptions
+	caching = cacheInit((size_t)cache_size * 1024);
+	if ((fillBuffer = malloc(sizeof(fill_header_t) + CACHE_ENTRY_MAX))
+		&& socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fillChannel) == 0)
+	{
+		int size = FILL_SNDBUF;
+		setsockopt(fillChannel[1], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+		setsockopt(fillChannel[0], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+		ev.data.ptr = &fillTag;
+		epoll_ctl(epollfd, EPOLL_CTL_ADD, fillChannel[0], &ev);
+	}
+
+	// the event loop takes the first CPU, pool thread i the i-th after it (-A)
+	if (cpu_affinity && affinityInit())
+		affinityPin(affinityCpu(0));
+
+	// threads that fork the handlers, off the event loop
+	if (pool_threads < 0)
+		pool_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (pool_threads > POOL_THREADS_MAX)
+		pool_threads = POOL_THREADS_MAX;
+	earlyExitsSize = server_limits.workers;
+	earlyExits = calloc(earlyExitsSize, sizeof(early_exit_t));
+	int poolfd = earlyExits ? poolInit(pool_threads) : -1;
+	if (poolfd >= 0)
+	{
+		ev.data.ptr = &poolTag;
+		epoll_ctl(epollfd, EPOLL_CTL_ADD, poolfd, &ev);
+	}
 
-	// ACCEPT connections
-	while (1)
+	timerWheelInit(&wheel, timerNowMs());
+
+	// started by a binary upgrade: the old server can drain now
+	const char *upgradeFrom = getenv(ENV_UPGRADE_FROM);
+	if (upgradeFrom)
 	{
-		addrlen = sizeof(clientaddr);
-		clients[slot] = accept (listenfd, (struct sockaddr *) &clientaddr, &addrlen);
+		kill((pid_t)atoi(upgradeFrom), SIGQUIT);
+		unsetenv(ENV_UPGRADE_FROM);
+	}
 
-		if (clients[slot]<0)
+	if (io_backend == IO_BACKEND_URING && !startRing())
+		fprintf(stderr, "io_uring is not available (%s), using epoll.\n", strerror(errno));
+
+	struct epoll_event events[MAX_EVENTS];
+	while (!draining || openConnections > 0)
+	{
+		if (uring)
 		{
-			perror("accept() error");
+			int result = uringSubmit(&ring, timerNextTimeout(&wheel));
+			if (result < 0)
+			{
+				fprintf(stderr, "io_uring_enter() error: %s\n", strerror(-result));
+				exit(1);
+			}
+			handleCompletions();
 		}
 		else
 		{
-			if ( fork()==0 )
+			int n = epoll_wait(epollfd, events, MAX_EVENTS, timerNextTimeout(&wheel));
+			if (n < 0 && errno != EINTR)
 			{
-				respond(slot);
-				exit(0);
+				perror("epoll_wait() error");
+				exit(1);
 			}
+			handleEvents(events, n);
 		}
 
-		while (clients[slot]!=-1) slot = (slot+1) % CONNMAX;
+		timerAdvance(&wheel, timerNowMs());
+	}
+
+	fprintf(stderr, "Drained, exiting.\n");
+}
+
+/*
+ * Applies server_listener to a listening socket; a Unix socket only becomes
+ * non-blocking. Accepted connections inherit TCP_NODELAY and SO_BUSY_POLL.
+ * An option the kernel refuses (busy polling needs CAP_NET_ADMIN above
+ * net.core.busy_read) is reported and left off.
+ */
+static void tuneListener(int fd)
+{
+	const struct {
+		int level, name, value;
+		const char *label;
+	} options[] = {
+		// wake the loop when the request's first bytes are in, not at the handshake
+		{ IPPROTO_TCP, TCP_DEFER_ACCEPT, server_listener.defer_accept, "TCP_DEFER_ACCEPT" },
+		// take a request in the SYN from clients that saw us before
+		// (server side needs bit 0x2 in net.ipv4.tcp_fastopen)
+		{ IPPROTO_TCP, TCP_FASTOPEN, server_listener.fastopen, "TCP_FASTOPEN" },
+		{ SOL_SOCKET, SO_BUSY_POLL, server_listener.busy_poll, "SO_BUSY_POLL" },
+		{ IPPROTO_TCP, TCP_NODELAY, server_listener.nodelay != 0, "TCP_NODELAY" },
+	};
+
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+	struct sockaddr_storage addr;
+	socklen_t addrlen = sizeof(addr);
+	if (getsockname(fd, (struct sockaddr *) &addr, &addrlen) != 0 || addr.ss_family == AF_UNIX)
+		return;
+	for (size_t i = 0; i < sizeof(options) / sizeof(options[0]); i++) {
+		if (setsockopt(fd, options[i].level, options[i].name, &options[i].value, sizeof(int)) != 0)
+			fprintf(stderr, "Unable to set %s: %s\n", options[i].label, strerror(errno));
+	}
+}
+
+// take a listening socket for the life of the server; tls if its clients speak HTTPS,
+// admin if they may use the /admin routes
+static void addListener(int fd, int tls, int admin)
+{
+	if (listenerCount == LISTENERS_MAX)
+	{
+		fprintf(stderr, "More than %d listeners.\n", LISTENERS_MAX);
+		exit(1);
 	}
+	tuneListener(fd);
+	listenerTls[listenerCount] = tls;
+	listenerAdmin[listenerCount] = admin;
+	listeners[listenerCount++] = fd;
 }
 
-//start server
-void startServer(const char *port)
+// bind a TCP port on all addresses, or on 127.0.0.1 alone
+static int openTcp(const char *port, int loopback)
 {
 	struct addrinfo hints, *res, *p;
+	int fd = -1;
 
-	// getaddrinfo for host
+	// getaddrinfo for host: one IPv6 socket for both families, or IPv4 alone
+	// when IPv6 is off or the kernel has none
 	memset (&hints, 0, sizeof(hints));
-	hints.ai_family = AF_INET;
+	const char *host = loopback ? "127.0.0.1" : NULL;
+	hints.ai_family = server_listener.ipv6 && !loopback ? AF_INET6 : AF_INET;
 	hints.ai_socktype = SOCK_STREAM;
 	hints.ai_flags = AI_PASSIVE;
-	if (getaddrinfo(NULL, port, &hints, &res) != 0)
+	if (getaddrinfo(host, port, &hints, &res) != 0)
 	{
-		perror ("getaddrinfo() error");
-		exit(1);
+		hints.ai_family = AF_INET;
+		if (getaddrinfo(host, port, &hints, &res) != 0)
+		{
+			perror ("getaddrinfo() error");
+			exit(1);
+		}
+	}
+	// socket and bind, waiting a little if the port is still held by a previous server
+	for (int attempt = 0; attempt < BIND_ATTEMPTS; attempt++)
+	{
+		for (p = res; p!=NULL; p=p->ai_next)
+		{
+			int option = 1, v6only = 0;
+			fd = socket (p->ai_family, p->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+			if (fd == -1) continue;
+			setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &option, sizeof(option));
+			if (p->ai_family == AF_INET6)
+				setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only));
+			if (bind(fd, p->ai_addr, p->ai_addrlen) == 0) break;
+			close(fd);
+		}
+		if (p != NULL || errno != EADDRINUSE) break;
+		usleep(BIND_RETRY_US);
 	}
-	// socket and bind
-	for (p = res; p!=NULL; p=p->ai_next)
+	if (p == NULL && hints.ai_family == AF_INET6 && errno == EAFNOSUPPORT)
 	{
-		int option = 1;
-		listenfd = socket (p->ai_family, p->ai_socktype, 0);
-		setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &option, sizeof(option));
-		if (listenfd == -1) continue;
-		if (bind(listenfd, p->ai_addr, p->ai_addrlen) == 0) break;
+		freeaddrinfo(res);
+		server_listener.ipv6 = 0;
+		return openTcp(port, loopback);
 	}
 	if (p==NULL)
 	{
@@ -112,11 +3758,172 @@ void startServer(const char *port)
 	freeaddrinfo(res);
 
 	// listen for incoming connections
-	if ( listen (listenfd, 1000000) != 0 )
+	if ( listen (fd, server_listener.backlog) != 0 )
 	{
 		perror("listen() error");
 		exit(1);
 	}
+	return fd;
+}
+
+// 1 if a server accepts connections on the Unix socket, 0 if the file is left over
+static int unixSocketLive(const struct sockaddr_un *addr)
+{
+	int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	int live = connect(probe, (const struct sockaddr *) addr, sizeof(*addr)) == 0 || errno != ECONNREFUSED;
+	close(probe);
+	return live;
+}
+
+/*
+ * Binds a Unix socket at path, for a reverse proxy on the same host. A
+ * socket file left behind by a server that is gone is replaced; one that a
+ * running server accepts on is not. Who may connect follows the file's
+ * permissions, set by the umask.
+ */
+static int openUnix(const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if (strlen(path) >= sizeof(addr.sun_path))
+	{
+		fprintf(stderr, "%s: path too long for a Unix socket\n", path);
+		exit(1);
+	}
+	strcpy(addr.sun_path, path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+	{
+		perror("socket() error");
+		exit(1);
+	}
+
+	struct stat st;
+	int bound = bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0;
+	if (!bound && errno == EADDRINUSE && lstat(path, &st) == 0 && S_ISSOCK(st.st_mode) && !unixSocketLive(&addr))
+	{
+		unlink(path);
+		bound = bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0;
+	}
+	if (!bound || listen(fd, server_listener.backlog) != 0)
+	{
+		perror(path);
+		exit(1);
+	}
+	return fd;
+}
+
+// take the sockets systemd opened (socket activation): LISTEN_FDS of them
+// from descriptor 3 on, if LISTEN_PID says they are meant for this process;
+// those named "tls" (FileDescriptorName=tls) are HTTPS listeners, those
+// named "admin" admin listeners
+static void takeActivated(void)
+{
+	const char *pid = getenv("LISTEN_PID"), *fds = getenv("LISTEN_FDS");
+	const char *names = getenv("LISTEN_FDNAMES");
+	for (int i = 0; pid && fds && atoi(pid) == getpid() && i < atoi(fds); i++)
+	{
+		// names are separated by ':', in the order of the descriptors
+		int tls = names && strncmp(names, "tls", 3) == 0 && (names[3] == ':' || names[3] == '\0');
+		int admin = names && strncmp(names, "admin", 5) == 0 && (names[5] == ':' || names[5] == '\0');
+		if (names)
+			names = strchr(names, ':') ? strchr(names, ':') + 1 : NULL;
+
+		int fd = LISTEN_FDS_START + i, listening = 0;
+		socklen_t size = sizeof(listening);
+		if (getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &size) != 0 || !listening)
+		{
+			fprintf(stderr, "Descriptor %d from LISTEN_FDS is not a listening socket.\n", fd);
+			exit(1);
+		}
+		addListener(fd, tls, admin);
+	}
+
+	// not for the handlers, nor for a binary started by an upgrade
+	unsetenv("LISTEN_PID");
+	unsetenv("LISTEN_FDS");
+	unsetenv("LISTEN_FDNAMES");
+}
+
+// announce a listener by the address it is bound to
+static void printListener(int fd, int tls, int admin)
+{
+	struct sockaddr_storage addr;
+	socklen_t addrlen = sizeof(addr);
+	if (getsockname(fd, (struct sockaddr *) &addr, &addrlen) != 0)
+		return;
+
+	if (addr.ss_family == AF_UNIX)
+		printf("Server started %sunix:%s%s%s\n", "\033[92m", ((struct sockaddr_un *) &addr)->sun_path, "\033[0m",
+			   admin ? " (admin)" : "");
+	else
+	{
+		int port = addr.ss_family == AF_INET6 ? ntohs(((struct sockaddr_in6 *) &addr)->sin6_port)
+											  : ntohs(((struct sockaddr_in *) &addr)->sin_port);
+		printf("Server started %s%s://127.0.0.1:%d%s%s\n", "\033[92m", tls ? "https" : "http", port, "\033[0m",
+			   admin ? " (admin)" : "");
+	}
+}
+
+/*
+ * Opens the listening sockets: the ones handed over by the server this one
+ * replaces (SIGUSR2), or else those systemd passed and one per address.
+ * Exits if there is nothing to listen on.
+ *
+ * Parameters:
+ *   addresses - TCP ports ("8080"), TLS ports ("tls:8443") and Unix socket
+ *               paths ("unix:/run/cserver.sock"), any of the plain ones
+ *               prefixed "admin:" for an admin listener; an admin TCP port
+ *               is bound to 127.0.0.1 only.
+ *   count     - Number of addresses.
+ */
+static void openListeners(char *const *addresses, int count)
+{
+	// inherited from the server we are replacing; this binary's options still apply
+	const char *inherited = getenv(ENV_LISTEN_FD);
+	if (inherited)
+	{
+		const char *next = inherited;
+		while (*next)
+		{
+			int tls = strncmp(next, "tls:", 4) == 0;
+			if (tls) next += 4;
+			int admin = strncmp(next, "admin:", 6) == 0;
+			if (admin) next += 6;
+			char *end;
+			int fd = (int)strtol(next, &end, 10);
+			if (end == next) break;
+			addListener(fd, tls, admin);
+			if (listen(fd, server_listener.backlog) != 0)
+				perror("listen() error");
+			next = *end == ',' ? end + 1 : end;
+		}
+		unsetenv(ENV_LISTEN_FD);
+	}
+	else
+	{
+		takeActivated();
+		for (int i = 0; i < count; i++)
+		{
+			const char *address = addresses[i];
+			int admin = strncmp(address, "admin:", 6) == 0;
+			if (admin) address += 6;
+			if (strncmp(address, "unix:", 5) == 0)
+				addListener(openUnix(address + 5), 0, admin);
+			else if (!admin && strncmp(address, "tls:", 4) == 0)
+				addListener(openTcp(address + 4, 0), 1, 0);
+			else
+				addListener(openTcp(address, admin), 0, admin);
+		}
+	}
+
+	if (!listenerCount)
+	{
+		fprintf(stderr, "Nothing to listen on.\n");
+		exit(1);
+	}
+	for (int i = 0; i < listenerCount; i++)
+		printListener(listeners[i], listenerTls[i], listenerAdmin[i]);
 }
 
 
@@ -132,73 +3939,387 @@ char *request_header(const char *name)
 	return NULL;
 }
 
-//client connection
-void respond(int n)
+// check whether the current request came on an admin: listener, from the client itself:
+// a request relayed by a proxy (X-Forwarded-For) is not trusted even there
+int request_is_admin(void)
+{
+	if (!clientadmin) return 0;
+	for (header_t *h = reqhdr; h->name; h++)
+		if (strcasecmp(h->name, "X-Forwarded-For") == 0)
+			return 0;
+	return 1;
+}
+
+// describe the response being rendered for the cache
+static void fillHeader(fill_header_t *header, const char *key)
+{
+	*header = (fill_header_t){
+		.kind = FILL_RESPONSE,
+		.ttl = cache_ttl,
+		.stale = cache_stale,
+		.version = cacheVersion,
+		.version_seen = cacheVersionSeen,
+	};
+	snprintf(header->key, sizeof(header->key), "%s", key);
+}
+
+// send a message and what follows it to the server; 1 if the channel took it
+static int sendChannel(const fill_header_t *header, const char *body, size_t length)
+{
+	struct iovec parts[2] = {
+		{ (void *)header, sizeof(*header) },
+		{ (void *)body, length },
+	};
+	struct msghdr message = { .msg_iov = parts, .msg_iovlen = 2 };
+	return sendmsg(fillChannel[1], &message, MSG_DONTWAIT | MSG_NOSIGNAL) >= 0;
+}
+
+// hand a copy of a cacheable response to the server
+static void sendFill(const char *key, const char *response, size_t length)
+{
+	fill_header_t header;
+	fillHeader(&header, key);
+
+	// a full channel only costs the cache a fill
+	sendChannel(&header, response, length);
+}
+
+/*
+ * Ties the response being rendered to a version counter in shared memory
+ * (e.g. profileVersion()). Call it before reading the data the page shows;
+ * a CACHE_PER_SESSION() copy is served only while the counter is unchanged.
+ */
+void cache_depends_on(const uint64_t *version)
+{
+	cacheVersion = version;
+	if (version)
+		cacheVersionSeen = __atomic_load_n(version, __ATOMIC_ACQUIRE);
+}
+
+// decide whether the connection may carry another request after this one
+static int wantsKeepAlive(void)
+{
+	const char *connection = request_header("Connection");
+	if (strcmp(prot, "HTTP/1.1") == 0)
+		return !connection || strcasecmp(connection, "close") != 0;
+	return connection && strcasecmp(connection, "keep-alive") == 0;
+}
+
+// anonymous routes only cache anonymous requests and vice versa
+static int responseCacheable(const connection_t *c)
+{
+	if (cache_ttl <= 0 || cache_session != c->cache_session || (cache_session && !cacheVersion))
+		return 0;
+	METRIC_INC(cache_session ? METRIC_CACHE_SESSION_MISSES : METRIC_CACHE_MISSES);
+	return 1;
+}
+
+// split the framed request in request into the globals; 0 if the request line is malformed
+static int parseRequest(connection_t *c, char *request)
+{
+	// the server framed the request; terminate the header block and the body
+	buf = request;
+	buf[c->header_length - 2] = '\0';
+	buf[c->request_length] = '\0';
+
+	method 	= strtok(buf,  " \t\r\n");
+	uri		= strtok(NULL, " \t");
+	prot   	= strtok(NULL, " \t\r\n");
+
+	if (!method || !uri || !prot)
+	{
+		fprintf(stderr, "Malformed request line.\n");
+		printf("HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+		return 0;
+	}
+
+	fprintf(stderr, "\x1b[32m + [%s] %s\x1b[0m\n", method, uri);
+
+	if ((qs = strchr(uri, '?')))
+	{
+		*qs++ = '\0'; //split URI
+	} else {
+		qs = uri - 1; //use an empty string
+	}
+
+	header_t *h = reqhdr;
+	while(h < reqhdr+16) {
+		char *k,*v;
+		k = strtok(NULL, "\r\n: \t"); if (!k) break;
+		v = strtok(NULL, "\r\n");	 if (!v) v = "";
+		while(*v && *v==' ') v++;
+		h->name  = k;
+		h->value = v;
+		h++;
+		fprintf(stderr, "[H] %s: %s\n", k, v);
+	}
+	h->name = NULL;
+
+	payload = buf + c->header_length;
+	payload_size = c->request_length - c->header_length;
+	if (payload_size <100)
+		fprintf(stderr, "[H] %d %s:\n", payload_size  ,payload );
+
+	clientadmin = c->admin;
+	keep_alive = !draining && wantsKeepAlive();
+
+	cache_ttl = 0;
+	cache_session = 0;
+	cacheVersion = NULL;
+	return 1;
+}
+
+//client request, runs in the forked handler with the socket on stdout
+int respond(connection_t *c)
 {
-	int rcvd;
+	memstat_counters_t counters;
+	memstatBegin(&counters);
+	responding = c;
 
-	buf = malloc(65535);
-	rcvd = recv(clients[n], buf, 65535, 0);
-	
-	if (rcvd<0)	// receive error
-		fprintf(stderr,("recv() error\n"));
-	else if (rcvd==0)	// receive socket closed
-		fprintf(stderr,"Client disconnected upexpectedly.\n");
-	else	// message received
+	if (!parseRequest(c, c->buf))
 	{
-		buf[rcvd] = '\0';
+		memstatUse(NULL);
+		fflush(stdout);
+		return WORKER_CLOSE;
+	}
+
+	// capture the response of a cacheable request so a copy can go to the server
+	FILE *socketStream = stdout;
+	char *captured = NULL;
+	size_t capturedLength = 0;
+	if (c->cache_key && fillChannel[1] >= 0) {
+		FILE *capture = open_memstream(&captured, &capturedLength);
+		if (capture) stdout = capture;
+	}
+
+	// call router
+	route();
+
+	if (stdout != socketStream) {
+		fclose(stdout);
+		stdout = socketStream;
+
+		// anything not cached goes back empty, so requests waiting on this one stop waiting
+		if (responseCacheable(c))
+			sendFill(c->cache_key, captured, capturedLength <= CACHE_ENTRY_MAX ? capturedLength : 0);
+		else
+			sendFill(c->cache_key, NULL, 0);
+		fwrite(captured, 1, capturedLength, stdout);
+		free(captured);
+	}
+
+	// tidy up
+	int status = subscribing ? WORKER_SUBSCRIBE : keep_alive ? WORKER_KEEP_ALIVE : WORKER_CLOSE;
+	if (fflush(stdout) != 0)
+		status = (errno == EAGAIN || errno == EWOULDBLOCK) ? WORKER_WRITE_STALL : WORKER_CLOSE;
+
+	// send what runWorker()'s cork held back; the server keeps using the socket
+	int off = 0;
+	setsockopt(STDOUT_FILENO, IPPROTO_TCP, TCP_CORK, &off, sizeof(off));
+	close(STDOUT_FILENO);
 
-		method 	= strtok(buf,  " \t\r\n");
-		uri		= strtok(NULL, " \t");
-		prot   	= strtok(NULL, " \t\r\n"); 
+	memstatEnd(route_name);
+	return status;
+}
+
+/*
+ * Client request on a coroutine in the server (-c): the same as respond(),
+ * with stdout going to c->response. Globals are the request's own while it
+ * runs; the event loop's wait in `loop` meanwhile.
+ */
+static void handlerMain(void *arg)
+{
+	connection_t *c = arg;
+	request_state_t loop;
+	memstat_counters_t counters;
+	saveRequest(&loop);
+	c->handler->request = &loop;
 
-		fprintf(stderr, "\x1b[32m + [%s] %s\x1b[0m\n", method, uri);
-		
-		if ((qs = strchr(uri, '?')))
+	// parsing writes into the buffer, which still holds any pipelined request
+	char *request = malloc(c->request_length + 1);
+	FILE *out = open_memstream(&c->response, &c->response_length);
+	c->reuse = 0;
+	if (request && out)
+	{
+		memcpy(request, c->buf, c->request_length);
+		stdout = out;
+		if (parseRequest(c, request))
 		{
-			*qs++ = '\0'; //split URI
-		} else {
-			qs = uri - 1; //use an empty string
-		}
-
-		header_t *h = reqhdr;
-		char *t, *t2;
-		while(h < reqhdr+16) {
-			char *k,*v;
-			k = strtok(NULL, "\r\n: \t"); if (!k) break;
-			v = strtok(NULL, "\r\n");	 while(*v && *v==' ') v++;
-			h->name  = k;
-			h->value = v;
-			h++;
-			fprintf(stderr, "[H] %s: %s\n", k, v);
-			t = v + 1 + strlen(v);
-			if (t[1] == '\r' && t[2] == '\n')
-				break;
+			memstatBegin(&counters);
+			route();
+			memstatEnd(route_name);
+			c->reuse = keep_alive;
+
+			if (c->cache_key && (c->handler->fill = malloc(sizeof(fill_header_t)))) {
+				fillHeader(c->handler->fill, c->cache_key);
+				if (!responseCacheable(c))
+					c->handler->fill->ttl = 0;
+			}
 		}
+	}
+	if (out)
+		fclose(out);
+	free(request);
+
+	loadRequest(&loop);
+	c->handler->request = NULL;
+}
+
+/*
+ * Waits until fd is ready for events (EPOLLIN, EPOLLOUT) or timeout ms have
+ * passed, -1 for no limit. A coroutine handler (-c) is suspended meanwhile,
+ * so the server goes on with other requests; a forked handler blocks.
+ *
+ * Returns:
+ *   1 if fd is ready, 0 on timeout, -1 on error.
+ */
+int request_wait(int fd, int events, int timeout)
+{
+	connection_t *c = running;
+	if (!c) {
+		struct pollfd p = { .fd = fd, .events = events };
+		int ready = poll(&p, 1, timeout);
+		return ready < 0 ? -1 : ready > 0;
+	}
+
+	struct epoll_event ev = { .events = events, .data.ptr = c };
+	if (epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &ev) != 0)
+		return -1;
+	c->handler->wait_expired = 0;
+	if (timeout >= 0)
+		timerAdd(&wheel, &c->timer, timerNowMs() + timeout);
+
+	coroYield();
 
-		t2 = request_header("Content-Length"); // and the related header if there is  
-		payload_size = t2 ? atol(t2) : (rcvd-(t-buf));
+	timerCancel(&wheel, &c->timer);
+	epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, NULL);
+	return !c->handler->wait_expired;
+}
 
-		payload = buf+ rcvd-payload_size;
-		if (payload_size <100)
-			fprintf(stderr, "[H] %d %s:\n", payload_size  ,payload );
+/*
+ * Reads up to length bytes of fd at offset, like pread(). A coroutine
+ * handler on the io_uring backend (-c -I uring) submits the read to the
+ * ring and is suspended until it completes; otherwise it blocks.
+ *
+ * Returns:
+ *   The bytes read, 0 at the end of the file, -1 on error (errno set).
+ */
+long request_read(int fd, void *buffer, size_t length, long offset)
+{
+	connection_t *c = running;
+	if (!c || !uring)
+		return pread(fd, buffer, length, offset);
 
-		// bind clientfd to stdout, making it easier to write
-		clientfd = clients[n];
-		dup2(clientfd, STDOUT_FILENO);
-		close(clientfd);
+	struct io_uring_sqe *sqe = uringSqe(&ring);
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)buffer;
+	sqe->len = length;
+	sqe->off = offset;
+	sqe->user_data = opData(c, OP_READ);
 
-		// call router
-		route();
+	coroYield();
 
-		// tidy up
-		fflush(stdout);
-		shutdown(STDOUT_FILENO, SHUT_WR);
-		close(STDOUT_FILENO);
+	if (c->handler->io_result < 0) {
+		errno = -c->handler->io_result;
+		return -1;
+	}
+	return c->handler->io_result;
+}
+
+/*
+ * Runs CPU-bound work(arg), such as filling a large page, off the event
+ * loop. A coroutine handler (-c) is suspended while a pool thread runs it,
+ * and resumed on the event loop, which goes on to write its response; a
+ * forked handler is off the loop already and runs it in place, as does any
+ * handler without pool threads (-W 0). work() must not touch the request
+ * globals, nor call request_wait() or request_read().
+ */
+void request_compute(void (*work)(void *arg), void *arg)
+{
+	coroOffload(work, arg);
+}
+
+/*
+ * Tells whether an upstream of that name was configured, so a ROUTE_PROXY
+ * to it takes requests; routes to one that was not fall through to the
+ * routes after them.
+ *
+ * Returns:
+ *   1 if requests can be proxied to upstream, 0 otherwise.
+ */
+int proxy_configured(const char *upstream)
+{
+	return proxyFind(upstream) != NULL;
+}
+
+/*
+ * Keeps the connection open after this response as an event stream of
+ * topic (Server-Sent Events): the server sends it the events
+ * event_publish() gives the topic, and a heartbeat comment while there are
+ * none, until the client goes away. The handler writes the response head,
+ * with Content-Type: text/event-stream and without a Content-Length, and
+ * may follow it with first events. Subscribing before reading what those
+ * show means no change made meanwhile is missed.
+ *
+ * Returns:
+ *   1 if the connection will carry the stream, 0 if it cannot (an HTTP/2
+ *   stream, a name of HUB_TOPIC_MAX bytes or more, out of memory); the
+ *   handler then sends a complete response.
+ */
+int request_subscribe(const char *topic)
+{
+	connection_t *c = running ? running : responding;
+	if (!c || c->stream || strlen(topic) >= HUB_TOPIC_MAX)
+		return 0;
+	if (running) {
+		// the stream outlives the request: its memory is the server's, not the route's
+		memstat_counters_t *counters = memstatCounters();
+		memstatUse(NULL);
+		int subscribed = subscribeConnection(c, topic);
+		memstatUse(counters);
+		return subscribed;
+	}
+
+	// the server subscribes the connection when it reads this, before the handler's exit
+	fill_header_t header = { .kind = FILL_SUBSCRIBE, .connection = c - connections, .generation = c->generation };
+	snprintf(header.key, sizeof(header.key), "%s", topic);
+	subscribing = fillChannel[1] >= 0 && sendChannel(&header, NULL, 0);
+	return subscribing;
+}
+
+/*
+ * Sends an event to the streams subscribed to topic, as a Server-Sent
+ * Events frame of the given event type; each line of data becomes a data:
+ * line. A forked handler hands it to the server over the fill channel,
+ * where it is dropped if the channel is full. Streams that fall more than
+ * HUB_QUEUE_MAX events behind lose the oldest.
+ */
+void event_publish(const char *topic, const char *event, const char *data)
+{
+	char *frame = NULL;
+	size_t length = 0;
+	FILE *out = open_memstream(&frame, &length);
+	if (!out)
+		return;
+
+	fprintf(out, "event: %s\n", event);
+	for (const char *line = data;;) {
+		size_t lineLength = strcspn(line, "\r\n");
+		fprintf(out, "data: %.*s\n", (int)lineLength, line);
+		if (!line[lineLength])
+			break;
+		line += lineLength + (line[lineLength] == '\r' && line[lineLength + 1] == '\n') + 1;
 	}
+	fputc('\n', out);
+	fclose(out);
 
-	//Closing SOCKET
-	shutdown(clientfd, SHUT_RDWR);		 //All further send and recieve operations are DISABLED...
-	close(clientfd);
-	clients[n]=-1;
+	if (!responding) {
+		hubPublish(topic, frame, length);
+	} else if (fillChannel[1] >= 0 && length <= CACHE_ENTRY_MAX) {
+		fill_header_t header = { .kind = FILL_PUBLISH };
+		snprintf(header.key, sizeof(header.key), "%s", topic);
+		sendChannel(&header, frame, length);
+	}
+	free(frame);
 }
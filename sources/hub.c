@@ -0,0 +1,181 @@
+//
+//  hub.c
+//  CServer
+//
+//  Created by ibrahim alnakeeb on 19/10/2026.
+//
+
+#include "hub.h"
+#include "cache.h"
+#include "metrics.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HUB_MASK (HUB_BUCKETS - 1)
+
+// the subscribers of a name, freed with the last of them
+typedef struct hub_topic {
+	struct hub_topic	*next;			// hash chain
+	hub_subscriber_t	*subscribers;
+	uint64_t			hash;
+	char				name[];
+} hub_topic_t;
+
+static hub_topic_t *topics[HUB_BUCKETS];
+
+static hub_topic_t *findTopic(const char *name, uint64_t hash) {
+	for (hub_topic_t *topic = topics[hash & HUB_MASK]; topic; topic = topic->next)
+		if (topic->hash == hash && strcmp(topic->name, name) == 0)
+			return topic;
+	return NULL;
+}
+
+/*
+ * Adds a subscriber to a topic, taking it out of the one it was on.
+ *
+ * Parameters:
+ *   subscriber - Zero-initialized or unsubscribed (must not be NULL).
+ *   topic      - Name of the topic, shorter than HUB_TOPIC_MAX (must not be NULL).
+ *   notify     - Called by hubPublish() when an event is queued for it (must not be NULL).
+ *
+ * Returns:
+ *   1 on success, 0 if the name is too long or out of memory.
+ */
+int hubSubscribe(hub_subscriber_t *subscriber, const char *topic, hub_notify_fn notify) {
+	assert(subscriber != NULL && topic != NULL && notify != NULL);
+
+	if (subscriber->topic)
+		hubUnsubscribe(subscriber);
+
+	size_t length = strlen(topic);
+	if (length >= HUB_TOPIC_MAX) return 0;
+
+	uint64_t hash = cacheKeyHash(topic);
+	hub_topic_t *t = findTopic(topic, hash);
+	if (!t) {
+		t = malloc(sizeof(hub_topic_t) + length + 1);
+		if (!t) return 0;
+		t->hash = hash;
+		t->subscribers = NULL;
+		memcpy(t->name, topic, length + 1);
+		t->next = topics[hash & HUB_MASK];
+		topics[hash & HUB_MASK] = t;
+	}
+
+	subscriber->topic = t;
+	subscriber->notify = notify;
+	subscriber->head = subscriber->count = 0;
+	subscriber->prev = NULL;
+	subscriber->next = t->subscribers;
+	if (t->subscribers) t->subscribers->prev = subscriber;
+	t->subscribers = subscriber;
+	METRIC_INC(METRIC_EVENTS_SUBSCRIBED);
+	return 1;
+}
+
+/*
+ * Takes a subscriber off its topic and drops the events it did not take;
+ * a no-op if it is not subscribed.
+ */
+void hubUnsubscribe(hub_subscriber_t *subscriber) {
+	assert(subscriber != NULL);
+
+	hub_topic_t *t = subscriber->topic;
+	if (!t) return;
+
+	hub_event_t *event;
+	while ((event = hubNext(subscriber)))
+		hubRelease(event);
+
+	if (subscriber->prev) subscriber->prev->next = subscriber->next;
+	else t->subscribers = subscriber->next;
+	if (subscriber->next) subscriber->next->prev = subscriber->prev;
+	subscriber->prev = subscriber->next = NULL;
+	subscriber->topic = NULL;
+	METRIC_INC(METRIC_EVENTS_UNSUBSCRIBED);
+
+	if (!t->subscribers) {
+		hub_topic_t **link = &topics[t->hash & HUB_MASK];
+		while (*link != t)
+			link = &(*link)->next;
+		*link = t->next;
+		free(t);
+	}
+}
+
+/*
+ * Queues an event for every subscriber of a topic, then notifies them. The
+ * bytes are copied once for all of them. A subscriber whose queue is full
+ * loses its oldest event (counted as events_dropped): one that cannot keep
+ * up falls behind by at most HUB_QUEUE_MAX events. A notified subscriber
+ * may unsubscribe itself, but no other.
+ *
+ * Parameters:
+ *   topic  - Name of the topic (must not be NULL).
+ *   data   - The event as it is sent, e.g. a Server-Sent Events frame.
+ *   length - Its bytes.
+ *
+ * Returns:
+ *   The subscribers it was queued for; 0 without any, or out of memory.
+ */
+int hubPublish(const char *topic, const char *data, size_t length) {
+	assert(topic != NULL && (data != NULL || length == 0));
+
+	hub_topic_t *t = findTopic(topic, cacheKeyHash(topic));
+	if (!t || !t->subscribers) return 0;
+
+	hub_event_t *event = malloc(sizeof(hub_event_t) + length);
+	if (!event) return 0;
+	event->refs = 0;
+	event->length = length;
+	memcpy(event->data, data, length);
+
+	// every reference is taken before a notified subscriber can drop its own
+	int reached = 0;
+	for (hub_subscriber_t *s = t->subscribers; s; s = s->next, reached++) {
+		if (s->count == HUB_QUEUE_MAX) {
+			hubRelease(s->queue[s->head]);
+			s->head = (s->head + 1) % HUB_QUEUE_MAX;
+			s->count--;
+			METRIC_INC(METRIC_EVENTS_DROPPED);
+		}
+		s->queue[(s->head + s->count) % HUB_QUEUE_MAX] = event;
+		s->count++;
+		event->refs++;
+	}
+	METRIC_INC(METRIC_EVENTS_PUBLISHED);
+
+	hub_subscriber_t *next;
+	for (hub_subscriber_t *s = t->subscribers; s; s = next) {
+		next = s->next;
+		s->notify(s);
+	}
+	return reached;
+}
+
+/*
+ * Takes the subscriber's oldest queued event; the caller owns the reference
+ * and drops it with hubRelease() once the event is sent.
+ *
+ * Returns:
+ *   The event, NULL if none is queued.
+ */
+hub_event_t *hubNext(hub_subscriber_t *subscriber) {
+	assert(subscriber != NULL);
+
+	if (subscriber->count == 0) return NULL;
+	hub_event_t *event = subscriber->queue[subscriber->head];
+	subscriber->head = (subscriber->head + 1) % HUB_QUEUE_MAX;
+	subscriber->count--;
+	return event;
+}
+
+/*
+ * Drops a reference to an event; the last one frees it.
+ */
+void hubRelease(hub_event_t *event) {
+	if (event && --event->refs == 0)
+		free(event);
+}
@@ -0,0 +1,288 @@
+//
+//  memstat.c
+//  CServer
+//
+//  Created by ibrahim alnakeeb on 19/10/2026.
+//
+
+#define MEMSTAT_IMPLEMENTATION
+
+#include "memstat.h"
+#include "shm.h"
+
+#include <assert.h>
+#include <stdint.h>
+
+#define MEMSTAT_MAGIC 0x6d656d7374617421ULL
+
+typedef struct {
+	int			state;		// 0 free, 1 claiming, 2 ready
+	char		name[MEMSTAT_ROUTE_LEN];
+	uint64_t	requests;
+	uint64_t	allocations;
+	uint64_t	bytes;
+	uint64_t	peakLive;
+	uint64_t	leakedAllocations;
+	uint64_t	leakedBytes;
+} memstat_route_t;
+
+typedef struct {
+	uint64_t		unrecorded;		// requests whose route did not fit in the table
+	memstat_route_t	routes[MEMSTAT_MAX_ROUTES];
+} memstat_table_t;
+
+static memstat_table_t *table;
+
+#ifdef MEMSTAT
+
+// Prefix of every tracked block; keeps malloc's 16-byte alignment.
+typedef struct {
+	size_t		size;
+	uint64_t	request;	// the counters it was counted in, 0 for none
+	uint64_t	unused;
+	uint64_t	magic;		// last, so an untracked block is told apart by the word before it
+} memstat_header_t;
+
+static uint64_t requests;						// tags handed out by memstatBegin()
+static __thread memstat_counters_t *current;	// the request this thread allocates for, NULL for none
+
+static void countAlloc(memstat_header_t *header, size_t size) {
+	header->size = size;
+	header->request = current ? current->request : 0;
+	if (!current) return;
+
+	current->allocations++;
+	current->bytes += size;
+	current->liveAllocations++;
+	current->liveBytes += size;
+	if (current->liveBytes > current->peakLive)
+		current->peakLive = current->liveBytes;
+}
+
+// a block counted for another request, or for none, leaves the current one's counters alone
+static void countFree(const memstat_header_t *header) {
+	if (!current || header->request != current->request) return;
+
+	current->liveAllocations--;
+	current->liveBytes -= header->size;
+}
+
+static memstat_header_t *trackedHeader(void *ptr) {
+	memstat_header_t *header = (memstat_header_t *)ptr - 1;
+	return header->magic == MEMSTAT_MAGIC ? header : NULL;
+}
+
+void *memstatMalloc(size_t size) {
+	memstat_header_t *header = malloc(sizeof(memstat_header_t) + size);
+	if (!header) return NULL;
+
+	header->magic = MEMSTAT_MAGIC;
+	countAlloc(header, size);
+	return header + 1;
+}
+
+void *memstatCalloc(size_t count, size_t size) {
+	if (size && count > SIZE_MAX / size) return NULL;
+
+	void *ptr = memstatMalloc(count * size);
+	if (ptr) memset(ptr, 0, count * size);
+	return ptr;
+}
+
+void *memstatRealloc(void *ptr, size_t size) {
+	if (!ptr) return memstatMalloc(size);
+
+	memstat_header_t *header = trackedHeader(ptr);
+	if (!header) return realloc(ptr, size);
+
+	memstat_header_t old = *header;
+	header = realloc(header, sizeof(memstat_header_t) + size);
+	if (!header) return NULL;
+
+	countFree(&old);
+	countAlloc(header, size);
+	return header + 1;
+}
+
+char *memstatStrdup(const char *str) {
+	size_t len = strlen(str) + 1;
+	char *copy = memstatMalloc(len);
+	if (copy) memcpy(copy, str, len);
+	return copy;
+}
+
+/*
+ * Frees a block from memstatMalloc and friends. Blocks allocated by libc on
+ * our behalf (open_memstream, getline, ...) carry no header and are passed
+ * straight to free().
+ */
+void memstatFree(void *ptr) {
+	if (!ptr) return;
+
+	memstat_header_t *header = trackedHeader(ptr);
+	if (!header) {
+		free(ptr);
+		return;
+	}
+
+	countFree(header);
+	header->magic = 0;
+	free(header);
+}
+
+static memstat_route_t *findRoute(const char *route) {
+	for (int i = 0; i < MEMSTAT_MAX_ROUTES; i++) {
+		memstat_route_t *slot = &table->routes[i];
+		int state = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE);
+
+		if (state == 0) {
+			if (__atomic_compare_exchange_n(&slot->state, &state, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+				snprintf(slot->name, sizeof(slot->name), "%s", route);
+				__atomic_store_n(&slot->state, 2, __ATOMIC_RELEASE);
+				return slot;
+			}
+		}
+
+		// another process is naming this slot; it may be our route
+		while (state == 1)
+			state = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE);
+
+		if (strncmp(slot->name, route, sizeof(slot->name) - 1) == 0)
+			return slot;
+	}
+	return NULL;
+}
+
+#endif /* MEMSTAT */
+
+/*
+ * Allocates the shared per-route table. Only available in MEMSTAT builds
+ * ("make MEMSTAT=1"); must be called before the server starts forking.
+ *
+ * Returns:
+ *   MEMSTAT_OK on success, MEMSTAT_DISABLED if the build has no instrumentation
+ *   or the table could not be mapped.
+ */
+int memstatInit(void) {
+#ifdef MEMSTAT
+	table = shmAlloc(sizeof(memstat_table_t));
+#endif
+	return table ? MEMSTAT_OK : MEMSTAT_DISABLED;
+}
+
+/*
+ * Starts accounting a new request: the calling thread's allocations and frees
+ * go to counters until memstatEnd(), or until memstatUse() switches it.
+ *
+ * Parameters:
+ *   counters - The request's own, valid until memstatEnd() (must not be NULL).
+ */
+void memstatBegin(memstat_counters_t *counters) {
+	assert(counters != NULL);
+	memset(counters, 0, sizeof(*counters));
+#ifdef MEMSTAT
+	counters->request = __atomic_add_fetch(&requests, 1, __ATOMIC_RELAXED);
+	current = counters;
+#endif
+}
+
+/*
+ * Returns the counters the calling thread allocates for, NULL for none.
+ */
+memstat_counters_t *memstatCounters(void) {
+#ifdef MEMSTAT
+	return current;
+#else
+	return NULL;
+#endif
+}
+
+/*
+ * Makes the calling thread allocate for another request: a coroutine
+ * handler's when it is resumed, none (NULL) when it yields, or the one a
+ * pool thread runs a job for. Only one thread may use a request's counters
+ * at a time.
+ */
+void memstatUse(memstat_counters_t *counters) {
+#ifdef MEMSTAT
+	current = counters;
+#else
+	(void)counters;
+#endif
+}
+
+/*
+ * Adds the counters of the calling thread's request, which just finished, to
+ * the shared table, and stops accounting.
+ *
+ * Parameters:
+ *   route - Label of the route that handled the request (NULL if none matched).
+ *
+ * Side Effects:
+ *   Allocations still live at this point are recorded as leaked for the route.
+ */
+void memstatEnd(const char *route) {
+#ifdef MEMSTAT
+	memstat_counters_t *counters = current;
+	current = NULL;
+	if (!table || !counters) return;
+
+	memstat_route_t *slot = findRoute(route ? route : "(unrouted)");
+	if (!slot) {
+		__atomic_add_fetch(&table->unrecorded, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	__atomic_add_fetch(&slot->requests, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&slot->allocations, counters->allocations, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&slot->bytes, counters->bytes, __ATOMIC_RELAXED);
+	if (counters->liveAllocations > 0) {
+		__atomic_add_fetch(&slot->leakedAllocations, counters->liveAllocations, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&slot->leakedBytes, counters->liveBytes, __ATOMIC_RELAXED);
+	}
+
+	uint64_t peak = __atomic_load_n(&slot->peakLive, __ATOMIC_RELAXED);
+	while ((uint64_t)counters->peakLive > peak
+		&& !__atomic_compare_exchange_n(&slot->peakLive, &peak, counters->peakLive, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+#else
+	(void)route;
+#endif
+}
+
+/*
+ * Writes the per-route allocation table, one whitespace-separated row per route.
+ *
+ * Parameters:
+ *   out - Stream that receives the report (must not be NULL).
+ *
+ * Returns:
+ *   MEMSTAT_OK when the report was written, MEMSTAT_DISABLED otherwise.
+ */
+int memstatReport(FILE *out) {
+	assert(out != NULL);
+
+	if (!table) return MEMSTAT_DISABLED;
+
+	fprintf(out, "%-32s %10s %12s %14s %12s %8s %12s\n",
+		"route", "requests", "allocations", "bytes", "peak_live", "leaked", "leaked_bytes");
+
+	for (int i = 0; i < MEMSTAT_MAX_ROUTES; i++) {
+		memstat_route_t *slot = &table->routes[i];
+		if (__atomic_load_n(&slot->state, __ATOMIC_ACQUIRE) != 2) continue;
+
+		fprintf(out, "%-32s %10lu %12lu %14lu %12lu %8lu %12lu\n",
+			slot->name,
+			(unsigned long)slot->requests,
+			(unsigned long)slot->allocations,
+			(unsigned long)slot->bytes,
+			(unsigned long)slot->peakLive,
+			(unsigned long)slot->leakedAllocations,
+			(unsigned long)slot->leakedBytes);
+	}
+
+	if (table->unrecorded)
+		fprintf(out, "# %lu requests not recorded: route table full\n", (unsigned long)table->unrecorded);
+
+	return MEMSTAT_OK;
+}
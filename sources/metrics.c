@@ -0,0 +1,205 @@
+//
+//  metrics.c
+//  CServer
+//
+//  Created by ibrahim alnakeeb on 19/10/2026.
+//
+
+#define _GNU_SOURCE
+
+#include "metrics.h"
+#include "shm.h"
+
+#include <sched.h>
+#include <unistd.h>
+
+#define METRIC_SHARDS_MAX	256
+
+static const char *metricNames[METRIC_COUNT] = {
+	[METRIC_CONNECTIONS_ACCEPTED]	= "connections_accepted",
+	[METRIC_CONNECTIONS_CLOSED]		= "connections_closed",
+	[METRIC_REQUESTS_DISPATCHED]	= "requests_dispatched",
+	[METRIC_TIMEOUT_HEADER]			= "timeout_header_read",
+	[METRIC_TIMEOUT_BODY]			= "timeout_body_read",
+	[METRIC_TIMEOUT_IDLE]			= "timeout_idle_keepalive",
+	[METRIC_TIMEOUT_WRITE]			= "timeout_write_stall",
+	[METRIC_TIMEOUT_SLOW_RATE]		= "timeout_slow_rate",
+	[METRIC_REQUESTS_QUEUED]		= "requests_queued",
+	[METRIC_QUEUE_WAIT_MS]			= "queue_wait_ms_total",
+	[METRIC_SHED_CONNECTIONS]		= "shed_connection_limit",
+	[METRIC_SHED_QUEUE_FULL]		= "shed_queue_full",
+	[METRIC_SHED_QUEUE_WAIT]		= "shed_queue_wait",
+	[METRIC_SHED_RATE_LIMIT]		= "shed_rate_limit",
+	[METRIC_CACHE_HITS]				= "cache_hits",
+	[METRIC_CACHE_STALE_HITS]		= "cache_stale_hits",
+	[METRIC_CACHE_MISSES]			= "cache_misses",
+	[METRIC_CACHE_FILLS]			= "cache_fills",
+	[METRIC_CACHE_EVICTIONS]		= "cache_evictions",
+	[METRIC_CACHE_SESSION_HITS]		= "cache_session_hits",
+	[METRIC_CACHE_SESSION_MISSES]	= "cache_session_misses",
+	[METRIC_CACHE_COALESCED]		= "cache_coalesced",
+	[METRIC_CACHE_COALESCE_TIMEOUTS]	= "cache_coalesce_timeouts",
+	[METRIC_POOL_JOBS]				= "pool_jobs",
+	[METRIC_POOL_STEALS]			= "pool_steals",
+	[METRIC_POOL_WAIT_US]			= "pool_wait_us_total",
+	[METRIC_CORO_HANDLERS]			= "coroutine_handlers",
+	[METRIC_CORO_SUSPENDS]			= "coroutine_suspends",
+	[METRIC_BUFFER_ALLOCATIONS]		= "buffer_allocations",
+	[METRIC_BUFFER_GROWS]			= "buffer_grows",
+	[METRIC_TLS_HANDSHAKES]			= "tls_handshakes",
+	[METRIC_TLS_RESUMED]			= "tls_resumed",
+	[METRIC_TLS_KTLS]				= "tls_ktls",
+	[METRIC_TLS_FAILURES]			= "tls_handshake_failures",
+	[METRIC_H2_SESSIONS]			= "h2_sessions",
+	[METRIC_H2_STREAMS]				= "h2_streams",
+	[METRIC_H2_RESETS]				= "h2_streams_reset",
+	[METRIC_EVENTS_SUBSCRIBED]		= "events_subscribed",
+	[METRIC_EVENTS_UNSUBSCRIBED]	= "events_unsubscribed",
+	[METRIC_EVENTS_PUBLISHED]		= "events_published",
+	[METRIC_EVENTS_SENT]			= "events_sent",
+	[METRIC_EVENTS_DROPPED]			= "events_dropped",
+	[METRIC_EVENTS_HEARTBEATS]		= "events_heartbeats",
+	[METRIC_PROXY_REQUESTS]			= "proxy_requests",
+	[METRIC_PROXY_CONNECTS]			= "proxy_connects",
+	[METRIC_PROXY_REUSED]			= "proxy_connections_reused",
+	[METRIC_PROXY_RETRIES]			= "proxy_retries",
+	[METRIC_PROXY_FAILURES]			= "proxy_failures",
+	[METRIC_PROXY_SERVERS_DOWN]		= "proxy_servers_marked_down",
+	[METRIC_PROXY_ERRORS]			= "proxy_errors",
+	[METRIC_PROXY_TIMEOUTS]			= "proxy_timeouts",
+};
+
+static const char *classMetricNames[CLASS_METRIC_COUNT] = {
+	[CLASS_METRIC_DISPATCHED]		= "dispatched",
+	[CLASS_METRIC_QUEUED]			= "queued",
+	[CLASS_METRIC_QUEUE_WAIT_MS]	= "queue_wait_ms_total",
+	[CLASS_METRIC_SHED]				= "shed",
+};
+
+// a shard holds the METRIC_COUNT counters, then CLASS_METRIC_COUNT per class
+#define COUNTERS			(METRIC_COUNT + METRIC_CLASSES_MAX * CLASS_METRIC_COUNT)
+#define CLASS_COUNTER(index, metric)	(METRIC_COUNT + (size_t)(index) * CLASS_METRIC_COUNT + (metric))
+
+static uint64_t *counters;			// shards of stride counters each
+static int shards;
+static size_t stride;
+static const char *classNames[METRIC_CLASSES_MAX];	// NULL past the last class
+
+/*
+ * Maps the shared counters: a page of them per CPU, so processes on
+ * different cores do not bounce a cache line between them, and each page
+ * is first touched, and so placed, on the NUMA node of its CPU. Must be
+ * called before the server starts forking.
+ *
+ * Returns:
+ *   1 on success, 0 if the counters could not be mapped (metrics are then dropped).
+ */
+int metricsInit(void) {
+	long cpus = sysconf(_SC_NPROCESSORS_CONF);
+	shards = cpus < 1 ? 1 : cpus > METRIC_SHARDS_MAX ? METRIC_SHARDS_MAX : cpus;
+
+	size_t page = sysconf(_SC_PAGESIZE);
+	stride = ((sizeof(uint64_t) * COUNTERS + page - 1) & ~(page - 1)) / sizeof(uint64_t);
+	counters = shmAlloc(sizeof(uint64_t) * stride * shards);
+	return counters != NULL;
+}
+
+static void addCounter(size_t counter, uint64_t value) {
+	if (!counters) return;
+
+	int cpu = sched_getcpu();
+	uint64_t *shard = counters + (size_t)(cpu > 0 ? cpu % shards : 0) * stride;
+	__atomic_add_fetch(&shard[counter], value, __ATOMIC_RELAXED);
+}
+
+static uint64_t sumCounter(size_t counter) {
+	if (!counters) return 0;
+
+	uint64_t sum = 0;
+	for (int i = 0; i < shards; i++)
+		sum += __atomic_load_n(&counters[(size_t)i * stride + counter], __ATOMIC_RELAXED);
+	return sum;
+}
+
+/*
+ * Adds to a counter in the shard of the CPU the caller runs on; safe to
+ * call from any process.
+ */
+void metricsAdd(metric_t metric, uint64_t value) {
+	assert(metric < METRIC_COUNT);
+	addCounter(metric, value);
+}
+
+/*
+ * Returns the current value of a counter, summed over the shards.
+ */
+uint64_t metricsGet(metric_t metric) {
+	assert(metric < METRIC_COUNT);
+	return sumCounter(metric);
+}
+
+/*
+ * Names the scheduling class whose counters are at index, so the report
+ * lists them. Called before the server starts forking.
+ */
+void metricsNameClass(int index, const char *name) {
+	assert(index >= 0 && index < METRIC_CLASSES_MAX);
+	classNames[index] = name;
+}
+
+/*
+ * Adds to a counter of a scheduling class; safe to call from any process.
+ */
+void metricsClassAdd(int index, class_metric_t metric, uint64_t value) {
+	assert(index >= 0 && index < METRIC_CLASSES_MAX && metric < CLASS_METRIC_COUNT);
+	addCounter(CLASS_COUNTER(index, metric), value);
+}
+
+/*
+ * Returns the current value of a scheduling class's counter.
+ */
+uint64_t metricsClassGet(int index, class_metric_t metric) {
+	assert(index >= 0 && index < METRIC_CLASSES_MAX && metric < CLASS_METRIC_COUNT);
+	return sumCounter(CLASS_COUNTER(index, metric));
+}
+
+// hits / (hits + misses), 0 before the first lookup
+static double ratio(uint64_t hits, uint64_t misses) {
+	return hits + misses ? (double)hits / (hits + misses) : 0;
+}
+
+/*
+ * Writes every counter as a "name value" line, followed by the derived cache
+ * hit ratios, the open event streams and the share of proxied requests
+ * that went on a kept-alive upstream connection, then the counters of each
+ * scheduling class as "class_<name>_<counter> value" with its average queue
+ * wait.
+ *
+ * Parameters:
+ *   out - Stream that receives the report (must not be NULL).
+ */
+void metricsReport(FILE *out) {
+	assert(out != NULL);
+
+	for (int i = 0; i < METRIC_COUNT; i++)
+		fprintf(out, "%s %lu\n", metricNames[i], (unsigned long)metricsGet(i));
+
+	fprintf(out, "cache_hit_ratio %.3f\n", ratio(
+		metricsGet(METRIC_CACHE_HITS) + metricsGet(METRIC_CACHE_STALE_HITS), metricsGet(METRIC_CACHE_MISSES)));
+	fprintf(out, "cache_session_hit_ratio %.3f\n", ratio(
+		metricsGet(METRIC_CACHE_SESSION_HITS), metricsGet(METRIC_CACHE_SESSION_MISSES)));
+	fprintf(out, "events_subscribers %lu\n", (unsigned long)(
+		metricsGet(METRIC_EVENTS_SUBSCRIBED) - metricsGet(METRIC_EVENTS_UNSUBSCRIBED)));
+	fprintf(out, "proxy_reuse_ratio %.3f\n", ratio(
+		metricsGet(METRIC_PROXY_REUSED), metricsGet(METRIC_PROXY_CONNECTS)));
+
+	for (int i = 0; i < METRIC_CLASSES_MAX && classNames[i]; i++) {
+		for (int j = 0; j < CLASS_METRIC_COUNT; j++)
+			fprintf(out, "class_%s_%s %lu\n", classNames[i], classMetricNames[j], (unsigned long)metricsClassGet(i, j));
+
+		// requests that waited, and those that were dispatched right away
+		uint64_t dispatched = metricsClassGet(i, CLASS_METRIC_DISPATCHED);
+		fprintf(out, "class_%s_queue_wait_ms_avg %.1f\n", classNames[i],
+				dispatched ? (double)metricsClassGet(i, CLASS_METRIC_QUEUE_WAIT_MS) / dispatched : 0);
+	}
+}
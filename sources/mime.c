@@ -0,0 +1,37 @@
+//
+//  mime.c
+//  CServer
+//
+//  Created by ibrahim alnakeeb on 19/10/2026.
+//
+
+#include "mime.h"
+
+#include <assert.h>
+#include <string.h>
+
+/*
+ * Determines the MIME type based on the file extension of the given path.
+ *
+ * Parameters:
+ *	path - The file path to evaluate (must not be NULL).
+ *
+ * Returns:
+ *   A string literal representing the MIME type (e.g., "text/html", "image/png").
+ *   Defaults to MIME_BIN if the extension is unrecognized or missing.
+ */
+const char *get_mime_type(const char *path) {
+	assert(path != NULL);
+
+	const char *ext = strrchr(path, '.');
+	if (!ext) return MIME_BIN;
+
+	if (strcmp(ext, ".html") == 0)	return MIME_HTML;
+	if (strcmp(ext, ".css") == 0)	return MIME_CSS;
+	if (strcmp(ext, ".js") == 0)	return MIME_JS;
+	if (strcmp(ext, ".ico") == 0)	return MIME_ICO;
+	if (strcmp(ext, ".png") == 0) 	return MIME_PNG;
+	if (strcmp(ext, ".jpg") == 0 || strcmp(ext, ".jpeg") == 0) return MIME_JPEG;
+
+	return MIME_BIN;
+}
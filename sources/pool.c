@@ -0,0 +1,298 @@
+//
+//  pool.c
+//  CServer
+//
+//  Created by ibrahim alnakeeb on 19/10/2026.
+//
+
+#define _GNU_SOURCE
+
+#include "pool.h"
+#include "affinity.h"
+#include "metrics.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+
+#define POOL_MASK	(POOL_DEQUE_SIZE - 1)
+
+/*
+ * Chase-Lev work-stealing deque of fixed size. Its owner pushes and pops at
+ * the bottom; any other thread steals from the top. top and bottom only grow,
+ * so a slot is reused only after the job in it was taken.
+ */
+typedef struct {
+	int64_t		top __attribute__((aligned(4096)));		// whole pages, placed by the first thread to write them
+	int64_t		bottom __attribute__((aligned(64)));
+	pool_job_t	*jobs[POOL_DEQUE_SIZE] __attribute__((aligned(64)));
+} deque_t;
+
+static deque_t *deques;				// [0] the submitting thread's, [1..threads] one per pool thread
+static int threads;
+static __thread int self;			// this thread's deque
+static pool_job_t *completed;		// finished jobs, newest first
+static int completionFd = -1;
+
+static int sleepers;
+static pthread_mutex_t parkLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t parkCond = PTHREAD_COND_INITIALIZER;
+
+static uint64_t nowNs(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// owner only; 0 when the deque is full
+static int dequePush(deque_t *d, pool_job_t *job) {
+	int64_t bottom = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+	int64_t top = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+	if (bottom - top >= POOL_DEQUE_SIZE) return 0;
+
+	__atomic_store_n(&d->jobs[bottom & POOL_MASK], job, __ATOMIC_RELAXED);
+	__atomic_store_n(&d->bottom, bottom + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+// owner only, newest job first
+static pool_job_t *dequePop(deque_t *d) {
+	int64_t bottom = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1;
+	__atomic_store_n(&d->bottom, bottom, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	int64_t top = __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+
+	if (top > bottom) {
+		__atomic_store_n(&d->bottom, bottom + 1, __ATOMIC_RELAXED);
+		return NULL;
+	}
+
+	pool_job_t *job = __atomic_load_n(&d->jobs[bottom & POOL_MASK], __ATOMIC_RELAXED);
+	if (top == bottom) {
+		// the last job: a thief may be taking it right now
+		if (!__atomic_compare_exchange_n(&d->top, &top, top + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+			job = NULL;
+		__atomic_store_n(&d->bottom, bottom + 1, __ATOMIC_RELAXED);
+	}
+	return job;
+}
+
+// any thread, oldest job first; *contended is set when another thread won the job
+static pool_job_t *dequeSteal(deque_t *d, int *contended) {
+	int64_t top = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	int64_t bottom = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+	if (top >= bottom) return NULL;
+
+	pool_job_t *job = __atomic_load_n(&d->jobs[top & POOL_MASK], __ATOMIC_RELAXED);
+	if (!__atomic_compare_exchange_n(&d->top, &top, top + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+		*contended = 1;
+		return NULL;
+	}
+	return job;
+}
+
+static int hasWork(void) {
+	for (int i = 0; i <= threads; i++)
+		if (__atomic_load_n(&deques[i].top, __ATOMIC_ACQUIRE) < __atomic_load_n(&deques[i].bottom, __ATOMIC_ACQUIRE))
+			return 1;
+	return 0;
+}
+
+// try every other deque once, starting at a random one
+static pool_job_t *steal(unsigned *seed) {
+	for (;;) {
+		*seed = *seed * 1103515245 + 12345;
+		int start = (*seed >> 16) % (threads + 1), contended = 0;
+
+		for (int n = 0; n <= threads; n++) {
+			int victim = (start + n) % (threads + 1);
+			if (victim == self) continue;
+
+			pool_job_t *job = dequeSteal(&deques[victim], &contended);
+			if (job) {
+				if (victim != 0) METRIC_INC(METRIC_POOL_STEALS);
+				return job;
+			}
+		}
+		if (!contended) return NULL;
+	}
+}
+
+/*
+ * Sleeps until a job is submitted. The sleeper count is raised before the
+ * deques are checked, and poolSubmit() reads it after its push, so one of
+ * the two always sees the other.
+ */
+static void park(void) {
+	pthread_mutex_lock(&parkLock);
+	__atomic_add_fetch(&sleepers, 1, __ATOMIC_SEQ_CST);
+	if (!hasWork())
+		pthread_cond_wait(&parkCond, &parkLock);
+	__atomic_sub_fetch(&sleepers, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&parkLock);
+}
+
+static void wake(void) {
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (!__atomic_load_n(&sleepers, __ATOMIC_RELAXED)) return;
+
+	pthread_mutex_lock(&parkLock);
+	pthread_cond_signal(&parkCond);
+	pthread_mutex_unlock(&parkLock);
+}
+
+// hand a finished job back; the eventfd is only written when the list was empty
+static void complete(pool_job_t *job) {
+	pool_job_t *head = __atomic_load_n(&completed, __ATOMIC_RELAXED);
+	do {
+		job->completedNext = head;
+	} while (!__atomic_compare_exchange_n(&completed, &head, job, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+	if (!head) {
+		uint64_t one = 1;
+		if (write(completionFd, &one, sizeof(one)) < 0)
+			perror("write() error");
+	}
+}
+
+static void *poolThread(void *arg) {
+	self = (int)(intptr_t)arg;
+	unsigned seed = (unsigned)self * 2654435761u;
+
+	// pinned before its deque is written, so the deque's pages come from this core's node (-A)
+	if (affinityEnabled())
+		affinityPin(affinityCpu(self));
+
+	for (;;) {
+		pool_job_t *job = dequePop(&deques[self]);
+		if (!job) job = steal(&seed);
+		if (!job) {
+			park();
+			continue;
+		}
+
+		metricsAdd(METRIC_POOL_WAIT_US, (nowNs() - job->submitted) / 1000);
+		job->run(job);
+		complete(job);
+	}
+	return NULL;
+}
+
+// a forked child has none of the threads, and maybe parkLock held by one: it runs its jobs itself
+static void forked(void) {
+	threads = 0;
+}
+
+/*
+ * Starts the pool threads. They block every signal, so signals keep going
+ * to the thread that called poolInit(), which is also the one that submits
+ * jobs and calls poolComplete(). In a process forked afterwards the pool is
+ * off: poolSubmit() refuses every job.
+ *
+ * Parameters:
+ *   count - Number of threads, at most POOL_THREADS_MAX; 0 leaves the pool
+ *           off and poolSubmit() refuses every job.
+ *
+ * Returns:
+ *   An eventfd that becomes readable when jobs have finished, or -1 if the
+ *   pool is off or could not be started.
+ */
+int poolInit(int count) {
+	assert(count >= 0 && count <= POOL_THREADS_MAX);
+	if (count == 0 || deques) return -1;
+
+	// zero pages, left untouched here so each thread's deque is placed where that thread runs
+	deques = mmap(NULL, sizeof(deque_t) * (count + 1), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	completionFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (deques == MAP_FAILED || completionFd < 0) {
+		perror("poolInit() error");
+		if (deques != MAP_FAILED) munmap(deques, sizeof(deque_t) * (count + 1));
+		if (completionFd >= 0) close(completionFd);
+		deques = NULL;
+		completionFd = -1;
+		return -1;
+	}
+
+	// set before the first thread runs; the deque of a thread that failed to start stays empty
+	threads = count;
+	pthread_atfork(NULL, NULL, forked);
+
+	sigset_t all, old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	for (int i = 1; i <= count; i++) {
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, poolThread, (void *)(intptr_t)i) != 0) {
+			perror("pthread_create() error");
+			if (i == 1) threads = 0;
+			break;
+		}
+		pthread_detach(thread);
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	return threads ? completionFd : -1;
+}
+
+/*
+ * Returns the number of pool threads, 0 when the pool is off.
+ */
+int poolThreads(void) {
+	return threads;
+}
+
+/*
+ * Queues a job on the calling thread's deque, where idle pool threads steal
+ * it from. Called from the thread that started the pool, or from a running
+ * job.
+ *
+ * Parameters:
+ *   job - run() and done() must be set; the job must stay valid until done().
+ *
+ * Returns:
+ *   1 if queued, 0 if the pool is off or the deque is full (run it yourself).
+ */
+int poolSubmit(pool_job_t *job) {
+	assert(job != NULL && job->run != NULL && job->done != NULL);
+
+	if (!threads) return 0;
+
+	job->submitted = nowNs();
+	if (!dequePush(&deques[self], job)) return 0;
+
+	METRIC_INC(METRIC_POOL_JOBS);
+	wake();
+	return 1;
+}
+
+/*
+ * Calls done() for every job that finished since the last call, in the order
+ * they finished. Call it when the poolInit() eventfd is readable.
+ */
+void poolComplete(void) {
+	uint64_t count;
+	ssize_t got = read(completionFd, &count, sizeof(count));	// EAGAIN if an earlier call took them
+	(void)got;
+
+	pool_job_t *job = __atomic_exchange_n(&completed, NULL, __ATOMIC_ACQUIRE);
+	pool_job_t *ordered = NULL;
+	while (job) {
+		pool_job_t *next = job->completedNext;
+		job->completedNext = ordered;
+		ordered = job;
+		job = next;
+	}
+
+	while (ordered) {
+		pool_job_t *next = ordered->completedNext;
+		ordered->done(ordered);		// may free the job
+		ordered = next;
+	}
+}
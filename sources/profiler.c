@@ -0,0 +1,343 @@
+//
+//  profiler.c
+//  CServer
+//
+//  Created by ibrahim alnakeeb on 19/10/2026.
+//
+
+#define _GNU_SOURCE
+
+#include "profiler.h"
+#include "shm.h"
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#define PROFILER_MAX_PROBES 64
+
+typedef struct {
+	uint64_t	hash;		// 0 while the slot is free
+	uint64_t	count;
+	uint32_t	depth;
+	uint32_t	ready;		// set once pcs[] has been fully written
+	uintptr_t	pcs[PROFILER_MAX_DEPTH];
+} profile_stack_t;
+
+typedef struct {
+	int				busy;		// a report is being collected
+	int				active;		// children should record samples
+	int				hz;
+	time_t			deadline;	// CLOCK_MONOTONIC seconds
+	uint64_t		samples;
+	uint64_t		dropped;
+	profile_stack_t	stacks[PROFILER_MAX_STACKS];
+} profiler_state_t;
+
+static profiler_state_t *state;
+static uintptr_t stackLow, stackHigh;
+static int perfFd = -1;
+static long samplePeriod;		// nanoseconds of CPU time between samples
+static int periodSet;
+
+static time_t monotonicSeconds(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec;
+}
+
+/*
+ * Walks the frame-pointer chain of the interrupted code, leaf first.
+ * Every frame address is checked against the bounds of the main stack so a
+ * corrupt or missing frame pointer ends the walk instead of faulting.
+ */
+static uint32_t captureStack(void *context, uintptr_t *pcs) {
+	ucontext_t *uc = context;
+	uintptr_t pc, fp;
+	uint32_t depth = 0;
+
+#if defined(__x86_64__)
+	pc = (uintptr_t)uc->uc_mcontext.gregs[REG_RIP];
+	fp = (uintptr_t)uc->uc_mcontext.gregs[REG_RBP];
+#elif defined(__aarch64__)
+	pc = (uintptr_t)uc->uc_mcontext.pc;
+	fp = (uintptr_t)uc->uc_mcontext.regs[29];
+#else
+	(void)uc;
+	return 0;
+#endif
+
+	pcs[depth++] = pc;
+	while (depth < PROFILER_MAX_DEPTH
+		&& fp >= stackLow
+		&& fp + 2 * sizeof(uintptr_t) <= stackHigh
+		&& fp % sizeof(uintptr_t) == 0)
+	{
+		uintptr_t *frame = (uintptr_t *)fp;
+		if (!frame[1]) break;
+		pcs[depth++] = frame[1];
+		if (frame[0] <= fp) break;
+		fp = frame[0];
+	}
+	return depth;
+}
+
+/*
+ * Adds one sample to the shared stack table. Lock-free so it is safe to run
+ * from the signal handler of any process; stacks that do not fit in the table
+ * are counted as dropped.
+ */
+static void recordStack(const uintptr_t *pcs, uint32_t depth) {
+	uint64_t hash = 1469598103934665603ULL;
+	for (uint32_t i = 0; i < depth; i++) {
+		hash ^= pcs[i];
+		hash *= 1099511628211ULL;
+	}
+	if (hash == 0) hash = 1;
+
+	__atomic_add_fetch(&state->samples, 1, __ATOMIC_RELAXED);
+
+	for (uint32_t probe = 0; probe < PROFILER_MAX_PROBES; probe++) {
+		profile_stack_t *slot = &state->stacks[(hash + probe) % PROFILER_MAX_STACKS];
+		uint64_t current = __atomic_load_n(&slot->hash, __ATOMIC_ACQUIRE);
+
+		if (current == 0) {
+			if (__atomic_compare_exchange_n(&slot->hash, &current, hash, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+				memcpy(slot->pcs, pcs, depth * sizeof(uintptr_t));
+				slot->depth = depth;
+				__atomic_store_n(&slot->ready, 1, __ATOMIC_RELEASE);
+				__atomic_add_fetch(&slot->count, 1, __ATOMIC_RELAXED);
+				return;
+			}
+		}
+
+		if (current == hash) {
+			if (!__atomic_load_n(&slot->ready, __ATOMIC_ACQUIRE)) break;
+			if (slot->depth == depth && memcmp(slot->pcs, pcs, depth * sizeof(uintptr_t)) == 0) {
+				__atomic_add_fetch(&slot->count, 1, __ATOMIC_RELAXED);
+				return;
+			}
+		}
+	}
+
+	__atomic_add_fetch(&state->dropped, 1, __ATOMIC_RELAXED);
+}
+
+static void onSample(int sig, siginfo_t *info, void *context) {
+	(void)sig;
+	(void)info;
+
+	if (!__atomic_load_n(&state->active, __ATOMIC_ACQUIRE)) return;
+
+	int savedErrno = errno;
+	uintptr_t pcs[PROFILER_MAX_DEPTH];
+	uint32_t depth = captureStack(context, pcs);
+	if (depth > 0)
+		recordStack(pcs, depth);
+
+	// The perf counter fires once per refresh; the first interval was
+	// randomized, every later one is the full sample period.
+	if (perfFd >= 0) {
+		if (!periodSet) {
+			uint64_t period = samplePeriod;
+			ioctl(perfFd, PERF_EVENT_IOC_PERIOD, &period);
+			periodSet = 1;
+		}
+		ioctl(perfFd, PERF_EVENT_IOC_REFRESH, 1);
+	}
+	errno = savedErrno;
+}
+
+/*
+ * Prints one frame of a folded stack. Exported functions resolve to their
+ * name; anything else is printed as "[object+0xoffset]" for addr2line.
+ */
+static void writeFrame(FILE *out, uintptr_t pc, int isReturnAddress) {
+	Dl_info info;
+	void *lookup = (void *)(isReturnAddress ? pc - 1 : pc);
+
+	int found = dladdr(lookup, &info);
+	if (found && info.dli_sname) {
+		fputs(info.dli_sname, out);
+	} else if (found && info.dli_fname) {
+		const char *object = strrchr(info.dli_fname, '/');
+		fprintf(out, "[%s+0x%lx]", object ? object + 1 : info.dli_fname,
+			(unsigned long)(pc - (uintptr_t)info.dli_fbase));
+	} else {
+		fprintf(out, "[0x%lx]", (unsigned long)pc);
+	}
+}
+
+/*
+ * Allocates the shared sample table. Call once at startup, before any request
+ * is forked; without it the profiler stays disabled.
+ *
+ * Returns:
+ *   PROFILER_OK on success, PROFILER_DISABLED if the table could not be mapped.
+ */
+int profilerInit(void) {
+	state = shmAlloc(sizeof(profiler_state_t));
+	return state ? PROFILER_OK : PROFILER_DISABLED;
+}
+
+/*
+ * Opens a user-space task-clock counter that raises SIGPROF every `first`
+ * nanoseconds of CPU time. The counter is precise, unlike ITIMER_PROF which
+ * only advances on scheduler ticks.
+ */
+static int openTaskClock(long first) {
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_SOFTWARE;
+	attr.config = PERF_COUNT_SW_TASK_CLOCK;
+	attr.sample_period = first;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	int fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+	if (fd < 0) return -1;
+
+	struct f_owner_ex owner = { F_OWNER_TID, gettid() };
+	if (fcntl(fd, F_SETFL, O_ASYNC) != 0
+		|| fcntl(fd, F_SETSIG, SIGPROF) != 0
+		|| fcntl(fd, F_SETOWN_EX, &owner) != 0
+		|| ioctl(fd, PERF_EVENT_IOC_REFRESH, 1) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/*
+ * Starts sampling the calling process if a profiling session is running.
+ * Called by every forked request handler right after fork().
+ *
+ * Side Effects:
+ *   Installs a SIGPROF handler fed by a perf_event_open task-clock counter,
+ *   or by ITIMER_PROF where perf events are not permitted.
+ */
+void profilerAttach(void) {
+	if (!state || !__atomic_load_n(&state->active, __ATOMIC_ACQUIRE)) return;
+	if (monotonicSeconds() >= state->deadline) return;
+
+	pthread_attr_t attr;
+	void *base;
+	size_t size;
+	if (pthread_getattr_np(pthread_self(), &attr) != 0) return;
+	pthread_attr_getstack(&attr, &base, &size);
+	pthread_attr_destroy(&attr);
+	stackLow = (uintptr_t)base;
+	stackHigh = (uintptr_t)base + size;
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = onSample;
+	sa.sa_flags = SA_SIGINFO | SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGPROF, &sa, NULL);
+
+	// Request handlers usually exit before a full period of CPU time has
+	// elapsed, so the first sample lands at a random point of the period;
+	// otherwise short-lived processes would never be sampled at all.
+	unsigned int seed = (unsigned int)getpid() ^ (unsigned int)time(NULL);
+	samplePeriod = 1000000000L / state->hz;
+	long first = 1 + rand_r(&seed) % samplePeriod;
+
+	perfFd = openTaskClock(first);
+	if (perfFd >= 0) return;
+
+	struct itimerval timer;
+	timer.it_interval.tv_sec = 0;
+	timer.it_interval.tv_usec = samplePeriod / 1000;
+	timer.it_value.tv_sec = 0;
+	timer.it_value.tv_usec = 1 + first / 1000;
+	setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+/*
+ * Runs a profiling session and writes the aggregated stacks in the folded
+ * format expected by flamegraph.pl ("root;caller;leaf count" per line).
+ *
+ * Parameters:
+ *   seconds - Length of the session; clamped to 1..PROFILER_MAX_SECONDS.
+ *   hz      - Samples per second of CPU time; clamped to 1..PROFILER_MAX_HZ.
+ *   out     - Stream that receives the folded stacks (must not be NULL).
+ *
+ * Returns:
+ *   PROFILER_OK when the report was written,
+ *   PROFILER_DISABLED if the profiler was not initialized,
+ *   PROFILER_BUSY if another session is already running.
+ *
+ * Side Effects:
+ *   Blocks the calling process for the length of the session.
+ */
+int profilerRun(int seconds, int hz, FILE *out) {
+	assert(out != NULL);
+
+	if (!state) return PROFILER_DISABLED;
+
+	int expected = 0;
+	if (!__atomic_compare_exchange_n(&state->busy, &expected, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+		return PROFILER_BUSY;
+
+	if (seconds < 1) seconds = 1;
+	if (seconds > PROFILER_MAX_SECONDS) seconds = PROFILER_MAX_SECONDS;
+	if (hz < 1) hz = 1;
+	if (hz > PROFILER_MAX_HZ) hz = PROFILER_MAX_HZ;
+
+	memset(state->stacks, 0, sizeof(state->stacks));
+	state->samples = 0;
+	state->dropped = 0;
+	state->hz = hz;
+	state->deadline = monotonicSeconds() + seconds;
+	__atomic_store_n(&state->active, 1, __ATOMIC_RELEASE);
+
+	time_t remaining;
+	while ((remaining = state->deadline - monotonicSeconds()) > 0)
+		sleep(remaining);
+
+	__atomic_store_n(&state->active, 0, __ATOMIC_RELEASE);
+
+	for (int i = 0; i < PROFILER_MAX_STACKS; i++) {
+		profile_stack_t *slot = &state->stacks[i];
+		if (!__atomic_load_n(&slot->ready, __ATOMIC_ACQUIRE)) continue;
+
+		for (int frame = (int)slot->depth - 1; frame >= 0; frame--) {
+			writeFrame(out, slot->pcs[frame], frame != 0);
+			if (frame != 0) fputc(';', out);
+		}
+		fprintf(out, " %lu\n", (unsigned long)slot->count);
+	}
+
+	__atomic_store_n(&state->busy, 0, __ATOMIC_RELEASE);
+	return PROFILER_OK;
+}
+
+/*
+ * Reports the counters of the last profiling session.
+ *
+ * Parameters:
+ *   samples - Receives the number of samples taken (must not be NULL).
+ *   dropped - Receives the number of samples that did not fit in the table (must not be NULL).
+ */
+void profilerStats(unsigned long *samples, unsigned long *dropped) {
+	assert(samples != NULL && dropped != NULL);
+
+	*samples = state ? (unsigned long)state->samples : 0;
+	*dropped = state ? (unsigned long)state->dropped : 0;
+}
@@ -0,0 +1,622 @@
+//
+//  proxy.c
+//  CServer
+//
+//  Created by ibrahim alnakeeb on 19/10/2026.
+//
+
+#define _GNU_SOURCE
+
+#include "proxy.h"
+#include "metrics.h"
+
+#include <assert.h>
+#include <limits.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/un.h>
+
+// states of the chunked encoding (RFC 9112 section 7.1)
+#define CHUNK_SIZE			0		// hex digits of the chunk's size
+#define CHUNK_EXTENSION		1		// ";name=value" up to the end of the line
+#define CHUNK_SIZE_LF		2
+#define CHUNK_DATA			3
+#define CHUNK_DATA_CR		4
+#define CHUNK_DATA_LF		5
+#define CHUNK_TRAILER		6		// start of a trailer line, or of the closing blank line
+#define CHUNK_TRAILER_LINE	7
+#define CHUNK_END_LF		8
+
+static proxy_upstream_t upstreams[PROXY_UPSTREAMS_MAX];
+static int upstreamCount;
+
+// "host:port", "[v6]:port" or "unix:/path" into a socket address; 0 if it does not resolve
+static int resolve(const char *address, proxy_server_t *server) {
+	if (strncmp(address, "unix:", 5) == 0) {
+		struct sockaddr_un *un = (struct sockaddr_un *)&server->addr;
+		if (strlen(address + 5) >= sizeof(un->sun_path)) return 0;
+		un->sun_family = AF_UNIX;
+		strcpy(un->sun_path, address + 5);
+		server->addr_length = sizeof(struct sockaddr_un);
+		return 1;
+	}
+
+	char host[PROXY_ADDRESS_MAX];
+	snprintf(host, sizeof(host), "%s", address);
+	char *colon = strrchr(host, ':');
+	if (!colon || colon == host || !colon[1]) return 0;
+	*colon = '\0';
+	char *name = host;
+	if (*name == '[' && colon[-1] == ']') {
+		name++;
+		colon[-1] = '\0';
+	}
+
+	struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM, .ai_flags = AI_NUMERICSERV };
+	struct addrinfo *result;
+	if (getaddrinfo(name, colon + 1, &hints, &result) != 0) return 0;
+	memcpy(&server->addr, result->ai_addr, result->ai_addrlen);
+	server->addr_length = result->ai_addrlen;
+	freeaddrinfo(result);
+	return 1;
+}
+
+/*
+ * Checks an upstream's values the way proxyAddUpstream() does, without
+ * resolving its servers or adding it.
+ *
+ * Returns:
+ *   1 if the values are valid, 0 if not.
+ */
+int proxyValidUpstream(const char *name, int count, int keepalive, int idle, int maxFails, int down, int timeout) {
+	return name && *name && strlen(name) < PROXY_NAME_MAX && count >= 1 && count <= PROXY_SERVERS_MAX
+		   && keepalive >= 0 && idle >= 1 && maxFails >= 1 && down >= 1 && timeout >= 1;
+}
+
+/*
+ * Adds an upstream that ROUTE_PROXY() routes may name. Host names are
+ * resolved once, here. A name that is already taken keeps its first
+ * definition, so a reload of the configuration leaves the upstreams alone.
+ *
+ * Parameters:
+ *   servers   - Addresses: "host:port", "[v6]:port" or "unix:/path".
+ *   keepalive - Idle connections kept per server, 0 for none.
+ *   idle      - Seconds an idle connection is kept.
+ *   maxFails  - Failures in a row that take a server out of the rotation...
+ *   down      - ...for this many seconds.
+ *   timeout   - Seconds to connect, and to wait for each part of the response.
+ *
+ * Returns:
+ *   1 on success, 0 on an invalid value, an address that does not resolve
+ *   or when PROXY_UPSTREAMS_MAX are set.
+ */
+int proxyAddUpstream(const char *name, char *const *servers, int count,
+					 int keepalive, int idle, int maxFails, int down, int timeout) {
+	if (!proxyValidUpstream(name, count, keepalive, idle, maxFails, down, timeout))
+		return 0;
+	if (proxyFind(name)) return 1;
+	if (upstreamCount == PROXY_UPSTREAMS_MAX) return 0;
+
+	proxy_upstream_t *upstream = &upstreams[upstreamCount];
+	memset(upstream, 0, sizeof(*upstream));
+	for (int i = 0; i < count; i++) {
+		proxy_server_t *server = &upstream->servers[i];
+		if (strlen(servers[i]) >= PROXY_ADDRESS_MAX || !resolve(servers[i], server)) {
+			fprintf(stderr, "Upstream %s: cannot resolve %s\n", name, servers[i]);
+			return 0;
+		}
+		strcpy(server->address, servers[i]);
+	}
+	strcpy(upstream->name, name);
+	upstream->count = count;
+	upstream->keepalive = keepalive;
+	upstream->idle = idle;
+	upstream->max_fails = maxFails;
+	upstream->down = down;
+	upstream->timeout = timeout;
+	upstreamCount++;
+	return 1;
+}
+
+// the upstream of that name, NULL if none is configured
+proxy_upstream_t *proxyFind(const char *name) {
+	for (int i = 0; i < upstreamCount; i++)
+		if (strcmp(upstreams[i].name, name) == 0)
+			return &upstreams[i];
+	return NULL;
+}
+
+int proxyUpstreamCount(void) {
+	return upstreamCount;
+}
+
+/*
+ * Picks the server with the fewest outstanding requests, taking turns among
+ * equally busy ones. Servers taken out by their failures are skipped until
+ * their time is up; then one request at a time goes to them until one
+ * succeeds.
+ *
+ * Returns:
+ *   The server, its request counted as outstanding; NULL if every server is out.
+ */
+proxy_server_t *proxyPick(proxy_upstream_t *upstream, uint64_t now) {
+	assert(upstream != NULL);
+
+	proxy_server_t *best = NULL;
+	for (int i = 0; i < upstream->count; i++) {
+		proxy_server_t *server = &upstream->servers[(upstream->next + i) % upstream->count];
+		if (server->down_until > now || (server->fails >= upstream->max_fails && server->outstanding > 0))
+			continue;
+		if (!best || server->outstanding < best->outstanding)
+			best = server;
+	}
+	if (!best) return NULL;
+
+	best->outstanding++;
+	upstream->next = (best - upstream->servers + 1) % upstream->count;
+	return best;
+}
+
+/*
+ * Ends a request proxyPick() counted. A failure is a connection refused,
+ * reset or timed out, or a malformed response; the status code of a
+ * complete response does not count. max_fails of them in a row take the
+ * server out for its down time (counted as proxy_servers_down).
+ *
+ * Parameters:
+ *   failed - 1 on a failure, 0 once the response came through, -1 when
+ *            the exchange ended without telling (the client left).
+ */
+void proxyDone(proxy_upstream_t *upstream, proxy_server_t *server, int failed, uint64_t now) {
+	assert(upstream != NULL && server != NULL && server->outstanding > 0);
+
+	server->outstanding--;
+	if (failed == 0)
+		server->fails = 0;
+	if (failed <= 0) return;
+
+	METRIC_INC(METRIC_PROXY_FAILURES);
+	if (++server->fails >= upstream->max_fails) {
+		server->down_until = now + (uint64_t)upstream->down * 1000;
+		METRIC_INC(METRIC_PROXY_SERVERS_DOWN);
+	}
+}
+
+// value of the next field named name after the one at after (NULL: the first), NULL if none; *valueLength excludes the CRLF
+static const char *nextField(const char *head, size_t length, const char *after, const char *name, size_t *valueLength) {
+	size_t nameLength = strlen(name);
+	const char *end = head + length;
+	const char *line = after ? memmem(after, end - after, "\r\n", 2) : memmem(head, length, "\r\n", 2);
+
+	while (line && (line += 2) < end) {
+		const char *eol = memmem(line, end - line, "\r\n", 2);
+		if (!eol) break;
+		if ((size_t)(eol - line) > nameLength && line[nameLength] == ':' && strncasecmp(line, name, nameLength) == 0) {
+			const char *value = line + nameLength + 1;
+			while (value < eol && (*value == ' ' || *value == '\t'))
+				value++;
+			*valueLength = eol - value;
+			return value;
+		}
+		line = eol;
+	}
+	return NULL;
+}
+
+// value of the first field named name in a head, NULL if absent
+static const char *findField(const char *head, size_t length, const char *name, size_t *valueLength) {
+	return nextField(head, length, NULL, name, valueLength);
+}
+
+/*
+ * Every field line of a head is a name, a colon and a value: no
+ * whitespace in or after the name (RFC 9112 section 5.1), no line folded
+ * onto the one before. A server behind the proxy could otherwise take
+ * "Transfer-Encoding : chunked" for a field this file does not see.
+ */
+static int validFields(const char *head, size_t length) {
+	const char *line = memmem(head, length, "\r\n", 2);
+	const char *end = head + length - 2;		// the blank line's CRLF
+	while (line && (line += 2) < end) {
+		const char *eol = memmem(line, end + 2 - line, "\r\n", 2);
+		const char *colon = memchr(line, ':', eol - line);
+		if (!colon || colon == line) return 0;
+		for (const char *c = line; c < colon; c++)
+			if (*c <= ' ' || *c == 0x7f) return 0;
+		line = eol;
+	}
+	return 1;
+}
+
+// a Content-Length value: digits, then nothing but whitespace; -1 if it is not
+static long long parseLength(const char *value, size_t length) {
+	const char *end = value + length;
+	long long result = 0;
+	if (value == end || *value < '0' || *value > '9') return -1;
+	for (; value < end && *value >= '0' && *value <= '9'; value++) {
+		if (result > (LLONG_MAX - 9) / 10) return -1;
+		result = result * 10 + (*value - '0');
+	}
+	for (; value < end; value++)
+		if (*value != ' ' && *value != '\t') return -1;
+	return result;
+}
+
+// copies n bytes to out unless that passes capacity; *used counts them either way
+static void append(char *out, size_t capacity, size_t *used, const char *data, size_t n) {
+	if (*used <= capacity && n <= capacity - *used)
+		memcpy(out + *used, data, n);
+	*used += n;
+}
+
+// a comma-separated field value lists the token, in any case
+static int hasToken(const char *value, size_t length, const char *token) {
+	size_t tokenLength = strlen(token);
+	const char *end = value + length;
+	while (value < end) {
+		while (value < end && (*value == ' ' || *value == '\t' || *value == ','))
+			value++;
+		const char *item = value;
+		while (value < end && *value != ',')
+			value++;
+		const char *itemEnd = value;
+		while (itemEnd > item && (itemEnd[-1] == ' ' || itemEnd[-1] == '\t'))
+			itemEnd--;
+		if ((size_t)(itemEnd - item) == tokenLength && strncasecmp(item, token, tokenLength) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+// the last coding of Transfer-Encoding is chunked
+static int chunkedLast(const char *value, size_t length) {
+	while (length > 0 && (value[length - 1] == ' ' || value[length - 1] == '\t'))
+		length--;
+	return length >= 7 && strncasecmp(value + length - 7, "chunked", 7) == 0
+		   && (length == 7 || value[length - 8] == ',' || value[length - 8] == ' ');
+}
+
+/*
+ * A field that only concerns one connection: the hop-by-hop fields of RFC
+ * 9110 section 7.6.1, and those the message's Connection field names. The
+ * chunked encoding is relayed as it is, so Transfer-Encoding stays.
+ */
+static int hopByHop(const char *line, size_t nameLength, const char *connection, size_t connectionLength) {
+	static const char *const names[] = { "connection", "keep-alive", "proxy-connection", "te", "trailer", "upgrade",
+										 "http2-settings" };
+	for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+		if (nameLength == strlen(names[i]) && strncasecmp(line, names[i], nameLength) == 0)
+			return 1;
+
+	char name[64];
+	if (!connection || nameLength >= sizeof(name)) return 0;
+	memcpy(name, line, nameLength);
+	name[nameLength] = '\0';
+	return hasToken(connection, connectionLength, name);
+}
+
+/*
+ * Finds how a request's body is framed. Anything a server behind the
+ * proxy could read differently (request smuggling) is refused: both
+ * Content-Length and Transfer-Encoding, an encoding other than chunked,
+ * Transfer-Encoding given twice, Content-Length fields that disagree or
+ * are not a number, and field names with whitespace before the colon.
+ *
+ * Returns:
+ *   1 with *body set, 0 if the framing is invalid.
+ */
+int proxyRequestBody(const char *head, size_t length, proxy_body_t *body) {
+	assert(head != NULL && body != NULL);
+
+	memset(body, 0, sizeof(*body));
+	if (!validFields(head, length)) return 0;
+
+	size_t valueLength;
+	const char *encoding = findField(head, length, "Transfer-Encoding", &valueLength);
+	size_t lengthLength;
+	const char *contentLength = findField(head, length, "Content-Length", &lengthLength);
+
+	if (encoding) {
+		size_t otherLength;
+		if (contentLength || !chunkedLast(encoding, valueLength)
+			|| nextField(head, length, encoding, "Transfer-Encoding", &otherLength))
+			return 0;
+		body->mode = PROXY_BODY_CHUNKED;
+		return 1;
+	}
+
+	body->mode = PROXY_BODY_NONE;
+	body->done = 1;
+	if (!contentLength) return 1;
+
+	long long value = parseLength(contentLength, lengthLength);
+	if (value < 0) return 0;
+	for (const char *other = contentLength;
+		 (other = nextField(head, length, other, "Content-Length", &lengthLength)); )
+		if (parseLength(other, lengthLength) != value) return 0;
+	if (value > 0) {
+		body->mode = PROXY_BODY_LENGTH;
+		body->remaining = value;
+		body->done = 0;
+	}
+	return 1;
+}
+
+/*
+ * Rewrites a client's request head for an upstream: HTTP/1.1 on a
+ * connection the proxy keeps, without the client's hop-by-hop fields, with
+ * the X-Forwarded-For fields merged into one that ends with the client,
+ * and the scheme it used in X-Forwarded-Proto. The request line's target
+ * and every other field are passed on as they are, Host included.
+ *
+ * Parameters:
+ *   head   - The request line and fields, blank line included.
+ *   client - The client's address as text.
+ *   https  - The client came over TLS.
+ *
+ * Returns:
+ *   The new head, to be freed, NULL on a malformed request line or out of memory.
+ */
+char *proxyRequestHead(const char *head, size_t length, const char *client, int https, size_t *outLength) {
+	assert(head != NULL && client != NULL && outLength != NULL);
+
+	const char *eol = memmem(head, length, "\r\n", 2);
+	const char *version = eol ? memrchr(head, ' ', eol - head) : NULL;
+	if (!version || version == head) return NULL;
+
+	// the merged X-Forwarded-For: every value and a ", " after it, then the client
+	size_t forwardedLength = 0, valueLength;
+	for (const char *value = NULL; (value = nextField(head, length, value, "X-Forwarded-For", &valueLength)); )
+		forwardedLength += valueLength + 2;
+
+	static const char requestVersion[] = " HTTP/1.1\r\n";
+	static const char forwardedFor[] = "X-Forwarded-For: ";
+	const char *proto = https ? "X-Forwarded-Proto: https\r\n\r\n" : "X-Forwarded-Proto: http\r\n\r\n";
+	size_t capacity = (version - head) + sizeof(requestVersion) + length + sizeof(forwardedFor) + forwardedLength
+					  + strlen(client) + 2 + strlen(proto);
+	char *out = malloc(capacity);
+	if (!out) return NULL;
+	size_t used = 0;
+	append(out, capacity, &used, head, version - head);
+	append(out, capacity, &used, requestVersion, sizeof(requestVersion) - 1);
+
+	size_t connectionLength = 0;
+	const char *connection = findField(head, length, "Connection", &connectionLength);
+	const char *end = head + length - 2;		// the blank line's CRLF
+	for (const char *line = eol + 2; line < end; ) {
+		const char *next = memmem(line, end - line + 2, "\r\n", 2);
+		const char *colon = memchr(line, ':', next - line);
+		size_t nameLength = colon ? (size_t)(colon - line) : 0;
+		if (nameLength && !hopByHop(line, nameLength, connection, connectionLength)
+			&& !(nameLength == 15 && strncasecmp(line, "X-Forwarded-For", 15) == 0)
+			&& !(nameLength == 17 && strncasecmp(line, "X-Forwarded-Proto", 17) == 0))
+			append(out, capacity, &used, line, next + 2 - line);
+		line = next + 2;
+	}
+
+	append(out, capacity, &used, forwardedFor, sizeof(forwardedFor) - 1);
+	for (const char *value = NULL; (value = nextField(head, length, value, "X-Forwarded-For", &valueLength)); ) {
+		while (valueLength > 0 && (value[valueLength - 1] == ' ' || value[valueLength - 1] == '\t'))
+			valueLength--;
+		if (valueLength == 0) continue;
+		append(out, capacity, &used, value, valueLength);
+		append(out, capacity, &used, ", ", 2);
+	}
+	append(out, capacity, &used, client, strlen(client));
+	append(out, capacity, &used, "\r\n", 2);
+	append(out, capacity, &used, proto, strlen(proto));
+	if (used > capacity) {
+		free(out);
+		return NULL;
+	}
+	*outLength = used;
+	return out;
+}
+
+/*
+ * Parses the head of an upstream's response and finds how its body is
+ * framed: none for HEAD requests, 1xx, 204 and 304; chunked, a length, or
+ * up to the end of the connection, which then cannot be kept.
+ *
+ * Parameters:
+ *   headRequest - The request was a HEAD.
+ *
+ * Returns:
+ *   1 with *response set, 0 if the head is not complete yet, -1 if it is malformed.
+ */
+int proxyParseResponse(const char *data, size_t length, int headRequest, proxy_response_t *response) {
+	assert(data != NULL && response != NULL);
+
+	const char *end = memmem(data, length, "\r\n\r\n", 4);
+	if (!end) return length >= PROXY_HEAD_MAX ? -1 : 0;
+	if (length < 12 || memcmp(data, "HTTP/1.", 7) != 0 || data[8] != ' '
+		|| data[9] < '1' || data[9] > '5' || data[10] < '0' || data[10] > '9' || data[11] < '0' || data[11] > '9')
+		return -1;
+
+	memset(response, 0, sizeof(*response));
+	response->length = end + 4 - data;
+	response->status = (data[9] - '0') * 100 + (data[10] - '0') * 10 + (data[11] - '0');
+
+	size_t valueLength;
+	const char *connection = findField(data, response->length, "Connection", &valueLength);
+	response->keep_alive = data[7] == '1' ? !connection || !hasToken(connection, valueLength, "close")
+										   : connection && hasToken(connection, valueLength, "keep-alive");
+
+	proxy_body_t *body = &response->body;
+	if (headRequest || response->status < 200 || response->status == 204 || response->status == 304) {
+		body->mode = PROXY_BODY_NONE;
+		body->done = 1;
+		return 1;
+	}
+
+	const char *encoding = findField(data, response->length, "Transfer-Encoding", &valueLength);
+	if (encoding) {
+		body->mode = chunkedLast(encoding, valueLength) ? PROXY_BODY_CHUNKED : PROXY_BODY_CLOSE;
+	} else if ((encoding = findField(data, response->length, "Content-Length", &valueLength))) {
+		long long value = parseLength(encoding, valueLength);
+		if (value < 0) return -1;
+		body->mode = value ? PROXY_BODY_LENGTH : PROXY_BODY_NONE;
+		body->remaining = value;
+		body->done = value == 0;
+	} else {
+		body->mode = PROXY_BODY_CLOSE;
+	}
+	if (body->mode == PROXY_BODY_CLOSE)
+		response->keep_alive = 0;
+	return 1;
+}
+
+/*
+ * Rewrites an upstream's response head for the client: HTTP/1.1, without
+ * the upstream's hop-by-hop fields, with a Connection field of the
+ * client's own.
+ *
+ * Parameters:
+ *   keepAlive - The client's connection stays open after the response.
+ *   dechunk   - The body goes out decoded (an HTTP/1.0 client, an HTTP/2
+ *               stream): Transfer-Encoding is dropped too.
+ *
+ * Returns:
+ *   The new head, to be freed, NULL if out of memory.
+ */
+char *proxyResponseHead(const char *head, size_t length, int keepAlive, int dechunk, size_t *outLength) {
+	assert(head != NULL && outLength != NULL);
+
+	const char *connectionField = keepAlive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+	size_t capacity = length + strlen(connectionField);
+	char *out = malloc(capacity);
+	if (!out) return NULL;
+	const char *eol = memmem(head, length, "\r\n", 2);
+	size_t used = 0;
+	append(out, capacity, &used, "HTTP/1.1", 8);
+	append(out, capacity, &used, head + 8, eol + 2 - (head + 8));
+
+	size_t connectionLength = 0;
+	const char *connection = findField(head, length, "Connection", &connectionLength);
+	const char *end = head + length - 2;
+	for (const char *line = eol + 2; line < end; ) {
+		const char *next = memmem(line, end - line + 2, "\r\n", 2);
+		const char *colon = memchr(line, ':', next - line);
+		size_t nameLength = colon ? (size_t)(colon - line) : 0;
+		if (nameLength && !hopByHop(line, nameLength, connection, connectionLength)
+			&& !(dechunk && nameLength == 17 && strncasecmp(line, "Transfer-Encoding", 17) == 0))
+			append(out, capacity, &used, line, next + 2 - line);
+		line = next + 2;
+	}
+	append(out, capacity, &used, connectionField, strlen(connectionField));
+	if (used > capacity) {
+		free(out);
+		return NULL;
+	}
+	*outLength = used;
+	return out;
+}
+
+/*
+ * Finds how much of the bytes that arrived belongs to the body being
+ * relayed, continuing where the last call stopped. What follows the body
+ * is left alone: the next request of a keep-alive client, or bytes an
+ * upstream should not have sent.
+ *
+ * Parameters:
+ *   decode  - Move the chunks' data to the front of data, without the
+ *             chunked encoding around it.
+ *   payload - Set to the bytes to send on: all those taken, or with decode
+ *             the data decoded.
+ *
+ * Returns:
+ *   The bytes of data that belong to the body. body->done is set once it
+ *   ended, body->failed on malformed chunks.
+ */
+size_t proxyBodyScan(proxy_body_t *body, char *data, size_t length, int decode, size_t *payload) {
+	assert(body != NULL && payload != NULL);
+
+	size_t taken = 0, out = 0;
+	*payload = 0;
+	if (body->done || body->failed) return 0;
+
+	switch (body->mode) {
+	case PROXY_BODY_NONE:
+		body->done = 1;
+		return 0;
+	case PROXY_BODY_CLOSE:
+		*payload = length;
+		return length;
+	case PROXY_BODY_LENGTH:
+		taken = length < body->remaining ? length : body->remaining;
+		body->remaining -= taken;
+		body->done = body->remaining == 0;
+		*payload = taken;
+		return taken;
+	}
+
+	while (taken < length && !body->done && !body->failed) {
+		if (body->state == CHUNK_DATA) {
+			size_t n = length - taken < body->remaining ? length - taken : body->remaining;
+			if (decode)
+				memmove(data + out, data + taken, n);
+			out += n;
+			taken += n;
+			body->remaining -= n;
+			if (body->remaining == 0)
+				body->state = CHUNK_DATA_CR;
+			continue;
+		}
+
+		char c = data[taken++];
+		int digit = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10
+				  : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+		switch (body->state) {
+		case CHUNK_SIZE:
+			if (digit >= 0 && body->digits < 15) {
+				body->remaining = body->remaining << 4 | digit;
+				body->digits++;
+				break;
+			}
+			if (!body->digits || digit >= 0) {
+				body->failed = 1;
+				break;
+			}
+			if (c == ';' || c == ' ' || c == '\t')
+				body->state = CHUNK_EXTENSION;
+			else if (c == '\r')
+				body->state = CHUNK_SIZE_LF;
+			else
+				body->failed = 1;
+			break;
+		case CHUNK_EXTENSION:
+			if (c == '\r')
+				body->state = CHUNK_SIZE_LF;
+			break;
+		case CHUNK_SIZE_LF:
+			body->failed = c != '\n';
+			body->state = body->remaining ? CHUNK_DATA : CHUNK_TRAILER;
+			body->digits = 0;
+			break;
+		case CHUNK_DATA_CR:
+			body->failed = c != '\r';
+			body->state = CHUNK_DATA_LF;
+			break;
+		case CHUNK_DATA_LF:
+			body->failed = c != '\n';
+			body->state = CHUNK_SIZE;
+			break;
+		case CHUNK_TRAILER:
+			body->state = c == '\r' ? CHUNK_END_LF : CHUNK_TRAILER_LINE;
+			break;
+		case CHUNK_TRAILER_LINE:
+			if (c == '\n')
+				body->state = CHUNK_TRAILER;
+			break;
+		case CHUNK_END_LF:
+			body->failed = c != '\n';
+			body->done = !body->failed;
+			break;
+		}
+	}
+	*payload = decode ? out : taken;
+	return taken;
+}
@@ -0,0 +1,251 @@
+//
+//  ratelimit.c
+//  CServer
+//
+//  Created by ibrahim alnakeeb on 19/10/2026.
+//
+
+#include "ratelimit.h"
+#include "shm.h"
+#include "timer.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define TOKEN		1000000u		// a request's worth of a bucket, in micro-tokens
+
+// A client's bucket under one rule. The state packs the time of the last
+// take (ms since ratelimitInit(), high half) and the micro-tokens left then
+// (low half), so a take is a single compare-and-swap; 0 is a full bucket.
+typedef struct {
+	uint64_t	key;			// 0 if free
+	uint64_t	state;
+} bucket_t;
+
+typedef struct {
+	char		method[16];		// empty for any method
+	char		path[RATELIMIT_PATH_MAX];
+	size_t		pathLength;
+	int			prefix;			// path ended in '*'
+	uint64_t	seed;			// keys clients under this rule apart from other rules
+	uint32_t	capacity;		// micro-tokens
+	uint32_t	refill;			// micro-tokens per ms
+	char		response[192];	// the prebuilt 429
+} rule_t;
+
+static bucket_t *table;			// shared with every process the server forks
+static uint64_t epoch;			// timerNowMs() of ratelimitInit(), less one
+static rule_t rules[RATELIMIT_RULES_MAX];
+static int ruleCount;
+static uint32_t idleMs;			// a bucket untouched this long is full under any rule
+
+/*
+ * Maps the bucket table. Call it before the handlers are forked.
+ *
+ * Returns:
+ *   1 on success, 0 if the table could not be mapped.
+ */
+int ratelimitInit(void) {
+	epoch = timerNowMs() - 1;
+	table = shmAlloc(sizeof(bucket_t) * RATELIMIT_SLOTS);
+	return table != NULL;
+}
+
+// FNV-1a, continued from seed; never 0, which marks a free slot
+static uint64_t hash(uint64_t seed, const void *data, size_t length) {
+	const unsigned char *bytes = data;
+	uint64_t h = seed;
+	for (size_t i = 0; i < length; i++) {
+		h ^= bytes[i];
+		h *= 0x100000001b3ULL;
+	}
+	h ^= h >> 29;
+	return h ? h : 1;
+}
+
+/*
+ * Checks a rule's values the way ratelimitAddRule() does, without adding
+ * it, so a configuration can be checked whole before any of it applies.
+ *
+ * Returns:
+ *   1 if ratelimitAddRule() would take the rule while there is room, 0 if not.
+ */
+int ratelimitValidRule(const char *method, const char *path, int requests, int seconds, int burst) {
+	return path && *path && strlen(path) < RATELIMIT_PATH_MAX
+		   && (!method || strlen(method) < sizeof(rules[0].method))
+		   && requests >= 1 && seconds >= 1 && burst >= 1 && burst <= RATELIMIT_BURST_MAX;
+}
+
+/*
+ * Adds a limit of requests per seconds on each client, refilled continuously
+ * and allowing bursts of up to burst requests. Rules are kept per process;
+ * the buckets are shared.
+ *
+ * Parameters:
+ *   method - "POST", or NULL for any method.
+ *   path   - The path the rule covers; a trailing '*' covers every path
+ *            starting with the rest, "*" alone every path.
+ *
+ * Returns:
+ *   1 on success, 0 on an invalid rule or when RATELIMIT_RULES_MAX are set.
+ */
+int ratelimitAddRule(const char *method, const char *path, int requests, int seconds, int burst) {
+	if (ruleCount == RATELIMIT_RULES_MAX || !ratelimitValidRule(method, path, requests, seconds, burst))
+		return 0;
+
+	rule_t *rule = &rules[ruleCount];
+	memset(rule, 0, sizeof(rule_t));
+	snprintf(rule->method, sizeof(rule->method), "%s", method ? method : "");
+	snprintf(rule->path, sizeof(rule->path), "%s", path);
+	rule->pathLength = strlen(path);
+	if (rule->path[rule->pathLength - 1] == '*')
+		rule->prefix = 1, rule->pathLength--;
+	rule->seed = hash(hash(0xcbf29ce484222325ULL, rule->method, strlen(rule->method)), path, strlen(path));
+	rule->capacity = (uint32_t)burst * TOKEN;
+	rule->refill = (uint32_t)((uint64_t)requests * TOKEN / 1000 / seconds);
+	if (rule->refill == 0) rule->refill = 1;
+
+	int retryAfter = (seconds + requests - 1) / requests;
+	snprintf(rule->response, sizeof(rule->response),
+			 "HTTP/1.1 429 Too Many Requests\r\n"
+			 "Retry-After: %d\r\n"
+			 "Content-Type: text/plain\r\n"
+			 "Content-Length: 18\r\n"
+			 "Connection: close\r\n"
+			 "\r\n"
+			 "Too many requests\n", retryAfter);
+
+	// buckets of removed rules stay reclaimable, so this only grows
+	uint32_t fullMs = rule->capacity / rule->refill + 1;
+	if (fullMs > idleMs) idleMs = fullMs;
+	ruleCount++;
+	return 1;
+}
+
+/*
+ * Removes every rule, before a reload adds the configured ones again.
+ */
+void ratelimitClearRules(void) {
+	ruleCount = 0;
+}
+
+/*
+ * Returns the number of rules.
+ */
+int ratelimitRuleCount(void) {
+	return ruleCount;
+}
+
+// a bucket that was never taken from, or has refilled completely since, is as good as a new one
+static int idle(const bucket_t *slot, uint32_t now) {
+	uint64_t state = __atomic_load_n(&slot->state, __ATOMIC_RELAXED);
+	return state == 0 || now - (uint32_t)(state >> 32) >= idleMs;
+}
+
+// the bucket of key, claiming a free or idle slot for it; NULL if all are in use
+static bucket_t *findBucket(uint64_t key, uint32_t now) {
+	size_t first = key & (RATELIMIT_SLOTS - 1);
+	for (int i = 0; i < RATELIMIT_PROBES; i++) {
+		bucket_t *slot = &table[(first + i) & (RATELIMIT_SLOTS - 1)];
+		if (__atomic_load_n(&slot->key, __ATOMIC_ACQUIRE) == key)
+			return slot;
+	}
+
+	for (int i = 0; i < RATELIMIT_PROBES; i++) {
+		bucket_t *slot = &table[(first + i) & (RATELIMIT_SLOTS - 1)];
+		uint64_t seen = __atomic_load_n(&slot->key, __ATOMIC_ACQUIRE);
+		if (seen != 0 && !idle(slot, now))
+			continue;
+		if (__atomic_compare_exchange_n(&slot->key, &seen, key, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+			|| seen == key)
+			return slot;
+	}
+	return NULL;
+}
+
+// gives back a token take() took, when another rule refuses the request after all
+static void refund(bucket_t *bucket, const rule_t *rule) {
+	uint64_t state = __atomic_load_n(&bucket->state, __ATOMIC_ACQUIRE);
+	while (state != 0) {		// 0 is full already
+		uint64_t tokens = (uint64_t)(uint32_t)state + TOKEN;
+		if (tokens > rule->capacity) tokens = rule->capacity;
+		uint64_t next = (state & ~(uint64_t)UINT32_MAX) | tokens;
+		if (__atomic_compare_exchange_n(&bucket->state, &state, next, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			return;
+	}
+}
+
+/*
+ * Takes a token from the bucket, first adding what has accrued since the
+ * last take; there is no refill timer.
+ *
+ * Returns:
+ *   1 if a token was taken, 0 if the bucket is empty.
+ */
+static int take(bucket_t *bucket, const rule_t *rule, uint32_t now) {
+	uint64_t state = __atomic_load_n(&bucket->state, __ATOMIC_ACQUIRE);
+	for (;;) {
+		uint64_t tokens = rule->capacity;
+		if (state != 0) {
+			tokens = (uint32_t)state + (uint64_t)(now - (uint32_t)(state >> 32)) * rule->refill;
+			if (tokens > rule->capacity) tokens = rule->capacity;
+		}
+		if (tokens < TOKEN)
+			return 0;
+
+		uint64_t next = (uint64_t)now << 32 | (tokens - TOKEN);
+		if (__atomic_compare_exchange_n(&bucket->state, &state, next, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			return 1;
+	}
+}
+
+static int matches(const rule_t *rule, const char *method, size_t methodLength, const char *path, size_t pathLength) {
+	if (rule->method[0] && (strlen(rule->method) != methodLength || memcmp(rule->method, method, methodLength) != 0))
+		return 0;
+	if (rule->prefix)
+		return pathLength >= rule->pathLength && memcmp(rule->path, path, rule->pathLength) == 0;
+	return pathLength == rule->pathLength && memcmp(rule->path, path, pathLength) == 0;
+}
+
+/*
+ * Charges a request to its client's bucket under every rule that covers it,
+ * or under none: a request one rule refuses gets back the tokens the rules
+ * before it took. Safe to call from any thread or process sharing the table.
+ *
+ * Parameters:
+ *   client - Bytes that identify the client, e.g. its IP address.
+ *   path   - Without the query string.
+ *   now    - Milliseconds of a monotonic clock (timerNowMs()).
+ *
+ * Returns:
+ *   NULL if the request may go on, or the 429 response of the rule it is
+ *   over. When the table has no slot left for a client, its requests go on.
+ */
+const char *ratelimitCheck(const void *client, size_t clientLength, const char *method, size_t methodLength,
+						   const char *path, size_t pathLength, uint64_t now) {
+	if (!table || ruleCount == 0) return NULL;
+
+	uint32_t elapsed = (uint32_t)(now - epoch);		// wraps after 49 days, the subtractions still hold
+	bucket_t *taken[RATELIMIT_RULES_MAX];
+	const rule_t *takenRules[RATELIMIT_RULES_MAX];
+	int takenCount = 0;
+
+	for (int i = 0; i < ruleCount; i++) {
+		const rule_t *rule = &rules[i];
+		if (!matches(rule, method, methodLength, path, pathLength))
+			continue;
+
+		bucket_t *bucket = findBucket(hash(rule->seed, client, clientLength), elapsed);
+		if (!bucket) continue;
+		if (!take(bucket, rule, elapsed)) {
+			while (takenCount > 0) {
+				takenCount--;
+				refund(taken[takenCount], takenRules[takenCount]);
+			}
+			return rule->response;
+		}
+		taken[takenCount] = bucket;
+		takenRules[takenCount++] = rule;
+	}
+	return NULL;
+}
@@ -7,31 +7,9 @@
 
 #include "response.h"
 
-/*
- * Determines the MIME type based on the file extension of the given path.
- *
- * Parameters:
- *	path - The file path to evaluate (must not be NULL).
- *
- * Returns:
- *   A string literal representing the MIME type (e.g., "text/html", "image/png").
- *   Defaults to MIME_BIN if the extension is unrecognized or missing.
- */
-const char *get_mime_type(const char *path) {
-	assert(path != NULL);
-
-	const char *ext = strrchr(path, '.');
-	if (!ext) return MIME_BIN;
-
-	if (strcmp(ext, ".html") == 0)	return MIME_HTML;
-	if (strcmp(ext, ".css") == 0)	return MIME_CSS;
-	if (strcmp(ext, ".js") == 0)	return MIME_JS;
-	if (strcmp(ext, ".ico") == 0)	return MIME_ICO;
-	if (strcmp(ext, ".png") == 0) 	return MIME_PNG;
-	if (strcmp(ext, ".jpg") == 0 || strcmp(ext, ".jpeg") == 0) return MIME_JPEG;
-
-	return MIME_BIN;
-}
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 /*
  * Reads the entire contents of a binary file into a newly allocated buffer.
@@ -41,8 +19,10 @@ const char *get_mime_type(const char *path) {
  *   out_size - Optional pointer to store the number of bytes read; can be NULL.
  *
  * Returns:
- *   Pointer to a newly allocated buffer containing the file's contents,
- *   or NULL if the file cannot be opened, read fully, or memory allocation fails.
+ *   Pointer to a newly allocated buffer containing the file's contents followed by
+ *   a '\0' terminator (not counted in out_size), or NULL if the file cannot be opened,
+ *   read fully, or memory allocation fails. With embedded assets the file comes from
+ *   the bundle and the filesystem is not touched.
  *
  * Side Effects:
  *   Allocates memory that must be freed by the caller.
@@ -50,36 +30,49 @@ const char *get_mime_type(const char *path) {
 char *getFile(const char *path, int *out_size) {
 	assert(path != NULL);
 
-	FILE *file = fopen(path, "rb");
-	if (!file) return NULL;
+	if (bundleMode() == BUNDLE_EMBEDDED) {
+		const bundle_file_t *bundled = bundleFind(path, NULL);
+		if (!bundled) return NULL;
 
-	// Seek to the end to determine file size
-	if (fseek(file, 0, SEEK_END) != 0) {
-		fclose(file);
-		return NULL;
+		char *copy = malloc(bundled->length + 1);
+		if (!copy) return NULL;
+		memcpy(copy, bundled->data, bundled->length + 1);
+		if (out_size)
+			*out_size = (int)bundled->length;
+		return copy;
 	}
 
-	long size = ftell(file);
-	if (size < 0) {
-		fclose(file);
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return NULL;
+
+	struct stat info;
+	if (fstat(fd, &info) != 0) {
+		close(fd);
 		return NULL;
 	}
-	rewind(file);
+	long size = info.st_size;
 
-	// Allocate exact size (no null terminator)
-	char *buffer = malloc(size);
+	// Terminate the buffer so text files can be used as strings
+	char *buffer = malloc(size + 1);
 	if (!buffer) {
-		fclose(file);
+		close(fd);
 		return NULL;
 	}
 
-	size_t bytes_read = fread(buffer, 1, size, file);
-	fclose(file);
+	// request_read() lets a coroutine handler wait for the disk without holding up the server
+	long bytes_read = 0;
+	while (bytes_read < size) {
+		long n = request_read(fd, buffer + bytes_read, size - bytes_read, bytes_read);
+		if (n <= 0) break;
+		bytes_read += n;
+	}
+	close(fd);
 
-	if (bytes_read != (size_t)size) {
+	if (bytes_read != size) {
 		free(buffer);
 		return NULL;
 	}
+	buffer[size] = '\0';
 
 	if(out_size) {
 		*out_size = (int)bytes_read;
@@ -88,52 +81,116 @@ char *getFile(const char *path, int *out_size) {
 	return buffer;
 }
 
+// index of the placeholder starting at text, or -1
+static int matchPlaceholder(const char *text, const char **placeholders, const size_t *keyLengths, int count) {
+	for (int i = 0; i < count; i++)
+		if (strncmp(text, placeholders[i], keyLengths[i]) == 0)
+			return i;
+	return -1;
+}
+
+// a template and its values, filled by fillTemplate()
+typedef struct {
+	const char	*page;
+	const char	**placeholders;
+	const char	**values;
+	const int	*modes;
+	int			count;
+	char		*result;
+} template_fill_t;
+
+// renderTemplate()'s CPU-bound part: the page with its placeholders replaced, or NULL
+static void fillTemplate(void *arg) {
+	template_fill_t *fill = arg;
+	const char **placeholders = fill->placeholders, **values = fill->values;
+	const int *modes = fill->modes;
+	int count = fill->count;
+
+	size_t keyLengths[TEMPLATE_SLOTS_MAX], valueLengths[TEMPLATE_SLOTS_MAX], escapedLengths[TEMPLATE_SLOTS_MAX];
+	for (int i = 0; i < count; i++) {
+		assert(placeholders[i][0] == '{');
+		keyLengths[i] = strlen(placeholders[i]);
+		valueLengths[i] = strlen(values[i]);
+		escapedLengths[i] = escapedLength(values[i], valueLengths[i], modes ? modes[i] : ESCAPE_HTML);
+	}
+
+	// measure, then fill
+	size_t length = 0;
+	const char *text = fill->page;
+	for (const char *brace; (brace = strchr(text, '{')); ) {
+		int slot = matchPlaceholder(brace, placeholders, keyLengths, count);
+		length += brace - text + (slot >= 0 ? escapedLengths[slot] : 1);
+		text = brace + (slot >= 0 ? keyLengths[slot] : 1);
+	}
+	length += strlen(text);
+
+	char *result = malloc(length + 1);
+	if (!result) return;
+
+	char *out = result;
+	text = fill->page;
+	for (const char *brace; (brace = strchr(text, '{')); ) {
+		int slot = matchPlaceholder(brace, placeholders, keyLengths, count);
+		memcpy(out, text, brace - text);
+		out += brace - text;
+		if (slot >= 0) {
+			out += escapeHtml(out, values[slot], valueLengths[slot], modes ? modes[slot] : ESCAPE_HTML);
+			text = brace + keyLengths[slot];
+		} else {
+			*out++ = '{';
+			text = brace + 1;
+		}
+	}
+	strcpy(out, text);
+	fill->result = result;
+}
+
 /*
- * Loads a template file and replaces specified placeholders with corresponding values.
+ * Loads a template file and replaces specified placeholders with corresponding values,
+ * escaping each value for the slot it fills.
  *
  * Parameters:
  *   filepath     - Path to the template file to load.
- *   placeholders - Array of placeholder strings to search for in the template.
+ *   placeholders - Array of placeholder strings to search for in the template; each starts with '{'.
  *   values       - Array of values to replace corresponding placeholders.
- *   count        - Number of placeholder-value pairs (must match in both arrays).
+ *   modes        - How each value is inserted: ESCAPE_HTML, ESCAPE_ATTRIBUTE or, for
+ *                  trusted markup, ESCAPE_RAW. NULL escapes every value as ESCAPE_HTML.
+ *   count        - Number of placeholder-value pairs (at most TEMPLATE_SLOTS_MAX).
  *
  * Returns:
  *   A newly allocated string with all placeholders replaced by their values,
- *   or NULL if the template file could not be read.
+ *   or NULL if the template file could not be read or memory allocation fails.
  *
  * Side Effects:
  *   Allocates memory for the resulting page; the caller is responsible for freeing it.
+ *
+ * Notes:
+ *   The template is scanned once, so values are never searched for placeholders.
+ *   A page of TEMPLATE_COMPUTE_MIN bytes or more is filled through request_compute(),
+ *   on a pool thread for a coroutine handler.
  */
-char *renderTemplate(const char *filepath, const char **placeholders, const char **values, int count) {
+char *renderTemplate(const char *filepath, const char **placeholders, const char **values, const int *modes, int count) {
 	assert((count == 0) || (placeholders && values));
-
-	char *page = GET_FILE(filepath);
-
-	for (int i = 0; i < count; i++) {
-		const char *key = placeholders[i];
-		const char *value = values[i];
-
-		char *temp = NULL;
-
-		// Replace all occurrences of key with value
-		while (1) {
-			char *pos = strstr(page, key);
-			if (!pos) break;
-
-			size_t before_len = pos - page;
-			size_t after_len = strlen(pos + strlen(key));
-			size_t new_len = before_len + strlen(value) + after_len;
-
-			temp = malloc(new_len + 1);
-			strncpy(temp, page, before_len);
-			strcpy(temp + before_len, value);
-			strcpy(temp + before_len + strlen(value), pos + strlen(key));
-
-			free(page);
-			page = temp;
-		}
-	}
-	return page;
+	assert(count <= TEMPLATE_SLOTS_MAX);
+
+	int size;
+	char *page = GET_FILE_WITH_SIZE(filepath, &size);
+	if (!page) return NULL;
+
+	template_fill_t fill = {
+		.page = page,
+		.placeholders = placeholders,
+		.values = values,
+		.modes = modes,
+		.count = count,
+	};
+	if (size >= TEMPLATE_COMPUTE_MIN)
+		request_compute(fillTemplate, &fill);
+	else
+		fillTemplate(&fill);
+
+	free(page);
+	return fill.result;
 }
 
 /*
@@ -155,13 +212,16 @@ char *renderFileResponse(const char *filepath, int *out_size) {
 	assert(filepath != NULL);
 
 	if (strncmp(filepath, "assets", 6) == 0) {
-		const char *response_str =
+		char response_str[BUFFER_SIZE];
+		snprintf(response_str, sizeof(response_str),
 			"HTTP/1.1 403 Forbidden\r\n"
 			"Content-Type: text/plain\r\n"
 			"Content-Length: 13\r\n"
-			"Connection: close\r\n"
+			"%s"
 			"\r\n"
-			"403 Forbidden";
+			"403 Forbidden",
+			CONNECTION_HEADER
+		);
 
 		if (out_size) 
 			*out_size = strlen(response_str);
@@ -195,9 +255,9 @@ char *renderFileResponse(const char *filepath, int *out_size) {
 		"%s\r\n"
 		"Content-Type: %s\r\n"
 		"Content-Length: %d\r\n"
-		"Connection: close\r\n"
+		"%s"
 		"\r\n",
-		status_line, mime_type, file_size
+		status_line, mime_type, file_size, CONNECTION_HEADER
 	);
 
 	char *response = malloc(header_size + file_size + 1);
@@ -210,9 +270,9 @@ char *renderFileResponse(const char *filepath, int *out_size) {
 		"%s\r\n"
 		"Content-Type: %s\r\n"
 		"Content-Length: %d\r\n"
-		"Connection: close\r\n"
+		"%s"
 		"\r\n",
-		status_line, mime_type, file_size
+		status_line, mime_type, file_size, CONNECTION_HEADER
 	);
 
 	memcpy(response + header_size, content, file_size);
@@ -225,6 +285,32 @@ char *renderFileResponse(const char *filepath, int *out_size) {
 	return response;
 }
 
+/*
+ * Sends an embedded file with its prebuilt headers, or a 304 Not Modified when
+ * the client already holds the same version.
+ *
+ * Parameters:
+ *   file    - The bundled file to send (must not be NULL).
+ *   variant - BUNDLE_IMMUTABLE for a fingerprinted URL, BUNDLE_REVALIDATE otherwise.
+ *
+ * Side Effects:
+ *   Writes the response to stdout.
+ */
+void sendBundledFile(const bundle_file_t *file, int variant) {
+	assert(file != NULL);
+
+	const char *cached = request_header("If-None-Match");
+	if (cached && strstr(cached, file->etag)) {
+		printf("HTTP/1.1 304 Not Modified\r\nETag: %s\r\n%s%s\r\n", file->etag,
+			   variant == BUNDLE_IMMUTABLE ? BUNDLE_IMMUTABLE_CACHE : BUNDLE_REVALIDATE_CACHE, CONNECTION_HEADER);
+		return;
+	}
+
+	fwrite(file->headers[variant], 1, file->headersLength[variant], stdout);
+	printf("%s\r\n", CONNECTION_HEADER);
+	fwrite(file->data, 1, file->length, stdout);
+}
+
 /*
  * Constructs a complete HTTP response with the given HTML content and status line.
  *
@@ -244,15 +330,15 @@ char *renderHtmlResponse(const char *html, const char *status) {
 	const char *type = "text/html";
 
 	int header_len = snprintf(NULL, 0,
-		"%s\r\nContent-Type: %s\r\nContent-Length: %d\r\nConnection: close\r\n\r\n",
-		status, type, body_len);
+		"%s\r\nContent-Type: %s\r\nContent-Length: %d\r\n%s\r\n",
+		status, type, body_len, CONNECTION_HEADER);
 
 	char *response = malloc(header_len + body_len + 1);
 	if (!response) return NULL;
 
 	snprintf(response, header_len + 1,
-		"%s\r\nContent-Type: %s\r\nContent-Length: %d\r\nConnection: close\r\n\r\n",
-		status, type, body_len);
+		"%s\r\nContent-Type: %s\r\nContent-Length: %d\r\n%s\r\n",
+		status, type, body_len, CONNECTION_HEADER);
 
 	memcpy(response + header_len, html, body_len);
 	response[header_len + body_len] = '\0';
@@ -273,7 +359,7 @@ void renderErrorPage(const char *message) {
 	const char *placeholders[] = { "{{message}}" };
 	const char *values[] = { message };
 
-	char *rendered_html = renderTemplate(ERROR_PAGE, placeholders, values, 1);
+	char *rendered_html = renderTemplate(ERROR_PAGE, placeholders, values, NULL, 1);
 	if (!rendered_html) {
 		sendFallback500Response();
 		return;
@@ -315,9 +401,9 @@ void redirect(const char *location, const char *status, int clearCookie, const c
 		"Location: %s\r\n"
 		"%s"
 		"Content-Length: 0\r\n"
-		"Connection: close\r\n"
+		"%s"
 		"\r\n",
-		status, location, cookieHeader
+		status, location, cookieHeader, CONNECTION_HEADER
 	);
 }
 
@@ -333,9 +419,9 @@ void sendFallback500Response() {
 		"%s\r\n"
 		"Content-Type: %s\r\n"
 		"Content-Length: %zu\r\n"
-		"Connection: close\r\n"
+		"%s"
 		"\r\n"
 		"%s", 
-		STATUS_500_INTERNAL_ERROR, MIME_PLAIN, strlen(message), message
+		STATUS_500_INTERNAL_ERROR, MIME_PLAIN, strlen(message), CONNECTION_HEADER, message
 	);
 }
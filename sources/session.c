@@ -6,9 +6,18 @@
 //
 
 #include "session.h"
+#include "coro.h"
 
 #define SESSIONS_FILE "assets/db/sessions.txt"
 
+// arguments and result of a call made on a pool thread (see coroOffload())
+typedef struct {
+	const char	*token;
+	const char	*username;
+	char		*outUsername;
+	int			result;
+} session_call_t;
+
 /*
  * Generates a secure random token and stores it as a hexadecimal string.
  *
@@ -19,13 +28,18 @@
  * Returns:
  *   TOKEN_GENERATION_SUCCESS on successful token generation,
  *   TOKEN_GENERATION_FAILURE if secure random bytes could not be generated.
+ *
+ * Notes:
+ *   The bytes come from the kernel (getrandom()), not OpenSSL: a handler forked
+ *   on a pool thread may inherit OpenSSL's generator locked by a TLS handshake
+ *   the event loop was running, and would wait on it forever.
  */
 int generateToken(char *token) {
 	assert(token != NULL);
 
 	unsigned char buffer[TOKEN_SIZE];
 
-	if (RAND_bytes(buffer, TOKEN_SIZE) != 1) {
+	if (getrandom(buffer, TOKEN_SIZE, 0) != TOKEN_SIZE) {
 		fprintf(stderr, "Failed to generate secure random bytes\n");
 		return TOKEN_GENERATION_FAILURE;
 	}
@@ -50,9 +64,7 @@ int generateToken(char *token) {
  *   TOKEN_NOT_FOUND if the token does not exist in the session file,
  *   TOKEN_FILE_ERROR if the session file could not be opened.
  */
-int getUsernameFromToken(const char *token, char *outUsername) {
-	assert(token != NULL && outUsername != NULL);
-
+static int findUsername(const char *token, char *outUsername) {
 	FILE* file = fopen(SESSIONS_FILE, "r");
 	if (!file) return TOKEN_FILE_ERROR;
 
@@ -83,9 +95,7 @@ int getUsernameFromToken(const char *token, char *outUsername) {
  *   SESSION_WRITE_SUCCESS if the session was successfully stored,
  *   SESSION_WRITE_FAILED if the session file could not be opened for appending.
  */
-int storeSession(const char *token, const char *username) {
-	assert(token != NULL && username != NULL);
-
+static int appendSession(const char *token, const char *username) {
 	FILE* file = fopen(SESSIONS_FILE, "a");
 	if (!file) return SESSION_WRITE_FAILED;
 
@@ -106,10 +116,7 @@ int storeSession(const char *token, const char *username) {
  *   TOKEN_INVALID if the token is not found or is NULL,
  *   TOKEN_FILE_ERROR if the session file could not be opened.
  */
-int checkToken(const char *token) {
-	assert(token != NULL);
-	if (!token) return TOKEN_INVALID;
-
+static int findToken(const char *token) {
 	FILE* file = fopen(SESSIONS_FILE, "r");
 	if (!file) return TOKEN_FILE_ERROR;
 
@@ -130,6 +137,51 @@ int checkToken(const char *token) {
 	return TOKEN_INVALID;
 }
 
+/*
+ * The calls handlers make; coroOffload() moves their file I/O to a pool
+ * thread when a coroutine handler makes them.
+ */
+
+static void callGetUsernameFromToken(void *arg) {
+	session_call_t *call = arg;
+	call->result = findUsername(call->token, call->outUsername);
+}
+
+int getUsernameFromToken(const char *token, char *outUsername) {
+	assert(token != NULL && outUsername != NULL);
+
+	session_call_t call = { .token = token, .outUsername = outUsername };
+	coroOffload(callGetUsernameFromToken, &call);
+	return call.result;
+}
+
+static void callStoreSession(void *arg) {
+	session_call_t *call = arg;
+	call->result = appendSession(call->token, call->username);
+}
+
+int storeSession(const char *token, const char *username) {
+	assert(token != NULL && username != NULL);
+
+	session_call_t call = { .token = token, .username = username };
+	coroOffload(callStoreSession, &call);
+	return call.result;
+}
+
+static void callCheckToken(void *arg) {
+	session_call_t *call = arg;
+	call->result = findToken(call->token);
+}
+
+int checkToken(const char *token) {
+	assert(token != NULL);
+	if (!token) return TOKEN_INVALID;
+
+	session_call_t call = { .token = token };
+	coroOffload(callCheckToken, &call);
+	return call.result;
+}
+
 /*
  * Extracts the session token from the "Cookie" HTTP header.
  *
@@ -0,0 +1,34 @@
+//
+//  shm.c
+//  CServer
+//
+//  Created by ibrahim alnakeeb on 19/10/2026.
+//
+
+#include "shm.h"
+
+#include <stdio.h>
+#include <sys/mman.h>
+
+/*
+ * Allocates a zero-filled memory region that stays shared between the server
+ * and every process it forks afterwards.
+ *
+ * Parameters:
+ *   size - Number of bytes to map.
+ *
+ * Returns:
+ *   Pointer to the shared region, or NULL if the mapping could not be created.
+ *
+ * Notes:
+ *   Must be called before the request handlers are forked; the region lives
+ *   for the lifetime of the process and is never unmapped.
+ */
+void *shmAlloc(size_t size) {
+	void *region = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (region == MAP_FAILED) {
+		perror("mmap() error");
+		return NULL;
+	}
+	return region;
+}
@@ -0,0 +1,188 @@
+//
+//  timer.c
+//  CServer
+//
+//  Created by ibrahim alnakeeb on 19/10/2026.
+//
+
+#include "timer.h"
+
+#include <assert.h>
+#include <stddef.h>
+#include <time.h>
+
+#define TIMER_MASK (TIMER_SLOTS - 1)
+
+static void listInit(timer_entry_t *head) {
+	head->next = head;
+	head->prev = head;
+}
+
+static void listAppend(timer_entry_t *head, timer_entry_t *timer) {
+	timer->prev = head->prev;
+	timer->next = head;
+	head->prev->next = timer;
+	head->prev = timer;
+}
+
+static void listUnlink(timer_entry_t *timer) {
+	timer->prev->next = timer->next;
+	timer->next->prev = timer->prev;
+	timer->next = NULL;
+	timer->prev = NULL;
+}
+
+/*
+ * Files a timer in the level whose span covers its distance from now.
+ * Timers that are already due go in the slot of the next tick.
+ */
+static void place(timer_wheel_t *wheel, timer_entry_t *timer) {
+	uint64_t expires = timer->expires;
+	if (expires <= wheel->now)
+		expires = wheel->now + 1;
+
+	uint64_t delta = expires - wheel->now;
+	int level = 0;
+	while (level < TIMER_LEVELS - 1 && delta >= (1ULL << (TIMER_LEVEL_BITS * (level + 1))))
+		level++;
+
+	// beyond the span of the last level: park it as far out as possible
+	uint64_t span = 1ULL << (TIMER_LEVEL_BITS * TIMER_LEVELS);
+	if (delta >= span)
+		expires = wheel->now + span - 1;
+
+	int slot = (expires >> (TIMER_LEVEL_BITS * level)) & TIMER_MASK;
+	listAppend(&wheel->slots[level][slot], timer);
+}
+
+/*
+ * Returns the current CLOCK_MONOTONIC time in milliseconds.
+ */
+uint64_t timerNowMs(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/*
+ * Prepares an empty wheel.
+ *
+ * Parameters:
+ *   wheel - The wheel to initialize (must not be NULL).
+ *   nowMs - The current time, as returned by timerNowMs().
+ */
+void timerWheelInit(timer_wheel_t *wheel, uint64_t nowMs) {
+	assert(wheel != NULL);
+
+	wheel->now = nowMs / TIMER_TICK_MS;
+	wheel->pending = 0;
+	for (int level = 0; level < TIMER_LEVELS; level++)
+		for (int slot = 0; slot < TIMER_SLOTS; slot++)
+			listInit(&wheel->slots[level][slot]);
+}
+
+/*
+ * Schedules a timer in O(1). A timer that is already pending is moved.
+ *
+ * Parameters:
+ *   wheel     - The wheel to schedule on (must not be NULL).
+ *   timer     - The timer; its callback must be set (must not be NULL).
+ *   expiresMs - Absolute expiry time in timerNowMs() milliseconds.
+ */
+void timerAdd(timer_wheel_t *wheel, timer_entry_t *timer, uint64_t expiresMs) {
+	assert(wheel != NULL && timer != NULL && timer->callback != NULL);
+
+	if (timerIsPending(timer))
+		timerCancel(wheel, timer);
+
+	timer->expires = (expiresMs + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+	place(wheel, timer);
+	wheel->pending++;
+}
+
+/*
+ * Cancels a pending timer in O(1); cancelling an idle timer is a no-op.
+ */
+void timerCancel(timer_wheel_t *wheel, timer_entry_t *timer) {
+	assert(wheel != NULL && timer != NULL);
+
+	if (!timerIsPending(timer)) return;
+	listUnlink(timer);
+	wheel->pending--;
+}
+
+/*
+ * Returns non-zero if the timer is scheduled. Timers must be zero-initialized
+ * before their first use.
+ */
+int timerIsPending(const timer_entry_t *timer) {
+	return timer->next != NULL;
+}
+
+/*
+ * Moves the wheel forward to nowMs, firing every timer that expired on the way.
+ * Callbacks run after their timer has been removed and may schedule timers again.
+ */
+void timerAdvance(timer_wheel_t *wheel, uint64_t nowMs) {
+	assert(wheel != NULL);
+
+	uint64_t target = nowMs / TIMER_TICK_MS;
+	if (wheel->pending == 0 && target > wheel->now) {
+		wheel->now = target;
+		return;
+	}
+
+	while (wheel->now < target) {
+		wheel->now++;
+
+		// refill the lower levels each time an upper slot comes around
+		for (int level = 1; level < TIMER_LEVELS; level++) {
+			if ((wheel->now >> (TIMER_LEVEL_BITS * (level - 1))) & TIMER_MASK) break;
+
+			int slot = (wheel->now >> (TIMER_LEVEL_BITS * level)) & TIMER_MASK;
+			timer_entry_t *head = &wheel->slots[level][slot];
+			while (head->next != head) {
+				timer_entry_t *timer = head->next;
+				listUnlink(timer);
+				place(wheel, timer);
+			}
+		}
+
+		timer_entry_t due;
+		timer_entry_t *head = &wheel->slots[0][wheel->now & TIMER_MASK];
+		listInit(&due);
+		if (head->next != head) {
+			due.next = head->next;
+			due.prev = head->prev;
+			due.next->prev = &due;
+			due.prev->next = &due;
+			listInit(head);
+		}
+
+		while (due.next != &due) {
+			timer_entry_t *timer = due.next;
+			listUnlink(timer);
+			wheel->pending--;
+			timer->callback(timer);
+		}
+	}
+}
+
+/*
+ * Returns how long epoll_wait() may sleep before the next timer could be due,
+ * in milliseconds, or TIMER_NONE when nothing is scheduled.
+ */
+int timerNextTimeout(const timer_wheel_t *wheel) {
+	assert(wheel != NULL);
+
+	if (wheel->pending == 0) return TIMER_NONE;
+
+	for (uint64_t ticks = 1; ticks <= TIMER_SLOTS; ticks++) {
+		const timer_entry_t *head = &wheel->slots[0][(wheel->now + ticks) & TIMER_MASK];
+		if (head->next != head)
+			return (int)(ticks * TIMER_TICK_MS);
+		if (((wheel->now + ticks) & TIMER_MASK) == 0)
+			return (int)(ticks * TIMER_TICK_MS);	// upper levels cascade here
+	}
+	return TIMER_SLOTS * TIMER_TICK_MS;
+}
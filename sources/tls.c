@@ -0,0 +1,223 @@
+//
+//  tls.c
+//  CServer
+//
+//  Created by ibrahim alnakeeb on 19/10/2026.
+//
+
+#include "tls.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+#define TLS_SESSION_ID_CONTEXT	"cserver"
+
+static SSL_CTX *context;
+static int offerHttp2;
+
+// ALPN protocol names, length-prefixed, in the server's order of preference
+static const unsigned char protocols[] = "\x02h2\x08http/1.1";
+
+// ALPN: h2 when the client offers it and HTTP/2 is on, else http/1.1; neither is no error
+static int selectProtocol(SSL *ssl, const unsigned char **out, unsigned char *outLength,
+						  const unsigned char *in, unsigned int inLength, void *arg) {
+	(void)ssl;
+	(void)arg;
+	const unsigned char *offer = offerHttp2 ? protocols : protocols + 3;
+	unsigned int offerLength = sizeof(protocols) - 1 - (offerHttp2 ? 0 : 3);
+	if (SSL_select_next_proto((unsigned char **)out, outLength, offer, offerLength, in, inLength)
+		!= OPENSSL_NPN_NEGOTIATED)
+		return SSL_TLSEXT_ERR_NOACK;
+	return SSL_TLSEXT_ERR_OK;
+}
+
+/*
+ * Sets up the server's TLS 1.3 context: certificate chain and key, session
+ * resumption and kernel TLS. Handshakes only ever run in the server process,
+ * so the session cache and the ticket key are kept in its memory.
+ *
+ * Parameters:
+ *   certificate  - PEM file of the certificate followed by its chain.
+ *   key          - PEM file of the private key.
+ *   tickets      - Tickets issued after a full handshake; 0 turns resumption off.
+ *   sessionCache - Sessions the server keeps. With 0, tickets carry the
+ *                  session encrypted under a key of this process (stateless);
+ *                  otherwise they only name a cached session, which lives
+ *                  until it is pushed out of the cache.
+ *   ktls         - Hand the socket's encryption to the kernel (kTLS) after
+ *                  the handshake, where the kernel has the "tls" module.
+ *   http2        - Offer h2 in ALPN ahead of http/1.1.
+ *
+ * Returns:
+ *   1 on success, 0 if the certificate or key cannot be used (the OpenSSL
+ *   errors are printed).
+ */
+int tlsInit(const char *certificate, const char *key, int tickets, int sessionCache, int ktls, int http2) {
+	SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+	if (!ctx
+		|| !SSL_CTX_set_min_proto_version(ctx, TLS1_3_VERSION)
+		|| SSL_CTX_use_certificate_chain_file(ctx, certificate) != 1
+		|| SSL_CTX_use_PrivateKey_file(ctx, key, SSL_FILETYPE_PEM) != 1
+		|| SSL_CTX_check_private_key(ctx) != 1) {
+		ERR_print_errors_fp(stderr);
+		SSL_CTX_free(ctx);
+		return 0;
+	}
+
+	// idle connections keep no record buffers; a retried write may come from a moved buffer
+	SSL_CTX_set_mode(ctx, SSL_MODE_RELEASE_BUFFERS | SSL_MODE_ENABLE_PARTIAL_WRITE
+					 | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+	SSL_CTX_set_session_id_context(ctx, (const unsigned char *)TLS_SESSION_ID_CONTEXT,
+								   sizeof(TLS_SESSION_ID_CONTEXT) - 1);
+	SSL_CTX_set_num_tickets(ctx, tickets);
+	if (sessionCache > 0) {
+		SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+		SSL_CTX_sess_set_cache_size(ctx, sessionCache);
+		SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);		// TLS 1.3: tickets name cached sessions
+	} else {
+		SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+	}
+
+	if (ktls)
+		SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+
+	offerHttp2 = http2;
+	SSL_CTX_set_alpn_select_cb(ctx, selectProtocol, NULL);
+
+	context = ctx;
+	return 1;
+}
+
+/*
+ * Starts the server side of a session on an accepted, non-blocking socket.
+ *
+ * Returns:
+ *   The session, NULL if out of memory.
+ */
+tls_t *tlsAccept(int fd) {
+	SSL *ssl = SSL_new(context);
+	if (!ssl) return NULL;
+	if (SSL_set_fd(ssl, fd) != 1) {
+		SSL_free(ssl);
+		return NULL;
+	}
+	SSL_set_accept_state(ssl);
+	return ssl;
+}
+
+/*
+ * Advances the handshake with what the client has sent so far.
+ *
+ * Returns:
+ *   TLS_HANDSHAKE_DONE once it is complete, TLS_HANDSHAKE_READ or
+ *   TLS_HANDSHAKE_WRITE to be called again when the socket is readable or
+ *   writable, TLS_HANDSHAKE_FAILED if the client cannot be served.
+ */
+int tlsHandshake(tls_t *tls) {
+	int result = SSL_do_handshake(tls);
+	if (result == 1) return TLS_HANDSHAKE_DONE;
+
+	switch (SSL_get_error(tls, result)) {
+	case SSL_ERROR_WANT_READ:	return TLS_HANDSHAKE_READ;
+	case SSL_ERROR_WANT_WRITE:	return TLS_HANDSHAKE_WRITE;
+	default:
+		ERR_clear_error();
+		return TLS_HANDSHAKE_FAILED;
+	}
+}
+
+/*
+ * Returns 1 if the completed handshake resumed an earlier session.
+ */
+int tlsResumed(tls_t *tls) {
+	return SSL_session_reused(tls);
+}
+
+/*
+ * Returns 1 if the kernel encrypts what is written to the socket (kTLS),
+ * so plain writes to it, from any process, go out as TLS records.
+ */
+int tlsKernelSend(tls_t *tls) {
+	return BIO_get_ktls_send(SSL_get_wbio(tls));
+}
+
+/*
+ * Returns 1 if the client and the server agreed on HTTP/2 (ALPN h2) in the
+ * handshake.
+ */
+int tlsHttp2(tls_t *tls) {
+	const unsigned char *protocol;
+	unsigned int length;
+	SSL_get0_alpn_selected(tls, &protocol, &length);
+	return length == 2 && memcmp(protocol, "h2", 2) == 0;
+}
+
+// recv()-like result of an SSL_read() or SSL_write() that returned result
+static ssize_t ioResult(tls_t *tls, int result) {
+	switch (SSL_get_error(tls, result)) {
+	case SSL_ERROR_WANT_READ:
+	case SSL_ERROR_WANT_WRITE:
+		errno = EAGAIN;
+		return -1;
+	case SSL_ERROR_ZERO_RETURN:
+		return 0;					// close_notify
+	case SSL_ERROR_SYSCALL:
+		ERR_clear_error();
+		if (errno == 0) errno = ECONNRESET;
+		return -1;
+	default:
+		ERR_clear_error();
+		errno = EPROTO;
+		return -1;
+	}
+}
+
+/*
+ * Reads decrypted bytes, like recv() on a non-blocking socket.
+ *
+ * Returns:
+ *   The bytes read, 0 once the client closed the session, or -1 with errno
+ *   EAGAIN when nothing can be read yet, another errno on an error.
+ */
+ssize_t tlsRead(tls_t *tls, void *buffer, size_t length) {
+	size_t read = 0;
+	int result = SSL_read_ex(tls, buffer, length, &read);
+	return result == 1 ? (ssize_t)read : ioResult(tls, result);
+}
+
+/*
+ * Tells whether decrypted bytes are waiting in the session: the rest of a
+ * record a read did not take, which the socket no longer signals.
+ */
+int tlsPending(tls_t *tls) {
+	return SSL_pending(tls) > 0;
+}
+
+/*
+ * Encrypts and sends bytes, like send() on a non-blocking socket; at most a
+ * record goes out per call. After EAGAIN the same bytes must be offered
+ * again, from wherever they are by then.
+ *
+ * Returns:
+ *   The bytes taken, or -1 with errno as for tlsRead().
+ */
+ssize_t tlsWrite(tls_t *tls, const void *buffer, size_t length) {
+	size_t written = 0;
+	int result = SSL_write_ex(tls, buffer, length, &written);
+	return result == 1 ? (ssize_t)written : ioResult(tls, result);
+}
+
+/*
+ * Sends close_notify if the socket takes it right away and frees the
+ * session. The caller closes the socket.
+ */
+void tlsClose(tls_t *tls) {
+	if (SSL_is_init_finished(tls))
+		SSL_shutdown(tls);
+	ERR_clear_error();
+	SSL_free(tls);
+}
@@ -0,0 +1,264 @@
+//
+//  uring.c
+//  CServer
+//
+//  Created by ibrahim alnakeeb on 19/10/2026.
+//
+
+#define _GNU_SOURCE
+
+#include "uring.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+static int enter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags, void *arg, size_t argSize) {
+	return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, arg, argSize);
+}
+
+static int registerRing(int fd, unsigned opcode, void *arg, unsigned count) {
+	return (int)syscall(__NR_io_uring_register, fd, opcode, arg, count);
+}
+
+/*
+ * Creates the ring and maps its queues. Asks for a ring that only this
+ * thread submits to and that runs completion work when it waits
+ * (SINGLE_ISSUER, DEFER_TASKRUN), and falls back to a plain one on kernels
+ * without them.
+ *
+ * Parameters:
+ *   ring    - Filled in.
+ *   entries - Submission queue size; the completion queue is twice as big.
+ *
+ * Returns:
+ *   1 on success, 0 if io_uring is unavailable (errno tells why) or the
+ *   kernel cannot wait with a timeout (before 5.11).
+ */
+int uringInit(uring_t *ring, unsigned entries) {
+	memset(ring, 0, sizeof(uring_t));
+	ring->fd = -1;
+
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	params.flags = IORING_SETUP_CLAMP | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+	int fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+	if (fd < 0 && errno == EINVAL) {
+		memset(&params, 0, sizeof(params));
+		params.flags = IORING_SETUP_CLAMP;
+		fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+	}
+	if (fd < 0) return 0;
+
+	if (!(params.features & IORING_FEAT_EXT_ARG)) {
+		close(fd);
+		errno = ENOSYS;
+		return 0;
+	}
+
+	size_t sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	size_t cqSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	int single = params.features & IORING_FEAT_SINGLE_MMAP;
+	if (single && cqSize > sqSize) sqSize = cqSize;
+
+	char *sq = mmap(NULL, sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	char *cq = single ? sq : mmap(NULL, cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+	struct io_uring_sqe *sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe),
+		PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED) {
+		close(fd);		// the mappings go with the process; this happens once at startup
+		return 0;
+	}
+
+	ring->fd = fd;
+	ring->sqHead = (unsigned *)(sq + params.sq_off.head);
+	ring->sqTail = (unsigned *)(sq + params.sq_off.tail);
+	ring->sqMask = *(unsigned *)(sq + params.sq_off.ring_mask);
+	ring->sqEntries = params.sq_entries;
+	ring->sqes = sqes;
+	ring->cqHead = (unsigned *)(cq + params.cq_off.head);
+	ring->cqTail = (unsigned *)(cq + params.cq_off.tail);
+	ring->cqMask = *(unsigned *)(cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+	// SQE i always sits in slot i
+	unsigned *array = (unsigned *)(sq + params.sq_off.array);
+	for (unsigned i = 0; i < params.sq_entries; i++)
+		array[i] = i;
+
+	ring->sqLocalTail = ring->sqSubmitted = *ring->sqTail;
+	return 1;
+}
+
+/*
+ * Returns 1 if the kernel implements the operation (an IORING_OP_ value).
+ */
+int uringSupports(uring_t *ring, int op) {
+	size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+	struct io_uring_probe *probe = calloc(1, size);
+	if (!probe) return 0;
+
+	int supported = registerRing(ring->fd, IORING_REGISTER_PROBE, probe, 256) == 0
+				 && op <= probe->last_op
+				 && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+	free(probe);
+	return supported;
+}
+
+/*
+ * Returns a zeroed submission queue entry to fill in. It goes to the kernel
+ * with the next uringSubmit(), or right away when the queue is full.
+ */
+struct io_uring_sqe *uringSqe(uring_t *ring) {
+	unsigned head = __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+	if (ring->sqLocalTail - head >= ring->sqEntries) {
+		uringSubmit(ring, 0);
+		head = __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+	}
+	assert(ring->sqLocalTail - head < ring->sqEntries);
+
+	struct io_uring_sqe *sqe = &ring->sqes[ring->sqLocalTail & ring->sqMask];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	ring->sqLocalTail++;
+	return sqe;
+}
+
+/*
+ * Hands the queued entries to the kernel and waits for a completion.
+ *
+ * Parameters:
+ *   timeoutMs - How long to wait: -1 until a completion arrives, 0 not at all.
+ *
+ * Returns:
+ *   0, or a negative errno other than a timeout or an interruption.
+ */
+int uringSubmit(uring_t *ring, int timeoutMs) {
+	__atomic_store_n(ring->sqTail, ring->sqLocalTail, __ATOMIC_RELEASE);
+	unsigned toSubmit = ring->sqLocalTail - ring->sqSubmitted;
+
+	struct __kernel_timespec ts = { .tv_sec = timeoutMs / 1000, .tv_nsec = (long long)(timeoutMs % 1000) * 1000000 };
+	struct io_uring_getevents_arg arg = {
+		.sigmask_sz = _NSIG / 8,
+		.ts = timeoutMs >= 0 ? (uint64_t)(uintptr_t)&ts : 0,
+	};
+	unsigned minComplete = timeoutMs != 0 && uringCqe(ring) == NULL;
+
+	int result = enter(ring->fd, toSubmit, minComplete, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+	if (result >= 0) {
+		ring->sqSubmitted += result;
+		return 0;
+	}
+	if (errno == ETIME || errno == EINTR || errno == EBUSY || errno == EAGAIN)
+		return 0;
+	return -errno;
+}
+
+/*
+ * Returns the oldest unseen completion, NULL if there is none.
+ */
+struct io_uring_cqe *uringCqe(uring_t *ring) {
+	unsigned head = *ring->cqHead;
+	if (head == __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE)) return NULL;
+	return &ring->cqes[head & ring->cqMask];
+}
+
+/*
+ * Frees the slot of the completion uringCqe() returned.
+ */
+void uringCqeSeen(uring_t *ring) {
+	__atomic_store_n(ring->cqHead, *ring->cqHead + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Registers a ring of count buffers of size bytes in URING_BUFFER_GROUP.
+ * A receive with IOSQE_BUFFER_SELECT takes one and reports its id in the
+ * completion flags; hand it back with uringRecycleBuffer().
+ *
+ * Parameters:
+ *   count - A power of two, at most 32768.
+ *
+ * Returns:
+ *   1 on success, 0 if the kernel has no buffer rings (before 5.19) or out of memory.
+ */
+int uringProvideBuffers(uring_t *ring, unsigned count, unsigned size) {
+	assert(count > 0 && count <= 32768 && (count & (count - 1)) == 0);
+
+	size_t ringSize = count * sizeof(struct io_uring_buf);
+	struct io_uring_buf_ring *buffers = mmap(NULL, ringSize, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	char *data = malloc((size_t)count * size);
+	if (buffers == MAP_FAILED || !data) {
+		if (buffers != MAP_FAILED) munmap(buffers, ringSize);
+		free(data);
+		return 0;
+	}
+
+	struct io_uring_buf_reg reg = {
+		.ring_addr = (uint64_t)(uintptr_t)buffers,
+		.ring_entries = count,
+		.bgid = URING_BUFFER_GROUP,
+	};
+	if (registerRing(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+		munmap(buffers, ringSize);
+		free(data);
+		return 0;
+	}
+
+	ring->buffers = buffers;
+	ring->bufferData = data;
+	ring->bufferCount = count;
+	ring->bufferSize = size;
+	ring->bufferTail = 0;
+	for (unsigned id = 0; id < count; id++)
+		uringRecycleBuffer(ring, id);
+	return 1;
+}
+
+/*
+ * Returns the memory of a provided buffer, by the id from a completion.
+ */
+char *uringBuffer(uring_t *ring, unsigned id) {
+	assert(id < ring->bufferCount);
+	return ring->bufferData + (size_t)id * ring->bufferSize;
+}
+
+/*
+ * Gives a provided buffer back to the kernel once its data was consumed.
+ */
+void uringRecycleBuffer(uring_t *ring, unsigned id) {
+	assert(id < ring->bufferCount);
+
+	struct io_uring_buf *slot = &ring->buffers->bufs[ring->bufferTail & (ring->bufferCount - 1)];
+	slot->addr = (uint64_t)(uintptr_t)uringBuffer(ring, id);
+	slot->len = ring->bufferSize;
+	slot->bid = (unsigned short)id;
+	ring->bufferTail++;
+	__atomic_store_n(&ring->buffers->tail, ring->bufferTail, __ATOMIC_RELEASE);
+}
+
+/*
+ * Registers an empty table of count files. Descriptors are put in and taken
+ * out of it with IORING_OP_FILES_UPDATE; operations then name them by slot
+ * with IOSQE_FIXED_FILE, which saves looking the file up each time.
+ *
+ * Returns:
+ *   1 on success, 0 on failure.
+ */
+int uringRegisterFiles(uring_t *ring, unsigned count) {
+	int *slots = malloc(count * sizeof(int));
+	if (!slots) return 0;
+	for (unsigned i = 0; i < count; i++)
+		slots[i] = -1;
+
+	int result = registerRing(ring->fd, IORING_REGISTER_FILES, slots, count);
+	free(slots);
+	return result == 0;
+}
@@ -6,10 +6,29 @@
 //
 
 #include "user.h"
+#include "coro.h"
+#include "httpd.h"
+#include "shm.h"
 
 #define USERS_FILE "assets/db/users.txt"
 #define TEMP_USERS_FILE "assets/db/users_tmp.txt"
 
+typedef struct {
+	int			state;		// 0 free, 1 claiming, 2 ready
+	char		name[PROFILE_NAME_LEN];
+	uint64_t	version;
+} profile_version_t;
+
+static profile_version_t *versions;		// shared by every handler process
+
+// arguments and result of a call made on a pool thread (see coroOffload())
+typedef struct {
+	const char	*username;
+	const char	*value;			// password or description
+	int			result;
+	char		*description;
+} user_call_t;
+
 /*
  * Splits a line of format "username:password:description" into its parts.
  *
@@ -25,10 +44,34 @@
 int parseUserLine(char *line, char **username, char **password, char **desc) {
 	assert(line != NULL && username != NULL && password != NULL && desc != NULL);
 
-	*username = strtok(line, ":");
-	*password = strtok(NULL, ":");
-	*desc = strtok(NULL, "\n");  // Up to end of line
-	return (*username && *password && *desc);
+	size_t length = strlen(line);
+	char *rest;
+	*username = strtok_r(line, ":", &rest);
+	*password = strtok_r(NULL, ":", &rest);
+	if (!*username || !*password) return 0;
+
+	*desc = strtok_r(NULL, "\n", &rest);  // Up to end of line
+	// a cleared description: the line ends right after the password's ':'
+	char *descStart = *password + strlen(*password) + 1;
+	if (!*desc && descStart <= line + length) {
+		descStart[strcspn(descStart, "\n")] = '\0';
+		*desc = descStart;
+	}
+	return *desc != NULL;
+}
+
+/*
+ * Checks that a decoded form value can be stored as a USERS_FILE field:
+ * shorter than maxLength and without control characters. Only the last
+ * field of the line may hold ':' or be empty.
+ */
+static int isStorable(const char *value, size_t maxLength, int lastField) {
+	size_t length = 0;
+	for (; value[length]; length++) {
+		unsigned char c = value[length];
+		if (c < 0x20 || c == 0x7f || (c == ':' && !lastField)) return 0;
+	}
+	return (length > 0 || lastField) && length < maxLength;
 }
 
 /*
@@ -44,13 +87,11 @@ int parseUserLine(char *line, char **username, char **password, char **desc) {
  * Side Effects:
  *   Allocates memory for the returned description string, which must be freed by the caller.
  */
-char *getProfileDescription(const char *username) {
-	assert(username != NULL);
-
+static char *readProfileDescription(const char *username) {
 	FILE *file = fopen(USERS_FILE, "r");
 	if (!file) return NULL;
 
-	static char line[MAX_LINE_LEN];
+	char line[MAX_LINE_LEN];
 	while (fgets(line, sizeof(line), file)) {
 		char *u, *p, *d;
 		char temp[MAX_LINE_LEN];
@@ -74,11 +115,12 @@ char *getProfileDescription(const char *username) {
  *
  * Returns:
  *   UPDATE_SUCCESS (1) if the description was successfully updated,
- *   UPDATE_FAILED (0) if the user was not found,
+ *   UPDATE_FAILED (0) if the user was not found, or the description is
+ *   longer than PROFILE_DESCRIPTION_MAX or holds control characters,
  *   USER_FILE_ERROR (-1) if there was an error opening the user file or temporary file.
  */
-int setProfileDescription(const char *username, const char *new_desc) {
-	assert(username != NULL && new_desc != NULL);
+static int writeProfileDescription(const char *username, const char *new_desc) {
+	if (!isStorable(new_desc, PROFILE_DESCRIPTION_MAX + 1, 1)) return UPDATE_FAILED;
 	
 	FILE *file = fopen(USERS_FILE, "r");
 	if (!file) return USER_FILE_ERROR;
@@ -111,9 +153,70 @@ int setProfileDescription(const char *username, const char *new_desc) {
 	remove(USERS_FILE);
 	rename(TEMP_USERS_FILE, USERS_FILE);
 
+	// pages rendered from the old description are now out of date
+	const uint64_t *version = profileVersion(username);
+	if (updated && version)
+		__atomic_add_fetch((uint64_t *)version, 1, __ATOMIC_RELEASE);
+
 	return updated ? UPDATE_SUCCESS : UPDATE_FAILED;
 }
 
+/*
+ * Maps the shared table of profile versions. Must be called before the
+ * server starts forking.
+ *
+ * Returns:
+ *   1 on success, 0 if the table could not be mapped (profiles are then untracked).
+ */
+int profileVersionsInit(void) {
+	versions = shmAlloc(sizeof(profile_version_t) * PROFILE_VERSION_SLOTS);
+	return versions != NULL;
+}
+
+/*
+ * Returns the counter that setProfileDescription() bumps each time the user's
+ * profile changes, claiming a slot for users seen for the first time. The
+ * counter is shared by every process, so a page can record the version it
+ * was rendered from and be checked against it later.
+ *
+ * Parameters:
+ *   username - The user (must not be NULL).
+ *
+ * Returns:
+ *   Pointer to the counter, or NULL if the table is full, unmapped, or the name too long.
+ */
+const uint64_t *profileVersion(const char *username) {
+	assert(username != NULL);
+
+	if (!versions || strlen(username) >= PROFILE_NAME_LEN) return NULL;
+
+	uint32_t hash = 2166136261u;
+	for (const char *c = username; *c; c++)
+		hash = (hash ^ (unsigned char)*c) * 16777619u;
+
+	for (int probe = 0; probe < PROFILE_VERSION_SLOTS; probe++) {
+		profile_version_t *slot = &versions[(hash + probe) % PROFILE_VERSION_SLOTS];
+		int state = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE);
+
+		if (state == 0) {
+			if (__atomic_compare_exchange_n(&slot->state, &state, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+				strcpy(slot->name, username);
+				slot->version = 1;
+				__atomic_store_n(&slot->state, 2, __ATOMIC_RELEASE);
+				return &slot->version;
+			}
+		}
+
+		// another process is naming this slot; it may be our user
+		while (state == 1)
+			state = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE);
+
+		if (strcmp(slot->name, username) == 0)
+			return &slot->version;
+	}
+	return NULL;
+}
+
 /*
  * Verifies whether the provided password matches the stored password for a given username.
  *
@@ -126,9 +229,7 @@ int setProfileDescription(const char *username, const char *new_desc) {
  *   0 if the username exists but the password does not match,
  *   USER_FILE_ERROR if the user file could not be opened.
  */
-int checkPassword(const char *username, const char *password) {
-	assert(username != NULL && password != NULL);
-
+static int findPassword(const char *username, const char *password) {
 	FILE *file = fopen(USERS_FILE, "r");
 	if (!file) return USER_FILE_ERROR;
 
@@ -158,9 +259,7 @@ int checkPassword(const char *username, const char *password) {
  *   USER_NOT_FOUND if the user does not exist,
  *   USER_FILE_ERROR if the user file could not be opened.
  */
-int checkUser(const char *username) {
-	assert(username != NULL);
-
+static int findUser(const char *username) {
 	FILE *file = fopen(USERS_FILE, "r");
 	if (!file) return USER_FILE_ERROR;
 
@@ -189,19 +288,18 @@ int checkUser(const char *username) {
  *
  * Returns:
  *   ADD_USER_SUCCESS if the user was successfully added,
- *   ADD_USER_INVALID_INPUT if username or password is empty,
+ *   ADD_USER_INVALID_INPUT if username or password is empty, too long,
+ *   or holds ':' or control characters,
  *   ADD_USER_FAILED if the user already exists,
  *   USER_FILE_ERROR if the file could not be opened for writing.
  */
-int addUser(const char *username, const char *password) {
-	assert(username != NULL && password != NULL);
-
+static int appendUser(const char *username, const char *password) {
 	// Runtime validation
-	if (strlen(username) == 0 || strlen(password) == 0) {
+	if (!isStorable(username, PROFILE_NAME_LEN, 0) || !isStorable(password, PROFILE_NAME_LEN, 0)) {
 		return ADD_USER_INVALID_INPUT;
 	}
 
-	if(checkUser(username) == USER_EXISTS) return ADD_USER_FAILED;
+	if(findUser(username) == USER_EXISTS) return ADD_USER_FAILED;
 
 	FILE* file = fopen(USERS_FILE, "a");
 	if (!file) {
@@ -213,4 +311,80 @@ int addUser(const char *username, const char *password) {
 	fclose(file);
 
 	return ADD_USER_SUCCESS;
-}
\ No newline at end of file
+}
+
+/*
+ * The calls handlers make. Each runs on a pool thread while a coroutine
+ * handler waits, so the file I/O does not hold up the event loop; in a
+ * forked handler it simply runs in place. See the functions above for
+ * parameters and results.
+ */
+
+static void callGetProfileDescription(void *arg) {
+	user_call_t *call = arg;
+	call->description = readProfileDescription(call->username);
+}
+
+char *getProfileDescription(const char *username) {
+	assert(username != NULL);
+
+	user_call_t call = { .username = username };
+	coroOffload(callGetProfileDescription, &call);
+	return call.description;
+}
+
+static void callSetProfileDescription(void *arg) {
+	user_call_t *call = arg;
+	call->result = writeProfileDescription(call->username, call->value);
+}
+
+int setProfileDescription(const char *username, const char *new_desc) {
+	assert(username != NULL && new_desc != NULL);
+
+	user_call_t call = { .username = username, .value = new_desc };
+	coroOffload(callSetProfileDescription, &call);
+
+	// pages open on the profile (GET /home/events) show it right away
+	if (call.result == UPDATE_SUCCESS)
+		event_publish(username, "profile", new_desc);
+	return call.result;
+}
+
+static void callCheckPassword(void *arg) {
+	user_call_t *call = arg;
+	call->result = findPassword(call->username, call->value);
+}
+
+int checkPassword(const char *username, const char *password) {
+	assert(username != NULL && password != NULL);
+
+	user_call_t call = { .username = username, .value = password };
+	coroOffload(callCheckPassword, &call);
+	return call.result;
+}
+
+static void callCheckUser(void *arg) {
+	user_call_t *call = arg;
+	call->result = findUser(call->username);
+}
+
+int checkUser(const char *username) {
+	assert(username != NULL);
+
+	user_call_t call = { .username = username };
+	coroOffload(callCheckUser, &call);
+	return call.result;
+}
+
+static void callAddUser(void *arg) {
+	user_call_t *call = arg;
+	call->result = appendUser(call->username, call->value);
+}
+
+int addUser(const char *username, const char *password) {
+	assert(username != NULL && password != NULL);
+
+	user_call_t call = { .username = username, .value = password };
+	coroOffload(callAddUser, &call);
+	return call.result;
+}
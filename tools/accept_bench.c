@@ -0,0 +1,228 @@
+//
+//  accept_bench.c
+//  CServer
+//
+//  Created by ibrahim alnakeeb on 19/10/2026.
+//
+//  Connection rate of the server with each listener option (-N) on its own
+//  and all together: client processes open a connection, send GET /login
+//  with Connection: close, read the response to the end and start over, so
+//  every request pays for a handshake and an accept. Clients use TCP Fast
+//  Open when the server offers it; whether the kernel took the request in
+//  the SYN depends on net.ipv4.tcp_fastopen (0x2 for the server side).
+//
+//  Usage: make bench, or obj/accept_bench [clients] [seconds]
+//
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#define BENCH_SERVER		"./server"
+#define BENCH_PATH			"/login"
+#define BENCH_CLIENTS		4
+#define BENCH_SECONDS		2
+#define BENCH_WARMUP		0.3			// seconds before connections are counted
+#define BENCH_SAMPLES		(512 * 1024)	// per client
+
+typedef struct {
+	const char	*name;
+	const char	*options;		// -N
+	int			fastopen;		// clients send the request in the SYN
+} variant_t;
+
+// what one client process measured, in memory shared with the parent
+typedef struct {
+	long	counted;
+	long	failed;
+	long	synData;			// connections whose request the server took in the SYN
+	double	samples[BENCH_SAMPLES];
+} client_result_t;
+
+static const variant_t variants[] = {
+	{ "baseline",	"defer=0,fastopen=0,busypoll=0,nodelay=0",		0 },
+	{ "+defer",		"defer=10,fastopen=0,busypoll=0,nodelay=0",		0 },
+	{ "+fastopen",	"defer=0,fastopen=256,busypoll=0,nodelay=0",	1 },
+	{ "+busypoll",	"defer=0,fastopen=0,busypoll=50,nodelay=0",		0 },
+	{ "+nodelay",	"defer=0,fastopen=0,busypoll=0,nodelay=1",		0 },
+	{ "all",		"defer=10,fastopen=256,busypoll=50,nodelay=1",	1 },
+};
+
+static const char request[] = "GET " BENCH_PATH " HTTP/1.1\r\nHost: bench\r\nConnection: close\r\n\r\n";
+
+static double nowSeconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int compareDoubles(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+static pid_t startServer(const char *options, int port) {
+	char portText[16];
+	snprintf(portText, sizeof(portText), "%d", port);
+
+	pid_t pid = fork();
+	if (pid == 0) {
+		int null = open("/dev/null", O_WRONLY);
+		dup2(null, STDOUT_FILENO);
+		dup2(null, STDERR_FILENO);
+		execl(BENCH_SERVER, BENCH_SERVER, "-N", options, portText, (char *)NULL);
+		_exit(127);
+	}
+	return pid;
+}
+
+/*
+ * Makes one request on a new connection and reads the response to the end.
+ * Each client binds its own loopback source address, so the runs do not
+ * share (and run out of) ephemeral ports.
+ *
+ * Returns:
+ *   1 on a 200 response, 0 on an error.
+ */
+static int exchange(const struct sockaddr_in *server, const struct sockaddr_in *source, int fastopen, long *synData) {
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) return 0;
+	int on = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	setsockopt(fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &on, sizeof(on));
+	if (bind(fd, (const struct sockaddr *)source, sizeof(*source)) != 0) {
+		close(fd);
+		return 0;
+	}
+
+	ssize_t sent;
+	if (fastopen) {
+		sent = sendto(fd, request, sizeof(request) - 1, MSG_FASTOPEN | MSG_NOSIGNAL,
+					  (const struct sockaddr *)server, sizeof(*server));
+	} else if (connect(fd, (const struct sockaddr *)server, sizeof(*server)) == 0) {
+		sent = send(fd, request, sizeof(request) - 1, MSG_NOSIGNAL);
+	} else {
+		sent = -1;
+	}
+	if (sent != (ssize_t)(sizeof(request) - 1)) {
+		close(fd);
+		return 0;
+	}
+
+	char buf[16384];
+	ssize_t rcvd, total = 0;
+	int ok = 0;
+	while ((rcvd = recv(fd, buf, sizeof(buf), 0)) > 0) {
+		if (total == 0)
+			ok = rcvd >= 12 && strncmp(buf, "HTTP/1.1 200", 12) == 0;
+		total += rcvd;
+	}
+
+	struct tcp_info info;
+	socklen_t infoSize = sizeof(info);
+	if (fastopen && getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &infoSize) == 0
+		&& (info.tcpi_options & TCPI_OPT_SYN_DATA))
+		(*synData)++;
+	close(fd);
+	return ok && rcvd == 0;
+}
+
+static void runClient(const variant_t *variant, int index, int clientIndex, int port, int seconds,
+					  client_result_t *result) {
+	struct sockaddr_in server = { .sin_family = AF_INET, .sin_port = htons(port) };
+	server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	struct sockaddr_in source = { .sin_family = AF_INET };
+	source.sin_addr.s_addr = htonl(0x7f000000 | (index + 1) << 16 | (getpid() % 200 + 1) << 8 | (clientIndex + 1));
+
+	double measureFrom = nowSeconds() + BENCH_WARMUP, end = measureFrom + seconds;
+	for (double start = nowSeconds(); start < end; start = nowSeconds()) {
+		if (!exchange(&server, &source, variant->fastopen, &result->synData))
+			result->failed++;
+		else if (start >= measureFrom && result->counted < BENCH_SAMPLES)
+			result->samples[result->counted++] = nowSeconds() - start;
+	}
+	_exit(0);
+}
+
+static int run(int index, int clients, int seconds, client_result_t *results, double *samples) {
+	const variant_t *variant = &variants[index];
+	int port = 20000 + (getpid() + index * 97) % 20000;
+	pid_t server = startServer(variant->options, port);
+	if (server < 0) return 1;
+
+	// wait for the listener
+	struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port) };
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	int up = 0;
+	for (int attempt = 0; attempt < 100 && !up; attempt++) {
+		int probe = socket(AF_INET, SOCK_STREAM, 0);
+		up = connect(probe, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+		close(probe);
+		if (!up) usleep(50000);
+	}
+	if (!up) {
+		fprintf(stderr, "%s: the server did not start\n", variant->name);
+		kill(server, SIGKILL);
+		waitpid(server, NULL, 0);
+		return 1;
+	}
+
+	memset(results, 0, clients * sizeof(client_result_t));
+	for (int i = 0; i < clients; i++) {
+		if (fork() == 0)
+			runClient(variant, index, i, port, seconds, &results[i]);
+	}
+	for (int i = 0; i < clients; i++)
+		wait(NULL);
+	kill(server, SIGTERM);
+	waitpid(server, NULL, 0);
+
+	long counted = 0, failed = 0, synData = 0;
+	for (int i = 0; i < clients; i++) {
+		memcpy(samples + counted, results[i].samples, results[i].counted * sizeof(double));
+		counted += results[i].counted;
+		failed += results[i].failed;
+		synData += results[i].synData;
+	}
+
+	qsort(samples, counted, sizeof(double), compareDoubles);
+	printf("  %-10s %8.0f conn/s   p50 %7.1f us   p99 %7.1f us", variant->name, counted / (double)seconds,
+		   counted ? samples[counted / 2] * 1e6 : 0, counted ? samples[counted * 99 / 100] * 1e6 : 0);
+	if (variant->fastopen)
+		printf("   %ld in the SYN", synData);
+	printf("%s\n", failed ? "   (errors)" : "");
+	return failed != 0;
+}
+
+int main(int argc, char *argv[]) {
+	int clients = argc > 1 ? atoi(argv[1]) : BENCH_CLIENTS;
+	int seconds = argc > 2 ? atoi(argv[2]) : BENCH_SECONDS;
+	if (clients < 1) clients = 1;
+	if (seconds < 1) seconds = 1;
+
+	size_t size = clients * sizeof(client_result_t);
+	client_result_t *results = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	double *samples = malloc((size_t)clients * BENCH_SAMPLES * sizeof(double));
+	if (results == MAP_FAILED || !samples) return 1;
+
+	printf("%d clients, a new connection per GET %s for %d s\n", clients, BENCH_PATH, seconds);
+	int failed = 0;
+	for (int i = 0; i < (int)(sizeof(variants) / sizeof(variants[0])); i++)
+		failed |= run(i, clients, seconds, results, samples);
+	munmap(results, size);
+	free(samples);
+	return failed;
+}
@@ -0,0 +1,269 @@
+//
+//  bundle.c
+//  CServer
+//
+//  Created by ibrahim alnakeeb on 19/10/2026.
+//
+//  Build-time generator: writes the C source of the embedded public/ tree
+//  (see headers/bundle.h) to stdout. References to bundled files inside
+//  HTML, CSS and JS are rewritten to content-fingerprinted URLs.
+//
+//  Usage: bundle public/css/style.css public/templates/login.html ... > bundle_data.c
+//
+
+#include "bundle.h"
+#include "mime.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SEED_ATTEMPTS	100000
+
+
+typedef struct {
+	const char		*path;
+	unsigned char	*original;
+	size_t			originalLength;
+	unsigned char	*data;				// original with references rewritten
+	size_t			length;
+	char			etag[24];
+	char			fingerprintPath[512];
+} input_t;
+
+static unsigned char *readAll(const char *path, size_t *length) {
+	FILE *file = fopen(path, "rb");
+	if (!file) return NULL;
+
+	size_t capacity = 4096, used = 0;
+	unsigned char *data = malloc(capacity);
+	size_t n;
+	while (data && (n = fread(data + used, 1, capacity - used, file)) > 0) {
+		used += n;
+		if (used == capacity)
+			data = realloc(data, capacity *= 2);
+	}
+	fclose(file);
+
+	*length = used;
+	return data;
+}
+
+static int isText(const char *path) {
+	const char *mimeType = get_mime_type(path);
+	return strcmp(mimeType, MIME_HTML) == 0 || strcmp(mimeType, MIME_CSS) == 0 || strcmp(mimeType, MIME_JS) == 0;
+}
+
+/*
+ * Hashes the contents (64-bit FNV-1a) into a strong ETag and derives the
+ * fingerprinted path from its first BUNDLE_FINGERPRINT_LEN hex digits:
+ * "public/css/style.css" -> "public/css/style.a458e3d5.css".
+ */
+static void contentTag(input_t *input) {
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < input->length; i++)
+		hash = (hash ^ input->data[i]) * 1099511628211ULL;
+	snprintf(input->etag, sizeof(input->etag), "\"%016llx\"", (unsigned long long)hash);
+
+	const char *slash = strrchr(input->path, '/');
+	const char *ext = strrchr(input->path, '.');
+	if (!ext || (slash && ext < slash))
+		ext = input->path + strlen(input->path);
+
+	snprintf(input->fingerprintPath, sizeof(input->fingerprintPath), "%.*s.%.*s%s",
+		(int)(ext - input->path), input->path, BUNDLE_FINGERPRINT_LEN, input->etag + 1, ext);
+}
+
+/*
+ * Rebuilds a text file from its original contents, replacing each "/<path>"
+ * of a bundled file with "/<fingerprint path>".
+ *
+ * Returns:
+ *   1 if the result differs from the previous pass, 0 otherwise.
+ */
+static int rewriteReferences(input_t *input, input_t *inputs, int count) {
+	size_t capacity = input->originalLength + 1, used = 0;
+	unsigned char *out = malloc(capacity);
+	if (!out) exit(1);
+
+	for (size_t pos = 0; pos < input->originalLength; ) {
+		const char *replacement = NULL;
+		size_t matched = 0;
+
+		if (input->original[pos] == '/') {
+			for (int i = 0; i < count; i++) {
+				size_t len = strlen(inputs[i].path);
+				if (pos + 1 + len <= input->originalLength
+					&& memcmp(input->original + pos + 1, inputs[i].path, len) == 0
+					&& len > matched) {
+					matched = len;
+					replacement = inputs[i].fingerprintPath;
+				}
+			}
+		}
+
+		const unsigned char *chunk = replacement ? (const unsigned char *)replacement : input->original + pos;
+		size_t chunkLength = replacement ? strlen(replacement) : 1;
+		if (replacement) {
+			out[used++] = '/';
+			pos += 1 + matched;
+		} else {
+			pos++;
+		}
+
+		while (used + chunkLength + 1 > capacity) {
+			out = realloc(out, capacity *= 2);
+			if (!out) exit(1);
+		}
+		memcpy(out + used, chunk, chunkLength);
+		used += chunkLength;
+	}
+
+	int changed = used != input->length || memcmp(out, input->data, used) != 0;
+	if (input->data != input->original)
+		free(input->data);
+	input->data = out;
+	input->length = used;
+	return changed;
+}
+
+static const char *keyPath(input_t *inputs, int key) {
+	return key & 1 ? inputs[key >> 1].fingerprintPath : inputs[key >> 1].path;
+}
+
+// finds a seed under which no two keys (both paths of every file) share a slot
+static int findSeed(input_t *inputs, int count, uint32_t mask, uint32_t *seed, short *slots) {
+	for (uint32_t candidate = 0; candidate < SEED_ATTEMPTS; candidate++) {
+		memset(slots, 0xff, sizeof(short) * (mask + 1));
+
+		int key;
+		for (key = 0; key < count * 2; key++) {
+			uint32_t slot = bundleHash(keyPath(inputs, key), candidate) & mask;
+			if (slots[slot] >= 0) break;
+			slots[slot] = (short)key;
+		}
+		if (key == count * 2) {
+			*seed = candidate;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void printString(const char *str) {
+	putchar('"');
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\') printf("\\%c", *str);
+		else if (*str == '\r') printf("\\r");
+		else if (*str == '\n') printf("\\n");
+		else putchar(*str);
+	}
+	putchar('"');
+}
+
+int main(int argc, char *argv[]) {
+	int count = argc - 1;
+	input_t *inputs = calloc(count ? count : 1, sizeof(input_t));
+	if (!inputs) return 1;
+
+	for (int i = 0; i < count; i++) {
+		inputs[i].path = argv[i + 1];
+		inputs[i].original = readAll(argv[i + 1], &inputs[i].originalLength);
+		if (!inputs[i].original) {
+			perror(argv[i + 1]);
+			return 1;
+		}
+		inputs[i].data = inputs[i].original;
+		inputs[i].length = inputs[i].originalLength;
+		contentTag(&inputs[i]);
+	}
+
+	// a rewrite changes the fingerprint of the rewritten file, which may be
+	// referenced in turn (page -> stylesheet -> image); repeat until stable
+	int changed = 1;
+	for (int pass = 0; changed && pass <= count; pass++) {
+		changed = 0;
+		for (int i = 0; i < count; i++) {
+			if (!isText(inputs[i].path)) continue;
+			if (rewriteReferences(&inputs[i], inputs, count)) {
+				contentTag(&inputs[i]);
+				changed = 1;
+			}
+		}
+	}
+	if (changed) {
+		fprintf(stderr, "bundle: circular references between text files\n");
+		return 1;
+	}
+
+	// at least twice as many slots as keys keeps the seed search short
+	uint32_t mask = 1;
+	while (mask + 1 < (uint32_t)count * 4)
+		mask = (mask << 1) | 1;
+
+	short *slots = malloc(sizeof(short) * (mask + 1));
+	uint32_t seed = 0;
+	while (slots && !findSeed(inputs, count, mask, &seed, slots)) {
+		mask = (mask << 1) | 1;
+		slots = realloc(slots, sizeof(short) * (mask + 1));
+	}
+	if (!slots) return 1;
+
+	printf("// Generated by tools/bundle.c from public/; do not edit.\n\n");
+	printf("#include \"bundle.h\"\n\n");
+
+	for (int i = 0; i < count; i++) {
+		printf("static const unsigned char data%d[] = {", i);
+		for (size_t j = 0; j < inputs[i].length; j++)
+			printf("%s0x%02x,", j % 16 ? "" : "\n\t", inputs[i].data[j]);
+		printf("\n\t0x00\n};\n\n");
+	}
+
+	int lengths[2];
+	printf("const bundle_file_t bundleFiles[] = {\n");
+	for (int i = 0; i < count; i++) {
+		const char *mimeType = get_mime_type(inputs[i].path);
+		const char *cacheControl[] = { BUNDLE_REVALIDATE_CACHE, BUNDLE_IMMUTABLE_CACHE };
+
+		printf("\t{ ");
+		printString(inputs[i].path);
+		printf(", ");
+		printString(inputs[i].fingerprintPath);
+		printf(", ");
+		printString(mimeType);
+		printf(", data%d, %zu, ", i, inputs[i].length);
+		printString(inputs[i].etag);
+		printf(",\n\t  {");
+
+		for (int variant = 0; variant < 2; variant++) {
+			char headers[512];
+			int headersLength = snprintf(headers, sizeof(headers),
+				"HTTP/1.1 200 OK\r\n"
+				"Content-Type: %s\r\n"
+				"Content-Length: %zu\r\n"
+				"ETag: %s\r\n"
+				"%s",
+				mimeType, inputs[i].length, inputs[i].etag, cacheControl[variant]);
+
+			printf("\n\t\t");
+			printString(headers);
+			printf(",");
+			lengths[variant] = headersLength;
+		}
+		printf("\n\t  }, { %d, %d } },\n", lengths[0], lengths[1]);
+	}
+	if (count == 0)
+		printf("\t{ 0 }\n");
+	printf("};\n\n");
+
+	printf("const int bundleFileCount = %d;\n\n", count);
+
+	printf("const short bundleSlots[] = {");
+	for (uint32_t i = 0; i <= mask; i++)
+		printf("%s%d,", i % 16 ? " " : "\n\t", slots[i]);	// file * 2 + fingerprinted
+	printf("\n};\n\n");
+
+	printf("const uint32_t bundleSlotMask = %uu;\n", mask);
+	printf("const uint32_t bundleSeed = %uu;\n", seed);
+	return 0;
+}
@@ -0,0 +1,81 @@
+//
+//  escape_bench.c
+//  CServer
+//
+//  Created by ibrahim alnakeeb on 19/10/2026.
+//
+//  Throughput of escapeHtml() against memcpy() on clean text, text with an
+//  occasional special character, and markup-heavy text, for every kernel
+//  the CPU runs.
+//
+//  Usage: make bench
+//
+
+#include "escape.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_BYTES		(64 * 1024)		// fits in L2, like a rendered page
+#define BENCH_ROUNDS	4000
+
+static double nowSeconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// every n-th byte is a special character (0: none)
+static void fill(char *text, size_t length, int n) {
+	const char *words = "the quick brown fox jumps over the lazy dog ";
+	const char *specials = "<>&\"'";
+	for (size_t i = 0; i < length; i++)
+		text[i] = n && i % n == 0 ? specials[(i / n) % 5] : words[i % 44];
+}
+
+static double gigabytesPerSecond(double seconds) {
+	return (double)BENCH_BYTES * BENCH_ROUNDS / seconds / 1e9;
+}
+
+int main(void) {
+	char *text = malloc(BENCH_BYTES);
+	char *out = malloc(BENCH_BYTES * 6);
+	if (!text || !out) return 1;
+
+	const struct { const char *name; int every; } inputs[] = {
+		{ "clean", 0 }, { "1 in 1000", 1000 }, { "1 in 20", 20 },
+	};
+	const char *kernels[] = { "scalar", "sse2", "avx2" };
+	volatile size_t sink = 0;
+
+	printf("%-10s %-8s %10s %10s %8s\n", "input", "kernel", "memcpy", "escape", "ratio");
+	for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+		fill(text, BENCH_BYTES, inputs[i].every);
+
+		double start = nowSeconds();
+		for (int round = 0; round < BENCH_ROUNDS; round++) {
+			memcpy(out, text, BENCH_BYTES);
+			sink += out[round % BENCH_BYTES];
+		}
+		double copy = gigabytesPerSecond(nowSeconds() - start);
+
+		for (int kernel = ESCAPE_KERNEL_SCALAR; kernel <= ESCAPE_KERNEL_AVX2; kernel++) {
+			if (!escapeUseKernel(kernel)) continue;
+
+			start = nowSeconds();
+			for (int round = 0; round < BENCH_ROUNDS; round++)
+				sink += escapeHtml(out, text, BENCH_BYTES, ESCAPE_ATTRIBUTE);
+			double escape = gigabytesPerSecond(nowSeconds() - start);
+
+			printf("%-10s %-8s %7.2f GB/s %5.2f GB/s %7.2fx\n",
+				inputs[i].name, kernels[kernel], copy, escape, copy / escape);
+		}
+	}
+
+	(void)sink;
+	free(text);
+	free(out);
+	return 0;
+}
@@ -0,0 +1,301 @@
+//
+//  events_bench.c
+//  CServer
+//
+//  Created by ibrahim alnakeeb on 19/10/2026.
+//
+//  Idle event streams and their fan-out: many pages of one user follow
+//  GET /home/events while the profile is saved over and over. Reports what
+//  an idle stream costs the server (resident memory per subscriber) and how
+//  long an update takes to reach the first and the last of them. The
+//  server runs its handlers as coroutines (-c), so subscribing needs no
+//  fork per stream.
+//
+//  Usage: make bench, or obj/events_bench [subscribers] [updates]
+//
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#define BENCH_SERVER		"./server"
+#define BENCH_SUBSCRIBERS	10000
+#define BENCH_UPDATES		20
+#define BENCH_WAVE			500			// subscribers connecting at once
+#define BENCH_TIMEOUT_MS	10000
+#define BENCH_FDS_SPARE		64			// descriptors besides the subscribers
+#define BENCH_USER			"events_bench"
+
+static char buffer[64 * 1024];
+static char cookie[128];
+
+// a subscriber: its socket and the events it has seen, counted by their blank lines
+typedef struct {
+	int		fd;
+	int		events;
+	char	last;			// the last byte read
+} subscriber_t;
+
+static double nowSeconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static pid_t startServer(int port, int subscribers) {
+	char plainPort[16], limits[64];
+	snprintf(plainPort, sizeof(plainPort), "%d", port);
+	snprintf(limits, sizeof(limits), "connections=%d", subscribers + BENCH_FDS_SPARE);
+
+	pid_t pid = fork();
+	if (pid == 0) {
+		int null = open("/dev/null", O_WRONLY);
+		dup2(null, STDOUT_FILENO);
+		dup2(null, STDERR_FILENO);
+		execl(BENCH_SERVER, BENCH_SERVER, "-c", "-L", limits, "-T", "heartbeat=0", plainPort, (char *)NULL);
+		_exit(127);
+	}
+	return pid;
+}
+
+static int connectTo(int port) {
+	struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port) };
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		close(fd);
+		return -1;
+	}
+	// a reset on close leaves no TIME_WAIT behind, so the ports last the run
+	int on = 1;
+	struct linger linger = { .l_onoff = 1, .l_linger = 0 };
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+	setsockopt(fd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+	return fd;
+}
+
+static int writeAll(int fd, const char *data, size_t length) {
+	while (length > 0) {
+		ssize_t sent = send(fd, data, length, MSG_NOSIGNAL);
+		if (sent <= 0) return 0;
+		data += sent;
+		length -= sent;
+	}
+	return 1;
+}
+
+/*
+ * Sends a request on a connection of its own and reads the response until
+ * the server closes it (Connection: close).
+ *
+ * Returns:
+ *   The status code, 0 if the exchange failed. The response is in buffer.
+ */
+static int exchange(int port, const char *request) {
+	int fd = connectTo(port);
+	if (fd < 0 || !writeAll(fd, request, strlen(request))) {
+		if (fd >= 0) close(fd);
+		return 0;
+	}
+
+	size_t length = 0;
+	ssize_t rcvd;
+	while (length < sizeof(buffer) - 1 && (rcvd = recv(fd, buffer + length, sizeof(buffer) - 1 - length, 0)) > 0)
+		length += rcvd;
+	buffer[length] = '\0';
+	close(fd);
+	return strncmp(buffer, "HTTP/1.1 ", 9) == 0 ? atoi(buffer + 9) : 0;
+}
+
+static int post(int port, const char *path, const char *body) {
+	char request[1024];
+	snprintf(request, sizeof(request),
+		"POST %s HTTP/1.1\r\nHost: bench\r\nConnection: close\r\n%s%s%s"
+		"Content-Type: application/x-www-form-urlencoded\r\nContent-Length: %zu\r\n\r\n%s",
+		path, cookie[0] ? "Cookie: " : "", cookie, cookie[0] ? "\r\n" : "", strlen(body), body);
+	return exchange(port, request);
+}
+
+// sign the bench's user up (again) and in, keeping the session cookie
+static int signIn(int port) {
+	post(port, "/login", "action=signup&username=" BENCH_USER "&password=bench");
+	if (post(port, "/login", "action=signin&username=" BENCH_USER "&password=bench") != 302)
+		return 0;
+
+	const char *token = strstr(buffer, "session=");
+	if (!token) return 0;
+	size_t length = strcspn(token, ";\r\n");
+	if (length >= sizeof(cookie)) return 0;
+	memcpy(cookie, token, length);
+	cookie[length] = '\0';
+	return 1;
+}
+
+// resident memory of a process in KiB, 0 if unknown
+static long residentKb(pid_t pid) {
+	char path[64], line[256];
+	snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+	FILE *file = fopen(path, "r");
+	if (!file) return 0;
+	long kb = 0;
+	while (fgets(line, sizeof(line), file))
+		if (strncmp(line, "VmRSS:", 6) == 0)
+			kb = atol(line + 6);
+	fclose(file);
+	return kb;
+}
+
+// read what a subscriber has, counting the events: each ends with a blank line
+static int readEvents(subscriber_t *s) {
+	for (;;) {
+		ssize_t rcvd = recv(s->fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+		if (rcvd < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return 1;
+		if (rcvd <= 0)
+			return 0;
+		for (ssize_t i = 0; i < rcvd; i++) {
+			if (buffer[i] == '\n' && s->last == '\n')
+				s->events++;
+			s->last = buffer[i];
+		}
+	}
+}
+
+/*
+ * Reads events until every subscriber has seen `events` of them.
+ *
+ * Returns:
+ *   Seconds from `start` until the first and the last got there, or 0 in
+ *   *last on a timeout or a closed stream.
+ */
+static void awaitEvents(int epollfd, subscriber_t *subscribers, int count, int events, double start,
+						double *first, double *last) {
+	struct epoll_event ready[256];
+	int behind = 0;
+	for (int i = 0; i < count; i++)
+		behind += subscribers[i].events < events;
+
+	*first = *last = 0;
+	while (behind > 0) {
+		int n = epoll_wait(epollfd, ready, 256, BENCH_TIMEOUT_MS);
+		if (n <= 0) return;
+		for (int i = 0; i < n; i++) {
+			subscriber_t *s = ready[i].data.ptr;
+			int was = s->events;
+			if (!readEvents(s)) return;
+			if (was < events && s->events >= events) {
+				behind--;
+				if (*first == 0)
+					*first = nowSeconds() - start;
+			}
+		}
+	}
+	*last = nowSeconds() - start;
+}
+
+static int compareDoubles(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : x > y;
+}
+
+int main(int argc, char *argv[]) {
+	int count = argc > 1 ? atoi(argv[1]) : BENCH_SUBSCRIBERS;
+	int updates = argc > 2 ? atoi(argv[2]) : BENCH_UPDATES;
+	if (updates < 1) updates = 1;
+
+	// the subscribers' sockets, and the server's as its child: as many as allowed
+	struct rlimit files;
+	if (getrlimit(RLIMIT_NOFILE, &files) == 0) {
+		files.rlim_cur = files.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &files);
+		if ((rlim_t)count + BENCH_FDS_SPARE > files.rlim_cur)
+			count = (int)files.rlim_cur - BENCH_FDS_SPARE;
+	}
+	if (count < 1) count = 1;
+
+	int port = 20000 + getpid() % 20000;
+	pid_t server = startServer(port, count);
+	if (server < 0) return 1;
+
+	// wait for the listener
+	int probe = -1;
+	for (int attempt = 0; attempt < 100 && probe < 0; attempt++) {
+		probe = connectTo(port);
+		if (probe < 0) usleep(50000);
+	}
+	int failed = probe < 0 || !signIn(port);
+	if (probe >= 0) close(probe);
+
+	subscriber_t *subscribers = calloc(count, sizeof(subscriber_t));
+	int epollfd = epoll_create1(0);
+	failed = failed || !subscribers || epollfd < 0;
+	if (failed) fprintf(stderr, "The server did not start, or the sign-in failed\n");
+
+	// each subscriber's first event is the current description
+	long before = residentKb(server);
+	char request[512];
+	int length = snprintf(request, sizeof(request), "GET /home/events HTTP/1.1\r\nHost: bench\r\nCookie: %s\r\n\r\n", cookie);
+	double start = nowSeconds(), first, last = 0;
+	for (int opened = 0; !failed && opened < count; opened += BENCH_WAVE) {
+		int wave = count - opened < BENCH_WAVE ? count - opened : BENCH_WAVE;
+		for (int i = opened; !failed && i < opened + wave; i++) {
+			subscriber_t *s = &subscribers[i];
+			s->fd = connectTo(port);
+			struct epoll_event ev = { .events = EPOLLIN, .data.ptr = s };
+			failed = s->fd < 0 || !writeAll(s->fd, request, length) || epoll_ctl(epollfd, EPOLL_CTL_ADD, s->fd, &ev) != 0;
+		}
+		if (!failed)
+			awaitEvents(epollfd, subscribers + opened, wave, 1, start, &first, &last);
+		failed = failed || last == 0;
+	}
+	double subscribing = nowSeconds() - start;
+	long after = residentKb(server);
+
+	double *lasts = calloc(updates, sizeof(double)), *firsts = calloc(updates, sizeof(double));
+	for (int u = 0; !failed && lasts && firsts && u < updates; u++) {
+		char body[64];
+		snprintf(body, sizeof(body), "profile-description=update+%d", u);
+		start = nowSeconds();
+		failed = post(port, "/home", body) != 200;
+		if (!failed)
+			awaitEvents(epollfd, subscribers, count, u + 2, start, &firsts[u], &lasts[u]);
+		failed = failed || lasts[u] == 0;
+	}
+
+	if (!failed) {
+		qsort(firsts, updates, sizeof(double), compareDoubles);
+		qsort(lasts, updates, sizeof(double), compareDoubles);
+		printf("%d event streams of one user, %d profile updates\n", count, updates);
+		printf("  subscribe   %8.0f streams/s   server RSS +%ld KiB, %.0f bytes per idle stream\n",
+			   count / subscribing, after - before, (after - before) * 1024.0 / count);
+		printf("  fan-out     first p50 %7.3f ms   all p50 %7.3f ms   all p99 %7.3f ms (save included)\n",
+			   firsts[updates / 2] * 1e3, lasts[updates / 2] * 1e3, lasts[updates * 99 / 100] * 1e3);
+	} else {
+		fprintf(stderr, "Event streams failed or timed out\n");
+	}
+
+	for (int i = 0; subscribers && i < count; i++)
+		if (subscribers[i].fd > 0) close(subscribers[i].fd);
+	free(subscribers);
+	free(firsts);
+	free(lasts);
+	kill(server, SIGTERM);
+	waitpid(server, NULL, 0);
+	return failed;
+}
@@ -0,0 +1,363 @@
+//
+//  h2_bench.c
+//  CServer
+//
+//  Created by ibrahim alnakeeb on 19/10/2026.
+//
+//  Page loads over HTTP/1.1 against HTTP/2: new visitors fetching /login
+//  and then its stylesheet, icon and background image at once, as a
+//  browser does. Over HTTP/1.1 the assets each need a connection of their
+//  own to load in parallel; over HTTP/2 (prior knowledge, h2c) they are
+//  streams of the page's one connection. Reports the connections opened
+//  per page load and the page load latency, with several visitors at a time.
+//
+//  Usage: make bench, or obj/h2_bench [seconds] [visitors]
+//
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#define BENCH_SERVER		"./server"
+#define BENCH_SECONDS		2
+#define BENCH_VISITORS		8
+#define BENCH_LOADS_MAX		(1 << 20)		// page loads a visitor records
+#define BENCH_BUFFER		(256 * 1024)
+#define BENCH_WINDOW		(1 << 20)		// the client's flow control window
+
+#define ASSETS				3
+
+static const char *const page = "/login";
+static const char *const assets[ASSETS] = {
+	"/public/css/style.css",
+	"/public/images/favicon.ico",
+	"/public/images/background.jpg",
+};
+
+static char buffer[BENCH_BUFFER];
+
+static double nowSeconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static pid_t startServer(int port) {
+	char plainPort[16];
+	snprintf(plainPort, sizeof(plainPort), "%d", port);
+
+	pid_t pid = fork();
+	if (pid == 0) {
+		int null = open("/dev/null", O_WRONLY);
+		dup2(null, STDOUT_FILENO);
+		dup2(null, STDERR_FILENO);
+		execl(BENCH_SERVER, BENCH_SERVER, plainPort, (char *)NULL);
+		_exit(127);
+	}
+	return pid;
+}
+
+static int connectTo(int port) {
+	struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port) };
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		close(fd);
+		return -1;
+	}
+	// a reset on close leaves no TIME_WAIT behind, so the ports last the run
+	int on = 1;
+	struct linger linger = { .l_onoff = 1, .l_linger = 0 };
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+	setsockopt(fd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+	return fd;
+}
+
+static int writeAll(int fd, const char *data, size_t length) {
+	while (length > 0) {
+		ssize_t sent = send(fd, data, length, MSG_NOSIGNAL);
+		if (sent <= 0) return 0;
+		data += sent;
+		length -= sent;
+	}
+	return 1;
+}
+
+static int readAll(int fd, char *data, size_t length) {
+	while (length > 0) {
+		ssize_t rcvd = recv(fd, data, length, 0);
+		if (rcvd <= 0) return 0;
+		data += rcvd;
+		length -= rcvd;
+	}
+	return 1;
+}
+
+static int sendRequest(int fd, const char *path) {
+	char request[256];
+	int length = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: bench\r\n\r\n", path);
+	return writeAll(fd, request, length);
+}
+
+/*
+ * Reads one keep-alive response: the head, then Content-Length bytes of body.
+ *
+ * Returns:
+ *   1 on a 200 response, 0 otherwise.
+ */
+static int readResponse(int fd) {
+	size_t length = 0;
+	char *end = NULL;
+	while (!end) {
+		ssize_t rcvd = recv(fd, buffer + length, sizeof(buffer) - 1 - length, 0);
+		if (rcvd <= 0) return 0;
+		length += rcvd;
+		buffer[length] = '\0';
+		end = strstr(buffer, "\r\n\r\n");
+	}
+	const char *field = strcasestr(buffer, "Content-Length:");
+	if (strncmp(buffer, "HTTP/1.1 200", 12) != 0 || !field || field > end) return 0;
+
+	size_t body = strtoul(field + 15, NULL, 10), have = length - (end + 4 - buffer);
+	while (have < body) {
+		ssize_t rcvd = recv(fd, buffer, sizeof(buffer), 0);
+		if (rcvd <= 0) return 0;
+		have += rcvd;
+	}
+	return 1;
+}
+
+// HTTP/1.1: the page, then each asset on a connection of its own, the page's one reused
+static int loadHttp1(int port, int *connections) {
+	int fds[ASSETS] = { connectTo(port) }, ok = fds[0] >= 0;
+	*connections = 1;
+	ok = ok && sendRequest(fds[0], page) && readResponse(fds[0]);
+
+	for (int i = 1; ok && i < ASSETS; i++) {
+		fds[i] = connectTo(port);
+		ok = fds[i] >= 0;
+		*connections += ok;
+	}
+	for (int i = 0; ok && i < ASSETS; i++)
+		ok = sendRequest(fds[i], assets[i]);
+	for (int i = 0; ok && i < ASSETS; i++)
+		ok = readResponse(fds[i]);
+
+	for (int i = 0; i < ASSETS; i++)
+		if (fds[i] > 0) close(fds[i]);
+	return ok;
+}
+
+static size_t frameHeader(unsigned char *p, size_t length, int type, int flags, uint32_t stream) {
+	p[0] = length >> 16;
+	p[1] = length >> 8;
+	p[2] = length;
+	p[3] = type;
+	p[4] = flags;
+	p[5] = stream >> 24;
+	p[6] = stream >> 16;
+	p[7] = stream >> 8;
+	p[8] = stream;
+	return 9;
+}
+
+// a field literal without indexing, new name: 7-bit lengths are enough here
+static size_t literal(unsigned char *p, const char *name, const char *value) {
+	size_t nameLength = strlen(name), valueLength = strlen(value);
+	p[0] = 0;
+	p[1] = nameLength;
+	memcpy(p + 2, name, nameLength);
+	p[2 + nameLength] = valueLength;
+	memcpy(p + 3 + nameLength, value, valueLength);
+	return 3 + nameLength + valueLength;
+}
+
+// HEADERS with END_STREAM: a GET of path on stream
+static size_t headersFrame(unsigned char *p, uint32_t stream, const char *path) {
+	size_t length = 0;
+	unsigned char *block = p + 9;
+	length += literal(block + length, ":method", "GET");
+	length += literal(block + length, ":scheme", "http");
+	length += literal(block + length, ":authority", "bench");
+	length += literal(block + length, ":path", path);
+	frameHeader(p, length, 0x1, 0x4 | 0x1, stream);
+	return 9 + length;
+}
+
+/*
+ * Reads frames until `count` streams have ended, acknowledging the
+ * server's SETTINGS. Only the first byte of a response's header block is
+ * looked at: 0x88 is :status 200 from the static table.
+ *
+ * Returns:
+ *   1 if every stream ended with a 200 response, 0 otherwise.
+ */
+static int readStreams(int fd, int count) {
+	static const unsigned char settingsAck[9] = { 0, 0, 0, 0x4, 0x1, 0, 0, 0, 0 };
+	unsigned char head[9];
+	int ok = 1;
+
+	while (count > 0) {
+		if (!readAll(fd, (char *)head, sizeof(head))) return 0;
+		size_t length = (size_t)head[0] << 16 | head[1] << 8 | head[2];
+		if (length > sizeof(buffer) || !readAll(fd, buffer, length)) return 0;
+
+		int type = head[3], flags = head[4];
+		if (type == 0x4 && !(flags & 0x1) && !writeAll(fd, (const char *)settingsAck, sizeof(settingsAck)))
+			return 0;
+		if (type == 0x7 || type == 0x3)		// GOAWAY, RST_STREAM
+			return 0;
+		if (type == 0x1 && (length == 0 || (unsigned char)buffer[0] != 0x88))
+			ok = 0;
+		if ((type == 0x0 || type == 0x1) && (flags & 0x1))
+			count--;
+	}
+	return ok;
+}
+
+// HTTP/2: the page, then the assets as streams of the same connection at once
+static int loadHttp2(int port, int *connections) {
+	static const char preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+	unsigned char frames[2048];
+	size_t length = 0;
+
+	int fd = connectTo(port);
+	*connections = 1;
+	if (fd < 0) return 0;
+
+	// SETTINGS_INITIAL_WINDOW_SIZE and a connection WINDOW_UPDATE to match: the image takes one go
+	memcpy(frames, preface, sizeof(preface) - 1);
+	length = sizeof(preface) - 1;
+	length += frameHeader(frames + length, 6, 0x4, 0, 0);
+	unsigned char settings[6] = { 0, 0x4, BENCH_WINDOW >> 24, BENCH_WINDOW >> 16 & 0xff, BENCH_WINDOW >> 8 & 0xff,
+								BENCH_WINDOW & 0xff };
+	memcpy(frames + length, settings, sizeof(settings));
+	length += sizeof(settings);
+	length += frameHeader(frames + length, 4, 0x8, 0, 0);
+	uint32_t increment = BENCH_WINDOW - 65535;
+	unsigned char update[4] = { increment >> 24, increment >> 16, increment >> 8, increment };
+	memcpy(frames + length, update, sizeof(update));
+	length += sizeof(update);
+	length += headersFrame(frames + length, 1, page);
+
+	int ok = writeAll(fd, (const char *)frames, length) && readStreams(fd, 1);
+
+	length = 0;
+	for (int i = 0; i < ASSETS; i++)
+		length += headersFrame(frames + length, 3 + 2 * i, assets[i]);
+	ok = ok && writeAll(fd, (const char *)frames, length) && readStreams(fd, ASSETS);
+
+	close(fd);
+	return ok;
+}
+
+static int compareDoubles(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : x > y;
+}
+
+/*
+ * Runs `visitors` processes loading the page for `seconds`, and prints the
+ * page load rate, connections per page load and latency percentiles.
+ *
+ * Returns:
+ *   0 on success, 1 if a page load failed.
+ */
+static int run(const char *name, int (*load)(int, int *), int port, int seconds, int visitors) {
+	int channels[visitors][2];
+	pid_t pids[visitors];
+	for (int v = 0; v < visitors; v++) {
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, channels[v]) != 0) return 1;
+		if ((pids[v] = fork()) > 0) {
+			close(channels[v][1]);
+			continue;
+		}
+
+		// a visitor: its latencies, then its connection and failure counts
+		static double latencies[BENCH_LOADS_MAX];
+		long loads = 0, connections = 0, failed = 0;
+		double end = nowSeconds() + seconds;
+		while (nowSeconds() < end && loads < BENCH_LOADS_MAX) {
+			int opened;
+			double start = nowSeconds();
+			if (!load(port, &opened)) failed++;
+			latencies[loads++] = nowSeconds() - start;
+			connections += opened;
+		}
+		long counts[3] = { loads, connections, failed };
+		int ok = writeAll(channels[v][1], (const char *)counts, sizeof(counts))
+				 && writeAll(channels[v][1], (const char *)latencies, loads * sizeof(double));
+		_exit(!ok);
+	}
+
+	double *latencies = NULL;
+	long loads = 0, connections = 0, failed = 0;
+	for (int v = 0; v < visitors; v++) {
+		long counts[3];
+		if (readAll(channels[v][0], (char *)counts, sizeof(counts))) {
+			double *grown = realloc(latencies, (loads + counts[0]) * sizeof(double));
+			if (grown && readAll(channels[v][0], (char *)(grown + loads), counts[0] * sizeof(double))) {
+				loads += counts[0];
+				connections += counts[1];
+				failed += counts[2];
+			}
+			if (grown) latencies = grown;
+		}
+		close(channels[v][0]);
+		waitpid(pids[v], NULL, 0);
+	}
+	if (!loads) return 1;
+
+	qsort(latencies, loads, sizeof(double), compareDoubles);
+	printf("  %-9s %8.0f pages/s   %4.1f conn/page   p50 %7.3f ms   p99 %7.3f ms%s\n", name,
+		   (double)loads / seconds, (double)connections / loads, latencies[loads / 2] * 1e3,
+		   latencies[loads * 99 / 100] * 1e3, failed ? "   (errors)" : "");
+	free(latencies);
+	return failed != 0;
+}
+
+int main(int argc, char *argv[]) {
+	int seconds = argc > 1 ? atoi(argv[1]) : BENCH_SECONDS;
+	int visitors = argc > 2 ? atoi(argv[2]) : BENCH_VISITORS;
+	if (seconds < 1) seconds = 1;
+	if (visitors < 1) visitors = 1;
+
+	int port = 20000 + getpid() % 20000;
+	pid_t server = startServer(port);
+	if (server < 0) return 1;
+
+	// wait for the listener
+	int probe = -1;
+	for (int attempt = 0; attempt < 100 && probe < 0; attempt++) {
+		probe = connectTo(port);
+		if (probe < 0) usleep(50000);
+	}
+	if (probe < 0) {
+		fprintf(stderr, "The server did not start\n");
+		kill(server, SIGKILL);
+		waitpid(server, NULL, 0);
+		return 1;
+	}
+	close(probe);
+
+	printf("Page loads of %s and %d assets, %d visitors, %d s each\n", page, ASSETS, visitors, seconds);
+	int failed = run("HTTP/1.1", loadHttp1, port, seconds, visitors);
+	failed |= run("HTTP/2", loadHttp2, port, seconds, visitors);
+
+	kill(server, SIGTERM);
+	waitpid(server, NULL, 0);
+	return failed;
+}
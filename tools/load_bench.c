@@ -0,0 +1,213 @@
+//
+//  load_bench.c
+//  CServer
+//
+//  Created by ibrahim alnakeeb on 19/10/2026.
+//
+//  Requests per second and latency of the server on each I/O backend (-I),
+//  and over a Unix socket next to TCP loopback: starts ./server, keeps a
+//  number of keep-alive connections busy with GET /login, which the server
+//  replays from its cache without a handler, so the numbers are mostly the
+//  event loop's socket I/O.
+//
+//  Usage: make bench, or obj/load_bench [connections] [seconds]
+//
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#define BENCH_SERVER		"./server"
+#define BENCH_PATH			"/login"
+#define BENCH_CONNECTIONS	256
+#define BENCH_SECONDS		3
+#define BENCH_WARMUP		0.5			// seconds before requests are counted
+#define BENCH_RESPONSE_MAX	(256 * 1024)
+#define BENCH_SAMPLES		(4 * 1024 * 1024)
+#define BENCH_UNIX_PATH		"/tmp/load_bench.sock"
+
+typedef struct {
+	int		fd;
+	double	sent;			// when the request went out
+	char	*buf;
+	size_t	length;
+} client_t;
+
+static const char request[] = "GET " BENCH_PATH " HTTP/1.1\r\nHost: bench\r\nConnection: keep-alive\r\n\r\n";
+
+static double nowSeconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int compareDoubles(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+// the server listens on the port and, with overUnix, on BENCH_UNIX_PATH too
+static pid_t startServer(const char *backend, int port, int overUnix, int connections) {
+	char limits[64], portText[16];
+	snprintf(limits, sizeof(limits), "connections=%d", connections + 64);
+	snprintf(portText, sizeof(portText), "%d", port);
+	const char *unixAddress = overUnix ? "unix:" BENCH_UNIX_PATH : NULL;
+
+	pid_t pid = fork();
+	if (pid == 0) {
+		int null = open("/dev/null", O_WRONLY);
+		dup2(null, STDOUT_FILENO);
+		dup2(null, STDERR_FILENO);
+		execl(BENCH_SERVER, BENCH_SERVER, "-I", backend, "-L", limits, portText, unixAddress, (char *)NULL);
+		_exit(127);
+	}
+	return pid;
+}
+
+static int connectTo(int port, int overUnix) {
+	struct sockaddr_in in = { .sin_family = AF_INET, .sin_port = htons(port) };
+	in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	struct sockaddr_un un = { .sun_family = AF_UNIX, .sun_path = BENCH_UNIX_PATH };
+
+	int fd = socket(overUnix ? AF_UNIX : AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+	int connected = overUnix ? connect(fd, (struct sockaddr *)&un, sizeof(un))
+							 : connect(fd, (struct sockaddr *)&in, sizeof(in));
+	if (connected != 0) {
+		close(fd);
+		return -1;
+	}
+	int on = 1;
+	if (!overUnix)
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+	return fd;
+}
+
+// length of the complete response at the start of buf, 0 if it is not all there yet
+static size_t responseLength(const char *buf, size_t length) {
+	const char *end = memmem(buf, length, "\r\n\r\n", 4);
+	if (!end) return 0;
+	size_t head = end + 4 - buf;
+
+	size_t body = 0;
+	const char *field = memmem(buf, head, "Content-Length:", 15);
+	if (field) body = strtoul(field + 15, NULL, 10);
+	return length >= head + body ? head + body : 0;
+}
+
+static int sendRequest(client_t *client) {
+	client->sent = nowSeconds();
+	return send(client->fd, request, sizeof(request) - 1, MSG_NOSIGNAL) == (ssize_t)(sizeof(request) - 1);
+}
+
+// keep every connection busy for `seconds`; latencies go to samples
+static int run(const char *backend, int overUnix, int connections, int seconds, double *samples) {
+	const char *label = overUnix ? "unix" : backend;
+	int port = 20000 + (getpid() + overUnix * 97) % 20000;
+	unlink(BENCH_UNIX_PATH);
+	pid_t server = startServer(backend, port, overUnix, connections);
+	if (server < 0) return 1;
+
+	// wait for the listener
+	int probe = -1;
+	for (int attempt = 0; attempt < 100 && probe < 0; attempt++) {
+		probe = connectTo(port, overUnix);
+		if (probe < 0) usleep(50000);
+	}
+	if (probe < 0) {
+		fprintf(stderr, "%s: the server did not start\n", label);
+		kill(server, SIGKILL);
+		waitpid(server, NULL, 0);
+		return 1;
+	}
+	close(probe);
+
+	int epollfd = epoll_create1(0);
+	client_t *clients = calloc(connections, sizeof(client_t));
+	if (epollfd < 0 || !clients) return 1;
+	for (int i = 0; i < connections; i++) {
+		clients[i].fd = connectTo(port, overUnix);
+		clients[i].buf = malloc(BENCH_RESPONSE_MAX);
+		if (clients[i].fd < 0 || !clients[i].buf) {
+			fprintf(stderr, "%s: connection %d failed\n", label, i);
+			return 1;
+		}
+		struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &clients[i] };
+		epoll_ctl(epollfd, EPOLL_CTL_ADD, clients[i].fd, &ev);
+		sendRequest(&clients[i]);
+	}
+
+	long counted = 0, failed = 0;
+	double start = nowSeconds(), measureFrom = start + BENCH_WARMUP, end = measureFrom + seconds;
+	struct epoll_event events[64];
+	while (nowSeconds() < end) {
+		int n = epoll_wait(epollfd, events, 64, 100);
+		double now = nowSeconds();
+		for (int i = 0; i < n; i++) {
+			client_t *client = events[i].data.ptr;
+			ssize_t rcvd = recv(client->fd, client->buf + client->length, BENCH_RESPONSE_MAX - client->length, 0);
+			if (rcvd <= 0) {
+				failed++;
+				epoll_ctl(epollfd, EPOLL_CTL_DEL, client->fd, NULL);
+				continue;
+			}
+			client->length += rcvd;
+
+			size_t length = responseLength(client->buf, client->length);
+			if (!length) continue;
+			if (strncmp(client->buf, "HTTP/1.1 200", 12) != 0)
+				failed++;
+			else if (client->sent >= measureFrom && counted < BENCH_SAMPLES)
+				samples[counted++] = now - client->sent;
+			client->length -= length;
+			memmove(client->buf, client->buf + length, client->length);
+			sendRequest(client);
+		}
+	}
+
+	for (int i = 0; i < connections; i++) {
+		close(clients[i].fd);
+		free(clients[i].buf);
+	}
+	free(clients);
+	close(epollfd);
+	kill(server, SIGTERM);
+	waitpid(server, NULL, 0);
+	unlink(BENCH_UNIX_PATH);
+
+	qsort(samples, counted, sizeof(double), compareDoubles);
+	printf("  %-6s %9.0f req/s   p50 %7.1f us   p99 %7.1f us%s\n", label, counted / (double)seconds,
+		   counted ? samples[counted / 2] * 1e6 : 0, counted ? samples[counted * 99 / 100] * 1e6 : 0,
+		   failed ? "   (errors)" : "");
+	return failed != 0;
+}
+
+int main(int argc, char *argv[]) {
+	int connections = argc > 1 ? atoi(argv[1]) : BENCH_CONNECTIONS;
+	int seconds = argc > 2 ? atoi(argv[2]) : BENCH_SECONDS;
+	if (connections < 1) connections = 1;
+	if (seconds < 1) seconds = 1;
+
+	double *samples = malloc(BENCH_SAMPLES * sizeof(double));
+	if (!samples) return 1;
+
+	printf("%d keep-alive connections, GET %s for %d s\n", connections, BENCH_PATH, seconds);
+	int failed = run("epoll", 0, connections, seconds, samples);
+	failed |= run("uring", 0, connections, seconds, samples);
+	failed |= run("epoll", 1, connections, seconds, samples);		// what a proxy on the same host saves
+	free(samples);
+	return failed;
+}
@@ -0,0 +1,242 @@
+//
+//  memstat_bench.c
+//  CServer
+//
+//  Created by ibrahim alnakeeb on 19/10/2026.
+//
+//  Leak check of every handler route: starts the allocation accounting
+//  build (obj/memstat/server, make MEMSTAT=1 in a directory of its own),
+//  once with forked handlers and once with coroutine handlers (-c), sends
+//  each route a few hundred requests, signed in and not, then reads
+//  /admin/memory. Fails if any route left an allocation live.
+//
+//  Usage: make bench, or obj/memstat_bench [rounds]
+//
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#define BENCH_SERVER		"obj/memstat/server"
+#define BENCH_ROUNDS		100
+#define BENCH_USER			"memstat_bench"
+
+static char buffer[64 * 1024];
+static char cookie[128];
+
+// the requests of one round; each is answered by a handler, none by the cache
+static const char *const requests[] = {
+	"GET / HTTP/1.1\r\n",
+	"GET /no/such/page HTTP/1.1\r\n",
+	"GET /home HTTP/1.1\r\n",
+	"GET /logout HTTP/1.1\r\n",
+	"GET /public/css/style.css HTTP/1.1\r\nIf-None-Match: \"stale\"\r\n",
+	"GET /admin/metrics HTTP/1.1\r\n",
+	NULL
+};
+static const char *const forms[][2] = {
+	{ "/login", "action=signin&username=" BENCH_USER "&password=wrong" },
+	{ "/login", "action=signin&username=nobody&password=bench" },
+	{ "/login", "action=signup&username=" BENCH_USER "&password=bench" },
+	{ "/login", "action=unknown" },
+	{ "/home", "profile-description=memstat+bench+%3Cb%3Eprofile%3C%2Fb%3E" },
+	{ NULL, NULL }
+};
+
+static int connectTo(int port) {
+	struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port) };
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int writeAll(int fd, const char *data, size_t length) {
+	while (length > 0) {
+		ssize_t sent = send(fd, data, length, MSG_NOSIGNAL);
+		if (sent <= 0) return 0;
+		data += sent;
+		length -= sent;
+	}
+	return 1;
+}
+
+/*
+ * Sends a request on a connection of its own and reads the response until
+ * the server closes it (Connection: close).
+ *
+ * Returns:
+ *   The status code, 0 if the exchange failed. The response is in buffer.
+ */
+static int exchange(int port, const char *request) {
+	int fd = connectTo(port);
+	if (fd < 0 || !writeAll(fd, request, strlen(request))) {
+		if (fd >= 0) close(fd);
+		return 0;
+	}
+
+	size_t length = 0;
+	ssize_t rcvd;
+	while (length < sizeof(buffer) - 1 && (rcvd = recv(fd, buffer + length, sizeof(buffer) - 1 - length, 0)) > 0)
+		length += rcvd;
+	buffer[length] = '\0';
+	close(fd);
+	return strncmp(buffer, "HTTP/1.1 ", 9) == 0 ? atoi(buffer + 9) : 0;
+}
+
+static int get(int port, const char *head) {
+	char request[1024];
+	snprintf(request, sizeof(request), "%sHost: bench\r\nConnection: close\r\n%s%s%s\r\n",
+		head, cookie[0] ? "Cookie: " : "", cookie, cookie[0] ? "\r\n" : "");
+	return exchange(port, request);
+}
+
+static int post(int port, const char *path, const char *body) {
+	char request[1024];
+	snprintf(request, sizeof(request),
+		"POST %s HTTP/1.1\r\nHost: bench\r\nConnection: close\r\n%s%s%s"
+		"Content-Type: application/x-www-form-urlencoded\r\nContent-Length: %zu\r\n\r\n%s",
+		path, cookie[0] ? "Cookie: " : "", cookie, cookie[0] ? "\r\n" : "", strlen(body), body);
+	return exchange(port, request);
+}
+
+// sign the bench's user up (again) and in, keeping the session cookie
+static int signIn(int port) {
+	cookie[0] = '\0';
+	post(port, "/login", "action=signup&username=" BENCH_USER "&password=bench");
+	if (post(port, "/login", "action=signin&username=" BENCH_USER "&password=bench") != 302)
+		return 0;
+
+	const char *token = strstr(buffer, "session=");
+	if (!token) return 0;
+	size_t length = strcspn(token, ";\r\n");
+	if (length >= sizeof(cookie)) return 0;
+	memcpy(cookie, token, length);
+	cookie[length] = '\0';
+	return 1;
+}
+
+// the server on port, the admin routes on port + 1
+static pid_t startServer(int port, int coroutines) {
+	char plainPort[16], adminPort[32];
+	snprintf(plainPort, sizeof(plainPort), "%d", port);
+	snprintf(adminPort, sizeof(adminPort), "admin:%d", port + 1);
+
+	pid_t pid = fork();
+	if (pid == 0) {
+		int null = open("/dev/null", O_WRONLY);
+		dup2(null, STDOUT_FILENO);
+		dup2(null, STDERR_FILENO);
+		if (coroutines)
+			execl(BENCH_SERVER, BENCH_SERVER, "-c", "-R", "off", plainPort, adminPort, (char *)NULL);
+		else
+			execl(BENCH_SERVER, BENCH_SERVER, "-R", "off", plainPort, adminPort, (char *)NULL);
+		_exit(127);
+	}
+
+	// wait for the listener
+	for (int attempt = 0; attempt < 100; attempt++) {
+		int probe = connectTo(port);
+		if (probe >= 0) {
+			close(probe);
+			return pid;
+		}
+		usleep(50000);
+	}
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+	return -1;
+}
+
+static void stopServer(pid_t pid) {
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+}
+
+/*
+ * Sends `rounds` rounds of every request, signed out then signed in, and
+ * checks the allocation table.
+ *
+ * Returns:
+ *   1 if every route freed what it allocated, 0 otherwise.
+ */
+static int run(const char *name, int port, int coroutines, int rounds) {
+	pid_t server = startServer(port, coroutines);
+	if (server < 0) {
+		fprintf(stderr, "%s did not start (make builds it)\n", BENCH_SERVER);
+		return 0;
+	}
+
+	int failed = 0;
+	long sent = 0;
+	for (int signedIn = 0; signedIn < 2 && !failed; signedIn++) {
+		cookie[0] = '\0';
+		if (signedIn && !signIn(port)) {
+			fprintf(stderr, "Signing in failed\n");
+			failed = 1;
+			break;
+		}
+		for (int round = 0; round < rounds && !failed; round++) {
+			for (int i = 0; requests[i] && !failed; i++, sent++)
+				failed = get(port, requests[i]) == 0;
+			for (int i = 0; forms[i][0] && !failed; i++, sent++)
+				failed = post(port, forms[i][0], forms[i][1]) == 0;
+		}
+	}
+	if (failed)
+		fprintf(stderr, "A request went unanswered\n");
+
+	// the table, one row per route under a header line
+	int routes = 0;
+	long leaked = 0;
+	if (!failed) {
+		cookie[0] = '\0';
+		failed = exchange(port + 1, "GET /admin/memory HTTP/1.1\r\nHost: bench\r\nConnection: close\r\n\r\n") != 200;
+		char *line = strstr(buffer, "\r\n\r\n");
+		line = line ? strchr(line + 4, '\n') : NULL;
+		for (; !failed && line && line[1]; line = strchr(line + 1, '\n')) {
+			char method[16], path[64];
+			unsigned long requestCount, allocations, bytes, peak, leakedAllocations, leakedBytes;
+			if (sscanf(line + 1, "%15s %63s %lu %lu %lu %lu %lu %lu", method, path, &requestCount, &allocations,
+					   &bytes, &peak, &leakedAllocations, &leakedBytes) != 8)
+				continue;
+			routes++;
+			leaked += leakedAllocations;
+			if (leakedAllocations)
+				fprintf(stderr, "%s %s leaked %lu allocations (%lu bytes) in %lu requests\n",
+						method, path, leakedAllocations, leakedBytes, requestCount);
+		}
+		failed = failed || routes == 0;
+		if (failed)
+			fprintf(stderr, "/admin/memory could not be read\n");
+	}
+
+	if (!failed)
+		printf("  %-10s %6ld requests   %2d routes   %ld leaked allocations\n", name, sent, routes, leaked);
+	stopServer(server);
+	return !failed && leaked == 0;
+}
+
+int main(int argc, char *argv[]) {
+	int rounds = argc > 1 ? atoi(argv[1]) : BENCH_ROUNDS;
+	if (rounds < 1) rounds = BENCH_ROUNDS;
+
+	int port = 20000 + getpid() % 20000;
+	printf("Allocations left live per route, %d rounds of %zu requests, signed out and in\n", rounds,
+		   sizeof(requests) / sizeof(requests[0]) - 1 + sizeof(forms) / sizeof(forms[0]) - 1);
+	int ok = run("forked", port, 0, rounds) && run("coroutines", port + 2, 1, rounds);
+	return !ok;
+}
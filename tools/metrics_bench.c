@@ -0,0 +1,108 @@
+//
+//  metrics_bench.c
+//  CServer
+//
+//  Created by ibrahim alnakeeb on 19/10/2026.
+//
+//  What the shared counters cost when handlers on every core bump them:
+//  one process pinned per CPU, all incrementing the same counter, first in
+//  a single shared array as metrics used to keep it, then through
+//  metricsAdd()'s per-CPU pages. Reports the time per increment and the
+//  last-level cache misses of each run where perf events are readable.
+//
+//  Usage: make bench, or obj/metrics_bench [increments per process]
+//
+
+#define _GNU_SOURCE
+
+#include "affinity.h"
+#include "metrics.h"
+#include "shm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#define BENCH_INCREMENTS	2000000
+
+static uint64_t *shared;		// the old layout: one array for every process
+
+static double nowSeconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// last-level cache misses of this process and the ones it forks, -1 if perf is not allowed
+static int openMisses(void) {
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = PERF_COUNT_HW_CACHE_MISSES;
+	attr.disabled = 1;
+	attr.inherit = 1;
+	attr.exclude_kernel = 1;
+	return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void bumpShared(long increments) {
+	for (long i = 0; i < increments; i++)
+		__atomic_add_fetch(&shared[METRIC_CACHE_HITS], 1, __ATOMIC_RELAXED);
+}
+
+static void bumpSharded(long increments) {
+	for (long i = 0; i < increments; i++)
+		METRIC_INC(METRIC_CACHE_HITS);
+}
+
+// one pinned process per CPU runs bump(); prints ns per increment and misses
+static void run(const char *name, void (*bump)(long), int processes, long increments) {
+	int misses = openMisses();
+	if (misses >= 0) {
+		ioctl(misses, PERF_EVENT_IOC_RESET, 0);
+		ioctl(misses, PERF_EVENT_IOC_ENABLE, 0);
+	}
+
+	double start = nowSeconds();
+	for (int i = 0; i < processes; i++) {
+		if (fork() == 0) {
+			affinityPin(affinityCpu(i));
+			bump(increments);
+			_exit(0);
+		}
+	}
+	while (wait(NULL) > 0)
+		;
+	double elapsed = nowSeconds() - start;
+
+	printf("  %-28s %6.1f ns/increment", name, elapsed * 1e9 / increments);
+	uint64_t count;
+	if (misses >= 0 && read(misses, &count, sizeof(count)) == sizeof(count))
+		printf("   %10.0f LLC misses/s\n", count / elapsed);
+	else
+		printf("   LLC misses n/a (perf events not permitted)\n");
+	if (misses >= 0) close(misses);
+}
+
+int main(int argc, char *argv[]) {
+	long increments = argc > 1 ? atol(argv[1]) : BENCH_INCREMENTS;
+	if (increments < 1) increments = 1;
+
+	int processes = affinityInit();
+	shared = shmAlloc(sizeof(uint64_t) * METRIC_COUNT);
+	if (!processes || !shared || !metricsInit()) return 1;
+
+	printf("%d processes, one per CPU, %ld increments each\n", processes, increments);
+	if (processes == 1)
+		printf("  (one CPU: nothing is shared between cores, expect no difference)\n");
+	run("one shared counter array", bumpShared, processes, increments);
+	run("per-CPU counter pages", bumpSharded, processes, increments);
+	return 0;
+}
@@ -0,0 +1,121 @@
+//
+//  pool_bench.c
+//  CServer
+//
+//  Created by ibrahim alnakeeb on 19/10/2026.
+//
+//  What handing work to the pool costs the event loop: poolSubmit() alone,
+//  the round trip of one job through a pool thread and back to poll(), and
+//  batch throughput; next to the fork() the server moves off the loop.
+//
+//  Usage: make bench
+//
+
+#include "pool.h"
+#include "metrics.h"
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define BENCH_BATCH		1000
+#define BENCH_BATCHES	200
+#define BENCH_TRIPS		20000
+#define BENCH_FORKS		200
+#define BENCH_RESIDENT	(8 * 1024 * 1024)	// the server's default cache size
+
+static int finished;
+
+static double nowSeconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void runNothing(pool_job_t *job) {
+	(void)job;
+}
+
+static void countDone(pool_job_t *job) {
+	(void)job;
+	finished++;
+}
+
+// poll the completion eventfd until `target` jobs are done
+static void waitFor(int fd, int target) {
+	struct pollfd p = { .fd = fd, .events = POLLIN };
+	while (finished < target) {
+		poll(&p, 1, -1);
+		poolComplete();
+	}
+}
+
+static int compareDoubles(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+int main(int argc, char *argv[]) {
+	int threads = argc > 1 ? atoi(argv[1]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads < 1) threads = 1;
+	if (threads > POOL_THREADS_MAX) threads = POOL_THREADS_MAX;
+
+	metricsInit();
+	int fd = poolInit(threads);
+	pool_job_t *jobs = calloc(BENCH_BATCH, sizeof(pool_job_t));
+	double *trips = malloc(BENCH_TRIPS * sizeof(double));
+	if (fd < 0 || !jobs || !trips) return 1;
+	for (int i = 0; i < BENCH_BATCH; i++)
+		jobs[i] = (pool_job_t){ .run = runNothing, .done = countDone };
+
+	printf("%d pool threads\n", threads);
+
+	// submit a batch, then collect it
+	double submitting = 0, start = nowSeconds();
+	for (int batch = 0; batch < BENCH_BATCHES; batch++) {
+		double before = nowSeconds();
+		for (int i = 0; i < BENCH_BATCH; i++)
+			poolSubmit(&jobs[i]);
+		submitting += nowSeconds() - before;
+		waitFor(fd, (batch + 1) * BENCH_BATCH);
+	}
+	double elapsed = nowSeconds() - start;
+	int total = BENCH_BATCH * BENCH_BATCHES;
+	printf("poolSubmit()       %8.0f ns per job\n", submitting / total * 1e9);
+	printf("batches of %d    %8.2f M jobs/s\n", BENCH_BATCH, total / elapsed / 1e6);
+
+	// one job at a time, through a pool thread and back to poll()
+	for (int i = 0; i < BENCH_TRIPS; i++) {
+		double before = nowSeconds();
+		poolSubmit(&jobs[0]);
+		waitFor(fd, total + i + 1);
+		trips[i] = nowSeconds() - before;
+	}
+	qsort(trips, BENCH_TRIPS, sizeof(double), compareDoubles);
+	printf("round trip         %8.1f us p50 %8.1f us p99\n",
+		trips[BENCH_TRIPS / 2] * 1e6, trips[BENCH_TRIPS * 99 / 100] * 1e6);
+
+	// what the event loop would spend on fork() itself
+	char *resident = malloc(BENCH_RESIDENT);
+	if (!resident) return 1;
+	memset(resident, 1, BENCH_RESIDENT);
+	double forking = 0;
+	for (int i = 0; i < BENCH_FORKS; i++) {
+		double before = nowSeconds();
+		pid_t pid = fork();
+		if (pid == 0) _exit(0);
+		forking += nowSeconds() - before;
+		waitpid(pid, NULL, 0);
+	}
+	printf("fork(), %d MiB     %8.1f us\n", BENCH_RESIDENT >> 20, forking / BENCH_FORKS * 1e6);
+	printf("steals             %8lu\n", (unsigned long)metricsGet(METRIC_POOL_STEALS));
+
+	free(resident);
+	free(trips);
+	free(jobs);
+	return 0;
+}
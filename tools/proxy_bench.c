@@ -0,0 +1,495 @@
+//
+//  proxy_bench.c
+//  CServer
+//
+//  Created by ibrahim alnakeeb on 19/10/2026.
+//
+//  The reverse proxy in front of two stand-in upstreams on loopback, each a
+//  thread per connection answering keep-alive HTTP/1.1. Measures requests
+//  per second and p50/p99 latency through ROUTE_PROXY("/api/", "api") with
+//  kept upstream connections and without (keepalive=0), and the upstream
+//  connections each run opened, from /admin/metrics. A run against
+//  upstreams that close each connection right after their response checks
+//  that none of those complete responses counts as a failure. Then streams
+//  a large response and a large upload through the server, reporting its
+//  peak resident memory, and kills one upstream to show the passive health
+//  checks taking it out of the rotation.
+//
+//  Usage: make bench, or obj/proxy_bench [seconds] [clients]
+//
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#define BENCH_SERVER		"./server"
+#define BENCH_SECONDS		3
+#define BENCH_CLIENTS		32
+#define BENCH_STREAM		(256L * 1024 * 1024)	// bytes of the large response and upload
+#define BENCH_HEALTH		200						// requests after an upstream dies
+#define BENCH_SAMPLES_MAX	(1 << 20)
+#define BENCH_TIMEOUT_MS	5000
+
+static char buffer[64 * 1024];
+static int upstreamCloses;		// the stand-in upstream closes each connection after its response
+
+static double nowSeconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int connectTo(int port) {
+	struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port) };
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		close(fd);
+		return -1;
+	}
+	int on = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+	return fd;
+}
+
+static int writeAll(int fd, const char *data, size_t length) {
+	while (length > 0) {
+		ssize_t sent = send(fd, data, length, MSG_NOSIGNAL);
+		if (sent <= 0) return 0;
+		data += sent;
+		length -= sent;
+	}
+	return 1;
+}
+
+// the Content-Length of a head, 0 without one
+static long contentLength(const char *head, size_t length) {
+	const char *end = head + length;
+	for (const char *line = head; line < end;) {
+		if (strncasecmp(line, "Content-Length:", 15) == 0)
+			return atol(line + 15);
+		const char *next = memmem(line, end - line, "\r\n", 2);
+		if (!next) break;
+		line = next + 2;
+	}
+	return 0;
+}
+
+/*
+ * Where the response in data ends: its head and the Content-Length bytes
+ * after it.
+ *
+ * Returns:
+ *   The response's length, 0 while it is not all in.
+ */
+static size_t responseEnd(const char *data, size_t length) {
+	const char *end = memmem(data, length, "\r\n\r\n", 4);
+	if (!end) return 0;
+	size_t total = end + 4 - data + contentLength(data, end - data);
+	return total <= length ? total : 0;
+}
+
+// ---- the stand-in upstream: a thread per connection, keep-alive HTTP/1.1
+
+static void *serveUpstream(void *arg) {
+	int fd = (int)(intptr_t)arg;
+	static const char filler[64 * 1024] = { [0 ... sizeof(filler) - 1] = 'x' };
+	char in[16 * 1024], drained[16 * 1024], head[256];
+	size_t length = 0;
+
+	for (;;) {
+		char *end;
+		while (!(end = memmem(in, length, "\r\n\r\n", 4))) {
+			ssize_t rcvd = length < sizeof(in) ? recv(fd, in + length, sizeof(in) - length, 0) : -1;
+			if (rcvd <= 0) {
+				close(fd);
+				return NULL;
+			}
+			length += rcvd;
+		}
+
+		// the body is dropped: an upload is only counted through
+		size_t headLength = end + 4 - in;
+		long body = contentLength(in, headLength);
+		int closing = memmem(in, headLength, "Connection: close", 17) != NULL;
+		long size = strncmp(in, "GET /api/big/", 13) == 0 ? atol(in + 13) : 64;
+		size_t have = length - headLength;
+		length = 0;
+		if ((long)have > body) {
+			length = have - body;
+			memmove(in, in + headLength + body, length);
+			have = body;
+		}
+		for (long left = body - have; left > 0;) {
+			ssize_t rcvd = recv(fd, drained, left < (long)sizeof(drained) ? (size_t)left : sizeof(drained), 0);
+			if (rcvd <= 0) {
+				close(fd);
+				return NULL;
+			}
+			left -= rcvd;
+		}
+
+		int headSize = snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: %ld\r\n\r\n", size);
+		int ok = writeAll(fd, head, headSize);
+		for (long left = size; ok && left > 0; left -= sizeof(filler))
+			ok = writeAll(fd, filler, left < (long)sizeof(filler) ? (size_t)left : sizeof(filler));
+		if (!ok || closing || upstreamCloses) {
+			close(fd);
+			return NULL;
+		}
+	}
+}
+
+static pid_t startUpstream(int port, int closes) {
+	int listener = socket(AF_INET, SOCK_STREAM, 0), on = 1;
+	struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port) };
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	if (listener < 0 || bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listener, 1024) != 0)
+		return -1;
+
+	pid_t pid = fork();
+	if (pid == 0) {
+		upstreamCloses = closes;
+		for (;;) {
+			int fd = accept(listener, NULL, NULL);
+			if (fd < 0) continue;
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+			pthread_t thread;
+			pthread_attr_t attr;
+			pthread_attr_init(&attr);
+			pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+			pthread_attr_setstacksize(&attr, 256 * 1024);
+			if (pthread_create(&thread, &attr, serveUpstream, (void *)(intptr_t)fd) != 0)
+				close(fd);
+			pthread_attr_destroy(&attr);
+		}
+	}
+	close(listener);
+	return pid;
+}
+
+// ---- the server and its metrics
+
+// the proxy on port, the admin routes on port + 3 (the upstreams take the two between)
+static pid_t startServer(int port, int upstream, int keepalive) {
+	char plainPort[16], adminPort[32], option[160];
+	snprintf(plainPort, sizeof(plainPort), "%d", port);
+	snprintf(adminPort, sizeof(adminPort), "admin:%d", port + 3);
+	snprintf(option, sizeof(option), "name=api,server=127.0.0.1:%d,server=127.0.0.1:%d,keepalive=%d,fails=2,down=30",
+			 upstream, upstream + 1, keepalive);
+
+	pid_t pid = fork();
+	if (pid == 0) {
+		int null = open("/dev/null", O_WRONLY);
+		dup2(null, STDOUT_FILENO);
+		dup2(null, STDERR_FILENO);
+		execl(BENCH_SERVER, BENCH_SERVER, "-U", option, "-R", "off", plainPort, adminPort, (char *)NULL);
+		_exit(127);
+	}
+
+	// wait for the listener
+	for (int attempt = 0; attempt < 100; attempt++) {
+		int probe = connectTo(port);
+		if (probe >= 0) {
+			close(probe);
+			return pid;
+		}
+		usleep(50000);
+	}
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+	return -1;
+}
+
+static void stopServer(pid_t pid) {
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+}
+
+// a counter of GET /admin/metrics on the admin port of the server on port, -1 if it cannot be read
+static long metric(int port, const char *name) {
+	static const char request[] = "GET /admin/metrics HTTP/1.1\r\nHost: bench\r\nConnection: close\r\n\r\n";
+	int fd = connectTo(port + 3);
+	if (fd < 0 || !writeAll(fd, request, sizeof(request) - 1)) {
+		if (fd >= 0) close(fd);
+		return -1;
+	}
+	size_t length = 0;
+	ssize_t rcvd;
+	while (length < sizeof(buffer) - 1 && (rcvd = recv(fd, buffer + length, sizeof(buffer) - 1 - length, 0)) > 0)
+		length += rcvd;
+	buffer[length] = '\0';
+	close(fd);
+
+	size_t nameLength = strlen(name);
+	for (char *line = buffer; line; line = strchr(line, '\n'), line = line ? line + 1 : NULL)
+		if (strncmp(line, name, nameLength) == 0 && line[nameLength] == ' ')
+			return atol(line + nameLength + 1);
+	return -1;
+}
+
+// peak resident memory of a process in KiB, 0 if unknown
+static long peakResidentKb(pid_t pid) {
+	char path[64], line[256];
+	snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+	FILE *file = fopen(path, "r");
+	if (!file) return 0;
+	long kb = 0;
+	while (fgets(line, sizeof(line), file))
+		if (strncmp(line, "VmHWM:", 6) == 0)
+			kb = atol(line + 6);
+	fclose(file);
+	return kb;
+}
+
+// ---- load: clients with one request in flight each, over keep-alive connections
+
+typedef struct {
+	int		fd;
+	double	sent;
+	size_t	length;
+	char	in[1024];
+} client_t;
+
+static int compareDoubles(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : x > y;
+}
+
+/*
+ * Keeps `count` clients busy with GET /api/item for `seconds`.
+ *
+ * Returns:
+ *   The requests answered, 0 on a failure; their latencies, sorted, in
+ *   samples.
+ */
+static long runLoad(int port, int count, double seconds, double *samples) {
+	static const char request[] = "GET /api/item HTTP/1.1\r\nHost: bench\r\n\r\n";
+	client_t *clients = calloc(count, sizeof(client_t));
+	int epollfd = epoll_create1(0);
+	long done = 0;
+	int failed = !clients || epollfd < 0;
+
+	double start = nowSeconds();
+	for (int i = 0; !failed && i < count; i++) {
+		client_t *c = &clients[i];
+		c->fd = connectTo(port);
+		struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+		c->sent = nowSeconds();
+		failed = c->fd < 0 || epoll_ctl(epollfd, EPOLL_CTL_ADD, c->fd, &ev) != 0
+				 || !writeAll(c->fd, request, sizeof(request) - 1);
+	}
+
+	struct epoll_event ready[256];
+	while (!failed && nowSeconds() - start < seconds) {
+		int n = epoll_wait(epollfd, ready, 256, BENCH_TIMEOUT_MS);
+		failed = n <= 0;
+		for (int i = 0; !failed && i < n; i++) {
+			client_t *c = ready[i].data.ptr;
+			ssize_t rcvd = recv(c->fd, c->in + c->length, sizeof(c->in) - c->length, 0);
+			failed = rcvd <= 0;
+			if (failed) break;
+			c->length += rcvd;
+			size_t end = responseEnd(c->in, c->length);
+			if (!end) continue;
+
+			failed = strncmp(c->in, "HTTP/1.1 200", 12) != 0;
+			if (done < BENCH_SAMPLES_MAX)
+				samples[done] = nowSeconds() - c->sent;
+			done++;
+			c->length -= end;
+			memmove(c->in, c->in + end, c->length);
+			c->sent = nowSeconds();
+			failed = failed || !writeAll(c->fd, request, sizeof(request) - 1);
+		}
+	}
+
+	for (int i = 0; clients && i < count; i++)
+		if (clients[i].fd > 0) close(clients[i].fd);
+	free(clients);
+	if (epollfd >= 0) close(epollfd);
+	if (failed) return 0;
+	qsort(samples, done < BENCH_SAMPLES_MAX ? done : BENCH_SAMPLES_MAX, sizeof(double), compareDoubles);
+	return done;
+}
+
+static int reportLoad(const char *name, int port, int clients, double seconds, double *samples) {
+	long connectsBefore = metric(port, "proxy_connects");
+	long requestsBefore = metric(port, "proxy_requests");
+	long done = runLoad(port, clients, seconds, samples);
+	if (!done) {
+		fprintf(stderr, "The %s run failed or timed out\n", name);
+		return 0;
+	}
+	long kept = done < BENCH_SAMPLES_MAX ? done : BENCH_SAMPLES_MAX;
+	printf("  %-12s %8.0f req/s   p50 %7.3f ms   p99 %7.3f ms   %ld upstream connects for %ld requests\n",
+		   name, done / seconds, samples[kept / 2] * 1e3, samples[kept * 99 / 100] * 1e3,
+		   metric(port, "proxy_connects") - connectsBefore, metric(port, "proxy_requests") - requestsBefore);
+	return 1;
+}
+
+// ---- streaming: a large response and a large upload through one connection
+
+/*
+ * Sends a request and reads its response, sending `upload` body bytes
+ * first if any.
+ *
+ * Returns:
+ *   Seconds it took, 0 on a failure.
+ */
+static double stream(int port, const char *request, long upload) {
+	int fd = connectTo(port);
+	if (fd < 0) return 0;
+	double start = nowSeconds();
+	int ok = writeAll(fd, request, strlen(request));
+	memset(buffer, 'y', sizeof(buffer));
+	for (long left = upload; ok && left > 0; left -= sizeof(buffer))
+		ok = writeAll(fd, buffer, left < (long)sizeof(buffer) ? (size_t)left : sizeof(buffer));
+
+	// the head, then the body by its length
+	size_t length = 0;
+	long body = -1, received = 0;
+	int status = 0;
+	while (ok) {
+		ssize_t rcvd = recv(fd, buffer + length, sizeof(buffer) - length, 0);
+		if (rcvd <= 0) break;
+		if (body < 0) {
+			length += rcvd;
+			char *blank = memmem(buffer, length, "\r\n\r\n", 4);
+			if (!blank) continue;
+			status = atoi(buffer + 9);
+			body = contentLength(buffer, blank + 4 - buffer);
+			received = length - (blank + 4 - buffer);
+			length = 0;
+		} else {
+			received += rcvd;
+		}
+		if (received >= body) break;
+	}
+	close(fd);
+	return ok && status == 200 && received == body ? nowSeconds() - start : 0;
+}
+
+// ---- passive health: one upstream dies under a steady stream of requests
+
+static int afterKill(int port, int *failures) {
+	static const char request[] = "GET /api/item HTTP/1.1\r\nHost: bench\r\nConnection: close\r\n\r\n";
+	*failures = 0;
+	for (int i = 0; i < BENCH_HEALTH; i++) {
+		int fd = connectTo(port);
+		if (fd < 0 || !writeAll(fd, request, sizeof(request) - 1)) {
+			if (fd >= 0) close(fd);
+			return 0;
+		}
+		size_t length = 0;
+		ssize_t rcvd;
+		while (length < sizeof(buffer) && (rcvd = recv(fd, buffer + length, sizeof(buffer) - length, 0)) > 0)
+			length += rcvd;
+		close(fd);
+		*failures += length < 12 || strncmp(buffer, "HTTP/1.1 200", 12) != 0;
+	}
+	return 1;
+}
+
+int main(int argc, char *argv[]) {
+	double seconds = argc > 1 ? atof(argv[1]) : BENCH_SECONDS;
+	int clients = argc > 2 ? atoi(argv[2]) : BENCH_CLIENTS;
+	if (seconds <= 0) seconds = BENCH_SECONDS;
+	if (clients < 1) clients = 1;
+
+	int port = 20000 + getpid() % 20000, upstream = port + 1;
+	// two that keep their connections, two that close them after each response (port + 4 and + 5),
+	// bound before the runs leave their ports in TIME_WAIT
+	pid_t upstreams[4] = { startUpstream(upstream, 0), startUpstream(upstream + 1, 0), startUpstream(port + 4, 1), startUpstream(port + 5, 1) };
+	double *samples = malloc(sizeof(double) * BENCH_SAMPLES_MAX);
+	int failed = upstreams[0] < 0 || upstreams[1] < 0 || upstreams[2] < 0 || upstreams[3] < 0 || !samples;
+	if (failed) fprintf(stderr, "The stand-in upstreams did not start\n");
+
+	// kept connections, and a new connection per request
+	pid_t server = -1;
+	if (!failed) {
+		printf("ROUTE_PROXY to 2 loopback upstreams, %d clients, %.0f s per run\n", clients, seconds);
+		failed = (server = startServer(port, upstream, 16)) < 0 || !reportLoad("keepalive=16", port, clients, seconds, samples);
+		if (server > 0) stopServer(server);
+	}
+	if (!failed) {
+		failed = (server = startServer(port, upstream, 0)) < 0 || !reportLoad("keepalive=0", port, clients, seconds, samples);
+		if (server > 0) stopServer(server);
+	}
+
+	// a response followed by the end of the connection is complete, not a failed server
+	if (!failed) {
+		long done = 0, failures = -1;
+		failed = (server = startServer(port, port + 4, 16)) < 0
+				 || (failures = metric(port, "proxy_failures")) < 0
+				 || !(done = runLoad(port, clients, seconds, samples));
+		if (!failed) {
+			long kept = done < BENCH_SAMPLES_MAX ? done : BENCH_SAMPLES_MAX;
+			failures = metric(port, "proxy_failures") - failures;
+			printf("  closing      %8.0f req/s   p50 %7.3f ms   p99 %7.3f ms   %ld upstream failures counted\n",
+				   done / seconds, samples[kept / 2] * 1e3, samples[kept * 99 / 100] * 1e3, failures);
+			failed = failures != 0;
+		}
+		if (failed)
+			fprintf(stderr, "The run against upstreams that close after each response failed\n");
+		if (server > 0) stopServer(server);
+	}
+
+	// the relay holds a buffer per side, however large the body
+	if (!failed && (server = startServer(port, upstream, 16)) < 0)
+		failed = 1;
+	if (!failed) {
+		char request[256];
+		long before = peakResidentKb(server);
+		snprintf(request, sizeof(request), "GET /api/big/%ld HTTP/1.1\r\nHost: bench\r\n\r\n", BENCH_STREAM);
+		double download = stream(port, request, 0);
+		snprintf(request, sizeof(request), "POST /api/upload HTTP/1.1\r\nHost: bench\r\nContent-Length: %ld\r\n\r\n", BENCH_STREAM);
+		double upload = download ? stream(port, request, BENCH_STREAM) : 0;
+		failed = !download || !upload;
+		if (!failed)
+			printf("  streaming    GET %4.0f MiB/s   POST %4.0f MiB/s   of %ld MiB each; server peak RSS +%ld KiB\n",
+				   BENCH_STREAM / 1048576.0 / download, BENCH_STREAM / 1048576.0 / upload, BENCH_STREAM >> 20,
+				   peakResidentKb(server) - before);
+		else
+			fprintf(stderr, "Streaming through the proxy failed\n");
+	}
+
+	// requests to the dead server fail until it is out; those without a body go to the other
+	if (!failed) {
+		kill(upstreams[1], SIGKILL);
+		waitpid(upstreams[1], NULL, 0);
+		upstreams[1] = -1;
+		int failures;
+		failed = !afterKill(port, &failures);
+		if (!failed)
+			printf("  one upstream killed: %d of %d requests failed, %ld retried elsewhere, %ld server marked down\n",
+				   failures, BENCH_HEALTH, metric(port, "proxy_retries"), metric(port, "proxy_servers_marked_down"));
+	}
+
+	if (server > 0) stopServer(server);
+	for (int i = 0; i < 4; i++)
+		if (upstreams[i] > 0) {
+			kill(upstreams[i], SIGKILL);
+			waitpid(upstreams[i], NULL, 0);
+		}
+	free(samples);
+	return failed;
+}
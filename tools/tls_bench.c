@@ -0,0 +1,299 @@
+//
+//  tls_bench.c
+//  CServer
+//
+//  Created by ibrahim alnakeeb on 19/10/2026.
+//
+//  TLS 1.3 termination of the server: the rate of full handshakes against
+//  resumed ones (GET /login with Connection: close, each connection
+//  resuming the session of the one before), and the bulk transfer rate of
+//  a keep-alive connection fetching a 68 KB image, over TLS and in the
+//  clear. Makes a throwaway P-256 certificate in /tmp and reports whether
+//  the kernel took over the encryption (kTLS needs the "tls" module).
+//
+//  Usage: make bench, or obj/tls_bench [seconds]
+//
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <openssl/err.h>
+#include <openssl/pem.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+
+#define BENCH_SERVER		"./server"
+#define BENCH_SECONDS		2
+#define BENCH_CERTIFICATE	"/tmp/tls_bench_cert.pem"
+#define BENCH_KEY			"/tmp/tls_bench_key.pem"
+#define BENCH_BUFFER		(256 * 1024)
+
+static const char handshakeRequest[] = "GET /login HTTP/1.1\r\nHost: bench\r\nConnection: close\r\n\r\n";
+static const char bulkRequest[] = "GET /public/images/background.jpg HTTP/1.1\r\nHost: bench\r\n\r\n";
+static const char metricsRequest[] = "GET /admin/metrics HTTP/1.1\r\nHost: bench\r\nConnection: close\r\n\r\n";
+
+static char buffer[BENCH_BUFFER];
+
+static double nowSeconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// a self-signed certificate for localhost, valid for a day
+static int makeCertificate(void) {
+	EVP_PKEY *key = EVP_EC_gen("P-256");
+	X509 *cert = X509_new();
+	if (!key || !cert) return 0;
+
+	X509_set_version(cert, 2);
+	ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+	X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+	X509_gmtime_adj(X509_getm_notAfter(cert), 24 * 3600);
+	X509_set_pubkey(cert, key);
+	X509_NAME *name = X509_get_subject_name(cert);
+	X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char *)"localhost", -1, -1, 0);
+	X509_set_issuer_name(cert, name);
+	if (!X509_sign(cert, key, EVP_sha256())) return 0;
+
+	FILE *certFile = fopen(BENCH_CERTIFICATE, "w"), *keyFile = fopen(BENCH_KEY, "w");
+	int ok = certFile && keyFile && PEM_write_X509(certFile, cert)
+			 && PEM_write_PrivateKey(keyFile, key, NULL, NULL, 0, NULL, NULL);
+	if (certFile) fclose(certFile);
+	if (keyFile) fclose(keyFile);
+	X509_free(cert);
+	EVP_PKEY_free(key);
+	return ok;
+}
+
+// HTTPS on port, plain HTTP on port + 1, the admin routes on port + 2
+static pid_t startServer(int port) {
+	char tlsPort[32], plainPort[16], adminPort[32];
+	snprintf(tlsPort, sizeof(tlsPort), "tls:%d", port);
+	snprintf(plainPort, sizeof(plainPort), "%d", port + 1);
+	snprintf(adminPort, sizeof(adminPort), "admin:%d", port + 2);
+
+	pid_t pid = fork();
+	if (pid == 0) {
+		int null = open("/dev/null", O_WRONLY);
+		dup2(null, STDOUT_FILENO);
+		dup2(null, STDERR_FILENO);
+		execl(BENCH_SERVER, BENCH_SERVER, "-t", "cert=" BENCH_CERTIFICATE ",key=" BENCH_KEY,
+			  tlsPort, plainPort, adminPort, (char *)NULL);
+		_exit(127);
+	}
+	return pid;
+}
+
+static int connectTo(int port) {
+	struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port) };
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		close(fd);
+		return -1;
+	}
+	int on = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+	return fd;
+}
+
+// reads and writes over TLS when ssl is set, in the clear otherwise
+static int writeAll(int fd, SSL *ssl, const char *data, size_t length) {
+	while (length > 0) {
+		ssize_t sent = ssl ? SSL_write(ssl, data, length) : send(fd, data, length, MSG_NOSIGNAL);
+		if (sent <= 0) return 0;
+		data += sent;
+		length -= sent;
+	}
+	return 1;
+}
+
+static ssize_t readSome(int fd, SSL *ssl, char *data, size_t length) {
+	return ssl ? SSL_read(ssl, data, length) : recv(fd, data, length, 0);
+}
+
+/*
+ * Reads one response: the head, then Content-Length bytes of body, or up to
+ * the end of the connection without one.
+ *
+ * Returns:
+ *   The bytes of the response, 0 on an error or a status other than 200.
+ */
+static size_t readResponse(int fd, SSL *ssl) {
+	size_t length = 0, total = 0;
+	char *end = NULL;
+	while (!end) {
+		ssize_t rcvd = readSome(fd, ssl, buffer + length, sizeof(buffer) - 1 - length);
+		if (rcvd <= 0) return 0;
+		length += rcvd;
+		buffer[length] = '\0';
+		end = strstr(buffer, "\r\n\r\n");
+	}
+	if (strncmp(buffer, "HTTP/1.1 200", 12) != 0) return 0;
+
+	size_t head = end + 4 - buffer;
+	const char *field = strcasestr(buffer, "Content-Length:");
+	if (!field || field > end) {
+		ssize_t rcvd;
+		total = length;
+		while ((rcvd = readSome(fd, ssl, buffer, sizeof(buffer))) > 0)
+			total += rcvd;
+		return total;
+	}
+
+	size_t body = strtoul(field + 15, NULL, 10), have = length - head;
+	total = length;
+	while (have < body) {
+		ssize_t rcvd = readSome(fd, ssl, buffer, sizeof(buffer));
+		if (rcvd <= 0) return 0;
+		have += rcvd;
+		total += rcvd;
+	}
+	return total;
+}
+
+// new connections for `seconds`, each resuming the last one's session if resume is set
+static int handshakes(SSL_CTX *ctx, int port, int resume, int seconds) {
+	SSL_SESSION *session = NULL;
+	long counted = 0, resumed = 0, failed = 0;
+	double start = nowSeconds(), end = start + seconds;
+
+	while (nowSeconds() < end) {
+		int fd = connectTo(port);
+		SSL *ssl = fd >= 0 ? SSL_new(ctx) : NULL;
+		if (!ssl) return 1;
+		SSL_set_fd(ssl, fd);
+		if (resume && session)
+			SSL_set_session(ssl, session);
+
+		// the ticket comes after the handshake, so the session is taken once the response is read
+		if (SSL_connect(ssl) == 1 && writeAll(fd, ssl, handshakeRequest, sizeof(handshakeRequest) - 1)
+			&& readResponse(fd, ssl)) {
+			counted++;
+			resumed += SSL_session_reused(ssl);
+			if (resume) {
+				SSL_SESSION_free(session);
+				session = SSL_get1_session(ssl);
+			}
+		} else {
+			failed++;
+			ERR_clear_error();
+		}
+		SSL_shutdown(ssl);
+		SSL_free(ssl);
+		close(fd);
+	}
+	SSL_SESSION_free(session);
+
+	double elapsed = nowSeconds() - start;
+	printf("  %-9s %8.0f conn/s   %7.1f us/conn   %ld of %ld resumed%s\n", resume ? "resumed" : "full",
+		   counted / elapsed, counted ? elapsed / counted * 1e6 : 0, resumed, counted, failed ? "   (errors)" : "");
+	return failed != 0;
+}
+
+// one keep-alive connection fetching the image for `seconds`
+static int bulk(SSL_CTX *ctx, int port, int seconds) {
+	int fd = connectTo(port);
+	SSL *ssl = NULL;
+	if (fd < 0) return 1;
+	if (ctx) {
+		ssl = SSL_new(ctx);
+		SSL_set_fd(ssl, fd);
+		if (SSL_connect(ssl) != 1) return 1;
+	}
+
+	long responses = 0, failed = 0;
+	double bytes = 0, start = nowSeconds(), end = start + seconds;
+	while (nowSeconds() < end && !failed) {
+		size_t length = writeAll(fd, ssl, bulkRequest, sizeof(bulkRequest) - 1) ? readResponse(fd, ssl) : 0;
+		if (!length) failed++;
+		bytes += length;
+		responses++;
+	}
+
+	if (ssl) {
+		SSL_shutdown(ssl);
+		SSL_free(ssl);
+	}
+	close(fd);
+
+	double elapsed = nowSeconds() - start;
+	printf("  %-9s %8.1f MB/s    %7.0f responses/s%s\n", ssl ? "bulk tls" : "bulk http", bytes / elapsed / 1e6,
+		   responses / elapsed, failed ? "   (errors)" : "");
+	return failed != 0;
+}
+
+// the server's tls_ktls counter, from /admin/metrics on the admin port
+static long kernelTlsCount(int port) {
+	int fd = connectTo(port);
+	if (fd < 0 || !writeAll(fd, NULL, metricsRequest, sizeof(metricsRequest) - 1)) return -1;
+	size_t length = 0;
+	ssize_t rcvd;
+	while (length < sizeof(buffer) - 1 && (rcvd = recv(fd, buffer + length, sizeof(buffer) - 1 - length, 0)) > 0)
+		length += rcvd;
+	buffer[length] = '\0';
+	close(fd);
+
+	const char *line = strstr(buffer, "\ntls_ktls ");
+	return line ? atol(line + 10) : -1;
+}
+
+int main(int argc, char *argv[]) {
+	int seconds = argc > 1 ? atoi(argv[1]) : BENCH_SECONDS;
+	if (seconds < 1) seconds = 1;
+
+	if (!makeCertificate()) {
+		fprintf(stderr, "Unable to make a certificate\n");
+		return 1;
+	}
+	SSL_CTX *ctx = SSL_CTX_new(TLS_client_method());
+	if (!ctx) return 1;
+	SSL_CTX_set_min_proto_version(ctx, TLS1_3_VERSION);
+	SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT);
+
+	int port = 20000 + getpid() % 20000;
+	pid_t server = startServer(port);
+	if (server < 0) return 1;
+
+	// wait for the listeners
+	int probe = -1;
+	for (int attempt = 0; attempt < 100 && probe < 0; attempt++) {
+		probe = connectTo(port + 1);
+		if (probe < 0) usleep(50000);
+	}
+	if (probe < 0) {
+		fprintf(stderr, "The server did not start\n");
+		kill(server, SIGKILL);
+		waitpid(server, NULL, 0);
+		return 1;
+	}
+	close(probe);
+
+	printf("TLS 1.3, P-256 certificate, %d s each\n", seconds);
+	int failed = handshakes(ctx, port, 0, seconds);
+	failed |= handshakes(ctx, port, 1, seconds);
+	failed |= bulk(NULL, port + 1, seconds);
+	failed |= bulk(ctx, port, seconds);
+	long ktls = kernelTlsCount(port + 2);
+	printf("  kernel TLS: %s\n", ktls > 0 ? "on" : ktls == 0 ? "off (no tls module)" : "unknown");
+
+	kill(server, SIGTERM);
+	waitpid(server, NULL, 0);
+	SSL_CTX_free(ctx);
+	unlink(BENCH_CERTIFICATE);
+	unlink(BENCH_KEY);
+	return failed;
+}